@@ -0,0 +1,53 @@
+#!/bin/sh
+# Translates programs to C with --emit-c, compiles them against the runtime with
+# the system C compiler, checks that they print exactly what the interpreter
+# prints and reports the wall time of the VM against the native executable.
+# usage: bench/aot.sh path/to/cilisp [program.cilisp ...]
+# (every program in inputs/ by default; CC and CFLAGS pick the compiler and flags)
+# A program reads from the name_target.txt next to it, if there is one.
+
+CILISP=$(cd "$(dirname "${1:-./cilisp}")" && pwd)/$(basename "${1:-./cilisp}")
+[ $# -gt 0 ] && shift
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+WORK=$(mktemp -d)
+status=0
+
+trap 'rm -rf "$WORK"' EXIT
+[ $# -gt 0 ] || set -- "$ROOT"/inputs/*.cilisp "$ROOT"/inputs/*/*.cilisp
+
+for source in arena number reduce vector runtime output format aot
+do
+    $CC -std=c11 $CFLAGS -I"$ROOT/src" -c "$ROOT/src/$source.c" -o "$WORK/$source.o" || exit 1
+done
+
+for program in "$@"
+do
+    [ -f "$program" ] || continue
+    name=$(basename "$program" .cilisp)
+    target=${program%.cilisp}_target.txt
+    [ -f "$target" ] || target=/dev/null
+
+    "$CILISP" --emit-c="$WORK/$name.c" "$program" > /dev/null 2>&1
+    $CC -std=c11 $CFLAGS -I"$ROOT/src" "$WORK/$name.c" "$WORK"/[a-z]*.o -lm -o "$WORK/$name" || { status=1; continue; }
+
+    start=$(date +%s%N)
+    "$CILISP" --vm "$program" "$target" > "$WORK/vm.out" 2>&1
+    mid=$(date +%s%N)
+    "$WORK/$name" "$target" > "$WORK/aot.out" 2>&1
+    end=$(date +%s%N)
+
+    if cmp -s "$WORK/vm.out" "$WORK/aot.out"
+    then
+        result=same
+    else
+        result=DIFFERENT
+        status=1
+    fi
+
+    printf "%-40s vm %8d us   native %8d us   %s\n" "${program#$ROOT/}" \
+        $(((mid - start) / 1000)) $(((end - mid) / 1000)) "$result"
+done
+
+exit $status
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Generates an input file of independent expressions, mostly lambda calls with
+# one calling rand or read now and then, and some going on over several lines,
+# runs it one expression at a time and with --batch on 1, 2, 4 ... threads up to
+# the number of CPUs, checks that the outputs match and reports the wall time of
+# each run.
+# usage: bench/batch.sh path/to/cilisp [lines [max_threads]]
+
+CILISP=${1:-./cilisp}
+LINES=${2:-20000}
+MAX_THREADS=${3:-$(getconf _NPROCESSORS_ONLN)}
+WORK=$(mktemp -d)
+status=0
+
+trap 'rm -rf "$WORK"' EXIT
+
+awk -v lines="$LINES" 'BEGIN {
+    for (i = 0; i < lines; i++)
+    {
+        if (i % 50 == 0)
+            print "(add (rand) (read))"
+        else if (i % 25 == 0)
+            printf "((let (f lambda (x)\n\n    (mult x %d)))\n  (f [1\n     2]))\n", i
+        else if (i % 2)
+            printf "((let (fib lambda (n) (cond (less n 2) n (add (fib (sub n 1)) (fib (sub n 2)))))) (fib %d))\n", 12 + i % 8
+        else
+            printf "((let (int gcd lambda (x y) (cond (equal y 0) x (gcd y (remainder x y))))) (gcd %d %d))\n", i * 7919, i + 1071
+    }
+    print "quit"
+}' > "$WORK/batch.cilisp"
+awk -v lines="$LINES" 'BEGIN { for (i = 0; i < lines / 50 + 1; i++) print i }' > "$WORK/read_target"
+
+start=$(date +%s%N)
+"$CILISP" "$WORK/batch.cilisp" "$WORK/read_target" > "$WORK/sequential.out" 2>&1
+end=$(date +%s%N)
+printf "%-12s %8d us\n" "sequential" $(((end - start) / 1000))
+
+threads=1
+while [ "$threads" -le "$MAX_THREADS" ]
+do
+    start=$(date +%s%N)
+    "$CILISP" --batch=$threads "$WORK/batch.cilisp" "$WORK/read_target" > "$WORK/batch.out" 2>&1
+    end=$(date +%s%N)
+
+    if cmp -s "$WORK/sequential.out" "$WORK/batch.out"
+    then
+        result=same
+    else
+        result=DIFFERENT
+        status=1
+    fi
+    printf "%-12s %8d us   %s\n" "--batch=$threads" $(((end - start) / 1000)) "$result"
+    threads=$((threads * 2))
+done
+
+exit $status
@@ -0,0 +1,1184 @@
+// Compares the reference tree walker (eval) with the bytecode VM on generated expressions,
+// measures how many builtin calls common-subexpression elimination saves, and how
+// much faster the VM runs with the int and double kernels picked by inferProgram,
+// times the reductions behind add, mult, max, min and hypot with each instruction set,
+// element-wise builtins on vectors against the same expression on each element,
+// the tree walker on recursive lambdas with 1 to max_threads threads, and the VM
+// on numeric lambdas with and without the JIT. First of all, it times each stage
+// of the interpreter on its own on generated input text: scanning, parsing,
+// evaluating, and allocating and freeing ASTs, and printing values.
+// usage: cilisp_bench [--json=file] [repetitions [max_threads]]
+// With --json, it also writes the numbers into file, for bench/compare.sh to
+// compare with those of another run.
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "cilisp.h"
+#include "vm.h"
+#include "reduce.h"
+#include "vector.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// A number --json writes: what suite/label measured, e.g. "MB/s", and which way is better.
+typedef struct bench_result {
+    char name[64];
+    const char *metric;
+    double value;
+    bool higherIsBetter;
+} BENCH_RESULT;
+
+static BENCH_RESULT *results;
+static size_t resultCount;
+static size_t resultCap;
+
+static void record(const char *suite, const char *label, const char *metric, double value, bool higherIsBetter)
+{
+    if (resultCount == resultCap)
+    {
+        resultCap = resultCap ? 2 * resultCap : 256;
+        if ((results = realloc(results, resultCap * sizeof(BENCH_RESULT))) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+    }
+
+    snprintf(results[resultCount].name, sizeof(results[resultCount].name), "%s/%s", suite, label);
+    results[resultCount].metric = metric;
+    results[resultCount].value = value;
+    results[resultCount++].higherIsBetter = higherIsBetter;
+}
+
+// One result per line, which bench/compare.sh reads without a JSON parser.
+static void writeJson(const char *path, int reps)
+{
+    FILE *out = fopen(path, "w");
+
+    if (out == NULL)
+    {
+        yyerror("Could not open \"%s\"!", path);
+    }
+
+    fprintf(out, "{\n  \"repetitions\": %d,\n  \"results\": [\n", reps);
+    for (size_t i = 0; i < resultCount; i++)
+    {
+        fprintf(out, "    {\"name\": \"%s\", \"metric\": \"%s\", \"value\": %.6g, \"better\": \"%s\"}%s\n",
+                results[i].name,
+                results[i].metric,
+                results[i].value,
+                results[i].higherIsBetter ? "higher" : "lower",
+                i + 1 < resultCount ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (fclose(out) != 0)
+    {
+        yyerror("Could not write \"%s\"!", path);
+    }
+}
+
+static AST_NODE *num(double value)
+{
+    if (value == (int64_t) value)
+    {
+        return createNumberNode((AST_NUMBER) {INT_TYPE, .ival = (int64_t) value});
+    }
+
+    return createNumberNode((AST_NUMBER) {DOUBLE_TYPE, .value = value});
+}
+
+static AST_NODE *call2(FUNC_TYPE func, AST_NODE *a, AST_NODE *b)
+{
+    return createFunctionNode(func, addExpressionToList(a, b));
+}
+
+static ATOM *name(char prefix, int i)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%c%d", prefix, i);
+    return intern(buffer);
+}
+
+// (add 1 (mult 1.0001 (sub 3 (add 1 ...)))) nested depth levels deep
+static AST_NODE *genDeep(int depth)
+{
+    static const FUNC_TYPE funcs[] = {ADD_FUNC, MULT_FUNC, SUB_FUNC, MAX_FUNC};
+    AST_NODE *node = num(1);
+
+    for (int i = 0; i < depth; i++)
+    {
+        node = call2(funcs[i % 4], num(i % 4 == 1 ? 1.0001 : i % 7), node);
+    }
+
+    return node;
+}
+
+// (add (sqrt 0) (pow 1 2) (sqrt 2) ...) with width operands
+static AST_NODE *genWide(int width)
+{
+    AST_NODE *list = NULL;
+
+    for (int i = width; i-- > 0;)
+    {
+        AST_NODE *term = i % 2 ?
+                         call2(POW_FUNC, num(i % 13), num(2)) :
+                         createFunctionNode(SQRT_FUNC, num(i));
+        list = addExpressionToList(term, list);
+    }
+
+    return createFunctionNode(ADD_FUNC, list);
+}
+
+// ((let (a0 1) (a1 (add a0 1)) ...) (hypot a0 a1 ...)) with n bindings
+static AST_NODE *genLet(int n)
+{
+    SYMBOL_TABLE_NODE *table = NULL;
+    AST_NODE *uses = NULL;
+
+    for (int i = n; i-- > 0;)
+    {
+        AST_NODE *value = i == 0 ? num(1) : call2(ADD_FUNC, createSymbolNode_U(name('a', i - 1)), num(1));
+        SYMBOL_TABLE_NODE *symbol = createSymbolNode_I(name('a', i), value);
+        symbol->next = table;
+        table = symbol;
+        uses = addExpressionToList(createSymbolNode_U(name('a', i)), uses);
+    }
+
+    return createScopeNode(table, createFunctionNode(HYPOT_FUNC, uses));
+}
+
+static AST_NODE *sym(const char *id)
+{
+    return createSymbolNode_U(intern(id));
+}
+
+static AST_NODE *callf(const char *id, AST_NODE *a, AST_NODE *b)
+{
+    return createCustomFunctionNode(intern(id), b ? addExpressionToList(a, b) : a);
+}
+
+static SYMBOL_TABLE_NODE *params(const char *a, const char *b)
+{
+    SYMBOL_TABLE_NODE *list = b ? createSymbolNode_I(intern(b), NULL) : NULL;
+    return storeSymbolTableNode(createSymbolNode_I(intern(a), NULL), list);
+}
+
+// The gcd of inputs/task_5.cilisp, called on consecutive Fibonacci numbers,
+// which take the most steps:
+// ((let (double gcd lambda (x y) (cond (greater y x) (gcd y x)
+//     (cond (equal y 0) x (gcd y (remainder x y)))))) (gcd a b))
+static AST_NODE *genGcd(double a, double b)
+{
+    AST_NODE *body = createCondNode(call2(GREATER_FUNC, sym("y"), sym("x")),
+                                    callf("gcd", sym("y"), sym("x")),
+                                    createCondNode(call2(EQUAL_FUNC, sym("y"), num(0)),
+                                                   sym("x"),
+                                                   callf("gcd", sym("y"), call2(REM_FUNC, sym("x"), sym("y")))));
+    SYMBOL_TABLE_NODE *gcd = createSymbolNode_T(intern("double"), intern("gcd"), createLambdaNode(params("x", "y"), body));
+
+    return createScopeNode(gcd, callf("gcd", num(a), num(b)));
+}
+
+// (fib lambda (n) (cond (less n 2) n (add (fib (sub n 1)) (fib (sub n 2)))))
+static SYMBOL_TABLE_NODE *fibBinding(void)
+{
+    AST_NODE *body = createCondNode(call2(LESS_FUNC, sym("n"), num(2)),
+                                    sym("n"),
+                                    call2(ADD_FUNC,
+                                          callf("fib", call2(SUB_FUNC, sym("n"), num(1)), NULL),
+                                          callf("fib", call2(SUB_FUNC, sym("n"), num(2)), NULL)));
+
+    return createSymbolNode_I(intern("fib"), createLambdaNode(params("n", NULL), body));
+}
+
+// ((let (fib lambda ...)) (fib n))
+static AST_NODE *genFib(int n)
+{
+    return createScopeNode(fibBinding(), callf("fib", num(n), NULL));
+}
+
+// ((let (fib lambda ...)) (max (fib n) (fib (sub n 1)) ...)) with 8 calls
+static AST_NODE *genFibs(int n)
+{
+    AST_NODE *list = NULL;
+
+    for (int i = 8; i-- > 0;)
+    {
+        list = addExpressionToList(callf("fib", call2(SUB_FUNC, num(n), num(i % 3)), NULL), list);
+    }
+
+    return createScopeNode(fibBinding(), createFunctionNode(MAX_FUNC, list));
+}
+
+static AST_NODE *dnum(double value)
+{
+    return createNumberNode((AST_NUMBER) {DOUBLE_TYPE, .value = value});
+}
+
+// ((let (fib lambda ...)) (fib n.0)), where every number the lambda sees is a double
+static AST_NODE *genDoubleFib(int n)
+{
+    return createScopeNode(fibBinding(), callf("fib", dnum(n), NULL));
+}
+
+// ((let (roots lambda (i acc) (cond (less i 0.5) acc (roots (sub i 1) (add acc (sqrt i))))))
+//     (roots n.0 0.0))
+static AST_NODE *genRoots(int n)
+{
+    AST_NODE *body = createCondNode(call2(LESS_FUNC, sym("i"), dnum(0.5)),
+                                    sym("acc"),
+                                    callf("roots",
+                                          call2(SUB_FUNC, sym("i"), num(1)),
+                                          call2(ADD_FUNC, sym("acc"), createFunctionNode(SQRT_FUNC, sym("i")))));
+    SYMBOL_TABLE_NODE *roots = createSymbolNode_I(intern("roots"), createLambdaNode(params("i", "acc"), body));
+
+    return createScopeNode(roots, callf("roots", dnum(n), dnum(0)));
+}
+
+// ((let (count lambda (i n) (cond (less i n) (count (add i 1) n) i))) (count 0 n))
+static AST_NODE *genCount(int n)
+{
+    AST_NODE *body = createCondNode(call2(LESS_FUNC, sym("i"), sym("n")),
+                                    callf("count", call2(ADD_FUNC, sym("i"), num(1)), sym("n")),
+                                    sym("i"));
+    SYMBOL_TABLE_NODE *count = createSymbolNode_I(intern("count"), createLambdaNode(params("i", "n"), body));
+
+    return createScopeNode(count, callf("count", num(0), num(n)));
+}
+
+// ((let (x 3) (y 4)) (add (mult (hypot (sub x y) (add x y)) (pow (sub x y) 0)) ...))
+// with n terms, whose powers repeat every 5
+static AST_NODE *genShared(int n)
+{
+    SYMBOL_TABLE_NODE *table = storeSymbolTableNode(createSymbolNode_I(intern("x"), num(3)),
+                                                    createSymbolNode_I(intern("y"), num(4)));
+    AST_NODE *list = NULL;
+
+    for (int i = n; i-- > 0;)
+    {
+        AST_NODE *norm = call2(HYPOT_FUNC, call2(SUB_FUNC, sym("x"), sym("y")), call2(ADD_FUNC, sym("x"), sym("y")));
+        AST_NODE *power = call2(POW_FUNC, call2(SUB_FUNC, sym("x"), sym("y")), num(i % 5));
+        list = addExpressionToList(call2(MULT_FUNC, norm, power), list);
+    }
+
+    return createScopeNode(table, createFunctionNode(ADD_FUNC, list));
+}
+
+// The builtin calls evaluating node makes, for trees without conds or lambdas,
+// where every builtin runs once: let values are only evaluated once too.
+static long countBuiltins(AST_NODE *node)
+{
+    long n = 0;
+
+    switch (node->type)
+    {
+        case FUNC_NODE_TYPE:
+            for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+            {
+                n += countBuiltins(op);
+            }
+            return n + 1;
+        case SCOPE_NODE_TYPE:
+            for (int i = 0; i < node->data.scope.nBindings; i++)
+            {
+                n += countBuiltins(node->data.scope.bindings[i]->value);
+            }
+            return n + countBuiltins(node->data.scope.child);
+        default:
+            return 0;
+    }
+}
+
+static double timeEval(AST_NODE *node, int reps, RET_VAL *val)
+{
+    double start = now();
+
+    for (int i = 0; i < reps; i++)
+    {
+        *val = eval(node, NULL);
+    }
+
+    return (now() - start) / reps;
+}
+
+static void benchCse(const char *label, AST_NODE *node, int reps)
+{
+    long before, after;
+    double beforeTime, afterTime;
+    RET_VAL beforeVal, afterVal;
+
+    resolveProgram(node);
+    before = countBuiltins(node);
+    beforeTime = timeEval(node, reps, &beforeVal);
+
+    cseProgram(node);
+    after = countBuiltins(node);
+    afterTime = timeEval(node, reps, &afterVal);
+
+    printf("%-14s builtin calls %7ld -> %7ld (-%4.1f%%)   eval %9.3f us -> %9.3f us   %s\n",
+           label,
+           before,
+           after,
+           100.0 * (before - after) / before,
+           beforeTime * 1e6,
+           afterTime * 1e6,
+           numberEqual(beforeVal, afterVal) && beforeVal.type == afterVal.type ? "ok" : "MISMATCH");
+    record("cse", label, "builtin calls", after, false);
+    record("cse", label, "eval us", afterTime * 1e6, false);
+}
+
+static double timeVm(AST_NODE *node, int reps, RET_VAL *val)
+{
+    CHUNK *chunk = compileProgram(node);
+    double start = now();
+
+    for (int i = 0; i < reps; i++)
+    {
+        *val = vmRun(chunk);
+    }
+
+    return (now() - start) / reps;
+}
+
+static void benchInfer(const char *label, AST_NODE *node, int reps)
+{
+    double genericTime, kernelTime;
+    RET_VAL genericVal, kernelVal;
+
+    resolveProgram(node);
+    genericTime = timeVm(node, reps, &genericVal);
+
+    inferProgram(node);
+    kernelTime = timeVm(node, reps, &kernelVal);
+
+    printf("%-14s vm generic %9.3f us   kernels %9.3f us   speedup %5.2fx   %s\n",
+           label,
+           genericTime * 1e6,
+           kernelTime * 1e6,
+           genericTime / kernelTime,
+           numberEqual(genericVal, kernelVal) && genericVal.type == kernelVal.type ? "ok" : "MISMATCH");
+    record("infer", label, "generic us", genericTime * 1e6, false);
+    record("infer", label, "kernels us", kernelTime * 1e6, false);
+}
+
+static void benchJit(const char *label, AST_NODE *node, int reps)
+{
+    double vmTime, jitTime;
+    RET_VAL vmVal, jitVal;
+
+    resolveProgram(node);
+    inferProgram(node);
+
+    currentContext->options.jit = -1;
+    vmTime = timeVm(node, reps, &vmVal);
+    currentContext->options.jit = 0;
+    jitTime = timeVm(node, reps, &jitVal);
+    currentContext->options.jit = -1;
+
+    printf("%-14s vm %9.3f us   jit %9.3f us   speedup %5.2fx   %s\n",
+           label,
+           vmTime * 1e6,
+           jitTime * 1e6,
+           vmTime / jitTime,
+           numberEqual(vmVal, jitVal) && vmVal.type == jitVal.type ? "ok" : "MISMATCH");
+    record("jit", label, "vm us", vmTime * 1e6, false);
+    record("jit", label, "jit us", jitTime * 1e6, false);
+}
+
+// The left to right loops the builtins ran before reduce.c, hypot squaring with pow.
+static double foldDoubles(REDUCE_OP op, const double *values, size_t n)
+{
+    double val = values[0];
+
+    if (op == REDUCE_SQUARES)
+    {
+        val = pow(val, 2);
+    }
+
+    for (size_t i = 1; i < n; i++)
+    {
+        switch (op)
+        {
+            case REDUCE_SUM:
+                val += values[i];
+                break;
+            case REDUCE_PRODUCT:
+                val *= values[i];
+                break;
+            case REDUCE_MAX:
+                val = values[i] > val ? values[i] : val;
+                break;
+            case REDUCE_MIN:
+                val = values[i] < val ? values[i] : val;
+                break;
+            case REDUCE_SQUARES:
+                val += pow(values[i], 2);
+                break;
+        }
+    }
+
+    return val;
+}
+
+static int64_t foldInts(REDUCE_OP op, const int64_t *values, size_t n)
+{
+    int64_t val = values[0];
+
+    for (size_t i = 1; i < n; i++)
+    {
+        switch (op)
+        {
+            case REDUCE_SUM:
+                val = intAdd(val, values[i]);
+                break;
+            case REDUCE_PRODUCT:
+                val = intMult(val, values[i]);
+                break;
+            case REDUCE_MAX:
+                val = values[i] > val ? values[i] : val;
+                break;
+            default:
+                val = values[i] < val ? values[i] : val;
+                break;
+        }
+    }
+
+    return val;
+}
+
+// Times a reduction of n operands left to right and with each kernel the CPU has,
+// checking that the kernels agree to the bit.
+static void benchReduce(const char *label, REDUCE_OP op, bool ints, size_t n, int reps)
+{
+    static const REDUCE_ISA isas[] = {REDUCE_SCALAR, REDUCE_SSE2, REDUCE_AVX2};
+    static const char *isaNames[] = {"scalar", "sse2", "avx2"};
+    static const char *isaMetrics[] = {"scalar ns", "sse2 ns", "avx2 ns"};
+    REDUCE_ISA best = reduceIsa();
+    char key[32];
+    double *doubles = malloc(n * sizeof(double));
+    int64_t *ints64 = malloc(n * sizeof(int64_t));
+    double start, foldTime, results[3];
+    volatile double sink;
+    bool same = true;
+
+    if (doubles == NULL || ints64 == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        ints64[i] = (int64_t) (i * 2654435761u % 2001) - 1000;
+        doubles[i] = op == REDUCE_PRODUCT ? 1 + ints64[i] * 1e-6 : ints64[i] * 0.37;
+    }
+
+    start = now();
+    for (int i = 0; i < reps; i++)
+    {
+        sink = ints ? foldInts(op, ints64, n) : foldDoubles(op, doubles, n);
+    }
+    foldTime = (now() - start) / reps;
+
+    printf("%-14s n %6zu   loop %10.1f ns", label, n, foldTime * 1e9);
+    snprintf(key, sizeof(key), "%s %zu", label, n);
+    record("reduce", key, "loop ns", foldTime * 1e9, false);
+
+    for (int k = 0; k < 3; k++)
+    {
+        double isaTime;
+
+        if (!reduceSetIsa(isas[k]))
+        {
+            continue;
+        }
+
+        start = now();
+        for (int i = 0; i < reps; i++)
+        {
+            results[k] = ints ? reduceInts(op, ints64, n) : reduceDoubles(op, doubles, n);
+        }
+        isaTime = (now() - start) / reps;
+
+        same = same && memcmp(&results[k], &results[0], sizeof(double)) == 0;
+        printf("   %s %10.1f ns (%5.2fx)", isaNames[k], isaTime * 1e9, foldTime / isaTime);
+        record("reduce", key, isaMetrics[k], isaTime * 1e9, false);
+    }
+
+    printf("   %s\n", same ? "ok" : "MISMATCH");
+    (void) sink;
+
+    reduceSetIsa(best);
+    free(doubles);
+    free(ints64);
+}
+
+// (add (mult x 1.5) (sqrt x)) for each of n doubles x, evaluated element by element
+// by the tree walker and once on a vector of them by the VM with each kernel the CPU
+// has, checking that every element agrees to the bit.
+static void benchVector(size_t n, int reps)
+{
+    static const REDUCE_ISA isas[] = {REDUCE_SCALAR, REDUCE_SSE2, REDUCE_AVX2};
+    static const char *isaNames[] = {"scalar", "sse2", "avx2"};
+    static const char *isaMetrics[] = {"scalar us", "sse2 us", "avx2 us"};
+    REDUCE_ISA best = reduceIsa();
+    char key[32];
+    VECTOR *vector = newVector(&currentContext->astArena, DOUBLE_TYPE, n);
+    AST_NODE *x1 = num(0);
+    AST_NODE *x2 = num(0);
+    AST_NODE *scalarExpr = call2(ADD_FUNC, call2(MULT_FUNC, x1, num(1.5)), createFunctionNode(SQRT_FUNC, x2));
+    AST_NODE *v1 = createNumberNode((AST_NUMBER) {VECTOR_TYPE, .vector = vector});
+    AST_NODE *v2 = createNumberNode((AST_NUMBER) {VECTOR_TYPE, .vector = vector});
+    AST_NODE *vectorExpr = call2(ADD_FUNC, call2(MULT_FUNC, v1, num(1.5)), createFunctionNode(SQRT_FUNC, v2));
+    double *expected = malloc(n * sizeof(double));
+    double start, elementTime;
+    RET_VAL val;
+    CHUNK *chunk;
+    bool same = true;
+
+    if (expected == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        vector->values[i] = (double) (i * 2654435761u % 2001) * 0.37;
+    }
+
+    resolveProgram(scalarExpr);
+    resolveProgram(vectorExpr);
+
+    start = now();
+    for (int r = 0; r < reps; r++)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            x1->data.number = x2->data.number = (AST_NUMBER) {DOUBLE_TYPE, .value = vector->values[i]};
+            expected[i] = eval(scalarExpr, NULL).value;
+        }
+    }
+    elementTime = (now() - start) / reps;
+
+    printf("vector         n %6zu   eval per element %10.1f us", n, elementTime * 1e6);
+    snprintf(key, sizeof(key), "n %zu", n);
+    record("vector", key, "eval per element us", elementTime * 1e6, false);
+
+    chunk = compileProgram(vectorExpr);
+    for (int k = 0; k < 3; k++)
+    {
+        double isaTime;
+
+        if (!reduceSetIsa(isas[k]))
+        {
+            continue;
+        }
+
+        start = now();
+        for (int r = 0; r < reps; r++)
+        {
+            arenaReset(&value_arena);
+            val = vmRun(chunk);
+        }
+        isaTime = (now() - start) / reps;
+
+        same = same && val.type == VECTOR_TYPE && memcmp(val.vector->values, expected, n * sizeof(double)) == 0;
+        printf("   %s %9.1f us (%6.1fx)", isaNames[k], isaTime * 1e6, elementTime / isaTime);
+        record("vector", key, isaMetrics[k], isaTime * 1e6, false);
+    }
+
+    printf("   %s\n", same ? "ok" : "MISMATCH");
+
+    arenaReset(&value_arena);
+    reduceSetIsa(best);
+    free(expected);
+}
+
+// Times evalProgram in tree walker mode on gen(n) with 1, 2, 4 ... threads up to
+// maxThreads. Each count but 1 runs in a child process, as the pool keeps its threads.
+static void benchParallel(const char *label, AST_NODE *(*gen)(int), int n, int maxThreads)
+{
+    CILISP_OPTIONS saved = currentContext->options;
+    double start, oneTime, time;
+    RET_VAL expected, val;
+    pid_t child;
+
+    currentContext->options.evalMode = TREE_EVAL_MODE;
+    currentContext->options.threads = 1;
+    start = now();
+    expected = evalProgram(gen(n));
+    oneTime = now() - start;
+    printf("%-14s threads %3d   eval %9.3f ms\n", label, 1, oneTime * 1e3);
+    fflush(stdout);
+    // the other counts run in child processes, which only print their numbers
+    record("parallel", label, "1 thread ms", oneTime * 1e3, false);
+
+    for (int threads = 2; threads <= maxThreads; threads = threads < maxThreads && 2 * threads > maxThreads ? maxThreads : 2 * threads)
+    {
+        if ((child = fork()) < 0)
+        {
+            yyerror("Could not fork!");
+        }
+
+        if (child == 0)
+        {
+            currentContext->options.threads = threads;
+            start = now();
+            val = evalProgram(gen(n));
+            time = now() - start;
+            printf("%-14s threads %3d   eval %9.3f ms   speedup %5.2fx   %s\n",
+                   label,
+                   threads,
+                   time * 1e3,
+                   oneTime / time,
+                   numberEqual(expected, val) && expected.type == val.type ? "ok" : "MISMATCH");
+            fflush(stdout);
+            _exit(0);
+        }
+
+        waitpid(child, NULL, 0);
+    }
+
+    currentContext->options = saved;
+}
+
+// The AST nodes and symbol table entries under node and its siblings, as the parser
+// builds them, before resolveProgram has looked at them.
+static long countNodes(AST_NODE *node)
+{
+    long n = 0;
+
+    for (; node != NULL; node = node->next)
+    {
+        n++;
+        for (SYMBOL_TABLE_NODE *symbol = node->symbolTable; symbol != NULL; symbol = symbol->next)
+        {
+            n += 1 + countNodes(symbol->value);
+        }
+
+        switch (node->type)
+        {
+            case FUNC_NODE_TYPE:
+                n += countNodes(node->data.function.opList);
+                break;
+            case SCOPE_NODE_TYPE:
+                n += countNodes(node->data.scope.child);
+                break;
+            case CONDITIONAL_NODE_TYPE:
+                n += countNodes(node->data.condition.condition);
+                n += countNodes(node->data.condition._true);
+                n += countNodes(node->data.condition._false);
+                break;
+            case LAMBDA_NODE_TYPE:
+                n += node->data.lambda.nParams + countNodes(node->data.lambda.body);
+                break;
+            default:
+                break;
+        }
+    }
+
+    return n;
+}
+
+// What the parser does with each top-level expression while a stage is timed,
+// in place of runProgram.
+static long parsedNodes;
+static double evalTime;
+
+static void countProgram(AST_NODE *node)
+{
+    parsedNodes += countNodes(node);
+}
+
+static void dropProgram(AST_NODE *node)
+{
+    (void) node;
+}
+
+// Prepares and compiles the expression as evalProgram does with the default
+// options but folding, which would leave the VM little to do, and times the VM.
+static void timeProgram(AST_NODE *node)
+{
+    CHUNK *chunk;
+    double start;
+
+    resolveProgram(node);
+    inferProgram(node);
+    chunk = compileProgram(node);
+    runtime->stackOverflow = false;
+
+    start = now();
+    vmRun(chunk);
+    evalTime += now() - start;
+}
+
+// The input text of a stage benchmark, ending with the end of the input and the
+// two NULs cilispEvalBuffer wants, and the builtin and lambda calls evaluating it makes.
+typedef struct stage_input {
+    char *text;
+    size_t len;
+    double ops;
+} STAGE_INPUT;
+
+static STAGE_INPUT endInput(FILE *out, char **text, size_t *len, double ops)
+{
+    fputs("\xff", out);
+    fputc('\0', out);
+    fputc('\0', out);
+    if (fclose(out) != 0)
+    {
+        yyerror("Memory allocation failed!");
+    }
+
+    return (STAGE_INPUT) {*text, *len, ops};
+}
+
+static FILE *startInput(char **text, size_t *len)
+{
+    FILE *out = open_memstream(text, len);
+
+    if (out == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+
+    return out;
+}
+
+// lines of the text of genDeep(depth)
+static STAGE_INPUT textDeep(int depth, int lines)
+{
+    static const char *funcs[] = {"add", "mult", "sub", "max"};
+    char *text;
+    size_t len;
+    FILE *out = startInput(&text, &len);
+
+    for (int line = 0; line < lines; line++)
+    {
+        for (int i = depth; i-- > 0;)
+        {
+            if (i % 4 == 1)
+            {
+                fprintf(out, "(%s 1.0001 ", funcs[i % 4]);
+            }
+            else
+            {
+                fprintf(out, "(%s %d ", funcs[i % 4], i % 7);
+            }
+        }
+        fputs("1", out);
+        for (int i = 0; i < depth; i++)
+        {
+            fputc(')', out);
+        }
+        fputc('\n', out);
+    }
+
+    return endInput(out, &text, &len, (double) depth * lines);
+}
+
+// lines of the text of genWide(width)
+static STAGE_INPUT textWide(int width, int lines)
+{
+    char *text;
+    size_t len;
+    FILE *out = startInput(&text, &len);
+
+    for (int line = 0; line < lines; line++)
+    {
+        fputs("(add", out);
+        for (int i = 0; i < width; i++)
+        {
+            if (i % 2)
+            {
+                fprintf(out, " (pow %d 2)", i % 13);
+            }
+            else
+            {
+                fprintf(out, " (sqrt %d)", i);
+            }
+        }
+        fputs(")\n", out);
+    }
+
+    return endInput(out, &text, &len, (double) (width + 1) * lines);
+}
+
+// lines of the text of genLet(n)
+static STAGE_INPUT textLet(int n, int lines)
+{
+    char *text;
+    size_t len;
+    FILE *out = startInput(&text, &len);
+
+    for (int line = 0; line < lines; line++)
+    {
+        fputs("((let (a0 1)", out);
+        for (int i = 1; i < n; i++)
+        {
+            fprintf(out, " (a%d (add a%d 1))", i, i - 1);
+        }
+        fputs(") (hypot", out);
+        for (int i = 0; i < n; i++)
+        {
+            fprintf(out, " a%d", i);
+        }
+        fputs("))\n", out);
+    }
+
+    return endInput(out, &text, &len, (double) n * lines);
+}
+
+// The lambda and builtin calls of (fib n): the call and less, then add and two
+// subs and the calls they make unless n < 2.
+static double fibOps(int n)
+{
+    return n < 2 ? 2 : 5 + fibOps(n - 1) + fibOps(n - 2);
+}
+
+// lines of the text of genFib(n)
+static STAGE_INPUT textFib(int n, int lines)
+{
+    char *text;
+    size_t len;
+    FILE *out = startInput(&text, &len);
+
+    for (int line = 0; line < lines; line++)
+    {
+        fprintf(out, "((let (fib lambda (n) (cond (less n 2) n (add (fib (sub n 1)) (fib (sub n 2)))))) (fib %d))\n", n);
+    }
+
+    return endInput(out, &text, &len, fibOps(n) * lines);
+}
+
+// lines of (add (read) (read) ...) with reads operands
+static STAGE_INPUT textRead(int reads, int lines)
+{
+    char *text;
+    size_t len;
+    FILE *out = startInput(&text, &len);
+
+    for (int line = 0; line < lines; line++)
+    {
+        fputs("(add", out);
+        for (int i = 0; i < reads; i++)
+        {
+            fputs(" (read)", out);
+        }
+        fputs(")\n", out);
+    }
+
+    return endInput(out, &text, &len, (double) (reads + 1) * lines);
+}
+
+// Times scanning the input alone, scanning and parsing it, and evaluating each of
+// its expressions on the VM, reps times each. The interpreter prints into out and
+// reads from readTarget, which is rewound before each run.
+static void benchStages(const char *label, STAGE_INPUT input, int reps, FILE *out, FILE *readTarget)
+{
+    CILISP_CTX *ctx = currentContext;
+    FILE *savedOut = ctx->runtime.output.file;
+    FILE *savedRead = ctx->runtime.readTarget;
+    double start, lexTime, parseTime;
+    size_t tokens = 0;
+
+    cilispFlush(ctx);
+    ctx->runtime.output.file = out;
+    ctx->runtime.readTarget = readTarget;
+
+    start = now();
+    for (int i = 0; i < reps; i++)
+    {
+        tokens = scanTokens(ctx, input.text, input.len);
+    }
+    lexTime = (now() - start) / reps;
+
+    parsedNodes = 0;
+    ctx->run = countProgram;
+    cilispEvalBuffer(ctx, input.text, input.len);
+    ctx->run = dropProgram;
+    start = now();
+    for (int i = 0; i < reps; i++)
+    {
+        cilispEvalBuffer(ctx, input.text, input.len);
+    }
+    parseTime = (now() - start) / reps;
+
+    evalTime = 0;
+    ctx->run = timeProgram;
+    for (int i = 0; i < reps; i++)
+    {
+        rewind(readTarget);
+        cilispEvalBuffer(ctx, input.text, input.len);
+    }
+    evalTime /= reps;
+
+    ctx->run = runProgram;
+    cilispFlush(ctx);
+    ctx->runtime.output.file = savedOut;
+    ctx->runtime.readTarget = savedRead;
+    useContext(ctx);
+
+    printf("%-14s %8.3f MB %9zu tokens   lex %8.1f MB/s   parse %7.2f Mnodes/s   eval %8.2f Mops/s\n",
+           label,
+           input.len * 1e-6,
+           tokens,
+           input.len * 1e-6 / lexTime,
+           parsedNodes * 1e-6 / parseTime,
+           input.ops * 1e-6 / evalTime);
+    record("stages", label, "lex MB/s", input.len * 1e-6 / lexTime, true);
+    record("stages", label, "parse Mnodes/s", parsedNodes * 1e-6 / parseTime, true);
+    record("stages", label, "eval Mops/s", input.ops * 1e-6 / evalTime, true);
+
+    free(input.text);
+}
+
+// n values of type: ints of up to 10 digits, doubles with a few decimals, as
+// sums of inputs like 0.1 come to, or doubles of all 17 digits
+static RET_VAL *genValues(NUM_TYPE type, bool exact, size_t n)
+{
+    RET_VAL *values = malloc(n * sizeof(RET_VAL));
+
+    if (values == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        values[i] = type == INT_TYPE ? (RET_VAL) {INT_TYPE, .ival = (int64_t) (i * 2654435761u % 10000000000) - 5000000000} :
+                    (RET_VAL) {DOUBLE_TYPE, .value = exact ? (double) (i % 100000) * 0.1 : sqrt((double) i) * 1e3};
+    }
+
+    return values;
+}
+
+// Times printing n values as printRetVal did with fprintf and "%lf", and as it
+// does through the output buffer of the interpreter with fixed and shortest
+// doubles, into out, in lines per second.
+static void benchOutput(const char *label, RET_VAL *values, size_t n, int reps, FILE *out)
+{
+    CILISP_CTX *ctx = currentContext;
+    OUTPUT *output = &ctx->runtime.output;
+    FILE *savedOut = output->file;
+    double start, printfTime, times[2];
+
+    start = now();
+    for (int i = 0; i < reps; i++)
+    {
+        for (size_t j = 0; j < n; j++)
+        {
+            if (values[j].type == INT_TYPE)
+            {
+                fprintf(out, "Integer : %" PRId64 "\n", values[j].ival);
+            }
+            else
+            {
+                fprintf(out, "Double : %lf\n", values[j].value);
+            }
+        }
+    }
+    fflush(out);
+    printfTime = (now() - start) / reps;
+
+    cilispFlush(ctx);
+    output->file = out;
+    for (int format = FIXED_DOUBLES; format <= SHORTEST_DOUBLES; format++)
+    {
+        output->doubles = format;
+        start = now();
+        for (int i = 0; i < reps; i++)
+        {
+            for (size_t j = 0; j < n; j++)
+            {
+                printRetVal(values[j]);
+            }
+        }
+        cilispFlush(ctx);
+        times[format] = (now() - start) / reps;
+    }
+    output->file = savedOut;
+    output->doubles = ctx->options.doubles;
+
+    printf("%-14s printf %8.2f Mlines/s   fixed %8.2f Mlines/s   shortest %8.2f Mlines/s\n",
+           label,
+           n * 1e-6 / printfTime,
+           n * 1e-6 / times[FIXED_DOUBLES],
+           n * 1e-6 / times[SHORTEST_DOUBLES]);
+    record("output", label, "printf Mlines/s", n * 1e-6 / printfTime, true);
+    record("output", label, "fixed Mlines/s", n * 1e-6 / times[FIXED_DOUBLES], true);
+    record("output", label, "shortest Mlines/s", n * 1e-6 / times[SHORTEST_DOUBLES], true);
+
+    free(values);
+}
+
+// Times building the AST of gen(n) with the functions the parser builds it with,
+// per node, and freeing it, which resets the arena it is in in one go.
+static void benchAlloc(const char *label, AST_NODE *(*gen)(int), int n, int reps)
+{
+    double start, allocTime = 0, freeTime = 0;
+    long nodes = 0;
+
+    arenaReset(&currentContext->astArena);
+    for (int i = 0; i < reps; i++)
+    {
+        AST_NODE *node;
+
+        start = now();
+        node = gen(n);
+        allocTime += now() - start;
+        nodes = countNodes(node);
+
+        start = now();
+        arenaReset(&currentContext->astArena);
+        freeTime += now() - start;
+    }
+
+    printf("%-14s nodes %8ld   alloc %7.2f ns/node   free %9.3f us\n",
+           label,
+           nodes,
+           allocTime / reps / nodes * 1e9,
+           freeTime / reps * 1e6);
+    record("alloc", label, "alloc ns/node", allocTime / reps / nodes * 1e9, false);
+    record("alloc", label, "free us", freeTime / reps * 1e6, false);
+}
+
+static void bench(const char *label, AST_NODE *node, int reps)
+{
+    double start, treeTime, vmTime, compileTime;
+    RET_VAL treeVal, vmVal;
+    CHUNK *chunk;
+
+    resolveProgram(node);
+
+    start = now();
+    for (int i = 0; i < reps; i++)
+    {
+        treeVal = eval(node, NULL);
+    }
+    treeTime = now() - start;
+
+    start = now();
+    for (int i = 0; i < reps; i++)
+    {
+        chunk = compileProgram(node);
+    }
+    compileTime = now() - start;
+
+    start = now();
+    for (int i = 0; i < reps; i++)
+    {
+        vmVal = vmRun(chunk);
+    }
+    vmTime = now() - start;
+
+    printf("%-14s eval %9.3f us   vm %9.3f us   compile %9.3f us   speedup %5.2fx   %s\n",
+           label,
+           treeTime / reps * 1e6,
+           vmTime / reps * 1e6,
+           compileTime / reps * 1e6,
+           treeTime / vmTime,
+           numberEqual(treeVal, vmVal) && treeVal.type == vmVal.type ? "ok" : "MISMATCH");
+    record("vm", label, "eval us", treeTime / reps * 1e6, false);
+    record("vm", label, "vm us", vmTime / reps * 1e6, false);
+    record("vm", label, "compile us", compileTime / reps * 1e6, false);
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t sizes[] = {8, 64, 1024, 65536};
+    const char *json = argc > 1 && strncmp(argv[1], "--json=", 7) == 0 ? argv[1] + 7 : NULL;
+    int first = json != NULL ? 2 : 1;
+    int reps = argc > first ? atoi(argv[first]) : 1000;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = argc > first + 1 ? atoi(argv[first + 1]) : cpus > 2 ? (int) cpus : 2;
+    FILE *devNull = fopen("/dev/null", "w");
+    FILE *numbers = tmpfile();
+
+    // the benchmarks build their ASTs and evaluate them on this interpreter
+    useContext(cilispCreate(&defaultOptions, stdout, stdin));
+    if (currentContext == NULL || devNull == NULL || numbers == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+
+    // what the reads of the read stage read, and where they print what they read
+    for (int i = 0; i < 100000; i++)
+    {
+        fprintf(numbers, "%d\n", i % 97 + 1);
+    }
+    benchStages("deep 1000", textDeep(1000, 100), reps / 100 + 1, devNull, numbers);
+    benchStages("wide 10000", textWide(10000, 20), reps / 100 + 1, devNull, numbers);
+    benchStages("let 1000", textLet(1000, 20), reps / 100 + 1, devNull, numbers);
+    benchStages("fib 15", textFib(15, 100), reps / 100 + 1, devNull, numbers);
+    benchStages("read 1000", textRead(1000, 100), reps / 100 + 1, devNull, numbers);
+
+    printf("\n");
+    benchOutput("ints", genValues(INT_TYPE, true, 100000), 100000, reps / 100 + 1, devNull);
+    benchOutput("doubles 0.1", genValues(DOUBLE_TYPE, true, 100000), 100000, reps / 100 + 1, devNull);
+    benchOutput("doubles", genValues(DOUBLE_TYPE, false, 100000), 100000, reps / 100 + 1, devNull);
+
+    printf("\n");
+    benchAlloc("deep 10000", genDeep, 10000, reps / 10 + 1);
+    benchAlloc("wide 100000", genWide, 100000, reps / 100 + 1);
+    benchAlloc("let 1000", genLet, 1000, reps);
+
+    printf("\n");
+
+    bench("deep 100", genDeep(100), reps);
+    bench("deep 10000", genDeep(10000), reps / 10 + 1);
+    bench("wide 1000", genWide(1000), reps);
+    bench("wide 100000", genWide(100000), reps / 100 + 1);
+    bench("let 1000", genLet(1000), reps);
+    bench("gcd fib(40)", genGcd(102334155, 63245986), reps);
+    bench("fib 20", genFib(20), reps / 100 + 1);
+
+    printf("\n");
+    benchCse("deep 100", genDeep(100), reps);
+    benchCse("wide 1000", genWide(1000), reps);
+    benchCse("shared 100", genShared(100), reps);
+    benchCse("shared 10000", genShared(10000), reps / 100 + 1);
+
+    printf("\n");
+    benchInfer("deep 10000", genDeep(10000), reps / 10 + 1);
+    benchInfer("wide 100000", genWide(100000), reps / 100 + 1);
+    benchInfer("let 1000", genLet(1000), reps);
+    benchInfer("count 100000", genCount(100000), reps / 100 + 1);
+
+    for (int i = 0; i < 4; i++)
+    {
+        int sizeReps = (int) (reps * 1000 / sizes[i]) + 1;
+
+        printf("\n");
+        benchReduce("add", REDUCE_SUM, false, sizes[i], sizeReps);
+        benchReduce("mult", REDUCE_PRODUCT, false, sizes[i], sizeReps);
+        benchReduce("max", REDUCE_MAX, false, sizes[i], sizeReps);
+        benchReduce("min", REDUCE_MIN, false, sizes[i], sizeReps);
+        benchReduce("hypot", REDUCE_SQUARES, false, sizes[i], sizeReps);
+        benchReduce("add int", REDUCE_SUM, true, sizes[i], sizeReps);
+        benchReduce("max int", REDUCE_MAX, true, sizes[i], sizeReps);
+    }
+
+    printf("\n");
+    benchVector(1024, reps);
+    benchVector(65536, reps / 64 + 1);
+
+    printf("\n");
+    benchParallel("fib 30", genFib, 30, maxThreads);
+    benchParallel("max 8 fibs", genFibs, 26, maxThreads);
+
+    printf("\n");
+    benchJit("fib 25.0", genDoubleFib(25), reps / 100 + 1);
+    benchJit("roots 100000", genRoots(100000), reps / 100 + 1);
+
+    if (json != NULL)
+    {
+        writeJson(json, reps);
+    }
+
+    return 0;
+}
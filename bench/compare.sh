@@ -0,0 +1,102 @@
+#!/bin/sh
+# Compares the numbers of two runs of cilisp_bench --json=file, by default those
+# of bench/baseline.json with a new run, and flags each number that got worse by
+# more than threshold percent (10 by default) as a regression.
+# usage: bench/compare.sh [baseline.json] current.json [threshold]
+#    or: bench/compare.sh --run path/to/cilisp_bench [baseline.json [threshold]]
+# The second form runs the benchmark itself with its default repetitions.
+
+ROOT=$(dirname "$0")/..
+
+if [ "$1" = "--run" ]
+then
+    BENCH=$2
+    BASELINE=${3:-$ROOT/bench/baseline.json}
+    THRESHOLD=${4:-10}
+    CURRENT=$(mktemp)
+    trap 'rm -f "$CURRENT"' EXIT
+    "$BENCH" --json="$CURRENT" > /dev/null || exit 2
+elif [ $# -ge 2 ]
+then
+    BASELINE=$1
+    CURRENT=$2
+    THRESHOLD=${3:-10}
+else
+    BASELINE=$ROOT/bench/baseline.json
+    CURRENT=$1
+    THRESHOLD=10
+fi
+
+if [ ! -f "$BASELINE" ] || [ ! -f "$CURRENT" ]
+then
+    echo "usage: bench/compare.sh [baseline.json] current.json [threshold]" >&2
+    exit 2
+fi
+
+# cilisp_bench writes one result per line
+awk -v threshold="$THRESHOLD" '
+function field(line, key,    start)
+{
+    if (match(line, "\"" key "\": \"[^\"]*\""))
+    {
+        start = length(key) + 5
+        return substr(line, RSTART + start, RLENGTH - start - 1)
+    }
+    match(line, "\"" key "\": [^,}]*")
+    return substr(line, RSTART + length(key) + 4, RLENGTH - length(key) - 4)
+}
+
+!/"name":/ { next }
+
+{
+    key = field($0, "name") "  " field($0, "metric")
+}
+
+FNR == NR {
+    base[key] = field($0, "value") + 0
+    order[++count] = key
+    next
+}
+
+{
+    current[key] = field($0, "value") + 0
+    higher[key] = field($0, "better") == "higher"
+    if (!(key in base))
+    {
+        printf "%-52s %12s %12g          new\n", key, "", current[key]
+    }
+}
+
+END {
+    for (i = 1; i <= count; i++)
+    {
+        key = order[i]
+        if (!(key in current))
+        {
+            printf "%-52s %12g %12s          missing\n", key, base[key], ""
+            continue
+        }
+        if (base[key] == 0)
+        {
+            printf "%-52s %12g %12g\n", key, base[key], current[key]
+            continue
+        }
+
+        change = 100 * (current[key] - base[key]) / base[key]
+        worse = higher[key] ? -change : change
+        result = ""
+        if (worse > threshold)
+        {
+            result = "REGRESSION"
+            regressions++
+        }
+        else if (-worse > threshold)
+        {
+            result = "better"
+        }
+        printf "%-52s %12g %12g %+7.1f%%  %s\n", key, base[key], current[key], change, result
+    }
+
+    printf "\n%d of %d numbers worse by more than %g%%\n", regressions, count, threshold
+    exit (regressions > 0)
+}' "$BASELINE" "$CURRENT"
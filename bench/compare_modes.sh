@@ -0,0 +1,43 @@
+#!/bin/sh
+# Runs every program in inputs/ through the reference tree walker (--eval), the
+# bytecode VM, the VM compiling every lambda it can on its first call (--jit=0),
+# and the VM without the kernels of type inference (--no-infer), diffs the
+# outputs and reports the wall time of each mode. inputs/nan_signs.cilisp makes
+# NaNs of both signs in operand orders the modes may swap. A program with a
+# name_target.txt next to it reads from that file instead of read_target.
+# usage: bench/compare_modes.sh path/to/cilisp [read_target]
+
+CILISP=${1:-./cilisp}
+READ_TARGET=${2:-/dev/null}
+ROOT=$(dirname "$0")/..
+status=0
+
+for program in "$ROOT"/inputs/*.cilisp "$ROOT"/inputs/*/*.cilisp
+do
+    [ -f "$program" ] || continue
+    target=${program%.cilisp}_target.txt
+    [ -f "$target" ] || target=$READ_TARGET
+
+    start=$(date +%s%N)
+    "$CILISP" --eval "$program" "$target" > /tmp/cilisp_eval.out 2>&1
+    mid=$(date +%s%N)
+    "$CILISP" --vm "$program" "$target" > /tmp/cilisp_vm.out 2>&1
+    end=$(date +%s%N)
+    "$CILISP" --vm --jit=0 "$program" "$target" > /tmp/cilisp_jit.out 2>&1
+    jit=$(date +%s%N)
+    "$CILISP" --vm --no-infer "$program" "$target" > /tmp/cilisp_noinfer.out 2>&1
+
+    if cmp -s /tmp/cilisp_eval.out /tmp/cilisp_vm.out && cmp -s /tmp/cilisp_eval.out /tmp/cilisp_jit.out &&
+       cmp -s /tmp/cilisp_eval.out /tmp/cilisp_noinfer.out
+    then
+        result=same
+    else
+        result=DIFFERENT
+        status=1
+    fi
+
+    printf "%-40s eval %6d us   vm %6d us   jit %6d us   %s\n" "${program#$ROOT/}" \
+        $(((mid - start) / 1000)) $(((end - mid) / 1000)) $(((jit - end) / 1000)) "$result"
+done
+
+exit $status
@@ -0,0 +1,29 @@
+#cilisp_add_executable(name program.cilisp)
+#
+#Translates program.cilisp to C with `cilisp --emit-c` and compiles it with the
+#C compiler of the project into the executable `name`, linked against
+#cilisp_runtime. The executable prints exactly what `cilisp program.cilisp`
+#prints and takes the file `(read)` reads from as its only argument.
+#
+#The translated code is always optimized: lambdas calling each other in tail
+#position only run in constant space once the C compiler turns those calls into
+#jumps.
+function(cilisp_add_executable name program)
+    get_filename_component(program ${program} ABSOLUTE)
+    set(translated ${CMAKE_CURRENT_BINARY_DIR}/${name}.c)
+
+    add_custom_command(
+            OUTPUT ${translated}
+            COMMAND cilisp --emit-c=${translated} ${program}
+            DEPENDS cilisp ${program}
+            WORKING_DIRECTORY ${CMAKE_BINARY_DIR}
+            COMMENT "Translating ${program} to C"
+            VERBATIM
+    )
+
+    add_executable(${name} ${translated})
+    set_property(TARGET ${name} PROPERTY C_STANDARD 11)
+    set_property(TARGET ${name} PROPERTY C_STANDARD_REQUIRED ON)
+    target_compile_options(${name} PRIVATE -O2)
+    target_link_libraries(${name} cilisp_runtime m)
+endfunction()
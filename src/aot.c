@@ -0,0 +1,66 @@
+#include "aot.h"
+
+AOT_FRAME aotFrames[MAX_CALL_DEPTH + 1];
+AOT_FRAME *aotTop;
+RET_VAL aotStack[VALUE_STACK_SIZE];
+RET_VAL *aotSp;
+uint32_t aotActive;
+
+static RUNTIME aotRuntime;
+
+static void finishOutput(void)
+{
+    flushRuntime(&aotRuntime);
+}
+
+void aotStart(int argc, char **argv, DOUBLE_FORMAT doubles)
+{
+    initRuntime(&aotRuntime, stdout, argc > 1 ? fopen(argv[1], "r") : stdin);
+    aotRuntime.output.doubles = doubles;
+    runtime = &aotRuntime;
+    atexit(finishOutput);
+}
+
+void aotEcho(const char *text)
+{
+    outputText(&aotRuntime.output, text);
+}
+
+RET_VAL aotLoad(RET_VAL *slot, AOT_FRAME *frame, AOT_THUNK thunk, const char *name, uint32_t cap)
+{
+    while (slot->type == UNBOUND_TYPE)
+    {
+        if (aotActive == cap)
+        {
+            return stackOverflowValue();
+        }
+        slot->type = PENDING_TYPE;
+        aotActive++;
+        thunk(frame);
+    }
+    if (slot->type == PENDING_TYPE)
+    {
+        warning(">>> Symbol \"%s\" is defined in terms of itself. Returning NAN.", name);
+        return NAN_RET_VAL;
+    }
+
+    return *slot;
+}
+
+void aotPrint(RET_VAL val)
+{
+    printResult(val);
+    arenaReset(&value_arena);
+}
+
+RET_VAL aotVector(NUM_TYPE type, size_t n, const uint64_t *bits)
+{
+    VECTOR *vector = newVector(&value_arena, type, n);
+
+    if (n > 0)
+    {
+        memcpy(vector->values, bits, n * sizeof(uint64_t));
+    }
+
+    return (RET_VAL) {VECTOR_TYPE, .vector = vector};
+}
@@ -0,0 +1,59 @@
+#ifndef __aot_h_
+#define __aot_h_
+
+#include <stdint.h>
+#include "runtime.h"
+#include "reduce.h"
+#include "vector.h"
+
+// What the programs cilisp --emit-c writes need besides the runtime.
+//
+// Each top-level expression becomes C functions running its bytecode the way
+// vmRun does, see emit.c: the main code, each lambda and each thunk. Their frames
+// and registers are kept on stacks of the same sizes as the VM's, and running
+// calls and thunks are counted like its activations, so calls overflow exactly
+// where they do in the VM.
+
+// The registers of a running function, on aotStack, and the frame of the scope
+// it was defined in.
+typedef struct aot_frame {
+    RET_VAL *R;
+    struct aot_frame *link;
+} AOT_FRAME;
+
+#define AOT_STACK_END (aotStack + VALUE_STACK_SIZE)
+
+extern AOT_FRAME aotFrames[MAX_CALL_DEPTH + 1];
+extern AOT_FRAME *aotTop;   // first free frame
+extern RET_VAL aotStack[VALUE_STACK_SIZE];
+extern RET_VAL *aotSp;      // first free register
+extern uint32_t aotActive;  // calls and thunks running
+
+// The function of a thunk, run in the frame of its scope.
+typedef void (*AOT_THUNK)(AOT_FRAME *fp);
+
+// Takes the values of read from argv[1] if given, like the second argument of
+// cilisp, and from stdin otherwise, and prints doubles as doubles says. What the
+// program prints is buffered until it exits.
+void aotStart(int argc, char **argv, DOUBLE_FORMAT doubles);
+// Prints what cilisp printed between two values, such as its prompts.
+void aotEcho(const char *text);
+// Loads a slot of frame that is not bound yet, or whose binding is being
+// evaluated, like OP_LOADSYM: runs thunk to bind the slot named name unless cap
+// calls and thunks are running already.
+RET_VAL aotLoad(RET_VAL *slot, AOT_FRAME *frame, AOT_THUNK thunk, const char *name, uint32_t cap);
+// Prints the value of an expression and frees the vectors computed for it.
+void aotPrint(RET_VAL val);
+// A vector constant of n elements of type, given by their bits.
+RET_VAL aotVector(NUM_TYPE type, size_t n, const uint64_t *bits);
+
+// The double with the given bits, for constants that have no literal.
+static inline double aotDouble(uint64_t bits)
+{
+    double value;
+
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+#endif
@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+void yyerror(char *, ...);
+
+static ARENA_BLOCK *newBlock(size_t size)
+{
+    ARENA_BLOCK *block;
+
+    if ((block = malloc(sizeof(ARENA_BLOCK) + size)) == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+
+    return block;
+}
+
+void *arenaAlloc(ARENA *arena, size_t size)
+{
+    ARENA_BLOCK *block = arena->current;
+    void *ptr;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    while (block == NULL || block->used + size > block->size)
+    {
+        if (block != NULL && block->next != NULL)
+        {
+            // a block kept from before the last reset
+            block = block->next;
+            block->used = 0;
+            continue;
+        }
+
+        ARENA_BLOCK *next = newBlock(size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+        if (block == NULL)
+        {
+            arena->first = next;
+        }
+        else
+        {
+            block->next = next;
+        }
+        block = next;
+    }
+
+    arena->current = block;
+    ptr = (char *) block->data + block->used;
+    block->used += size;
+
+    return ptr;
+}
+
+void *arenaCalloc(ARENA *arena, size_t size)
+{
+    return memset(arenaAlloc(arena, size), 0, size);
+}
+
+char *arenaStrdup(ARENA *arena, const char *str)
+{
+    size_t len = strlen(str) + 1;
+
+    return memcpy(arenaAlloc(arena, len), str, len);
+}
+
+// Releases everything allocated since the last reset in one go.
+// If the expression spilled into more than one block, they are merged into a
+// single block of the combined size so the next one is laid out contiguously.
+void arenaReset(ARENA *arena)
+{
+    ARENA_BLOCK *block = arena->first;
+    size_t total = 0;
+
+    if (block == NULL)
+    {
+        return;
+    }
+
+    if (block->next != NULL && arena->current != block)
+    {
+        for (; block != NULL; block = block->next)
+        {
+            total += block->size;
+        }
+        arenaFree(arena);
+        arena->first = newBlock(total);
+    }
+
+    arena->first->used = 0;
+    arena->current = arena->first;
+}
+
+void arenaFree(ARENA *arena)
+{
+    ARENA_BLOCK *block = arena->first;
+
+    while (block != NULL)
+    {
+        ARENA_BLOCK *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena->first = NULL;
+    arena->current = NULL;
+}
@@ -0,0 +1,26 @@
+#ifndef __arena_h_
+#define __arena_h_
+
+#include <stddef.h>
+
+// Bump-pointer allocator for everything that lives as long as one top-level expression.
+// Blocks are kept across resets, so in steady state allocating costs no malloc calls.
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+} ARENA_BLOCK;
+
+typedef struct arena {
+    ARENA_BLOCK *first;
+    ARENA_BLOCK *current;
+} ARENA;
+
+void *arenaAlloc(ARENA *arena, size_t size);
+void *arenaCalloc(ARENA *arena, size_t size);
+char *arenaStrdup(ARENA *arena, const char *str);
+void arenaReset(ARENA *arena);
+void arenaFree(ARENA *arena);
+
+#endif
@@ -0,0 +1,160 @@
+#include "cilisp.h"
+
+#define INITIAL_ATOM_BUCKETS 256
+
+// Interned identifiers. Every distinct name is stored once in the atom table of
+// the interpreter, so symbols can be compared by pointer instead of with strcmp.
+
+// Must be in sync with members of the FUNC_TYPE enum.
+// For example, funcNames[NEG_FUNC] should be "neg"
+static char *funcNames[] = {
+        "neg",
+        "abs",
+        "add",
+        "sub",
+        "mult",
+        "div",
+        "remainder",
+        "exp",
+        "exp2",
+        "pow",
+        "log",
+        "sqrt",
+        "cbrt",
+        "hypot",
+        "max",
+        "min",
+        "equal",
+        "less",
+        "greater",
+        "rand",
+        "read",
+        "print",
+        "vector",
+        "sum",
+        "dot",
+        "mean",
+        // the empty string below must remain the last element
+        ""
+};
+
+static size_t hashName(const char *name, size_t *len)
+{
+    // FNV-1a
+    size_t hash = 2166136261u;
+    const char *c;
+
+    for (c = name; *c != '\0'; c++)
+    {
+        hash = (hash ^ (unsigned char) *c) * 16777619u;
+    }
+    *len = c - name;
+
+    return hash;
+}
+
+static void growBuckets(ATOM_TABLE *atoms)
+{
+    size_t newCount = atoms->bucketCount ? 2 * atoms->bucketCount : INITIAL_ATOM_BUCKETS;
+    ATOM **newBuckets;
+    size_t len;
+
+    if ((newBuckets = calloc(newCount, sizeof(ATOM *))) == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+
+    for (size_t i = 0; i < atoms->bucketCount; i++)
+    {
+        ATOM *atom = atoms->buckets[i];
+        while (atom != NULL)
+        {
+            ATOM *next = atom->next;
+            size_t bucket = hashName(atom->name, &len) & (newCount - 1);
+            atom->next = newBuckets[bucket];
+            newBuckets[bucket] = atom;
+            atom = next;
+        }
+    }
+
+    free(atoms->buckets);
+    atoms->buckets = newBuckets;
+    atoms->bucketCount = newCount;
+}
+
+static ATOM *lookupAtom(ATOM_TABLE *atoms, const char *name)
+{
+    size_t len;
+    size_t hash;
+    ATOM *atom;
+
+    if (atoms->atomCount >= atoms->bucketCount)
+    {
+        growBuckets(atoms);
+    }
+
+    hash = hashName(name, &len);
+    for (atom = atoms->buckets[hash & (atoms->bucketCount - 1)]; atom != NULL; atom = atom->next)
+    {
+        if (memcmp(atom->name, name, len + 1) == 0)
+        {
+            return atom;
+        }
+    }
+
+    atom = arenaAlloc(&atoms->arena, sizeof(ATOM) + len + 1);
+    memcpy(atom->name, name, len + 1);
+    atom->func = CUSTOM_FUNC;
+    atom->type = NO_TYPE;
+    atom->binding = NULL;
+    atom->next = atoms->buckets[hash & (atoms->bucketCount - 1)];
+    atoms->buckets[hash & (atoms->bucketCount - 1)] = atom;
+    atoms->atomCount++;
+
+    return atom;
+}
+
+static void internBuiltins(ATOM_TABLE *atoms)
+{
+    for (int i = 0; funcNames[i][0] != '\0'; i++)
+    {
+        lookupAtom(atoms, funcNames[i])->func = i;
+    }
+
+    lookupAtom(atoms, "int")->type = INT_TYPE;
+    lookupAtom(atoms, "double")->type = DOUBLE_TYPE;
+}
+
+ATOM *intern(const char *name)
+{
+    ATOM_TABLE *atoms = &currentContext->atoms;
+
+    if (atoms->buckets == NULL)
+    {
+        internBuiltins(atoms);
+    }
+
+    return lookupAtom(atoms, name);
+}
+
+void freeAtoms(ATOM_TABLE *atoms)
+{
+    free(atoms->buckets);
+    arenaFree(&atoms->arena);
+    *atoms = (ATOM_TABLE) {NULL};
+}
+
+FUNC_TYPE resolveFunc(char *funcName)
+{
+    return intern(funcName)->func;
+}
+
+const char *funcName(FUNC_TYPE func)
+{
+    return funcNames[func];
+}
+
+NUM_TYPE resolveType(char *type)
+{
+    return intern(type)->type;
+}
@@ -0,0 +1,220 @@
+#include <pthread.h>
+#include <ctype.h>
+#include "batch.h"
+
+// As in pool.c: room to recurse as deeply as a main thread with the usual 8 MB stack.
+#define WORKER_STACK_SIZE ((size_t) 32 << 20)
+
+typedef struct batch_line {
+    const char *text;
+    // Lines that read or draw random numbers run in turn on the serial interpreter;
+    // turn is how many such lines come before this one.
+    bool serial;
+    size_t turn;
+    bool done;
+    CILISP_STATUS status;
+    char *output;
+    size_t len;
+    char *messages; // what went to the messages of the interpreter, if it has them
+    size_t messagesLen;
+} BATCH_LINE;
+
+struct batch {
+    BATCH_LINE *lines;
+    size_t count;
+    CILISP_OPTIONS options;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // a line is done
+    pthread_cond_t room;  // a line was printed, or a serial line is done
+    size_t next;          // the next line for a thread to take
+    size_t printed;       // lines batchNext has returned
+    CILISP_CTX *serial;
+    size_t turn;          // serial lines done
+};
+
+// Whether the line calls read or rand, which take the next value of a state shared
+// by all the lines. Words are scanned as the lexer scans symbols, so that names
+// such as "reader" do not count.
+static bool isSerial(const char *text)
+{
+    const char *p = text;
+
+    while (*p != '\0' && *p != (char) EOF)
+    {
+        if (isalpha((unsigned char) *p) || *p == '_' || *p == '$')
+        {
+            const char *word = p;
+
+            while (isalnum((unsigned char) *p) || *p == '_' || *p == '$')
+            {
+                p++;
+            }
+            if (p - word == 4 && (strncmp(word, "read", 4) == 0 || strncmp(word, "rand", 4) == 0))
+            {
+                return true;
+            }
+        }
+        else
+        {
+            p++;
+        }
+    }
+
+    return false;
+}
+
+// Evaluates the line, expression index of the input, on ctx, collecting what it
+// prints, and its messages apart if they go apart.
+static void evaluate(CILISP_CTX *ctx, BATCH_LINE *line, size_t index)
+{
+    outputCapture(&ctx->runtime.output);
+    if (ctx->runtime.messages != NULL)
+    {
+        outputCapture(ctx->runtime.messages);
+    }
+    ctx->runtime.expression = index;
+    // pushed rather than evaluated, as an expression may go on over several lines
+    line->status = cilispPush(ctx, line->text, strlen(line->text));
+    line->output = outputRelease(&ctx->runtime.output, &line->len);
+    if (ctx->runtime.messages != NULL &&
+        (line->messages = outputRelease(ctx->runtime.messages, &line->messagesLen)) == NULL)
+    {
+        free(line->output);
+        line->output = NULL;
+    }
+    if (line->output == NULL)
+    {
+        line->status = CILISP_ERROR;
+    }
+}
+
+static void *workerMain(void *arg)
+{
+    BATCH *batch = arg;
+    CILISP_CTX *ctx = cilispCreate(&batch->options, NULL, NULL);
+
+    if (ctx == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    while (batch->next < batch->count)
+    {
+        BATCH_LINE *line;
+
+        if (batch->next >= batch->printed + BATCH_WINDOW)
+        {
+            pthread_cond_wait(&batch->room, &batch->lock);
+            continue;
+        }
+        line = &batch->lines[batch->next++];
+
+        if (line->serial)
+        {
+            // the line before in turn was taken first, so it is running or done
+            while (batch->turn != line->turn)
+            {
+                pthread_cond_wait(&batch->room, &batch->lock);
+            }
+            pthread_mutex_unlock(&batch->lock);
+            evaluate(batch->serial, line, line - batch->lines);
+            pthread_mutex_lock(&batch->lock);
+            batch->turn++;
+            pthread_cond_broadcast(&batch->room);
+        }
+        else
+        {
+            pthread_mutex_unlock(&batch->lock);
+            evaluate(ctx, line, line - batch->lines);
+            pthread_mutex_lock(&batch->lock);
+        }
+
+        line->done = true;
+        if (line == &batch->lines[batch->printed])
+        {
+            pthread_cond_signal(&batch->ready);
+        }
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    cilispDestroy(ctx);
+    return NULL;
+}
+
+BATCH *batchStart(const CILISP_OPTIONS *options, FILE *readTarget, char **lines, size_t count)
+{
+    BATCH *batch = calloc(1, sizeof(BATCH));
+    size_t turns = 0;
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if (batch == NULL || (batch->lines = calloc(count, sizeof(BATCH_LINE))) == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+
+    batch->count = count;
+    batch->options = *options;
+    for (size_t i = 0; i < count; i++)
+    {
+        batch->lines[i].text = lines[i];
+        if ((batch->lines[i].serial = isSerial(lines[i])))
+        {
+            batch->lines[i].turn = turns++;
+        }
+    }
+
+    if ((batch->serial = cilispCreate(options, NULL, readTarget)) == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->ready, NULL);
+    pthread_cond_init(&batch->room, NULL);
+
+    // The threads run until every line is done; cilisp exits once it has printed
+    // the line that quits, without waiting for them.
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (int i = 0; i < options->batch; i++)
+    {
+        if (pthread_create(&thread, &attr, workerMain, batch) != 0)
+        {
+            yyerror("Could not start a worker thread!");
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    return batch;
+}
+
+CILISP_STATUS batchNext(BATCH *batch, const char **output, size_t *len, const char **messages, size_t *messagesLen)
+{
+    BATCH_LINE *line;
+
+    pthread_mutex_lock(&batch->lock);
+    if (batch->printed > 0)
+    {
+        free(batch->lines[batch->printed - 1].output);
+        free(batch->lines[batch->printed - 1].messages);
+        batch->lines[batch->printed - 1].output = NULL;
+        batch->lines[batch->printed - 1].messages = NULL;
+    }
+    line = &batch->lines[batch->printed];
+    while (!line->done)
+    {
+        pthread_cond_wait(&batch->ready, &batch->lock);
+    }
+    batch->printed++;
+    pthread_cond_broadcast(&batch->room);
+    pthread_mutex_unlock(&batch->lock);
+
+    *output = line->output;
+    *len = line->len;
+    *messages = line->messages;
+    *messagesLen = line->messagesLen;
+    return line->status;
+}
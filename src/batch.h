@@ -0,0 +1,32 @@
+#ifndef __batch_h_
+#define __batch_h_
+
+#include "cilisp.h"
+
+// Batch evaluation of an input file (--batch).
+//
+// The top-level expressions of the file, which main splits as the scanner does
+// and which may go on over several lines, are evaluated on a pool of threads with
+// an interpreter each, which print into a buffer per expression. They come back
+// in the order of the file, through a reorder buffer that lets the threads run at
+// most BATCH_WINDOW expressions ahead of the one printed. Those that call read
+// or rand run one after another, in order, on one more interpreter that owns the
+// read target and the rand sequence, so they read and draw exactly what they
+// would on a single interpreter.
+
+#define BATCH_WINDOW 4096
+
+typedef struct batch BATCH;
+
+// Starts options->batch threads evaluating lines[0 .. count), an expression each
+// as cilispPush takes it, ending with a newline or the byte 0xff and then a NUL,
+// which must stay as they are until batchNext has returned them.
+BATCH *batchStart(const CILISP_OPTIONS *options, FILE *readTarget, char **lines, size_t count);
+
+// Waits for the next expression to be evaluated, and returns its status and what it
+// printed, len bytes that stay valid until the next call, or NULL if there was
+// no memory to print into. Its messages come apart, in messagesLen bytes, when
+// --output has them go to stderr, and are NULL otherwise.
+CILISP_STATUS batchNext(BATCH *batch, const char **output, size_t *len, const char **messages, size_t *messagesLen);
+
+#endif
@@ -1,131 +1,52 @@
 #include "cilisp.h"
 #include "math.h"
+#include "vm.h"
+#include "reduce.h"
+#include "vector.h"
+#include "pool.h"
+#include "profile.h"
+#include "sampler.h"
+#include "timeline.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <ctype.h>
+
+const CILISP_OPTIONS defaultOptions = {VM_EVAL_MODE, true, true, true, 1, -1, NULL, 0, false, NULL, false, NULL,
+                                       TIMELINE_DEFAULT_THRESHOLD, NULL, SAMPLER_DEFAULT_RATE, FIXED_DOUBLES,
+                                       TEXT_OUTPUT};
+
+_Thread_local CILISP_CTX *currentContext;
+
+_Thread_local RET_VAL *value_stack;
+_Thread_local RET_VAL *value_stack_top;
+
+// An operand of a variadic builtin evaluated by the pool, see evalOperands.
+// The thread that spawned it evaluates it again in its turn if it failed.
+typedef struct eval_task {
+    POOL_TASK task;
+    AST_NODE *node;
+    ENV *env;
+    int callDepth;
+    size_t valueRoom; // value and env stack left to the spawning thread
+    size_t envRoom;
+    int depth;        // tasks it runs within, itself included
+    RET_VAL val;
+    bool failed;
+} EVAL_TASK;
 
-#define RED             "\033[31m"
-#define RESET_COLOR     "\033[0m"
-
-// yyerror:
-// Something went so wrong that the whole program should crash.
-// You should basically never call this unless an allocation fails.
-// (see the "yyerror("Memory allocation failed!")" calls and do the same.
-// This is basically printf, but red, with "\nERROR: " prepended, "\n" appended,
-// and an "exit(1);" at the end to crash the program.
-// It's called "yyerror" instead of "error" so the parser will use it for errors too.
-void yyerror(char *format, ...)
-{
-    char buffer[256];
-    va_list args;
-    va_start (args, format);
-    vsnprintf (buffer, 255, format, args);
-
-    printf(RED "\nERROR: %s\nExiting...\n" RESET_COLOR, buffer);
-    fflush(stdout);
-
-    va_end (args);
-    exit(1);
-}
-
-// warning:
-// Something went mildly wrong (on the user-input level, probably)
-// Let the user know what happened and what you're doing about it.
-// Then, move on. No big deal, they can enter more inputs. ¯\_(ツ)_/¯
-// You should use this pretty often:
-//      too many arguments, let them know and ignore the extra
-//      too few arguments, let them know and return NAN
-//      invalid arguments, let them know and return NAN
-//      many more uses to be added as we progress...
-// This is basically printf, but red, and with "\nWARNING: " prepended and "\n" appended.
-void warning(char *format, ...)
-{
-    char buffer[256];
-    va_list args;
-    va_start (args, format);
-    vsnprintf (buffer, 255, format, args);
-
-    printf(RED "WARNING: %s\n" RESET_COLOR, buffer);
-    fflush(stdout);
-
-    va_end (args);
-}
-
-FUNC_TYPE resolveFunc(char *funcName)
-{
-    // Array of string values for function names.
-    // Must be in sync with members of the FUNC_TYPE enum in order for resolveFunc to work.
-    // For example, funcNames[NEG_FUNC] should be "neg"
-    char *funcNames[] = {
-            "neg",
-            "abs",
-            "add",
-            "sub",
-            "mult",
-            "div",
-            "remainder",
-            "exp",
-            "exp2",
-            "pow",
-            "log",
-            "sqrt",
-            "cbrt",
-            "hypot",
-            "max",
-            "min",
-            "equal",
-            "less",
-            "greater",
-            "rand",
-            "read",
-            "print",
-            // TODO complete the array - DONE
-            // the empty string below must remain the last element
-            ""
-    };
-    int i = 0;
-    while (funcNames[i][0] != '\0')
-    {
-        if (strcmp(funcNames[i], funcName) == 0)
-        {
-            return i;
-        }
-        i++;
-    }
-    return CUSTOM_FUNC;
-}
-
-NUM_TYPE resolveType(char *type)
-{
-    char *types[] = {
-            "int",
-            "double"
-    };
-
-    if (strcmp(types[0], type) == 0)
-    {
-        return INT_TYPE;
-    }
-    else if (strcmp(types[1], type) == 0)
-    {
-        return DOUBLE_TYPE;
-    }
-
-    return NO_TYPE;
-}
+// The task this thread is running, if any; taskFailed points to its failed flag.
+static _Thread_local EVAL_TASK *currentTask;
 
-AST_NODE *createNumberNode(double value, NUM_TYPE type)
+AST_NODE *createNumberNode(AST_NUMBER number)
 {
     AST_NODE *node;
     size_t nodeSize;
 
     nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
-    {
-        yyerror("Memory allocation failed!");
-        exit(1);
-    }
+    node = arenaCalloc(&currentContext->astArena, nodeSize);
 
     node->type = NUM_NODE_TYPE;
-    node->data.number.value = value;
-    node->data.number.type = type;
+    node->data.number = number;
 
     // TODO complete the function - DONE
 
@@ -135,6 +56,34 @@ AST_NODE *createNumberNode(double value, NUM_TYPE type)
     return node;
 }
 
+// A literal vector of the numbers in a list, ints if they all are.
+AST_NODE *createVectorNode(AST_NODE *numbers)
+{
+    VECTOR *vector;
+    size_t length = 0;
+    bool ints = true;
+
+    for (AST_NODE *number = numbers; number != NULL; number = number->next)
+    {
+        length++;
+        ints = ints && number->data.number.type == INT_TYPE;
+    }
+
+    vector = newVector(&currentContext->astArena, ints ? INT_TYPE : DOUBLE_TYPE, length);
+    for (size_t i = 0; numbers != NULL; numbers = numbers->next, i++)
+    {
+        if (ints)
+        {
+            vector->ivals[i] = numbers->data.number.ival;
+        }
+        else
+        {
+            vector->values[i] = toDouble(numbers->data.number);
+        }
+    }
+
+    return createNumberNode((AST_NUMBER) {VECTOR_TYPE, .vector = vector});
+}
 
 AST_NODE *createFunctionNode(FUNC_TYPE func, AST_NODE *opList)
 {
@@ -142,11 +91,7 @@ AST_NODE *createFunctionNode(FUNC_TYPE func, AST_NODE *opList)
     size_t nodeSize;
 
     nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
-    {
-        yyerror("Memory allocation failed!");
-        exit(1);
-    }
+    node = arenaCalloc(&currentContext->astArena, nodeSize);
 
     node->type = FUNC_NODE_TYPE;
     node->data.function.func = func;
@@ -164,18 +109,47 @@ AST_NODE *createFunctionNode(FUNC_TYPE func, AST_NODE *opList)
     return node;
 }
 
-AST_NODE *createCondNode(AST_NODE *cond, AST_NODE *_true, AST_NODE *_false)
+AST_NODE *createCustomFunctionNode(ATOM *name, AST_NODE *opList)
+{
+    AST_NODE *node = createFunctionNode(CUSTOM_FUNC, opList);
+
+    node->data.function.name = name;
+    node->data.function.slot = -1;
+
+    return node;
+}
+
+AST_NODE *createLambdaNode(SYMBOL_TABLE_NODE *params, AST_NODE *body)
 {
     AST_NODE *node;
     size_t nodeSize;
 
     nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
+    node = arenaCalloc(&currentContext->astArena, nodeSize);
+
+    node->type = LAMBDA_NODE_TYPE;
+    node->data.lambda.params = params;
+    node->data.lambda.body = body;
+
+    body->parent = node;
+
+    while (params != NULL)
     {
-        yyerror("Memory allocation failed!");
-        exit(1);
+        node->data.lambda.nParams++;
+        params = params->next;
     }
 
+    return node;
+}
+
+AST_NODE *createCondNode(AST_NODE *cond, AST_NODE *_true, AST_NODE *_false)
+{
+    AST_NODE *node;
+    size_t nodeSize;
+
+    nodeSize = sizeof(AST_NODE);
+    node = arenaCalloc(&currentContext->astArena, nodeSize);
+
     node->type = CONDITIONAL_NODE_TYPE;
 
     node->data.condition.condition = cond;
@@ -195,11 +169,7 @@ AST_NODE *createScopeNode(SYMBOL_TABLE_NODE *symbolTable, AST_NODE *scopeList)
     size_t nodeSize;
 
     nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
-    {
-        yyerror("Memory allocation failed!");
-        exit(1);
-    }
+    node = arenaCalloc(&currentContext->astArena, nodeSize);
 
     scopeList->parent = node;
     scopeList->symbolTable = symbolTable;
@@ -216,50 +186,39 @@ AST_NODE *createScopeNode(SYMBOL_TABLE_NODE *symbolTable, AST_NODE *scopeList)
     return node;
 }
 
-SYMBOL_TABLE_NODE *createSymbolNode_T(char *type, char *id, AST_NODE *val)
+SYMBOL_TABLE_NODE *createSymbolNode_T(ATOM *type, ATOM *id, AST_NODE *val)
 {
     SYMBOL_TABLE_NODE *node;
     size_t nodeSize;
 
     nodeSize = sizeof(SYMBOL_TABLE_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
-    {
-        yyerror("Memory allocation failed!");
-        exit(1);
-    }
+    node = arenaCalloc(&currentContext->astArena, nodeSize);
 
-    node->id = calloc(sizeof(char), strlen(id)+1);
-    strcpy(node->id, id);
+    node->id = id;
     node->value = val;
-    node->type = resolveType(type);
-
-    if (val->data.number.type == DOUBLE_TYPE & node->type == INT_TYPE)
-    {
-        warning("Precision loss on int cast from %f to %d", val->data.number.value, (int) node->value->data.number.value);
-    }
+    node->type = type->type;
 
     if (node->value->type == NUM_NODE_TYPE)
     {
-        node->value->data.number.type = node->type;
+        if (val->data.number.type == DOUBLE_TYPE && node->type == INT_TYPE)
+        {
+            warning("Precision loss on int cast from %f to %" PRId64, val->data.number.value, toInt(val->data.number.value));
+        }
+        node->value->data.number = castBindingValue(node->value->data.number, node->type);
     }
 
     return node;
 }
 
-SYMBOL_TABLE_NODE *createSymbolNode_I(char *id, AST_NODE *val)
+SYMBOL_TABLE_NODE *createSymbolNode_I(ATOM *id, AST_NODE *val)
 {
     SYMBOL_TABLE_NODE *node;
     size_t nodeSize;
 
     nodeSize = sizeof(SYMBOL_TABLE_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
-    {
-        yyerror("Memory allocation failed!");
-        exit(1);
-    }
+    node = arenaCalloc(&currentContext->astArena, nodeSize);
 
-    node->id = calloc(sizeof(char), strlen(id)+1);
-    strcpy(node->id, id);
+    node->id = id;
     node->value = val;
     node->type = NO_TYPE;
 
@@ -267,40 +226,25 @@ SYMBOL_TABLE_NODE *createSymbolNode_I(char *id, AST_NODE *val)
     return node;
 }
 
-AST_NODE *createSymbolNode_U(char *id)
+AST_NODE *createSymbolNode_U(ATOM *id)
 {
     AST_NODE *node;
     size_t nodeSize;
 
     nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
-    {
-        yyerror("Memory allocation failed!");
-        exit(1);
-    }
+    node = arenaCalloc(&currentContext->astArena, nodeSize);
 
     node->data.symbol.id = id;
+    node->data.symbol.slot = -1;
     node->type = SYM_NODE_TYPE;
 
     return node;
 }
 
+// Duplicate symbols are reported and dropped later by resolveProgram,
+// which can detect them without comparing names.
 SYMBOL_TABLE_NODE *storeSymbolTableNode(SYMBOL_TABLE_NODE *newSymbol, SYMBOL_TABLE_NODE *symbolList)
 {
-    //References first STN for later reassignment
-    SYMBOL_TABLE_NODE *hold = symbolList;
-
-    while (symbolList != NULL)
-    {
-        if (strcmp(newSymbol->id, symbolList->id) == 0)
-        {
-            warning("The symbol \"%s\" already exists within the scope. Value remains unchanged.", newSymbol->id);
-            return newSymbol;
-        }
-        symbolList = symbolList->next;
-    }
-
-    symbolList = hold;
     newSymbol->next = symbolList;
 
     return newSymbol;
@@ -316,7 +260,37 @@ AST_NODE *addExpressionToList(AST_NODE *newExpr, AST_NODE *exprList)
     return newExpr;
 }
 
-RET_VAL evalNegFunc(AST_NODE *node)
+AST_NODE *locateNode(AST_NODE *node, YYLTYPE location)
+{
+    node->location = (SOURCE_LOCATION) {location.first_line, location.first_column,
+                                        location.last_line, location.last_column};
+
+    return node;
+}
+
+// The parser builds lists last element first; this puts them back in order.
+AST_NODE *reverseExpressionList(AST_NODE *exprList)
+{
+    AST_NODE *reversed = NULL;
+
+    while (exprList != NULL)
+    {
+        AST_NODE *next = exprList->next;
+
+        exprList->next = reversed;
+        reversed = exprList;
+        exprList = next;
+    }
+
+    return reversed;
+}
+
+// Evaluates the operands of a variadic builtin and reduces them, see reduce.h.
+static RET_VAL evalReduction(REDUCE_OP op, AST_NODE *opList, ENV *env);
+// Evaluates the operands of vector and concatenates them, see vector.h.
+static RET_VAL evalVector(AST_NODE *opList, ENV *env);
+
+RET_VAL evalNegFunc(AST_NODE *node, ENV *env)
 {
     RET_VAL val;
     node = node->data.function.opList;
@@ -326,8 +300,7 @@ RET_VAL evalNegFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    val = eval(node);
-    val.value = -val.value;
+    val = numberNeg(eval(node, env));
 
     if(node->next != NULL) {
         warning("Extra parameters ignored.");
@@ -336,7 +309,7 @@ RET_VAL evalNegFunc(AST_NODE *node)
     return val;
 }
 
-RET_VAL evalAbsFunc(AST_NODE *node)
+RET_VAL evalAbsFunc(AST_NODE *node, ENV *env)
 {
     RET_VAL val;
     node = node->data.function.opList;
@@ -346,15 +319,7 @@ RET_VAL evalAbsFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    val = eval(node);
-
-    if (val.type == INT_TYPE) {
-        val.value = abs((int) val.value);
-    }
-    else {
-        val.value = fabs(val.value);
-    }
-
+    val = numberAbs(eval(node, env));
 
     if(node->next != NULL) {
         warning("Extra parameters ignored.");
@@ -363,30 +328,19 @@ RET_VAL evalAbsFunc(AST_NODE *node)
     return val;
 }
 
-RET_VAL evalAddFunc(AST_NODE *node)
+RET_VAL evalAddFunc(AST_NODE *node, ENV *env)
 {
-    RET_VAL val, temp;
     node = node->data.function.opList;
-    val.value = 0; //Initialized to 0
-    val.type = INT_TYPE;
 
     if(node == NULL) {
         warning("Not enough parameters. Returning 0");
         return ZERO_RET_VAL;
     }
 
-    for (int i = 0; node != NULL; i++)
-    {
-        temp = eval(node);
-        val.value += temp.value;
-        val.type = val.type || temp.type;
-        node = node->next;
-    }
-
-    return val;
+    return evalReduction(REDUCE_SUM, node, env);
 }
 
-RET_VAL evalSubFunc(AST_NODE *node)
+RET_VAL evalSubFunc(AST_NODE *node, ENV *env)
 {
     RET_VAL val, val2;
     node = node->data.function.opList;
@@ -396,7 +350,7 @@ RET_VAL evalSubFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    val = eval(node);
+    val = eval(node, env);
 
     if(node->next == NULL) {
         warning("Not enough parameters. Returning NAN");
@@ -404,9 +358,8 @@ RET_VAL evalSubFunc(AST_NODE *node)
     }
 
     node = node->next;
-    val2 = eval(node);
-    val.type = val.type || val2.type;
-    val.value -= val2.value;
+    val2 = eval(node, env);
+    val = numberSub(val, val2);
 
     if(node->next != NULL) {
         warning("Extra parameters ignored.");
@@ -415,30 +368,20 @@ RET_VAL evalSubFunc(AST_NODE *node)
     return val;
 }
 
-RET_VAL evalMultFunc(AST_NODE *node)
+RET_VAL evalMultFunc(AST_NODE *node, ENV *env)
 {
-    RET_VAL val, temp;
+    RET_VAL val = {INT_TYPE, .ival = 1}; //Initialized value to 1 so that it doesn't return 0
     node = node->data.function.opList;
-    val.value = 1; //Initialized value to 1 so that it doesn't return 0
-    val.type = INT_TYPE;
 
     if(node == NULL) {
         warning("Not enough parameters. Returning 1");
         return val;
     }
 
-    for (int i = 0; node != NULL; i++)
-    {
-        temp = eval(node);
-        val.value *= temp.value;
-        val.type = val.type || temp.type;
-        node = node->next;
-    }
-
-    return val;
+    return evalReduction(REDUCE_PRODUCT, node, env);
 }
 
-RET_VAL evalDivFunc(AST_NODE *node)
+RET_VAL evalDivFunc(AST_NODE *node, ENV *env)
 {
     RET_VAL val, temp;
     node = node->data.function.opList;
@@ -448,22 +391,15 @@ RET_VAL evalDivFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    val = eval(node);
+    val = eval(node, env);
 
     if(node->next == NULL) {
         warning("Not enough parameters. Returning NAN");
         return NAN_RET_VAL;
     }
 
-    temp = eval(node->next);
-    val.type = val.type || temp.type;
-    if (val.type == INT_TYPE) {
-        val.value = (int) val.value / (int) temp.value;
-    }
-    else
-    {
-        val.value /= temp.value;
-    }
+    temp = eval(node->next, env);
+    val = numberDiv(val, temp);
 
     if(node->next->next != NULL) {
         warning("Extra parameters ignored.");
@@ -472,7 +408,7 @@ RET_VAL evalDivFunc(AST_NODE *node)
     return val;
 }
 
-RET_VAL evalRemFunc(AST_NODE *node)
+RET_VAL evalRemFunc(AST_NODE *node, ENV *env)
 {
     RET_VAL val, temp;
     node = node->data.function.opList;
@@ -482,21 +418,15 @@ RET_VAL evalRemFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    val = eval(node);
+    val = eval(node, env);
 
     if(node->next == NULL) {
         warning("Not enough parameters. Returning NAN");
         return NAN_RET_VAL;
     }
 
-    temp = eval(node->next);
-    val.type = val.type || temp.type;
-    val.value = fmod(val.value, temp.value);
-
-    if (val.value < 0)
-    {
-        val.value += fabs(temp.value);
-    }
+    temp = eval(node->next, env);
+    val = numberRem(val, temp);
 
     if(node->next->next != NULL) {
         warning("Extra parameters ignored.");
@@ -505,7 +435,7 @@ RET_VAL evalRemFunc(AST_NODE *node)
     return val;
 }
 
-RET_VAL evalExpFunc(AST_NODE *node)
+RET_VAL evalExpFunc(AST_NODE *node, ENV *env)
 {
     RET_VAL val;
     node = node->data.function.opList;
@@ -515,9 +445,8 @@ RET_VAL evalExpFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    val = eval(node);
-    val.type = DOUBLE_TYPE;
-    val.value = (double) exp(val.value);
+    val = eval(node, env);
+    val = numberExp(val);
 
     if(node->next != NULL) {
         warning("Extra parameters ignored.");
@@ -526,7 +455,7 @@ RET_VAL evalExpFunc(AST_NODE *node)
     return val;
 }
 
-RET_VAL evalExp2Func(AST_NODE *node)
+RET_VAL evalExp2Func(AST_NODE *node, ENV *env)
 {
     RET_VAL val;
     node = node->data.function.opList;
@@ -536,17 +465,7 @@ RET_VAL evalExp2Func(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    val = eval(node);
-
-    if(val.value < 0)
-    {
-        val.type = DOUBLE_TYPE;
-        val.value = (double) pow(2, val.value);
-    }
-    else
-    {
-        val.value = pow(2, val.value);
-    }
+    val = numberExp2(eval(node, env));
 
     if(node->next != NULL) {
         warning("Extra parameters ignored.");
@@ -555,9 +474,8 @@ RET_VAL evalExp2Func(AST_NODE *node)
     return val;
 }
 
-RET_VAL evalMinFunc(AST_NODE *node)
+RET_VAL evalMinFunc(AST_NODE *node, ENV *env)
 {
-    RET_VAL min, temp;
     node = node->data.function.opList;
 
     if(node == NULL) {
@@ -565,26 +483,11 @@ RET_VAL evalMinFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    min = eval(node);
-    node = node->next;
-
-    while (node != NULL)
-    {
-        temp = eval(node);
-        if (temp.value < min.value)
-        {
-            min.value = temp.value;
-            min.type = temp.type;
-        }
-        node = node->next;
-    }
-
-    return min;
+    return evalReduction(REDUCE_MIN, node, env);
 }
 
-RET_VAL evalMaxFunc(AST_NODE *node)
+RET_VAL evalMaxFunc(AST_NODE *node, ENV *env)
 {
-    RET_VAL max, temp;
     node = node->data.function.opList;
 
     if (node == NULL) {
@@ -592,26 +495,12 @@ RET_VAL evalMaxFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    max = eval(node);
-    node = node->next;
-
-    while (node != NULL)
-    {
-        temp = eval(node);
-        if (temp.value > max.value)
-        {
-            max.value = temp.value;
-            max.type = temp.type;
-        }
-        node = node->next;
-    }
-
-    return max;
+    return evalReduction(REDUCE_MAX, node, env);
 }
 
-RET_VAL evalHypotFunc(AST_NODE *node)
+RET_VAL evalHypotFunc(AST_NODE *node, ENV *env)
 {
-    RET_VAL val, temp;
+    RET_VAL val;
     node = node->data.function.opList;
 
 
@@ -620,22 +509,13 @@ RET_VAL evalHypotFunc(AST_NODE *node)
         return ZERO_RET_VAL;
     }
 
-    val.type = DOUBLE_TYPE;
-    val.value = 0;
-
-    for (int i = 0; node != NULL; i++)
-    {
-        temp = eval(node);
-        val.value += pow(temp.value, 2);
-        node = node->next;
-    }
-
-    val.value = sqrt(val.value);
+    // the squares are summed like add sums its operands, as x * x rather than pow(x, 2)
+    val = numberSqrt(evalReduction(REDUCE_SQUARES, node, env));
 
     return val;
 }
 
-RET_VAL evalCbrtFunc(AST_NODE *node)
+RET_VAL evalCbrtFunc(AST_NODE *node, ENV *env)
 {
     RET_VAL val;
     node = node->data.function.opList;
@@ -645,9 +525,8 @@ RET_VAL evalCbrtFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    val = eval(node);
-    val.type = DOUBLE_TYPE;
-    val.value = cbrt(val.value);
+    val = eval(node, env);
+    val = numberCbrt(val);
 
     if(node->next != NULL) {
         warning("Extra parameters ignored.");
@@ -656,7 +535,7 @@ RET_VAL evalCbrtFunc(AST_NODE *node)
     return val;
 }
 
-RET_VAL evalSqrtFunc(AST_NODE *node)
+RET_VAL evalSqrtFunc(AST_NODE *node, ENV *env)
 {
     RET_VAL val;
     node = node->data.function.opList;
@@ -666,9 +545,8 @@ RET_VAL evalSqrtFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    val = eval(node);
-    val.type = DOUBLE_TYPE;
-    val.value = sqrt(val.value);
+    val = eval(node, env);
+    val = numberSqrt(val);
 
     if(node->next != NULL) {
         warning("Extra parameters ignored.");
@@ -677,14 +555,18 @@ RET_VAL evalSqrtFunc(AST_NODE *node)
     return val;
 }
 
-RET_VAL evalLogFunc(AST_NODE *node)
+RET_VAL evalLogFunc(AST_NODE *node, ENV *env)
 {
     RET_VAL val;
     node = node->data.function.opList;
 
-    val = eval(node);
-    val.type = DOUBLE_TYPE;
-    val.value = log(val.value);
+    if(node == NULL) {
+        warning("Not enough parameters. Returning NAN");
+        return NAN_RET_VAL;
+    }
+
+    val = eval(node, env);
+    val = numberLog(val);
 
     if(node->next != NULL) {
         warning("Extra parameters ignored.");
@@ -693,7 +575,7 @@ RET_VAL evalLogFunc(AST_NODE *node)
     return val;
 }
 
-RET_VAL evalPowFunc(AST_NODE *node)
+RET_VAL evalPowFunc(AST_NODE *node, ENV *env)
 {
     RET_VAL val, temp;
     node = node->data.function.opList;
@@ -704,7 +586,7 @@ RET_VAL evalPowFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    val = eval(node);
+    val = eval(node, env);
 
     if(node->next == NULL)
     {
@@ -712,9 +594,8 @@ RET_VAL evalPowFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    temp = eval(node->next);
-    val.type = val.type || temp.type;
-    val.value = pow(val.value, temp.value);
+    temp = eval(node->next, env);
+    val = numberPow(val, temp);
 
     if(node->next->next != NULL) {
         warning("Extra parameters ignored.");
@@ -723,7 +604,7 @@ RET_VAL evalPowFunc(AST_NODE *node)
     return val;
 }
 
-RET_VAL evalLessFunc(AST_NODE *node)
+RET_VAL evalLessFunc(AST_NODE *node, ENV *env)
 {
     RET_VAL val, temp;
     node = node->data.function.opList;
@@ -734,7 +615,7 @@ RET_VAL evalLessFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    val = eval(node);
+    val = eval(node, env);
 
     if(node->next == NULL)
     {
@@ -742,8 +623,8 @@ RET_VAL evalLessFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    temp = eval(node->next);
-    val.value = (val.value < temp.value) ? (val.value = 1) : (val.value = 0);
+    temp = eval(node->next, env);
+    val = compareLess(val, temp);
 
     if(node->next->next != NULL) {
         warning("Extra parameters ignored.");
@@ -752,7 +633,7 @@ RET_VAL evalLessFunc(AST_NODE *node)
     return val;
 }
 
-RET_VAL evalGreaterFunc(AST_NODE *node)
+RET_VAL evalGreaterFunc(AST_NODE *node, ENV *env)
 {
     RET_VAL val, temp;
     node = node->data.function.opList;
@@ -763,7 +644,7 @@ RET_VAL evalGreaterFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    val = eval(node);
+    val = eval(node, env);
 
     if(node->next == NULL)
     {
@@ -771,8 +652,8 @@ RET_VAL evalGreaterFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    temp = eval(node->next);
-    val.value = (val.value > temp.value) ? (val.value = 1) : (val.value = 0);
+    temp = eval(node->next, env);
+    val = compareGreater(val, temp);
 
     if(node->next->next != NULL) {
         warning("Extra parameters ignored.");
@@ -781,7 +662,7 @@ RET_VAL evalGreaterFunc(AST_NODE *node)
     return val;
 }
 
-RET_VAL evalEqualFunc(AST_NODE *node)
+RET_VAL evalEqualFunc(AST_NODE *node, ENV *env)
 {
     RET_VAL val, temp;
     node = node->data.function.opList;
@@ -792,7 +673,7 @@ RET_VAL evalEqualFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    val = eval(node);
+    val = eval(node, env);
 
     if(node->next == NULL)
     {
@@ -800,8 +681,8 @@ RET_VAL evalEqualFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    temp = eval(node->next);
-    val.value = (val.value == temp.value) ? (val.value = 1) : (val.value = 0);
+    temp = eval(node->next, env);
+    val = compareEqual(val, temp);
 
     if(node->next->next != NULL) {
         warning("Extra parameters ignored.");
@@ -810,8 +691,9 @@ RET_VAL evalEqualFunc(AST_NODE *node)
     return val;
 }
 
-RET_VAL evalPrintFunc(AST_NODE *node)
+RET_VAL evalPrintFunc(AST_NODE *node, ENV *env)
 {
+    RET_VAL val;
     node = node->data.function.opList;
 
     if(node == NULL)
@@ -820,393 +702,1651 @@ RET_VAL evalPrintFunc(AST_NODE *node)
         return NAN_RET_VAL;
     }
 
-    printRetVal(node->data.number);
+    val = eval(node, env);
+    printRetVal(val);
 
     if(node->next != NULL) {
         warning("Extra parameters ignored.");
     }
 
-    return node->data.number;
+    return val;
 }
 
-RET_VAL evalRandFunc()
+RET_VAL evalVectorFunc(AST_NODE *node, ENV *env)
 {
-    return (RET_VAL){DOUBLE_TYPE, (((double) rand() / (RAND_MAX)))};
+    return evalVector(node->data.function.opList, env);
 }
 
-RET_VAL evalReadFunc()
+RET_VAL evalSumFunc(AST_NODE *node, ENV *env)
 {
-    int offset; // Number of characters read by sscanf
-    double value;
-    char buffer[64];
-    printf("read :: ");
-    fscanf(read_target, "%[^\n]\n", buffer);
-
-    if (strcmp(buffer, "0") == 0) { return ZERO_RET_VAL; }
-    printf("%s\n", buffer);
+    RET_VAL val;
+    node = node->data.function.opList;
 
-    if (sscanf(buffer, "%lf%n", &value, &offset) != 1) {
-        if (offset != strlen(buffer - 1))
-        {
-            warning("Invalid read entry! NAN returned!");
-            return NAN_RET_VAL;
-        }
-        warning("Invalid read entry! NAN returned!");
+    if(node == NULL) {
+        warning("Not enough parameters. Returning NAN");
         return NAN_RET_VAL;
     }
 
-    RET_VAL val = {NO_TYPE, value};
+    val = vectorSum(eval(node, env));
 
-    int intVal = trunc(val.value);
-    if (val.value == intVal) {
-        val.type = INT_TYPE;
-    } else {
-        val.type = DOUBLE_TYPE;
+    if(node->next != NULL) {
+        warning("Extra parameters ignored.");
     }
 
     return val;
 }
 
-RET_VAL evalConditionalFunc(AST_NODE *node)
-{
-    return (eval(node->data.condition.condition).value == 0) ?
-           eval(node->data.condition._false) :
-           eval(node->data.condition._true);
-}
-RET_VAL evalCustomFunc(AST_NODE *node)
+RET_VAL evalDotFunc(AST_NODE *node, ENV *env)
 {
-    RET_VAL val = (RET_VAL){INT_TYPE, 1};
-    //Initial Framework Attempt. Commented out to prevent errors
-    /*int i = 0; //i is counter to store list head of stack
-    AST_NODE *temp = node;
-    STACK_NODE *stack, *stackHead;
-    SYMBOL_TABLE_NODE *arg = node->symbolTable->value->argTable;
+    RET_VAL val, temp;
     node = node->data.function.opList;
 
-    //Initialize stackNode
-    size_t stackSize = sizeof(STACK_NODE);
-    if ((stack = calloc(stackSize, 1)) == NULL)
-    { yyerror("Memory allocation failed!"); exit(1); }
-
-    //Allocate space for and store values on stack
-    while (node != NULL)
+    if(node == NULL)
     {
-        stack->value = node->data.number;
-        if (node->next != NULL)
-        {
-            if ((stack->next = calloc(stackSize, 1)) == NULL)
-            { yyerror("Memory allocation failed!"); exit(1); }
-            if (!i) { stackHead = stack; }
-            stack = stack->next;
-        }
-        node = node->next;
-        i++;
+        warning("Not enough parameters. Returning NAN");
+        return NAN_RET_VAL;
     }
 
-    stack = stackHead; //Reset stack address
-    node = temp->symbolTable->value; //Reset node address
+    val = eval(node, env);
 
-    while (node->argTable != NULL && stack != NULL)
+    if(node->next == NULL)
     {
-        node->argTable->value->data.number = stack->value;
-        node->argTable = node->argTable->next;
-        stack = stack->next;
+        warning("Not enough parameters. Returning NAN");
+        return NAN_RET_VAL;
     }
 
-    node->argTable = arg; //Reset argTable address
+    temp = eval(node->next, env);
+    val = vectorDot(val, temp);
 
-    val = eval(temp->symbolTable->value);
-
-    if (temp->symbolTable->type == INT_TYPE && val.type == DOUBLE_TYPE)
-    {
-        warning("Precision loss on int cast from %.3lf to %d", val.value, (int) val.value);
-        val.type = INT_TYPE;
-        val.value = trunc(val.value);
+    if(node->next->next != NULL) {
+        warning("Extra parameters ignored.");
     }
-*/
+
     return val;
 }
 
-RET_VAL evalFuncNode(AST_NODE *node)
+RET_VAL evalMeanFunc(AST_NODE *node, ENV *env)
 {
     RET_VAL val;
+    node = node->data.function.opList;
 
-    if (!node || node == NULL)
-    {
-        yyerror("NULL AST_NODE passed into evalFuncNode!");
-        return NAN_RET_VAL; // unreachable but kills a clang-tidy warning
+    if(node == NULL) {
+        warning("Not enough parameters. Returning NAN");
+        return NAN_RET_VAL;
     }
 
-    switch (node->data.function.func)
-    {
-        case NEG_FUNC:
-            val = evalNegFunc(node);
-            break;
-        case ABS_FUNC:
-            val = evalAbsFunc(node);
-            break;
-        case ADD_FUNC:
-            val = evalAddFunc(node);
-            break;
-        case SUB_FUNC:
-            val = evalSubFunc(node);
-            break;
-        case MULT_FUNC:
-            val = evalMultFunc(node);
-            break;
-        case DIV_FUNC:
-            val = evalDivFunc(node);
-            break;
-        case REM_FUNC:
-            val = evalRemFunc(node);
-            break;
-        case EXP_FUNC:
-            val = evalExpFunc(node);
-            break;
-        case EXP2_FUNC:
-            val = evalExp2Func(node);
-            break;
-        case POW_FUNC:
-            val = evalPowFunc(node);
-            break;
-        case LOG_FUNC:
-            val = evalLogFunc(node);
-            break;
-        case SQRT_FUNC:
-            val = evalSqrtFunc(node);
-            break;
-        case CBRT_FUNC:
-            val = evalCbrtFunc(node);
-            break;
-        case HYPOT_FUNC:
-            val = evalHypotFunc(node);
-            break;
-        case MAX_FUNC:
-            val = evalMaxFunc(node);
-            break;
-        case MIN_FUNC:
-            val = evalMinFunc(node);
-            break;
-        case EQUAL_FUNC:
-            val = evalEqualFunc(node);
-            break;
-        case LESS_FUNC:
-            val = evalLessFunc(node);
-            break;
-        case GREATER_FUNC:
-            val = evalGreaterFunc(node);
-            break;
-        case RAND_FUNC:
-            val = evalRandFunc();
-            break;
-        case READ_FUNC:
-            val = evalReadFunc();
-            break;
-        case PRINT_FUNC:
-            val = evalPrintFunc(node);
-            break;
-        case CUSTOM_FUNC:
-            val = evalCustomFunc(node);
-        default:
-            break;
-    }
+    val = vectorMean(eval(node, env));
 
-    // TODO complete the function - DONE
-    // HINT:
-    // the helper functions that it calls will need to be defined above it
-    // because they are not declared in the .h file (and should not be)
+    if(node->next != NULL) {
+        warning("Extra parameters ignored.");
+    }
 
     return val;
 }
 
 
-RET_VAL evalNumNode(AST_NODE *node)
+#define ENV_STACK_SIZE (1 << 16)
+
+// Frames of the let scopes and calls being evaluated; their slots are on the value stack.
+static _Thread_local ENV *envStack;
+static _Thread_local ENV *envTop;
+
+// Where pushValues and pushEnv stop: the end of the stacks, or less for a task
+// that must not get more room than the thread that spawned it had.
+static _Thread_local RET_VAL *valueLimit;
+static _Thread_local ENV *envLimit;
+
+static _Thread_local int callDepth;
+
+// Reserves n slots on the value stack, or returns NULL if they do not fit.
+static RET_VAL *pushValues(int n)
 {
-    RET_VAL val;
-    val = node->data.number;
+    RET_VAL *values = value_stack_top;
 
-    // TODO complete the function - DONE
+    if (n > valueLimit - value_stack_top)
+    {
+        return NULL;
+    }
 
-    return val;
+    value_stack_top += n;
+    return values;
 }
 
-RET_VAL evalScopeNode(AST_NODE *node)
+static ENV *pushEnv(ENV *parent, AST_NODE *scope, RET_VAL *slots)
 {
-    RET_VAL val;
-    val = eval(node->data.scope.child);
+    if (envTop == envLimit)
+    {
+        return NULL;
+    }
 
-    return val;
+    *envTop = (ENV) {parent, scope, slots, NULL};
+    // the signal handler of --sample must not see the frame before it is there
+    atomic_signal_fence(memory_order_seq_cst);
+    return envTop++;
 }
 
-RET_VAL evalSymbolNode(AST_NODE *node)
+ENV *evalFrames(ENV **top)
 {
-    RET_VAL val;
+    *top = envTop;
+    return envStack;
+}
 
-    if (!node)
+// What an invocation of eval pops once it has its value, and still has to apply to it.
+typedef struct eval_state {
+    ENV *envBase;
+    RET_VAL *valueBase;
+    SYMBOL_TABLE_NODE *callee; // first lambda it called, whose type the result is cast to
+    bool extraParams;
+} EVAL_STATE;
+
+// Pushes the frame of the lambda called by node, with the arguments evaluated in
+// the caller's environment as its slots; eval then carries on with its body.
+// If eval already runs a lambda body, node is a tail call: everything that eval
+// pushed above the scope the callee was defined in is dead, so the new frame
+// takes its place. Returns NULL, with *val set, if the call does not happen.
+static ENV *pushCallFrame(EVAL_STATE *state, AST_NODE *node, ENV *env, RET_VAL *val)
+{
+    AST_FUNCTION *call = &node->data.function;
+    SYMBOL_TABLE_NODE *callee = call->callee;
+    AST_NODE *arg = call->opList;
+    AST_LAMBDA *lambda;
+    ENV *parent = env;
+    ENV *frame;
+    RET_VAL *args;
+    int i;
+
+    if (call->slot < 0)
     {
-        yyerror("NULL ast node passed into eval!");
-        return NAN_RET_VAL;
+        warning(">>> Function \"%s\" not found. Returning NAN.", call->name->name);
+        *val = NAN_RET_VAL;
+        return NULL;
     }
 
-    AST_NODE *evalNode = node;
-    SYMBOL_TABLE_NODE *sTN;
+    if (callee == NULL)
+    {
+        warning(">>> Symbol \"%s\" is not a function. Returning NAN.", call->name->name);
+        *val = NAN_RET_VAL;
+        return NULL;
+    }
+
+    lambda = &callee->value->data.lambda;
+
+    // the frame's parent is the scope the lambda was defined in
+    for (int depth = call->depth; depth > 0; depth--)
+    {
+        parent = parent->parent;
+    }
+
+    if ((args = pushValues(lambda->nParams)) == NULL)
+    {
+        *val = stackOverflowValue();
+        return NULL;
+    }
 
-    while (evalNode != NULL)
+    for (i = 0; i < lambda->nParams && arg != NULL; i++)
     {
-        sTN = evalNode->symbolTable;
-        while (sTN != NULL)
+        args[i] = eval(arg, env);
+        arg = arg->next;
+    }
+
+    if (i < lambda->nParams)
+    {
+        warning("Not enough parameters. Returning NAN");
+        *val = NAN_RET_VAL;
+        return NULL;
+    }
+
+    if (state->callee != NULL)
+    {
+        // resolveProgram only marks calls whose callee is defined outside the frame
+        ENV *envFloor = state->envBase;
+        RET_VAL *valueFloor = state->valueBase;
+
+        if (parent >= state->envBase && parent < envTop)
         {
-            if (strcmp(node->data.symbol.id, sTN->id) == 0)
-            {
-                val = eval(sTN->value);
-                if (sTN->value->type != NUM_NODE_TYPE)
-                {
-                    freeNode(sTN->value);
-                    sTN->value = createNumberNode(val.value, sTN->type);
-                    val.type = sTN->type;
-                }
-                return val;
-            }
-            sTN = sTN->next;
+            envFloor = parent + 1;
+            valueFloor = parent->slots + parent->scope->data.scope.nBindings;
+        }
+
+        memmove(valueFloor, args, lambda->nParams * sizeof(RET_VAL));
+        args = valueFloor;
+        value_stack_top = args + lambda->nParams;
+        envTop = envFloor;
+    }
+    else
+    {
+        state->extraParams = arg != NULL;
+        if (callDepth >= MAX_CALL_DEPTH)
+        {
+            *val = stackOverflowValue();
+            return NULL;
         }
-        evalNode = evalNode->parent;
+        callDepth++;
+        state->callee = callee;
+    }
+
+    if ((frame = pushEnv(parent, callee->value, args)) == NULL)
+    {
+        *val = stackOverflowValue();
     }
 
-    warning(">>> Symbol \"%s\" not found. Returning NAN.", node->data.symbol.id);
-    return NAN_RET_VAL;
+    return frame;
 }
 
-RET_VAL eval(AST_NODE *node)
+// The kernels below compute what the generic helpers do for operands that
+// inferProgram found to be all ints or all doubles, without looking at their types.
+// They are only picked for builtins called with the operands they take.
+
+// The operands of a variadic builtin, evaluated into consecutive slots like the
+// VM keeps them in registers, so that both reduce them alike.
+typedef struct operands {
+    RET_VAL *args;
+    int n;
+    bool heap; // the value stack was full
+} OPERANDS;
+
+// Tasks spawn tasks of their own down to this depth: enough for every thread to
+// find work when calls split unevenly, few enough that tasks stay large.
+static int maxTaskDepth;
+
+// Workers reset their value_arena when they start on a task of a newer expression
+// than the last one, whose vectors have been printed by then.
+static atomic_ulong expressionCount;
+static _Thread_local unsigned long arenaExpression;
+static _Thread_local bool worker;
+
+// What the passes, the compiler, the JIT, the kernels and value_arena keep for a
+// thread is freed when the thread exits, and when an interpreter is destroyed on
+// it; each of them allocates it again if the thread goes on. The stacks of a
+// worker of the pool go with the worker.
+static pthread_key_t threadStateKey;
+static pthread_once_t threadStateOnce = PTHREAD_ONCE_INIT;
+static bool threadStateWatched; // the key was created
+
+static void freeThreadScratch(void)
 {
-    RET_VAL val;
+    freeCseScratch();
+    freeInferScratch();
+    freeCompilerScratch();
+    jitFree();
+    freeReduceScratch();
+    arenaFree(&value_arena);
+}
 
-    if (!node)
+static void freeThreadState(void *unused)
+{
+    (void) unused;
+    freeThreadScratch();
+    if (worker)
     {
-        yyerror("NULL ast node passed into eval!");
-        return NAN_RET_VAL;
+        free(value_stack);
+        free(envStack);
+        value_stack = NULL;
+        envStack = NULL;
+    }
+}
+
+static void createThreadStateKey(void)
+{
+    threadStateWatched = pthread_key_create(&threadStateKey, freeThreadState) == 0;
+}
+
+// Has freeThreadState run when the calling thread exits.
+static void watchThread(void)
+{
+    pthread_once(&threadStateOnce, createThreadStateKey);
+    if (threadStateWatched && pthread_getspecific(threadStateKey) == NULL)
+    {
+        pthread_setspecific(threadStateKey, &threadStateKey);
     }
+}
 
-    switch (node->type)
+void initEvalThread(void)
+{
+    watchThread();
+    value_stack = malloc(VALUE_STACK_SIZE * sizeof(RET_VAL));
+    envStack = malloc(ENV_STACK_SIZE * sizeof(ENV));
+    if (value_stack == NULL || envStack == NULL)
     {
-        case FUNC_NODE_TYPE:
-            val = evalFuncNode(node);
-            break;
-        case NUM_NODE_TYPE:
-            val = evalNumNode(node);
-            break;
-        case SCOPE_NODE_TYPE:
-            val = evalScopeNode(node);
-            break;
-        case SYM_NODE_TYPE:
-            val = evalSymbolNode(node);
-            break;
-        case CONDITIONAL_NODE_TYPE:
-            val = evalConditionalFunc(node);
-            break;
+        yyerror("Memory allocation failed!");
     }
 
-    return val;
+    value_stack_top = value_stack;
+    valueLimit = value_stack + VALUE_STACK_SIZE;
+    envTop = envStack;
+    envLimit = envStack + ENV_STACK_SIZE;
+    worker = true;
 }
 
-// prints the type and value of a RET_VAL
-void printRetVal(RET_VAL val)
+static void runEvalTask(POOL_TASK *poolTask)
 {
-    switch (val.type)
+    EVAL_TASK *task = (EVAL_TASK *) poolTask;
+    EVAL_TASK *outerTask = currentTask;
+    bool *outerFailed = taskFailed;
+    int outerCallDepth = callDepth;
+    RET_VAL *outerValueLimit = valueLimit;
+    ENV *outerEnvLimit = envLimit;
+
+    if (worker && outerTask == NULL && arenaExpression != expressionCount)
     {
-        case INT_TYPE:
-            printf("Integer : %.lf\n", val.value);
-            break;
-        case DOUBLE_TYPE:
-            printf("Double : %lf\n", val.value);
-            break;
-        default:
-            printf("No Type : %lf\n", val.value);
-            break;
+        arenaReset(&value_arena);
+        arenaExpression = expressionCount;
     }
+
+    currentTask = task;
+    taskFailed = &task->failed;
+    callDepth = task->callDepth;
+    if (task->valueRoom < (size_t) (valueLimit - value_stack_top))
+    {
+        valueLimit = value_stack_top + task->valueRoom;
+    }
+    if (task->envRoom < (size_t) (envLimit - envTop))
+    {
+        envLimit = envTop + task->envRoom;
+    }
+
+    task->val = eval(task->node, task->env);
+
+    currentTask = outerTask;
+    taskFailed = outerFailed;
+    callDepth = outerCallDepth;
+    valueLimit = outerValueLimit;
+    envLimit = outerEnvLimit;
 }
 
-void freeFuncNode(AST_NODE *node)
+// Spawns the operands marked by parallelProgram and joins them. Only then are the
+// other operands evaluated, along with those whose task failed, in their order:
+// no task reads the let slots they may bind any more, and warnings and effects
+// come out as if nothing had been evaluated ahead of them.
+static void evalOperandTasks(AST_NODE *opList, ENV *env, RET_VAL *args, int n)
 {
-    freeNode(node->data.function.opList);
+    EVAL_TASK *tasks = calloc(n, sizeof(EVAL_TASK));
+    int depth = currentTask != NULL ? currentTask->depth + 1 : 1;
+    int i = 0;
+
+    if (tasks == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+
+    for (AST_NODE *op = opList; op != NULL; op = op->next, i++)
+    {
+        if (op->spawn)
+        {
+            tasks[i] = (EVAL_TASK) {
+                    .task.run = runEvalTask,
+                    .node = op,
+                    .env = env,
+                    .callDepth = callDepth,
+                    .valueRoom = valueLimit - value_stack_top,
+                    .envRoom = envLimit - envTop,
+                    .depth = depth
+            };
+            poolSpawn(&tasks[i].task);
+        }
+    }
+
+    // newest first, which this thread's deque gives back unless they were stolen
+    for (i = n; i-- > 0;)
+    {
+        if (tasks[i].node != NULL)
+        {
+            poolJoin(&tasks[i].task);
+        }
+    }
+
+    i = 0;
+    for (AST_NODE *op = opList; op != NULL; op = op->next, i++)
+    {
+        args[i] = op->spawn && !tasks[i].failed ? tasks[i].val : eval(op, env);
+    }
+
+    free(tasks);
 }
 
-void freeScopeNode(AST_NODE *node)
+static OPERANDS evalOperands(AST_NODE *opList, ENV *env)
 {
-    freeNode(node->data.scope.child);
+    OPERANDS operands = {NULL, 0, false};
+    bool spawn = false;
+
+    for (AST_NODE *op = opList; op != NULL; op = op->next)
+    {
+        operands.n++;
+        spawn = spawn || op->spawn;
+    }
+
+    // running out of stack here would turn a typed builtin into a NAN, so the heap takes over
+    if ((operands.args = pushValues(operands.n)) == NULL)
+    {
+        operands.heap = true;
+        if ((operands.args = malloc(operands.n * sizeof(RET_VAL))) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+    }
+
+    if (spawn && poolThreads() > 1 && (currentTask == NULL || currentTask->depth < maxTaskDepth))
+    {
+        evalOperandTasks(opList, env, operands.args, operands.n);
+        return operands;
+    }
+
+    for (int i = 0; opList != NULL; opList = opList->next)
+    {
+        operands.args[i++] = eval(opList, env);
+    }
+
+    return operands;
 }
 
-void freeSymbolTableNode(AST_NODE *node)
+static void releaseOperands(OPERANDS operands)
 {
-    if (!node)
+    if (operands.heap)
     {
-        return;
+        free(operands.args);
+    }
+    else
+    {
+        value_stack_top = operands.args;
     }
+}
+
+static RET_VAL evalReduction(REDUCE_OP op, AST_NODE *opList, ENV *env)
+{
+    OPERANDS operands = evalOperands(opList, env);
+    RET_VAL val = reduceValues(op, operands.args, operands.n);
 
-    free(node->data.symbol.id);
-    freeSymbolTableNode(node->next);
-    free(node);
+    releaseOperands(operands);
+    return val;
 }
 
-void freeCondNode(AST_NODE *node)
+static RET_VAL evalVector(AST_NODE *opList, ENV *env)
 {
-    freeNode(node->data.condition.condition);
-    freeNode(node->data.condition._false);
-    freeNode(node->data.condition._true);
+    OPERANDS operands = evalOperands(opList, env);
+    RET_VAL val = vectorMake(operands.args, operands.n);
+
+    releaseOperands(operands);
+    return val;
 }
 
-/*
- * NOT FUNCTIONING
- * Framework for evaluation
- */
-void freeStackNode(AST_NODE *node)
+static REDUCE_OP reduceOpOf(FUNC_TYPE func)
 {
-    if (!node) {
-        return;
+    switch (func)
+    {
+        case ADD_FUNC:
+            return REDUCE_SUM;
+        case MULT_FUNC:
+            return REDUCE_PRODUCT;
+        case MAX_FUNC:
+            return REDUCE_MAX;
+        default:
+            return REDUCE_MIN;
     }
-    free(node->next);
-    free(node);
 }
 
-void freeNode(AST_NODE *node)
+static RET_VAL evalIntFunc(AST_NODE *node, ENV *env)
 {
-    if (!node)
+    FUNC_TYPE func = node->data.function.func;
+    AST_NODE *op = node->data.function.opList;
+    OPERANDS operands;
+    int64_t val, temp;
+
+    switch (func)
     {
-        return;
+        case ABS_FUNC:
+            val = intAbs(eval(op, env).ival);
+            break;
+        case SUB_FUNC:
+        case DIV_FUNC:
+        case REM_FUNC:
+        case POW_FUNC:
+            val = eval(op, env).ival;
+            temp = eval(op->next, env).ival;
+            if (func == SUB_FUNC)
+            {
+                val = intSub(val, temp);
+            }
+            else if (func == DIV_FUNC)
+            {
+                val = intDiv(val, temp);
+            }
+            else
+            {
+                val = func == REM_FUNC ? intRem(val, temp) : intPow(val, temp);
+            }
+            break;
+        default:
+            operands = evalOperands(op, env);
+            val = reduceIntValues(reduceOpOf(func), operands.args, operands.n);
+            releaseOperands(operands);
+            break;
     }
 
-    // TODO complete the function
+    return (RET_VAL) {INT_TYPE, .ival = val};
+}
+
+static RET_VAL evalDoubleFunc(AST_NODE *node, ENV *env)
+{
+    FUNC_TYPE func = node->data.function.func;
+    AST_NODE *op = node->data.function.opList;
+    OPERANDS operands;
+    double val, temp;
+
+    switch (func)
+    {
+        case ABS_FUNC:
+            val = fabs(eval(op, env).value);
+            break;
+        case SUB_FUNC:
+        case DIV_FUNC:
+        case REM_FUNC:
+        case POW_FUNC:
+            val = eval(op, env).value;
+            temp = eval(op->next, env).value;
+            if (func == SUB_FUNC)
+            {
+                val -= temp;
+            }
+            else if (func == DIV_FUNC)
+            {
+                val /= temp;
+            }
+            else
+            {
+                val = func == REM_FUNC ? doubleRem(val, temp) : pow(val, temp);
+            }
+            break;
+        default:
+            operands = evalOperands(op, env);
+            val = reduceDoubleValues(reduceOpOf(func), operands.args, operands.n);
+            releaseOperands(operands);
+            break;
+    }
+
+    return (RET_VAL) {DOUBLE_TYPE, .value = val};
+}
+
+static int countOperands(AST_NODE *opList)
+{
+    int n = 0;
+
+    for (; opList != NULL; opList = opList->next)
+    {
+        n++;
+    }
+
+    return n;
+}
 
-    // look through the AST_NODE struct, decide what
-    // referenced data should have freeNode called on it
-    // (hint: it might be part of an s_expr_list, with more
-    // nodes following it in the list)
+static RET_VAL dispatchFuncNode(AST_NODE *node, ENV *env)
+{
+    RET_VAL val;
 
-    // if this node is FUNC_TYPE, it might have some operands
-    // to free as well (but this should probably be done in
-    // a call to another function, named something like
-    // freeFunctionNode)
+    if (!node || node == NULL)
+    {
+        yyerror("NULL AST_NODE passed into evalFuncNode!");
+        return NAN_RET_VAL; // unreachable but kills a clang-tidy warning
+    }
 
-    // and, finally,
-    freeNode(node->next);
+    switch (node->data.function.kernel)
+    {
+        case INT_KERNEL:
+            return evalIntFunc(node, env);
+        case DOUBLE_KERNEL:
+            return evalDoubleFunc(node, env);
+        case GENERIC_KERNEL:
+            break;
+    }
 
-    switch (node->type)
+    switch (node->data.function.func)
     {
-        case FUNC_NODE_TYPE:
-            freeFuncNode(node);
+        case NEG_FUNC:
+            val = evalNegFunc(node, env);
+            break;
+        case ABS_FUNC:
+            val = evalAbsFunc(node, env);
+            break;
+        case ADD_FUNC:
+            val = evalAddFunc(node, env);
+            break;
+        case SUB_FUNC:
+            val = evalSubFunc(node, env);
+            break;
+        case MULT_FUNC:
+            val = evalMultFunc(node, env);
+            break;
+        case DIV_FUNC:
+            val = evalDivFunc(node, env);
+            break;
+        case REM_FUNC:
+            val = evalRemFunc(node, env);
+            break;
+        case EXP_FUNC:
+            val = evalExpFunc(node, env);
+            break;
+        case EXP2_FUNC:
+            val = evalExp2Func(node, env);
+            break;
+        case POW_FUNC:
+            val = evalPowFunc(node, env);
+            break;
+        case LOG_FUNC:
+            val = evalLogFunc(node, env);
+            break;
+        case SQRT_FUNC:
+            val = evalSqrtFunc(node, env);
+            break;
+        case CBRT_FUNC:
+            val = evalCbrtFunc(node, env);
+            break;
+        case HYPOT_FUNC:
+            val = evalHypotFunc(node, env);
+            break;
+        case MAX_FUNC:
+            val = evalMaxFunc(node, env);
+            break;
+        case MIN_FUNC:
+            val = evalMinFunc(node, env);
+            break;
+        case EQUAL_FUNC:
+            val = evalEqualFunc(node, env);
+            break;
+        case LESS_FUNC:
+            val = evalLessFunc(node, env);
+            break;
+        case GREATER_FUNC:
+            val = evalGreaterFunc(node, env);
+            break;
+        case RAND_FUNC:
+            val = evalRandFunc();
+            break;
+        case READ_FUNC:
+            val = evalReadFunc();
+            break;
+        case PRINT_FUNC:
+            val = evalPrintFunc(node, env);
+            break;
+        case VECTOR_FUNC:
+            val = evalVectorFunc(node, env);
             break;
-        case CONDITIONAL_NODE_TYPE:
-            freeCondNode(node);
+        case SUM_FUNC:
+            val = evalSumFunc(node, env);
             break;
-        case SYM_NODE_TYPE:
-            freeSymbolTableNode(node);
+        case DOT_FUNC:
+            val = evalDotFunc(node, env);
             break;
-        case SCOPE_NODE_TYPE:
-            freeScopeNode(node);
+        case MEAN_FUNC:
+            val = evalMeanFunc(node, env);
+            break;
+        case CUSTOM_FUNC:
+            val = eval(node, env);
             break;
-        case NUM_NODE_TYPE:
         default:
             break;
     }
 
-    free(node);
-}
\ No newline at end of file
+    // TODO complete the function - DONE
+    // HINT:
+    // the helper functions that it calls will need to be defined above it
+    // because they are not declared in the .h file (and should not be)
+
+    return val;
+}
+
+// eval and its twin that profiles and traces it run the same loop, without a call
+// between them. The twins, like that of evalFuncNode, stay out of line.
+#ifdef __GNUC__
+#define EVAL_INLINE inline __attribute__((always_inline))
+#define EVAL_NOINLINE __attribute__((noinline))
+#else
+#define EVAL_INLINE inline
+#define EVAL_NOINLINE
+#endif
+
+// With --profile or --trace, the builtin at node is counted and traced as it runs.
+static EVAL_NOINLINE RET_VAL observedFuncNode(AST_NODE *node, ENV *env)
+{
+    PROFILE_SPAN span;
+    uint64_t start = 0;
+    RET_VAL val;
+
+    if (currentTimeline != NULL)
+    {
+        start = timelineNow();
+    }
+    if (currentSampler != NULL)
+    {
+        samplerCheck(currentSampler);
+        samplerBuiltin(currentSampler, node, env);
+    }
+    PROFILE_BEGIN(span, PROFILE_FUNC(node->data.function.func));
+    val = dispatchFuncNode(node, env);
+    if (currentProfile != NULL)
+    {
+        profileEnd(currentProfile, &span, countOperands(node->data.function.opList));
+    }
+    if (currentTimeline != NULL)
+    {
+        timelineBuiltin(currentTimeline, node, start);
+    }
+    return val;
+}
+
+RET_VAL evalFuncNode(AST_NODE *node, ENV *env)
+{
+    if ((currentProfile != NULL || currentTimeline != NULL) && node != NULL)
+    {
+        return observedFuncNode(node, env);
+    }
+    if (currentSampler != NULL)
+    {
+        samplerCheck(currentSampler);
+        samplerBuiltin(currentSampler, node, env);
+    }
+
+    return dispatchFuncNode(node, env);
+}
+
+
+RET_VAL evalNumNode(AST_NODE *node, ENV *env)
+{
+    RET_VAL val;
+    val = node->data.number;
+
+    // TODO complete the function - DONE
+
+    return val;
+}
+
+// The first lookup of a let binding from a task, which other tasks may look up
+// at the same time: the first one to claim the slot evaluates the value, and the
+// others fail rather than wait for it. A failed task leaves the slot unbound.
+static RET_VAL bindSlotFromTask(RET_VAL *slot, SYMBOL_TABLE_NODE *sTN, ENV *env)
+{
+    NUM_TYPE unbound = UNBOUND_TYPE;
+    RET_VAL val;
+
+    if (sTN->effects || sTN->value->type == LAMBDA_NODE_TYPE
+        || !__atomic_compare_exchange_n(&slot->type, &unbound, PENDING_TYPE, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    {
+        currentTask->failed = true;
+        return NAN_RET_VAL;
+    }
+
+    val = castBindingValue(eval(sTN->value, env), sTN->type);
+    if (currentTask->failed)
+    {
+        __atomic_store_n(&slot->type, UNBOUND_TYPE, __ATOMIC_RELEASE);
+        return NAN_RET_VAL;
+    }
+
+    // everything but the type, which publishes the value
+    memcpy(&slot->value, &val.value, sizeof(RET_VAL) - offsetof(RET_VAL, value));
+    __atomic_store_n(&slot->type, val.type, __ATOMIC_RELEASE);
+    return val;
+}
+
+RET_VAL evalSymbolNode(AST_NODE *node, ENV *env)
+{
+    RET_VAL val;
+    SYMBOL_TABLE_NODE *sTN;
+    RET_VAL *slot;
+
+    if (!node)
+    {
+        yyerror("NULL ast node passed into eval!");
+        return NAN_RET_VAL;
+    }
+
+    if (node->data.symbol.slot < 0)
+    {
+        warning(">>> Symbol \"%s\" not found. Returning NAN.", node->data.symbol.id->name);
+        return NAN_RET_VAL;
+    }
+
+    for (int depth = node->data.symbol.depth; depth > 0; depth--)
+    {
+        env = env->parent;
+    }
+    slot = &env->slots[node->data.symbol.slot];
+
+    if (currentTask != NULL)
+    {
+        NUM_TYPE type = __atomic_load_n(&slot->type, __ATOMIC_ACQUIRE);
+
+        if (type == UNBOUND_TYPE)
+        {
+            return bindSlotFromTask(slot, env->scope->data.scope.bindings[node->data.symbol.slot], env);
+        }
+        if (type == PENDING_TYPE)
+        {
+            currentTask->failed = true;
+            return NAN_RET_VAL;
+        }
+        return *slot;
+    }
+
+    if (slot->type == UNBOUND_TYPE)
+    {
+        // first lookup: evaluate the value within its own scope, then keep it
+        sTN = env->scope->data.scope.bindings[node->data.symbol.slot];
+        if (sTN->value->type == LAMBDA_NODE_TYPE)
+        {
+            warning(">>> Function \"%s\" used as a value. Returning NAN.", node->data.symbol.id->name);
+            return NAN_RET_VAL;
+        }
+        slot->type = PENDING_TYPE;
+        val = eval(sTN->value, env);
+        // untyped bindings keep the type of their value
+        *slot = castBindingValue(val, sTN->type);
+    }
+    else if (slot->type == PENDING_TYPE)
+    {
+        warning(">>> Symbol \"%s\" is defined in terms of itself. Returning NAN.", node->data.symbol.id->name);
+        return NAN_RET_VAL;
+    }
+
+    return *slot;
+}
+
+// Let bodies, cond branches and lambda bodies are evaluated by the loop below
+// rather than by recursing, so that a call in tail position of a lambda
+// (see resolveCallNode) runs in constant C and value stack space.
+static EVAL_INLINE RET_VAL evalNode(AST_NODE *node, ENV *env)
+{
+    EVAL_STATE state = {envTop, value_stack_top, NULL, false};
+    RET_VAL *slots;
+    ENV *next;
+    RET_VAL val;
+
+    if (currentTask != NULL && currentTask->failed)
+    {
+        // its value is thrown away
+        return NAN_RET_VAL;
+    }
+
+    while (true)
+    {
+        if (!node)
+        {
+            yyerror("NULL ast node passed into eval!");
+            return NAN_RET_VAL;
+        }
+
+        switch (node->type)
+        {
+            case FUNC_NODE_TYPE:
+                if (node->data.function.func != CUSTOM_FUNC)
+                {
+                    val = evalFuncNode(node, env);
+                    break;
+                }
+                if (state.callee != NULL && !node->data.function.tail)
+                {
+                    // an ordinary call within a lambda body gets an eval of its own
+                    val = eval(node, env);
+                    break;
+                }
+                if ((next = pushCallFrame(&state, node, env, &val)) == NULL)
+                {
+                    break;
+                }
+                env = next;
+                node = env->scope->data.lambda.body;
+                continue;
+            case NUM_NODE_TYPE:
+                val = evalNumNode(node, env);
+                break;
+            case SCOPE_NODE_TYPE:
+                slots = pushValues(node->data.scope.nBindings);
+                if (slots == NULL || (next = pushEnv(env, node, slots)) == NULL)
+                {
+                    val = stackOverflowValue();
+                    break;
+                }
+                for (int i = 0; i < node->data.scope.nBindings; i++)
+                {
+                    slots[i].type = UNBOUND_TYPE;
+                }
+                env = next;
+                node = node->data.scope.child;
+                continue;
+            case SYM_NODE_TYPE:
+                val = evalSymbolNode(node, env);
+                break;
+            case CONDITIONAL_NODE_TYPE:
+                node = isZero(eval(node->data.condition.condition, env)) ?
+                       node->data.condition._false :
+                       node->data.condition._true;
+                continue;
+            case LAMBDA_NODE_TYPE:
+                // lambdas only run when called
+                yyerror("LAMBDA ast node passed into eval!");
+                break;
+        }
+        break;
+    }
+
+    if (state.callee != NULL)
+    {
+        callDepth--;
+        val = castReturnValue(val, state.callee->type);
+    }
+
+    if (state.extraParams)
+    {
+        warning("Extra parameters ignored.");
+    }
+
+    envTop = state.envBase;
+    value_stack_top = state.valueBase;
+
+    return val;
+}
+
+// With --profile, each call of eval is timed as a call of the lambda or an eval
+// of the type of node it starts on; the let bodies, cond branches and tail calls
+// its loop goes on with count toward that. With --trace, the calls of lambdas
+// are spans of their own, which their tail calls are part of too.
+static EVAL_NOINLINE RET_VAL observedEval(AST_NODE *node, ENV *env)
+{
+    bool call = node->type == FUNC_NODE_TYPE && node->data.function.func == CUSTOM_FUNC;
+    PROFILE_SPAN span;
+    RET_VAL val;
+
+    if (call && currentTimeline != NULL)
+    {
+        SYMBOL_TABLE_NODE *callee = node->data.function.callee;
+
+        timelineCall(currentTimeline, node->data.function.name->name, node, callee != NULL ? callee->value : NULL);
+    }
+    PROFILE_BEGIN(span, call ? PROFILE_FUNC(CUSTOM_FUNC) : PROFILE_NODE(node->type));
+    val = evalNode(node, env);
+    if (currentProfile != NULL)
+    {
+        profileEnd(currentProfile, &span, call ? countOperands(node->data.function.opList) : -1);
+    }
+    if (call && currentTimeline != NULL)
+    {
+        timelineEnd(currentTimeline);
+    }
+
+    return val;
+}
+
+RET_VAL eval(AST_NODE *node, ENV *env)
+{
+    if ((currentProfile != NULL || currentTimeline != NULL) && node != NULL)
+    {
+        return observedEval(node, env);
+    }
+
+    return evalNode(node, env);
+}
+
+// The pool belongs to the first interpreter that runs an expression with
+// --threads, until it is destroyed: the others evaluate on their own thread,
+// which prints the same.
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static CILISP_CTX *poolOwner;
+
+static bool startPool(void)
+{
+    bool owner;
+
+    pthread_mutex_lock(&poolLock);
+    if (poolOwner == NULL)
+    {
+        poolOwner = currentContext;
+    }
+    owner = poolOwner == currentContext;
+    pthread_mutex_unlock(&poolLock);
+
+    if (!owner || poolThreads() > 1)
+    {
+        return owner;
+    }
+
+    maxTaskDepth = 4;
+    for (int n = 1; n < currentContext->options.threads; n *= 2)
+    {
+        maxTaskDepth++;
+    }
+    reduceIsa(); // picks the kernels before the workers look at them
+    poolStart(currentContext->options.threads, initEvalThread);
+    return true;
+}
+
+// Runs the passes selected in options over a top-level expression.
+static void prepareProgram(AST_NODE *node)
+{
+    CILISP_OPTIONS *options = &currentContext->options;
+
+    if (options->fold)
+    {
+        foldProgram(node);
+    }
+    resolveProgram(node);
+    if (options->cse)
+    {
+        cseProgram(node);
+    }
+    if (options->infer)
+    {
+        inferProgram(node);
+    }
+}
+
+// Evaluates a top-level expression with the strategy selected in options.
+RET_VAL evalProgram(AST_NODE *node)
+{
+    CILISP_OPTIONS *options = &currentContext->options;
+    PROFILE_SPAN span;
+    CHUNK *chunk;
+    RET_VAL val;
+
+    PROFILE_BEGIN(span, PROFILE_PREPARE);
+    prepareProgram(node);
+    PROFILE_END(span);
+    runtime->stackOverflow = false;
+    if (currentSampler != NULL)
+    {
+        // the builtins folding ran are done
+        samplerBuiltin(currentSampler, NULL, NULL);
+    }
+
+    if (options->evalMode == TREE_EVAL_MODE)
+    {
+        PROFILE_BEGIN(span, PROFILE_RUN);
+        if (options->threads > 1 && startPool())
+        {
+            parallelProgram(node);
+            expressionCount++;
+        }
+        val = eval(node, NULL);
+        PROFILE_END(span);
+        return val;
+    }
+
+    PROFILE_BEGIN(span, PROFILE_COMPILE);
+    chunk = compileProgram(node);
+    PROFILE_END(span);
+    PROFILE_BEGIN(span, PROFILE_RUN);
+    val = vmRun(chunk);
+    PROFILE_END(span);
+    return val;
+}
+
+// Evaluates and prints a top-level expression, or translates it to C with --emit-c.
+void runProgram(AST_NODE *node)
+{
+    PROFILE_SPAN span;
+    RET_VAL val;
+
+    if (currentContext->options.emit != NULL)
+    {
+        prepareProgram(node);
+        emitChunk(compileProgram(node));
+        return;
+    }
+
+    if (currentTimeline != NULL)
+    {
+        timelineExpression(currentTimeline, node);
+    }
+    if (currentSampler != NULL)
+    {
+        samplerCheck(currentSampler);
+        samplerPush(currentSampler, node);
+    }
+    val = evalProgram(node);
+    PROFILE_BEGIN(span, PROFILE_PRINT);
+    printResult(val);
+    PROFILE_END(span);
+    if (currentSampler != NULL)
+    {
+        // the samples point into the AST, which goes once this returns
+        samplerPop(currentSampler);
+        samplerCollect(currentSampler);
+    }
+    if (currentTimeline != NULL)
+    {
+        timelineEnd(currentTimeline);
+    }
+}
+
+void freeProgram(CILISP_CTX *ctx)
+{
+    PROFILE_SPAN span;
+
+    PROFILE_BEGIN(span, PROFILE_FREE);
+    arenaReset(&ctx->astArena);
+    arenaReset(&value_arena);
+    PROFILE_END(span);
+}
+
+void printStats(CILISP_CTX *ctx)
+{
+    if (ctx->profile == NULL || ctx->options.emit != NULL)
+    {
+        warning("No statistics are kept without --profile.");
+        return;
+    }
+
+    // the report is text, which goes apart from values printed as anything else
+    flushRuntime(&ctx->runtime);
+    profileReport(ctx->profile, ctx->runtime.messages != NULL ? stderr : ctx->runtime.output.file);
+}
+
+void useContext(CILISP_CTX *ctx)
+{
+    currentContext = ctx;
+    runtime = ctx != NULL ? &ctx->runtime : NULL;
+    currentProfile = ctx != NULL ? ctx->profile : NULL;
+    currentTimeline = ctx != NULL ? ctx->timeline : NULL;
+    currentSampler = ctx != NULL ? ctx->sampler : NULL;
+    if (ctx == NULL)
+    {
+        return;
+    }
+
+    watchThread();
+    value_stack = ctx->valueStack;
+    value_stack_top = value_stack;
+    valueLimit = value_stack + VALUE_STACK_SIZE;
+    envStack = ctx->envStack;
+    envTop = envStack;
+    envLimit = envStack + ENV_STACK_SIZE;
+    callDepth = 0;
+}
+
+CILISP_CTX *cilispCreate(const CILISP_OPTIONS *options, FILE *out, FILE *readTarget)
+{
+    CILISP_CTX *ctx = calloc(1, sizeof(CILISP_CTX));
+
+    if (ctx == NULL)
+    {
+        return NULL;
+    }
+
+    ctx->options = *options;
+    ctx->run = runProgram;
+    ctx->line = 1;
+    ctx->column = 1;
+    initRuntime(&ctx->runtime, out, readTarget);
+    ctx->runtime.output.doubles = options->doubles;
+    ctx->runtime.output.mode = options->output;
+    if (options->output != TEXT_OUTPUT && (ctx->runtime.messages = malloc(sizeof(OUTPUT))) != NULL)
+    {
+        outputInit(ctx->runtime.messages, stderr);
+    }
+    ctx->valueStack = malloc(VALUE_STACK_SIZE * sizeof(RET_VAL));
+    ctx->envStack = malloc(ENV_STACK_SIZE * sizeof(ENV));
+    ctx->vm = newVmStacks();
+    if (options->profile)
+    {
+        ctx->profile = profileCreate();
+    }
+    if (ctx->valueStack == NULL || ctx->envStack == NULL || ctx->vm == NULL || !initScanner(ctx) ||
+        (options->profile && ctx->profile == NULL) || (options->output != TEXT_OUTPUT && ctx->runtime.messages == NULL))
+    {
+        cilispDestroy(ctx);
+        return NULL;
+    }
+    reduceIsa(); // picks the kernels before interpreters on other threads look at them
+
+    return ctx;
+}
+
+void cilispDestroy(CILISP_CTX *ctx)
+{
+    if (ctx == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&poolLock);
+    if (poolOwner == ctx)
+    {
+        poolOwner = NULL;
+    }
+    pthread_mutex_unlock(&poolLock);
+    if (currentContext == ctx)
+    {
+        useContext(NULL);
+    }
+
+    flushRuntime(&ctx->runtime);
+    free(ctx->runtime.messages);
+    freeThreadScratch();
+    freeScanner(ctx);
+    traceFree(ctx->trace);
+    profileFree(ctx->profile);
+    timelineClose(ctx->timeline);
+    samplerFree(ctx->sampler);
+    free(ctx->pending);
+    free(ctx->valueStack);
+    free(ctx->envStack);
+    freeVmStacks(ctx->vm);
+    arenaFree(&ctx->astArena);
+    freeAtoms(&ctx->atoms);
+    free(ctx);
+}
+
+int cilispFlush(CILISP_CTX *ctx)
+{
+    return flushRuntime(&ctx->runtime);
+}
+
+// Runs parse on text, len bytes ending with the two NULs flex wants, and returns
+// the status it leaves, with the scanner and the arenas reset after an error.
+static CILISP_STATUS evalText(CILISP_CTX *ctx, void (*parse)(CILISP_CTX *, char *, size_t), char *text, size_t len)
+{
+    jmp_buf onError;
+    PROFILE_SPAN span;
+
+    useContext(ctx);
+    ctx->runtime.status = CILISP_OK;
+    ctx->runtime.onError = &onError;
+    if (setjmp(onError) == 0)
+    {
+        PROFILE_BEGIN(span, PROFILE_PARSE);
+        parse(ctx, text, len);
+        PROFILE_END(span);
+    }
+    else
+    {
+        // the expression that failed counts as done; the scanner and the parser may
+        // have been in the middle of the text
+        ctx->runtime.expression++;
+        freeScanner(ctx);
+        initScanner(ctx);
+        if (ctx->sampler != NULL)
+        {
+            samplerAbort(ctx->sampler);
+        }
+        arenaReset(&ctx->astArena);
+        arenaReset(&value_arena);
+        if (ctx->profile != NULL)
+        {
+            profileAbort(ctx->profile);
+        }
+        if (ctx->timeline != NULL)
+        {
+            timelineAbort(ctx->timeline);
+        }
+    }
+    ctx->runtime.onError = NULL;
+    useContext(NULL);
+
+    return ctx->runtime.status;
+}
+
+CILISP_STATUS cilispEval(CILISP_CTX *ctx, const char *line)
+{
+    size_t len = strcspn(line, "\n\xff");
+    CILISP_STATUS status;
+    char *text;
+
+    if (ctx->scanner == NULL)
+    {
+        return CILISP_ERROR;
+    }
+
+    // flex wants two NULs after the text, which the grammar wants to end with
+    // a newline or the end of the input
+    if ((text = malloc(len + 3)) == NULL)
+    {
+        return CILISP_ERROR;
+    }
+    memcpy(text, line, len);
+    text[len] = line[len] == '\xff' ? '\xff' : '\n';
+    text[len + 1] = '\0';
+    text[len + 2] = '\0';
+
+    status = evalText(ctx, parseLine, text, len + 3);
+    free(text);
+
+    return status;
+}
+
+// Whether a token may end before c: tokens are made of letters, digits, '.', '+'
+// and '-', or are a single character.
+static bool endsToken(char c)
+{
+    return !isalnum((unsigned char) c) && c != '_' && c != '$' && c != '.' && c != '+' && c != '-';
+}
+
+int cilispDepth(int depth, const char *text, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (text[i] == '(' || text[i] == '[')
+        {
+            depth++;
+        }
+        else if ((text[i] == ')' || text[i] == ']') && depth > 0)
+        {
+            depth--;
+        }
+    }
+
+    return depth;
+}
+
+CILISP_STATUS cilispPush(CILISP_CTX *ctx, const char *data, size_t len)
+{
+    CILISP_STATUS status;
+    size_t end;
+    char saved[2];
+
+    if (ctx->scanner == NULL)
+    {
+        return CILISP_ERROR;
+    }
+
+    // room for the data, the end of the input, and the two NULs flex wants
+    if (ctx->pendingLen + len + 3 > ctx->pendingCap)
+    {
+        size_t cap = ctx->pendingCap ? ctx->pendingCap : 256;
+        char *pending;
+
+        while (ctx->pendingLen + len + 3 > cap)
+        {
+            cap *= 2;
+        }
+        if ((pending = realloc(ctx->pending, cap)) == NULL)
+        {
+            return CILISP_ERROR;
+        }
+        ctx->pending = pending;
+        ctx->pendingCap = cap;
+    }
+
+    if (data != NULL)
+    {
+        memcpy(ctx->pending + ctx->pendingLen, data, len);
+        ctx->pendingLen += len;
+        // scan up to the last character that ends a token, keeping the rest for later
+        for (end = ctx->pendingLen; end > 0 && !endsToken(ctx->pending[end - 1]); end--);
+    }
+    else
+    {
+        ctx->pending[ctx->pendingLen++] = '\xff';
+        end = ctx->pendingLen;
+    }
+    if (end == 0)
+    {
+        return CILISP_OK;
+    }
+
+    memcpy(saved, ctx->pending + end, 2);
+    ctx->pending[end] = '\0';
+    ctx->pending[end + 1] = '\0';
+    status = evalText(ctx, pushTokens, ctx->pending, end + 2);
+    memcpy(ctx->pending + end, saved, 2);
+
+    if (status == CILISP_SYNTAX_ERROR || status == CILISP_ERROR)
+    {
+        ctx->pendingLen = 0;
+    }
+    else
+    {
+        memmove(ctx->pending, ctx->pending + end, ctx->pendingLen - end);
+        ctx->pendingLen -= end;
+    }
+
+    return status;
+}
+
+CILISP_STATUS cilispEvalBuffer(CILISP_CTX *ctx, char *buffer, size_t len)
+{
+    if (ctx->scanner == NULL || len < 3 || buffer[len - 3] != '\xff' || buffer[len - 2] != '\0' || buffer[len - 1] != '\0')
+    {
+        return CILISP_ERROR;
+    }
+
+    return evalText(ctx, parseBuffer, buffer, len);
+}
+
+// Strips recognized "--" options out of argv and returns the new argc,
+// so the positional arguments (input file, read target) keep their indices.
+int parseOptions(int argc, char **argv, CILISP_OPTIONS *options)
+{
+    int positional = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--eval") == 0)
+        {
+            options->evalMode = TREE_EVAL_MODE;
+        }
+        else if (strcmp(argv[i], "--vm") == 0)
+        {
+            options->evalMode = VM_EVAL_MODE;
+        }
+        else if (strcmp(argv[i], "--fold") == 0)
+        {
+            options->fold = true;
+        }
+        else if (strcmp(argv[i], "--no-fold") == 0)
+        {
+            options->fold = false;
+        }
+        else if (strcmp(argv[i], "--cse") == 0)
+        {
+            options->cse = true;
+        }
+        else if (strcmp(argv[i], "--no-cse") == 0)
+        {
+            options->cse = false;
+        }
+        else if (strcmp(argv[i], "--infer") == 0)
+        {
+            options->infer = true;
+        }
+        else if (strcmp(argv[i], "--no-infer") == 0)
+        {
+            options->infer = false;
+        }
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+        {
+            int threads = atoi(argv[i] + 10);
+
+            if (threads < 1 || threads > MAX_THREADS)
+            {
+                warning("Invalid thread count \"%s\" ignored.", argv[i] + 10);
+            }
+            else
+            {
+                options->threads = threads;
+            }
+        }
+        else if (strcmp(argv[i], "--jit") == 0)
+        {
+            options->jit = JIT_DEFAULT_THRESHOLD;
+        }
+        else if (strncmp(argv[i], "--jit=", 6) == 0)
+        {
+            char *end;
+            long calls = strtol(argv[i] + 6, &end, 10);
+
+            if (end == argv[i] + 6 || *end != '\0' || calls < 0 || calls > INT32_MAX - 1)
+            {
+                warning("Invalid JIT threshold \"%s\" ignored.", argv[i] + 6);
+            }
+            else
+            {
+                options->jit = (int) calls;
+            }
+        }
+        else if (strcmp(argv[i], "--no-jit") == 0)
+        {
+            options->jit = -1;
+        }
+        else if (strcmp(argv[i], "--batch") == 0)
+        {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+            options->batch = cpus < 1 ? 1 : cpus > MAX_THREADS ? MAX_THREADS : (int) cpus;
+        }
+        else if (strncmp(argv[i], "--batch=", 8) == 0)
+        {
+            int threads = atoi(argv[i] + 8);
+
+            if (threads < 1 || threads > MAX_THREADS)
+            {
+                warning("Invalid thread count \"%s\" ignored.", argv[i] + 8);
+            }
+            else
+            {
+                options->batch = threads;
+            }
+        }
+        else if (strcmp(argv[i], "--script") == 0)
+        {
+            options->script = true;
+        }
+        else if (strcmp(argv[i], "--parse-trace") == 0 || strncmp(argv[i], "--parse-trace=", 14) == 0)
+        {
+#ifdef CILISP_TRACE
+            options->parseTrace = argv[i][13] == '=' && argv[i][14] != '\0' ? argv[i] + 14 : "cilisp.trace";
+#else
+            warning("Tracing is not compiled in (see CILISP_TRACE); \"%s\" ignored.", argv[i]);
+#endif
+        }
+        else if (strcmp(argv[i], "--profile") == 0)
+        {
+            options->profile = true;
+        }
+        else if (strcmp(argv[i], "--trace") == 0 || (strncmp(argv[i], "--trace=", 8) == 0 && argv[i][8] != '\0'))
+        {
+            options->timeline = argv[i][7] == '=' ? argv[i] + 8 : "cilisp-trace.json";
+        }
+        else if (strncmp(argv[i], "--trace-threshold=", 18) == 0)
+        {
+            char *end;
+            long threshold = strtol(argv[i] + 18, &end, 10);
+
+            if (end == argv[i] + 18 || *end != '\0' || threshold < 0 || threshold > INT32_MAX)
+            {
+                warning("Invalid trace threshold \"%s\" ignored.", argv[i] + 18);
+            }
+            else
+            {
+                options->timelineThreshold = (int) threshold;
+            }
+        }
+        else if (strcmp(argv[i], "--sample") == 0 || (strncmp(argv[i], "--sample=", 9) == 0 && argv[i][9] != '\0'))
+        {
+#if SAMPLER_AVAILABLE
+            options->sample = argv[i][8] == '=' ? argv[i] + 9 : "cilisp.folded";
+#else
+            warning("Sampling needs the POSIX profiling timer; \"%s\" ignored.", argv[i]);
+#endif
+        }
+        else if (strncmp(argv[i], "--sample-rate=", 14) == 0)
+        {
+            char *end;
+            long rate = strtol(argv[i] + 14, &end, 10);
+
+            if (end == argv[i] + 14 || *end != '\0' || rate < 1 || rate > 10000)
+            {
+                warning("Invalid sample rate \"%s\" ignored.", argv[i] + 14);
+            }
+            else
+            {
+                options->sampleRate = (int) rate;
+            }
+        }
+        else if (strncmp(argv[i], "--doubles=", 10) == 0)
+        {
+            if (strcmp(argv[i] + 10, "fixed") == 0)
+            {
+                options->doubles = FIXED_DOUBLES;
+            }
+            else if (strcmp(argv[i] + 10, "shortest") == 0)
+            {
+                options->doubles = SHORTEST_DOUBLES;
+            }
+            else
+            {
+                warning("Invalid double format \"%s\" ignored.", argv[i] + 10);
+            }
+        }
+        else if (strncmp(argv[i], "--output=", 9) == 0)
+        {
+            if (strcmp(argv[i] + 9, "text") == 0)
+            {
+                options->output = TEXT_OUTPUT;
+            }
+            else if (strcmp(argv[i] + 9, "jsonl") == 0)
+            {
+                options->output = JSONL_OUTPUT;
+            }
+            else if (strcmp(argv[i] + 9, "binary") == 0)
+            {
+                options->output = BINARY_OUTPUT;
+            }
+            else
+            {
+                warning("Invalid output mode \"%s\" ignored.", argv[i] + 9);
+            }
+        }
+        else if (strcmp(argv[i], "--emit-c") == 0)
+        {
+            options->emit = "-";
+        }
+        else if (strncmp(argv[i], "--emit-c=", 9) == 0 && argv[i][9] != '\0')
+        {
+            options->emit = argv[i] + 9;
+        }
+        else if (strncmp(argv[i], "--", 2) == 0)
+        {
+            warning("Unknown option \"%s\" ignored.", argv[i]);
+        }
+        else
+        {
+            argv[positional++] = argv[i];
+        }
+    }
+
+    argv[positional] = NULL;
+    if (options->threads > 1 && options->evalMode != TREE_EVAL_MODE)
+    {
+        warning("--threads spreads the operands of the tree walker of --eval; ignored without it.");
+        options->threads = 1;
+    }
+    if (options->profile && options->batch > 0)
+    {
+        warning("--profile counts what one interpreter does; --batch ignored.");
+        options->batch = 0;
+    }
+    if (options->timeline != NULL && options->batch > 0)
+    {
+        warning("--trace follows what one interpreter does; --batch ignored.");
+        options->batch = 0;
+    }
+    if (options->sample != NULL && options->batch > 0)
+    {
+        warning("--sample follows what one interpreter does; --batch ignored.");
+        options->batch = 0;
+    }
+    if (options->emit != NULL && options->output != TEXT_OUTPUT)
+    {
+        warning("--emit-c translates the program to C, whose values print as text; --output ignored.");
+        options->output = TEXT_OUTPUT;
+    }
+    if (options->output != TEXT_OUTPUT)
+    {
+        // a program reads the values, which prompts and the echo would get in the way of
+        options->script = true;
+        sendMessagesApart();
+    }
+    if (options->emit != NULL)
+    {
+        startEmit(options->emit, options->doubles);
+    }
+    return positional;
+}
+
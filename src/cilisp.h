@@ -1,29 +1,11 @@
 #ifndef __cilisp_h_
 #define __cilisp_h_
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <stdarg.h>
-#include <string.h>
-#include <math.h>
-#include <stdbool.h>
+#include "runtime.h"
 #include "parser.h"
+#include "trace.h"
 
 
-#define NAN_RET_VAL (RET_VAL){DOUBLE_TYPE, NAN}
-#define ZERO_RET_VAL (RET_VAL){INT_TYPE, 0}
-
-
-#define BISON_FLEX_LOG_PATH "../src/bison-flex-output/bison_flex_log"
-FILE* read_target;
-FILE* flex_bison_log_file;
-
-
-int yyparse(void);
-int yylex(void);
-void yyerror(char *, ...);
-void warning(char*, ...);
-
 typedef enum func_type {
     NEG_FUNC,
     ABS_FUNC,
@@ -47,30 +29,58 @@ typedef enum func_type {
     RAND_FUNC,
     READ_FUNC,
     PRINT_FUNC,
+    VECTOR_FUNC,
+    SUM_FUNC,
+    DOT_FUNC,
+    MEAN_FUNC,
     // TODO complete the enum
     CUSTOM_FUNC
 } FUNC_TYPE;
 
-FUNC_TYPE resolveFunc(char *);
+// An interned identifier; see intern() in atom.c.
+// Builtin function and type names are interned up front with func/type set.
+typedef struct atom {
+    struct atom *next;
+    FUNC_TYPE func;
+    NUM_TYPE type;
+    struct scope_binding *binding; // innermost let binding while resolving
+    char name[];
+} ATOM;
 
-typedef enum num_type {
-    INT_TYPE,
-    DOUBLE_TYPE,
-    NO_TYPE
-} NUM_TYPE;
+// Every distinct name is stored once per interpreter, see atom.c.
+typedef struct atom_table {
+    ATOM **buckets;
+    size_t bucketCount;
+    size_t atomCount;
+    ARENA arena;
+} ATOM_TABLE;
 
+ATOM *intern(const char *name);
+void freeAtoms(ATOM_TABLE *atoms);
+FUNC_TYPE resolveFunc(char *);
+const char *funcName(FUNC_TYPE func); // of a builtin
 NUM_TYPE resolveType(char *);
 
-typedef struct {
-    NUM_TYPE type;
-    double value;
-} AST_NUMBER;
-
-typedef AST_NUMBER RET_VAL;
+// Which evaluator a builtin runs with. inferProgram picks INT_KERNEL or DOUBLE_KERNEL
+// when all operands are known to have that type, so the result type needs no checks.
+typedef enum kernel {
+    GENERIC_KERNEL,
+    INT_KERNEL,
+    DOUBLE_KERNEL
+} KERNEL;
 
+// For CUSTOM_FUNC calls, name is the called symbol; resolveProgram sets depth and
+// slot like for an AST_SYMBOL, callee to its binding if that is a lambda, and tail
+// if the call can replace the frame of the lambda it is the result of.
 typedef struct ast_function {
     FUNC_TYPE func;
     struct ast_node *opList;
+    ATOM *name;
+    int depth;
+    int slot;
+    struct symbol_table_node *callee;
+    bool tail;
+    KERNEL kernel;
 } AST_FUNCTION;
 
 typedef enum ast_node_type {
@@ -78,15 +88,24 @@ typedef enum ast_node_type {
     FUNC_NODE_TYPE,
     SYM_NODE_TYPE,
     SCOPE_NODE_TYPE,
-    CONDITIONAL_NODE_TYPE
+    CONDITIONAL_NODE_TYPE,
+    LAMBDA_NODE_TYPE
 } AST_NODE_TYPE;
 
+// depth counts the let scopes and lambda frames between the symbol and its binding,
+// slot is the binding's index in that scope; both are filled in by resolveProgram.
 typedef struct {
-    char* id;
+    ATOM *id;
+    int depth;
+    int slot;
 } AST_SYMBOL;
 
+// bindings holds the child's symbol table as an array indexed by slot,
+// without duplicates; it is filled in by resolveProgram.
 typedef struct {
     struct ast_node *child;
+    struct symbol_table_node **bindings;
+    int nBindings;
 } AST_SCOPE ;
 
 typedef struct condition {
@@ -95,6 +114,26 @@ typedef struct condition {
     struct ast_node *_false;
 } AST_CONDITION;
 
+// The value of a let binding defined with lambda.
+// A call runs body in a frame whose slots are the nParams arguments.
+// paramTypes is the type of the arguments of every call, filled in by inferProgram.
+typedef struct {
+    struct symbol_table_node *params;
+    int nParams;
+    struct ast_node *body;
+    NUM_TYPE *paramTypes;
+} AST_LAMBDA;
+
+// Where a node is in the input, from its first character to its last, by line
+// and column counted from 1 as the scanner reads the input; all 0 for the nodes
+// the passes make.
+typedef struct source_location {
+    int firstLine;
+    int firstColumn;
+    int lastLine;
+    int lastColumn;
+} SOURCE_LOCATION;
+
 typedef struct ast_node {
     AST_NODE_TYPE type;
     struct ast_node *parent;
@@ -105,31 +144,204 @@ typedef struct ast_node {
         AST_SYMBOL symbol;
         AST_SCOPE scope;
         AST_CONDITION condition;
+        AST_LAMBDA lambda;
     } data;
     struct ast_node *next;
+    bool spawn; // evaluated as a task of the pool by its variadic builtin, see parallel.c
+    SOURCE_LOCATION location;
 } AST_NODE;
 
+// effects is set by parallelProgram if evaluating value, or calling it for a
+// lambda, may run rand, read or print.
 typedef struct symbol_table_node {
-    char *id;
+    ATOM *id;
     NUM_TYPE type;
     AST_NODE *value;
     struct symbol_table_node *next;
+    bool effects;
 } SYMBOL_TABLE_NODE ;
 
-AST_NODE *createNumberNode(double value, NUM_TYPE type);
+AST_NODE *createNumberNode(AST_NUMBER number);
+AST_NODE *createVectorNode(AST_NODE *numbers);
 AST_NODE *createFunctionNode(FUNC_TYPE func, AST_NODE *opList);
+AST_NODE *createCustomFunctionNode(ATOM *name, AST_NODE *opList);
+AST_NODE *createLambdaNode(SYMBOL_TABLE_NODE *params, AST_NODE *body);
 AST_NODE *createScopeNode(SYMBOL_TABLE_NODE *symbolTable, AST_NODE *scopeList);
-SYMBOL_TABLE_NODE *createSymbolNode_I(char *id, AST_NODE *scopeList);
-SYMBOL_TABLE_NODE *createSymbolNode_T(char *type, char *id, AST_NODE *scopeList);
-AST_NODE *createSymbolNode_U(char *id);
+SYMBOL_TABLE_NODE *createSymbolNode_I(ATOM *id, AST_NODE *scopeList);
+SYMBOL_TABLE_NODE *createSymbolNode_T(ATOM *type, ATOM *id, AST_NODE *scopeList);
+AST_NODE *createSymbolNode_U(ATOM *id);
 AST_NODE *createCondNode(AST_NODE *cond, AST_NODE *_true, AST_NODE *_false);
 SYMBOL_TABLE_NODE *storeSymbolTableNode(SYMBOL_TABLE_NODE *newSymbol, SYMBOL_TABLE_NODE *symbolList);
 AST_NODE *addExpressionToList(AST_NODE *newExpr, AST_NODE *exprList);
+AST_NODE *reverseExpressionList(AST_NODE *exprList);
+// gives a node the parser has just made the location of its rule, and returns it
+AST_NODE *locateNode(AST_NODE *node, YYLTYPE location);
+
+// Runtime frame of a let scope, with one slot per binding, or of a lambda call,
+// with one slot per argument. Let slots start out UNBOUND_TYPE and are evaluated
+// on their first lookup.
+typedef struct env {
+    struct env *parent;
+    AST_NODE *scope;
+    RET_VAL *slots;
+    AST_NODE *current; // the builtin last started in it, kept for --sample, see sampler.h
+} ENV;
+
+// The frames the tree walker is in on this thread, from the outermost one up to
+// *top, which the signal handler of --sample reads.
+ENV *evalFrames(ENV **top);
+
+// Both evaluation modes keep let slots and call frames on this stack of
+// VALUE_STACK_SIZE values, and push or pop a frame by moving value_stack_top.
+// It is the stack of the interpreter this thread runs, see useContext, and every
+// thread evaluating operands for the tree walker has a stack of its own.
+extern _Thread_local RET_VAL *value_stack;
+extern _Thread_local RET_VAL *value_stack_top;
+
+// A builtin without effects called with the operand count its eval helper uses,
+// so that evaluating it never warns. See fold.c.
+bool isPureBuiltin(AST_NODE *node);
+
+void foldProgram(AST_NODE *node);
+void resolveProgram(AST_NODE *node);
+void cseProgram(AST_NODE *node);
+void inferProgram(AST_NODE *node);
+void parallelProgram(AST_NODE *node);
+// free the tables cseProgram and inferProgram keep for the calling thread, which
+// they allocate again if it runs them again
+void freeCseScratch(void);
+void freeInferScratch(void);
+
+RET_VAL eval(AST_NODE *node, ENV *env);
+RET_VAL evalFuncNode(AST_NODE *node, ENV *env);
+RET_VAL evalProgram(AST_NODE *node);
+void runProgram(AST_NODE *node);
+
+// gives a worker of the pool the stacks and arena eval needs
+void initEvalThread(void);
+
+// Evaluation strategy for top-level expressions.
+// VM_EVAL_MODE compiles each expression to bytecode (see vm.h);
+// TREE_EVAL_MODE is the reference tree walker (eval).
+typedef enum eval_mode {
+    VM_EVAL_MODE,
+    TREE_EVAL_MODE
+} EVAL_MODE;
+
+typedef struct cilisp_options {
+    EVAL_MODE evalMode;
+    bool fold;  // run foldProgram on each expression
+    bool cse;   // run cseProgram on each expression
+    bool infer; // run inferProgram on each expression
+    int threads; // threads evaluating operands in TREE_EVAL_MODE, see parallel.c
+    int jit;    // calls to a lambda before the VM compiles it to machine code, -1 for never, see jit.h
+    char *emit; // file --emit-c writes the program translated to C to instead of running it, "-" for stdout
+    int batch;  // threads evaluating the lines of an input file at once, 0 for one line at a time, see batch.h
+    bool script; // run the input without prompts or echo, mapped whole into memory if it can be
+    char *parseTrace; // file the tokens and reductions of the input are dumped to at exit, see trace.h
+    bool profile; // count and time the stages, builtins and node types, see profile.h
+    char *timeline; // file --trace writes the spans of the run to as Chrome trace events, see timeline.h
+    int timelineThreshold; // microseconds a builtin takes before --trace records it
+    char *sample; // file --sample writes the folded stacks of its samples to, see sampler.h
+    int sampleRate; // samples per second of CPU time --sample takes
+    DOUBLE_FORMAT doubles; // how values print doubles, see output.h
+    OUTPUT_MODE output; // how values print, and where the messages go, see output.h
+} CILISP_OPTIONS;
+
+#define MAX_THREADS 256
+
+extern const CILISP_OPTIONS defaultOptions;
+
+int parseOptions(int argc, char **argv, CILISP_OPTIONS *options);
+
+// An interpreter, which owns all the state parsing and evaluating lines takes,
+// so that several of them can run at once on different threads. Each one runs
+// on one thread at a time. The passes and the compiler keep scratch space per
+// thread, reused by every interpreter the thread runs.
+typedef struct cilisp_ctx {
+    RUNTIME runtime;
+    CILISP_OPTIONS options;
+    TRACE_RING *trace; // where the scanner and the parser record their steps, if anywhere, see trace.h
+    void (*run)(AST_NODE *node); // what the parser does with each top-level expression, runProgram by default
+    struct profile *profile; // the counters of --profile, if it keeps them, see profile.h
+    struct timeline *timeline; // where --trace writes the spans of the run, if anywhere, see timeline.h
+    struct sampler *sampler; // what --sample takes its samples with, if anything, see sampler.h
+    void *scanner;
+    yypstate *parser;
+    int depth;    // brackets the scanner is in, inside which newlines do not end an expression
+    int line;     // where the scanner is in the input, counted from 1, see locateToken
+    int column;
+    // What cilispPush has not scanned yet: the start of a token cut off at the
+    // end of the last piece of input.
+    char *pending;
+    size_t pendingLen;
+    size_t pendingCap;
+    // Owns the AST, symbol tables and lexer strings of the expression being evaluated.
+    // Reset in one go, along with value_arena, once its result has been printed.
+    ARENA astArena;
+    ATOM_TABLE atoms;
+    RET_VAL *valueStack;
+    ENV *envStack;
+    struct vm_stacks *vm;
+} CILISP_CTX;
+
+// The interpreter this thread is running, set by useContext.
+extern _Thread_local CILISP_CTX *currentContext;
+
+// Creates an interpreter with a copy of options, which prints to out and reads
+// the values of (read) from readTarget, or returns NULL if memory runs out.
+CILISP_CTX *cilispCreate(const CILISP_OPTIONS *options, FILE *out, FILE *readTarget);
+// Flushes what the interpreter has printed, and frees it.
+void cilispDestroy(CILISP_CTX *ctx);
+// Writes what the interpreter has printed so far to out and flushes it, and its
+// messages to stderr when options->output has them go apart. It is buffered
+// otherwise, but before reading values from stdin and after errors. Returns 0,
+// or -1 if writing has failed.
+int cilispFlush(CILISP_CTX *ctx);
+
+// Parses and runs one line of input, a top-level expression, and prints what it
+// evaluates to. The line ends at the first NUL, a newline, or the byte 0xff that
+// stands for the end of the input. Returns CILISP_QUIT for quit or the end of
+// the input; after an error the interpreter can go on with the next line.
+CILISP_STATUS cilispEval(CILISP_CTX *ctx, const char *line);
+
+// Feeds the next len bytes of an input to the parser, which runs each expression
+// as soon as it ends: with the newline after it, or with the end of the input,
+// which data == NULL stands for. Expressions may go on over several lines, and
+// over several calls, inside their brackets. Only the start of a token cut off at
+// the end of data is kept, however long the lines are. Returns CILISP_QUIT for
+// quit or the end of the input, and after an error drops the rest of what it got.
+CILISP_STATUS cilispPush(CILISP_CTX *ctx, const char *data, size_t len);
+
+// The brackets left open after len bytes of text, starting with depth open, as
+// the scanner counts them: a newline ends an expression only outside brackets.
+// For readers that split an input into expressions before it is parsed.
+int cilispDepth(int depth, const char *text, size_t len);
+
+// Parses and runs the expressions of a whole input one after another, printing
+// what each one evaluates to, until one quits or fails or the input ends. buffer
+// holds the input followed by the byte 0xff and two NULs, len bytes in all, and
+// is scanned in place, so it must be writable.
+CILISP_STATUS cilispEvalBuffer(CILISP_CTX *ctx, char *buffer, size_t len);
 
-RET_VAL eval(AST_NODE *node);
+// Makes ctx the interpreter this thread evaluates for, with empty stacks, as
+// cilispEval does; for code that builds and evaluates ASTs itself.
+void useContext(CILISP_CTX *ctx);
 
-void printRetVal(RET_VAL val);
+// Frees the AST and the values of the expression the parser has just run.
+void freeProgram(CILISP_CTX *ctx);
+// (stats): prints the counters of --profile so far.
+void printStats(CILISP_CTX *ctx);
 
-void freeNode(AST_NODE *node);
+// parse a line of input, a whole input, or a piece of one for cilispPush,
+// padded with two NULs for flex, see cilisp.l
+void parseLine(CILISP_CTX *ctx, char *text, size_t len);
+void parseBuffer(CILISP_CTX *ctx, char *text, size_t len);
+void pushTokens(CILISP_CTX *ctx, char *text, size_t len);
+// scans text, padded as for parseLine, without parsing it, and returns how many
+// tokens it holds; for cilisp_bench to time the scanner alone
+size_t scanTokens(CILISP_CTX *ctx, char *text, size_t len);
+bool initScanner(CILISP_CTX *ctx);
+void freeScanner(CILISP_CTX *ctx);
 
 #endif
\ No newline at end of file
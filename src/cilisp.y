@@ -1,25 +1,39 @@
+%code requires {
+    struct cilisp_ctx;
+}
+
  %{
     #include "cilisp.h"
-    #define ylog(r, p) {fprintf(flex_bison_log_file, "BISON: %s ::= %s \n", #r, #p); fflush(flex_bison_log_file);}
-    int yylex();
-    void yyerror(char*, ...);
+    #define ylog(r, p) TRACE_RULE(ctx->trace, #r, #p)
+    int yylex(YYSTYPE *lval, YYLTYPE *lloc, void *scanner);
+    // bison reports syntax errors with the location and the parameters of yyparse;
+    // the message leaves the location out, as --batch parses each line on its own
+    #define yyerror(loc, scanner, ctx, message) ((void) (loc), syntaxError(message))
 %}
 
+%define api.pure full
+%define api.push-pull both
+%locations
+%lex-param {void *scanner}
+%parse-param {void *scanner} {struct cilisp_ctx *ctx}
+
 %union {
     double dval;
+    int64_t lval;
     int ival;
-    char* sval;
-    char* tval;
+    struct atom *atom;
     struct ast_node *astNode;
+    struct symbol_table_node *symNode;
 };
 
 %token <ival> FUNC
-%token <dval> INT DOUBLE
-%token <sval> SYMBOL
-%token <tval> TYPE
-%token QUIT EOL EOFT LPAREN RPAREN LET COND
+%token <lval> INT
+%token <dval> DOUBLE
+%token <atom> SYMBOL TYPE
+%token QUIT STATS EOL EOFT LPAREN RPAREN LBRACKET RBRACKET LET COND LAMBDA
 
-%type <astNode> s_expr s_expr_section s_expr_list f_expr let_section let_list let_elem number
+%type <astNode> s_expr s_expr_section s_expr_list f_expr number vector number_list
+%type <symNode> let_section let_list let_elem arg_list
 
 %%
 
@@ -27,18 +41,27 @@ program:
     s_expr EOL {
         ylog(program, s_expr EOL);
         if ($1) {
-            printRetVal(eval($1));
-            freeNode($1);
+            ctx->run($1);
         }
+        freeProgram(ctx);
         YYACCEPT;
     }
     | s_expr EOFT {
         ylog(program, s_expr EOFT);
         if ($1) {
-            printRetVal(eval($1));
-            freeNode($1);
+            ctx->run($1);
         }
-        exit(EXIT_SUCCESS);
+        ctx->runtime.status = CILISP_QUIT;
+        YYACCEPT;
+    }
+    | stats EOL {
+        ylog(program, stats EOL);
+        YYACCEPT;
+    }
+    | stats EOFT {
+        ylog(program, stats EOFT);
+        ctx->runtime.status = CILISP_QUIT;
+        YYACCEPT;
     }
     | EOL {
         ylog(program, EOL);
@@ -46,19 +69,30 @@ program:
     }
     | EOFT {
         ylog(program, EOFT);
-        exit(EXIT_SUCCESS);
+        ctx->runtime.status = CILISP_QUIT;
+        YYACCEPT;
     };
 
+stats:
+    LPAREN STATS RPAREN {
+        ylog(stats, LPAREN STATS RPAREN);
+        printStats(ctx);
+    };
 
 s_expr:
     QUIT {
         ylog(s_expr, QUIT);
-        exit(EXIT_SUCCESS);
+        ctx->runtime.status = CILISP_QUIT;
+        YYACCEPT;
     }
     | number {
         ylog(s_expr, number);
         $$ = $1;
     }
+    | vector {
+        ylog(s_expr, vector);
+        $$ = $1;
+    }
     | f_expr {
         ylog(s_expr, f_expr);
         $$ = $1;
@@ -66,21 +100,21 @@ s_expr:
     | LPAREN let_section s_expr RPAREN
     {
         ylog(s_expr, let_section s_expr);
-        $$ = createScopeNode($2, $3);
+        $$ = locateNode(createScopeNode($2, $3), @$);
     }
     | LPAREN COND s_expr s_expr s_expr RPAREN
     {
         ylog(s_expr, COND s_expr s_expr s_expr);
-        $$ = createCondNode($3, $4, $5);
+        $$ = locateNode(createCondNode($3, $4, $5), @$);
     }
     | SYMBOL
     {
         ylog(s_expr, symbol);
-        $$ = createSymbolNode_U($1);
+        $$ = locateNode(createSymbolNode_U($1), @$);
     }
     | error {
         ylog(s_expr, error);
-        yyerror("unexpected token");
+        syntaxError("unexpected token");
         $$ = NULL;
     };
 
@@ -113,13 +147,40 @@ let_elem:
     {
         ylog(let_elem, TYPE SYMBOL s_expr);
         $$ = createSymbolNode_T($2, $3, $4);
+    }
+    | LPAREN SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN
+    {
+        ylog(let_elem, SYMBOL LAMBDA arg_list s_expr);
+        $$ = createSymbolNode_I($2, locateNode(createLambdaNode($5, $7), @$));
+    }
+    | LPAREN TYPE SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN
+    {
+        ylog(let_elem, TYPE SYMBOL LAMBDA arg_list s_expr);
+        $$ = createSymbolNode_T($2, $3, locateNode(createLambdaNode($6, $8), @$));
+    };
+
+arg_list:
+    SYMBOL arg_list
+    {
+        ylog(arg_list, SYMBOL arg_list);
+        $$ = storeSymbolTableNode(createSymbolNode_I($1, NULL), $2);
+    }
+    |
+    {
+        ylog(arg_list, <empty>);
+        $$ = NULL;
     };
 
 f_expr:
     LPAREN FUNC s_expr_section RPAREN
     {
         ylog(f_expr, s_expr_section);
-        $$ = createFunctionNode($2, $3);
+        $$ = locateNode(createFunctionNode($2, $3), @$);
+    }
+    | LPAREN SYMBOL s_expr_section RPAREN
+    {
+        ylog(f_expr, SYMBOL s_expr_section);
+        $$ = locateNode(createCustomFunctionNode($2, $3), @$);
     };
 
 
@@ -127,7 +188,7 @@ s_expr_section:
     s_expr_list
     {
         ylog(s_expr_section, s_expr_list);
-        $$ = $1;
+        $$ = reverseExpressionList($1);
     }
     |
     {
@@ -136,34 +197,49 @@ s_expr_section:
     };
 
 
+// Lists are left recursive, so that the parser stack does not grow with their
+// length, and built last element first.
 s_expr_list:
     s_expr
     {
        ylog(s_expr_list, s_expr);
        $$ = $1;
     }
-    | s_expr s_expr_list
-    {
-        ylog(s_expr_list, s_expr s_expr_list);
-        $$ = addExpressionToList($1, $2);
-    }
-    | error
+    | s_expr_list s_expr
     {
-        ylog(s_expr_section, error);
-        yyerror("unexpected token");
-        $$ = NULL;
+        ylog(s_expr_list, s_expr_list s_expr);
+        $$ = addExpressionToList($2, $1);
     };
 
 number:
     INT
     {
         ylog(number, INT);
-        $$ = createNumberNode($1, INT_TYPE);
+        $$ = locateNode(createNumberNode((AST_NUMBER) {INT_TYPE, .ival = $1}), @$);
     }
     | DOUBLE
     {
         ylog(number, DOUBLE);
-        $$ = createNumberNode($1, DOUBLE_TYPE);
+        $$ = locateNode(createNumberNode((AST_NUMBER) {DOUBLE_TYPE, .value = $1}), @$);
+    };
+
+vector:
+    LBRACKET number_list RBRACKET
+    {
+        ylog(vector, number_list);
+        $$ = locateNode(createVectorNode(reverseExpressionList($2)), @$);
+    };
+
+number_list:
+    number_list number
+    {
+        ylog(number_list, number_list number);
+        $$ = addExpressionToList($2, $1);
+    }
+    |
+    {
+        ylog(number_list, <empty>);
+        $$ = NULL;
     };
 
 %%
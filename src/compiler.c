@@ -0,0 +1,530 @@
+#include "vm.h"
+
+#define INITIAL_CHUNK_SIZE 64
+
+// Grows a (pointer, length, capacity) triple so one more element fits.
+#define GROW(array, len, cap) \
+    if ((len) >= (cap)) \
+    { \
+        (cap) = (cap) ? 2 * (cap) : INITIAL_CHUNK_SIZE; \
+        if (((array) = realloc((array), (cap) * sizeof(*(array)))) == NULL) \
+        { \
+            yyerror("Memory allocation failed!"); \
+        } \
+    }
+
+typedef enum arity {
+    NULLARY,
+    UNARY,
+    BINARY,
+    VARIADIC,
+    LIST // like VARIADIC, but no operands is fine too
+} ARITY;
+
+// How each builtin is compiled; must be in sync with FUNC_TYPE.
+// intOp/doubleOp replace op for the INT_KERNEL/DOUBLE_KERNEL builtins.
+// emptyMsg/emptyVal are what the eval helpers warn and return when operands are missing.
+typedef struct builtin {
+    OPCODE op;
+    OPCODE intOp;
+    OPCODE doubleOp;
+    ARITY arity;
+    VM_MESSAGE emptyMsg;
+    RET_VAL emptyVal;
+} BUILTIN;
+
+static const BUILTIN builtins[] = {
+        [NEG_FUNC]     = {OP_NEG,     OP_NEG,        OP_NEG,           UNARY,    MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [ABS_FUNC]     = {OP_ABS,     OP_ABS_INT,    OP_ABS_DOUBLE,    UNARY,    MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [ADD_FUNC]     = {OP_ADD,     OP_ADD_INT,    OP_ADD_DOUBLE,    VARIADIC, MSG_NOT_ENOUGH_ZERO, ZERO_RET_VAL},
+        [SUB_FUNC]     = {OP_SUB,     OP_SUB_INT,    OP_SUB_DOUBLE,    BINARY,   MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [MULT_FUNC]    = {OP_MULT,    OP_MULT_INT,   OP_MULT_DOUBLE,   VARIADIC, MSG_NOT_ENOUGH_ONE,  {INT_TYPE, .ival = 1}},
+        [DIV_FUNC]     = {OP_DIV,     OP_DIV_INT,    OP_DIV_DOUBLE,    BINARY,   MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [REM_FUNC]     = {OP_REM,     OP_REM_INT,    OP_REM_DOUBLE,    BINARY,   MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [EXP_FUNC]     = {OP_EXP,     OP_EXP,        OP_EXP,           UNARY,    MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [EXP2_FUNC]    = {OP_EXP2,    OP_EXP2,       OP_EXP2,          UNARY,    MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [POW_FUNC]     = {OP_POW,     OP_POW_INT,    OP_POW_DOUBLE,    BINARY,   MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [LOG_FUNC]     = {OP_LOG,     OP_LOG,        OP_LOG,           UNARY,    MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [SQRT_FUNC]    = {OP_SQRT,    OP_SQRT,       OP_SQRT,          UNARY,    MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [CBRT_FUNC]    = {OP_CBRT,    OP_CBRT,       OP_CBRT,          UNARY,    MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [HYPOT_FUNC]   = {OP_HYPOT,   OP_HYPOT,      OP_HYPOT,         VARIADIC, MSG_NOT_ENOUGH_NAN,  ZERO_RET_VAL},
+        [MAX_FUNC]     = {OP_MAX,     OP_MAX_INT,    OP_MAX_DOUBLE,    VARIADIC, MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [MIN_FUNC]     = {OP_MIN,     OP_MIN_INT,    OP_MIN_DOUBLE,    VARIADIC, MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [EQUAL_FUNC]   = {OP_EQUAL,   OP_EQUAL,      OP_EQUAL,         BINARY,   MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [LESS_FUNC]    = {OP_LESS,    OP_LESS,       OP_LESS,          BINARY,   MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [GREATER_FUNC] = {OP_GREATER, OP_GREATER,    OP_GREATER,       BINARY,   MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [RAND_FUNC]    = {OP_RAND,    OP_RAND,       OP_RAND,          NULLARY,  MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [READ_FUNC]    = {OP_READ,    OP_READ,       OP_READ,          NULLARY,  MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [PRINT_FUNC]   = {OP_PRINT,   OP_PRINT,      OP_PRINT,         UNARY,    MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [VECTOR_FUNC]  = {OP_VECTOR,  OP_VECTOR,     OP_VECTOR,        LIST,     MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [SUM_FUNC]     = {OP_SUM,     OP_SUM,        OP_SUM,           UNARY,    MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [DOT_FUNC]     = {OP_DOT,     OP_DOT,        OP_DOT,           BINARY,   MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL},
+        [MEAN_FUNC]    = {OP_MEAN,    OP_MEAN,       OP_MEAN,          UNARY,    MSG_NOT_ENOUGH_NAN,  NAN_RET_VAL}
+};
+
+// A compiled let scope: its slots are the registers reg .. reg + n - 1 of the
+// frame of function, and the thunks of its bindings are thunk .. thunk + n - 1.
+// The parameters of a lambda form a scope too, with slots starting at register 0
+// and no thunks, since arguments are bound by the call.
+typedef struct scope_record {
+    int32_t parent;
+    uint32_t reg;
+    uint32_t thunk;
+    uint32_t function;
+} SCOPE_RECORD;
+
+#define NO_THUNKS UINT32_MAX
+
+// A let binding waiting for its thunk to be compiled, with the scope it was bound in.
+// Lambda bindings have their body compiled as function instead, otherwise function is -1.
+typedef struct binding {
+    SYMBOL_TABLE_NODE *symbol;
+    uint32_t reg;
+    int32_t scope;
+    int32_t function;
+} BINDING;
+
+typedef struct compiler {
+    CHUNK *chunk;
+    BINDING *bindings;
+    uint32_t bindingLen;
+    uint32_t bindingCap;
+    SCOPE_RECORD *scopes;
+    uint32_t scopeLen;
+    uint32_t scopeCap;
+    int32_t scope; // innermost scope record, -1 at the top level
+    uint32_t function; // function being compiled, whose frame registers are allocated from
+    uint32_t top; // next free register
+} COMPILER;
+
+// Reused for every expression compiled on this thread so that, once warmed up,
+// compiling allocates nothing.
+static _Thread_local CHUNK chunk;
+static _Thread_local COMPILER compiler;
+
+static void compileNode(COMPILER *c, AST_NODE *node, uint32_t dst);
+
+static uint32_t emit(COMPILER *c, OPCODE op, uint32_t a, uint32_t b, uint32_t n)
+{
+    CHUNK *chunk = c->chunk;
+
+    GROW(chunk->code, chunk->codeLen, chunk->codeCap);
+    chunk->code[chunk->codeLen] = (INSTR) {NULL, op, a, b, n};
+
+    return chunk->codeLen++;
+}
+
+static void emitConst(COMPILER *c, uint32_t dst, RET_VAL val)
+{
+    CHUNK *chunk = c->chunk;
+
+    GROW(chunk->constants, chunk->constLen, chunk->constCap);
+    chunk->constants[chunk->constLen] = val;
+
+    emit(c, OP_LOADK, dst, chunk->constLen++, 0);
+}
+
+static uint32_t addName(COMPILER *c, char *name)
+{
+    CHUNK *chunk = c->chunk;
+
+    GROW(chunk->names, chunk->nameLen, chunk->nameCap);
+    chunk->names[chunk->nameLen] = name;
+
+    return chunk->nameLen++;
+}
+
+static uint32_t addFunction(COMPILER *c, SYMBOL_TABLE_NODE *symbol, uint32_t nParams, NUM_TYPE type)
+{
+    CHUNK *chunk = c->chunk;
+    int jit = currentContext->options.jit;
+    uint32_t countdown = symbol != NULL && jit >= 0 ? (uint32_t) jit + 1 : 0;
+
+    GROW(chunk->functions, chunk->functionLen, chunk->functionCap);
+    chunk->functions[chunk->functionLen] = (FUNCTION) {0, 0, nParams, type, symbol, countdown, NULL};
+
+    return chunk->functionLen++;
+}
+
+static uint32_t allocReg(COMPILER *c)
+{
+    uint32_t reg = c->top++;
+    FUNCTION *function = &c->chunk->functions[c->function];
+
+    if (c->top > function->nRegs)
+    {
+        function->nRegs = c->top;
+    }
+
+    return reg;
+}
+
+// Walks depth scopes out from the innermost one, counting in *hops the
+// function frames crossed on the way.
+static SCOPE_RECORD *findScope(COMPILER *c, int depth, uint32_t *hops)
+{
+    int32_t record = c->scope;
+
+    *hops = 0;
+    for (; depth > 0; depth--)
+    {
+        int32_t parent = c->scopes[record].parent;
+
+        if (c->scopes[parent].function != c->scopes[record].function)
+        {
+            (*hops)++;
+        }
+        record = parent;
+    }
+
+    return &c->scopes[record];
+}
+
+// Compiles the first n operands of opList into consecutive registers starting at c->top.
+static uint32_t compileOperands(COMPILER *c, AST_NODE *opList, uint32_t n)
+{
+    uint32_t base = c->top;
+
+    for (uint32_t i = 0; i < n && opList != NULL; i++)
+    {
+        compileNode(c, opList, allocReg(c));
+        opList = opList->next;
+    }
+
+    return base;
+}
+
+// Arguments are compiled into the caller's registers; OP_CALL copies them into
+// the new frame. Missing and extra arguments are handled like pushCallFrame does.
+static void compileCallNode(COMPILER *c, AST_NODE *node, uint32_t dst)
+{
+    AST_FUNCTION *call = &node->data.function;
+    uint32_t top = c->top;
+    uint32_t n = 0;
+    uint32_t want;
+    uint32_t base;
+    uint32_t hops;
+    uint32_t function;
+    uint32_t at;
+    SCOPE_RECORD *scope;
+
+    if (call->slot < 0)
+    {
+        emit(c, OP_UNDEF, dst, addName(c, call->name->name), MSG_FUNCTION_NOT_FOUND);
+        return;
+    }
+
+    if (call->callee == NULL)
+    {
+        emit(c, OP_UNDEF, dst, addName(c, call->name->name), MSG_NOT_A_FUNCTION);
+        return;
+    }
+
+    for (AST_NODE *op = call->opList; op != NULL; op = op->next)
+    {
+        n++;
+    }
+
+    scope = findScope(c, call->depth, &hops);
+    function = c->bindings[scope->thunk + call->slot].function;
+    want = c->chunk->functions[function].nParams;
+
+    base = compileOperands(c, call->opList, want);
+    if (n < want)
+    {
+        emit(c, OP_WARN, 0, MSG_NOT_ENOUGH_NAN, 0);
+        emitConst(c, dst, NAN_RET_VAL);
+    }
+    else
+    {
+        at = emit(c, call->tail ? OP_TAILCALL : OP_CALL, dst, base, function);
+        c->chunk->code[at].d = hops;
+        if (n > want)
+        {
+            emit(c, OP_WARN, 0, MSG_EXTRA_PARAMS, 0);
+        }
+    }
+
+    c->top = top;
+}
+
+static void compileFuncNode(COMPILER *c, AST_NODE *node, uint32_t dst)
+{
+    FUNC_TYPE func = node->data.function.func;
+    uint32_t top = c->top;
+    uint32_t n = 0;
+    uint32_t want;
+    uint32_t base;
+
+    if (func == CUSTOM_FUNC)
+    {
+        compileCallNode(c, node, dst);
+        return;
+    }
+
+    for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+    {
+        n++;
+    }
+
+    const BUILTIN *builtin = &builtins[func];
+    OPCODE op = builtin->op;
+
+    if (node->data.function.kernel == INT_KERNEL)
+    {
+        op = builtin->intOp;
+    }
+    else if (node->data.function.kernel == DOUBLE_KERNEL)
+    {
+        op = builtin->doubleOp;
+    }
+
+    switch (builtin->arity)
+    {
+        case NULLARY:
+            emit(c, builtin->op, dst, 0, 0);
+            break;
+        case UNARY:
+        case BINARY:
+            want = builtin->arity == UNARY ? 1 : 2;
+            // operands are evaluated up to the point the eval helper notices one is missing
+            base = compileOperands(c, node->data.function.opList, want);
+            if (n < want)
+            {
+                emit(c, OP_WARN, 0, builtin->emptyMsg, 0);
+                emitConst(c, dst, builtin->emptyVal);
+                break;
+            }
+            emit(c, op, dst, base, want);
+            if (n > want)
+            {
+                emit(c, OP_WARN, 0, MSG_EXTRA_PARAMS, 0);
+            }
+            break;
+        case VARIADIC:
+        case LIST:
+            if (n == 0 && builtin->arity == VARIADIC)
+            {
+                emit(c, OP_WARN, 0, builtin->emptyMsg, 0);
+                emitConst(c, dst, builtin->emptyVal);
+                break;
+            }
+            base = compileOperands(c, node->data.function.opList, n);
+            emit(c, op, dst, base, n);
+            break;
+    }
+
+    c->top = top;
+}
+
+static void compileScopeNode(COMPILER *c, AST_NODE *node, uint32_t dst)
+{
+    int n = node->data.scope.nBindings;
+    uint32_t top = c->top;
+    int32_t scope = c->scope;
+
+    GROW(c->scopes, c->scopeLen, c->scopeCap);
+    c->scopes[c->scopeLen] = (SCOPE_RECORD) {scope, top, c->bindingLen, c->function};
+    c->scope = c->scopeLen++;
+
+    for (int i = 0; i < n; i++)
+    {
+        SYMBOL_TABLE_NODE *symbol = node->data.scope.bindings[i];
+        int32_t function = -1;
+
+        if (symbol->value->type == LAMBDA_NODE_TYPE)
+        {
+            function = addFunction(c, symbol, symbol->value->data.lambda.nParams, symbol->type);
+        }
+
+        GROW(c->bindings, c->bindingLen, c->bindingCap);
+        c->bindings[c->bindingLen++] = (BINDING) {symbol, allocReg(c), c->scope, function};
+    }
+
+    if (n > 0)
+    {
+        emit(c, OP_UNBIND, top, 0, n);
+    }
+
+    compileNode(c, node->data.scope.child, dst);
+
+    c->scope = scope;
+    c->top = top;
+}
+
+static void compileSymbolNode(COMPILER *c, AST_NODE *node, uint32_t dst)
+{
+    SCOPE_RECORD *scope;
+    uint32_t slot = node->data.symbol.slot;
+    uint32_t hops;
+    uint32_t at;
+
+    if (node->data.symbol.slot < 0)
+    {
+        emit(c, OP_UNDEF, dst, addName(c, node->data.symbol.id->name), MSG_SYMBOL_NOT_FOUND);
+        return;
+    }
+
+    scope = findScope(c, node->data.symbol.depth, &hops);
+
+    if (scope->thunk != NO_THUNKS && c->bindings[scope->thunk + slot].function >= 0)
+    {
+        emit(c, OP_UNDEF, dst, addName(c, node->data.symbol.id->name), MSG_FUNCTION_AS_VALUE);
+        return;
+    }
+
+    // parameter slots are always bound, so they have no thunk to run
+    at = emit(c, OP_LOADSYM, dst, scope->reg + slot, scope->thunk == NO_THUNKS ? NO_THUNKS : scope->thunk + slot);
+    c->chunk->code[at].d = hops;
+}
+
+static void compileCondNode(COMPILER *c, AST_NODE *node, uint32_t dst)
+{
+    uint32_t cond = allocReg(c);
+    uint32_t jumpFalse;
+    uint32_t jumpEnd;
+
+    compileNode(c, node->data.condition.condition, cond);
+    c->top = cond;
+
+    jumpFalse = emit(c, OP_JUMPF, cond, 0, 0);
+    compileNode(c, node->data.condition._true, dst);
+    jumpEnd = emit(c, OP_JUMP, 0, 0, 0);
+
+    c->chunk->code[jumpFalse].b = c->chunk->codeLen;
+    compileNode(c, node->data.condition._false, dst);
+    c->chunk->code[jumpEnd].b = c->chunk->codeLen;
+}
+
+static void compileNode(COMPILER *c, AST_NODE *node, uint32_t dst)
+{
+    if (!node)
+    {
+        yyerror("NULL ast node passed into compileNode!");
+        return;
+    }
+
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+            emitConst(c, dst, node->data.number);
+            break;
+        case FUNC_NODE_TYPE:
+            compileFuncNode(c, node, dst);
+            break;
+        case SYM_NODE_TYPE:
+            compileSymbolNode(c, node, dst);
+            break;
+        case SCOPE_NODE_TYPE:
+            compileScopeNode(c, node, dst);
+            break;
+        case CONDITIONAL_NODE_TYPE:
+            compileCondNode(c, node, dst);
+            break;
+        case LAMBDA_NODE_TYPE:
+            // only reached through compileThunks
+            yyerror("LAMBDA ast node passed into compileNode!");
+            break;
+    }
+}
+
+// A lambda body runs in its own frame: parameters first, then its registers.
+static void compileLambda(COMPILER *c, uint32_t binding)
+{
+    CHUNK *chunk = c->chunk;
+    uint32_t function = c->bindings[binding].function;
+    AST_LAMBDA *lambda = &c->bindings[binding].symbol->value->data.lambda;
+    uint32_t result;
+
+    c->function = function;
+    c->top = 0;
+    chunk->functions[function].pc = chunk->codeLen;
+
+    for (int i = 0; i < lambda->nParams; i++)
+    {
+        allocReg(c);
+    }
+
+    GROW(c->scopes, c->scopeLen, c->scopeCap);
+    c->scopes[c->scopeLen] = (SCOPE_RECORD) {c->bindings[binding].scope, 0, NO_THUNKS, function};
+    c->scope = c->scopeLen++;
+
+    result = allocReg(c);
+    compileNode(c, lambda->body, result);
+    emit(c, OP_RET, result, 0, 0);
+}
+
+// Compiles one thunk per binding after the main code, or the body of a lambda.
+// Each thunk gets registers above everything allocated so far in its function's
+// frame, so it can be entered from any point of that function, or from a lambda
+// defined in it, without clobbering live registers.
+static void compileThunks(COMPILER *c)
+{
+    CHUNK *chunk = c->chunk;
+
+    // compiling a thunk may add bindings for scopes nested in its value
+    for (uint32_t i = 0; i < c->bindingLen; i++)
+    {
+        SYMBOL_TABLE_NODE *symbol = c->bindings[i].symbol;
+        uint32_t tmp;
+
+        // lambda bindings keep a thunk so that thunk indices match binding indices
+        GROW(chunk->thunks, chunk->thunkLen, chunk->thunkCap);
+        chunk->thunks[chunk->thunkLen++] = (THUNK) {chunk->codeLen, symbol->id->name};
+
+        if (c->bindings[i].function >= 0)
+        {
+            compileLambda(c, i);
+            continue;
+        }
+
+        c->scope = c->bindings[i].scope;
+        c->function = c->scopes[c->scope].function;
+        c->top = chunk->functions[c->function].nRegs;
+        tmp = allocReg(c);
+
+        compileNode(c, symbol->value, tmp);
+        emit(c, OP_BIND, c->bindings[i].reg, tmp, symbol->type);
+    }
+}
+
+void freeCompilerScratch(void)
+{
+    free(chunk.code);
+    free(chunk.constants);
+    free(chunk.names);
+    free(chunk.thunks);
+    free(chunk.functions);
+    free(compiler.bindings);
+    free(compiler.scopes);
+    chunk = (CHUNK) {0};
+    compiler = (COMPILER) {0};
+}
+
+CHUNK *compileProgram(AST_NODE *node)
+{
+    COMPILER *c = &compiler;
+    uint32_t result;
+
+    c->chunk = &chunk;
+    chunk.codeLen = 0;
+    chunk.constLen = 0;
+    chunk.nameLen = 0;
+    chunk.thunkLen = 0;
+    chunk.functionLen = 0;
+    chunk.linked = false;
+    jitReset();
+    c->bindingLen = 0;
+    c->scopeLen = 0;
+    c->scope = -1;
+    c->function = addFunction(c, NULL, 0, NO_TYPE);
+    c->top = 0;
+
+    result = allocReg(c);
+    compileNode(c, node, result);
+    emit(c, OP_RET, result, 0, 0);
+
+    compileThunks(c);
+
+    return &chunk;
+}
@@ -0,0 +1,615 @@
+#include <stdint.h>
+#include <string.h>
+#include "cilisp.h"
+
+// Common-subexpression elimination.
+//
+// A region is the part of an expression that is evaluated in one environment:
+// the top-level expression, a let body, a let value or a lambda body, without the
+// scopes nested in it. Pure builtins of a region that are structurally identical,
+// with symbols compared by their resolved binding, are put in one class; a class
+// used more than once becomes a binding of a new let scope wrapped around the
+// region, and its uses become symbols. Let values are evaluated on their first
+// lookup and kept, so a shared subtree runs once, when its first use would have.
+
+#define INITIAL_TABLE_SIZE 64
+
+// Grows a (pointer, capacity) pair so that index fits.
+#define RESERVE(array, index, cap) \
+    if ((index) >= (cap)) \
+    { \
+        while ((index) >= (cap)) \
+        { \
+            (cap) = (cap) ? 2 * (cap) : INITIAL_TABLE_SIZE; \
+        } \
+        if (((array) = realloc((array), (cap) * sizeof(*(array)))) == NULL) \
+        { \
+            yyerror("Memory allocation failed!"); \
+        } \
+    }
+
+#define IMPURE (-1)
+#define PURE_LEAF (-2)
+
+// How a level's bindings can be seen from the region being processed.
+// A let binding whose value is being evaluated warns on every lookup, which sharing
+// would merge into one warning. That can only happen from within the values of its
+// scope (lambdas included), so only symbols of scopes entered through their body
+// and lambda parameters, which are always bound, are pure.
+typedef struct cse_level {
+    AST_NODE *scope; // NULL for lambda parameters and the top level
+    bool safe;
+} CSE_LEVEL;
+
+typedef struct cse_class {
+    uint64_t hash;
+    AST_NODE *node;  // first occurrence
+    int uses;        // occurrences outside of other shared occurrences
+    int temp;        // slot of the binding holding the value, -1 until shared
+} CSE_CLASS;
+
+// Open-addressing tables, emptied for each region by bumping generation.
+typedef struct class_entry {
+    unsigned generation;
+    int class;
+} CLASS_ENTRY;
+
+typedef struct node_entry {
+    unsigned generation;
+    AST_NODE *node;
+    int class;
+} NODE_ENTRY;
+
+static _Thread_local CSE_LEVEL *levels;
+static _Thread_local int levelCap;
+
+static _Thread_local CSE_CLASS *classes;
+static _Thread_local int classLen;
+static _Thread_local int classCap;
+
+static _Thread_local CLASS_ENTRY *classTable;
+static _Thread_local int classTableSize;
+
+static _Thread_local NODE_ENTRY *nodeTable;
+static _Thread_local int nodeTableSize;
+static _Thread_local int nodeCount;
+
+static _Thread_local unsigned generation;
+
+static _Thread_local SYMBOL_TABLE_NODE **temps;
+static _Thread_local int tempLen;
+static _Thread_local int tempCap;
+
+static uint64_t mix(uint64_t hash, uint64_t word)
+{
+    // FNV-1a, a word at a time
+    return (hash ^ word) * 0x100000001b3u;
+}
+
+static size_t tableIndex(uint64_t hash, int size)
+{
+    return (size_t) (hash ^ (hash >> 29)) & (size - 1);
+}
+
+// The ival of ints, the bits of the double of anything else.
+static uint64_t numberBits(AST_NUMBER number)
+{
+    uint64_t bits;
+
+    if (number.type == INT_TYPE)
+    {
+        return (uint64_t) number.ival;
+    }
+
+    // a vector is only the same operand as itself
+    if (number.type == VECTOR_TYPE)
+    {
+        return (uint64_t) (uintptr_t) number.vector;
+    }
+
+    memcpy(&bits, &number.value, sizeof(bits));
+    return bits;
+}
+
+static int classOf(AST_NODE *node)
+{
+    size_t i;
+
+    if (nodeTableSize == 0)
+    {
+        return IMPURE;
+    }
+
+    for (i = tableIndex((uintptr_t) node * 0x9e3779b97f4a7c15u, nodeTableSize);
+         nodeTable[i].generation == generation;
+         i = (i + 1) & (nodeTableSize - 1))
+    {
+        if (nodeTable[i].node == node)
+        {
+            return nodeTable[i].class;
+        }
+    }
+
+    return IMPURE;
+}
+
+static void growNodeTable();
+
+static void setClass(AST_NODE *node, int class)
+{
+    size_t i;
+
+    if (2 * (nodeCount + 1) > nodeTableSize)
+    {
+        growNodeTable();
+    }
+
+    for (i = tableIndex((uintptr_t) node * 0x9e3779b97f4a7c15u, nodeTableSize);
+         nodeTable[i].generation == generation;
+         i = (i + 1) & (nodeTableSize - 1));
+
+    nodeTable[i] = (NODE_ENTRY) {generation, node, class};
+    nodeCount++;
+}
+
+static void growNodeTable()
+{
+    NODE_ENTRY *old = nodeTable;
+    int oldSize = nodeTableSize;
+
+    nodeTableSize = nodeTableSize ? 2 * nodeTableSize : INITIAL_TABLE_SIZE;
+    if ((nodeTable = calloc(nodeTableSize, sizeof(NODE_ENTRY))) == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+
+    // a fresh table holds nothing of the current generation
+    nodeCount = 0;
+    for (int i = 0; i < oldSize; i++)
+    {
+        if (old[i].generation == generation)
+        {
+            setClass(old[i].node, old[i].class);
+        }
+    }
+    free(old);
+}
+
+static void growClassTable()
+{
+    free(classTable);
+
+    classTableSize = classTableSize ? 2 * classTableSize : INITIAL_TABLE_SIZE;
+    if ((classTable = calloc(classTableSize, sizeof(CLASS_ENTRY))) == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+
+    for (int class = 0; class < classLen; class++)
+    {
+        size_t i;
+
+        for (i = tableIndex(classes[class].hash, classTableSize);
+             classTable[i].generation == generation;
+             i = (i + 1) & (classTableSize - 1));
+
+        classTable[i] = (CLASS_ENTRY) {generation, class};
+    }
+}
+
+static uint64_t hashLeaf(AST_NODE *node)
+{
+    if (node->type == NUM_NODE_TYPE)
+    {
+        return mix(mix(node->type, node->data.number.type), numberBits(node->data.number));
+    }
+
+    return mix(mix(mix(node->type, (uintptr_t) node->data.symbol.id), node->data.symbol.depth), node->data.symbol.slot);
+}
+
+static bool sameOperand(AST_NODE *a, AST_NODE *b)
+{
+    if (a->type != b->type)
+    {
+        return false;
+    }
+
+    switch (a->type)
+    {
+        case NUM_NODE_TYPE:
+            // doubles by bits, so that -0.0 and 0.0 differ and NAN equals itself
+            return a->data.number.type == b->data.number.type
+                   && numberBits(a->data.number) == numberBits(b->data.number);
+        case SYM_NODE_TYPE:
+            return a->data.symbol.id == b->data.symbol.id
+                   && a->data.symbol.depth == b->data.symbol.depth
+                   && a->data.symbol.slot == b->data.symbol.slot;
+        case FUNC_NODE_TYPE:
+            return classOf(a) == classOf(b);
+        default:
+            return false;
+    }
+}
+
+static bool sameCall(AST_NODE *a, AST_NODE *b)
+{
+    AST_NODE *opA = a->data.function.opList;
+    AST_NODE *opB = b->data.function.opList;
+
+    if (a->data.function.func != b->data.function.func)
+    {
+        return false;
+    }
+
+    for (; opA != NULL && opB != NULL; opA = opA->next, opB = opB->next)
+    {
+        if (!sameOperand(opA, opB))
+        {
+            return false;
+        }
+    }
+
+    return opA == NULL && opB == NULL;
+}
+
+// Puts a pure builtin whose operands are classified into its class.
+static int addToClass(AST_NODE *node)
+{
+    uint64_t hash = mix(0xcbf29ce484222325u, node->data.function.func);
+    size_t i;
+
+    for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+    {
+        hash = mix(hash, op->type == FUNC_NODE_TYPE ? classes[classOf(op)].hash : hashLeaf(op));
+    }
+
+    if (2 * (classLen + 1) > classTableSize)
+    {
+        growClassTable();
+    }
+
+    for (i = tableIndex(hash, classTableSize);
+         classTable[i].generation == generation;
+         i = (i + 1) & (classTableSize - 1))
+    {
+        CSE_CLASS *class = &classes[classTable[i].class];
+
+        if (class->hash == hash && sameCall(class->node, node))
+        {
+            setClass(node, classTable[i].class);
+            return classTable[i].class;
+        }
+    }
+
+    RESERVE(classes, classLen, classCap);
+    classes[classLen] = (CSE_CLASS) {hash, node, 0, -1};
+    classTable[i] = (CLASS_ENTRY) {generation, classLen};
+    setClass(node, classLen);
+
+    return classLen++;
+}
+
+static bool isPureSymbol(AST_NODE *node, int level)
+{
+    AST_SYMBOL *symbol = &node->data.symbol;
+    CSE_LEVEL *target;
+
+    if (symbol->slot < 0)
+    {
+        return false;
+    }
+
+    target = &levels[level - symbol->depth];
+    if (!target->safe)
+    {
+        return false;
+    }
+
+    // a function used as a value warns
+    return target->scope == NULL
+           || target->scope->data.scope.bindings[symbol->slot]->value->type != LAMBDA_NODE_TYPE;
+}
+
+// Classifies the pure builtins of a region, bottom-up.
+static int classifyNode(AST_NODE *node, int level)
+{
+    bool pure;
+
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+            return PURE_LEAF;
+        case SYM_NODE_TYPE:
+            return isPureSymbol(node, level) ? PURE_LEAF : IMPURE;
+        case FUNC_NODE_TYPE:
+            pure = isPureBuiltin(node);
+            for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+            {
+                if (classifyNode(op, level) == IMPURE)
+                {
+                    pure = false;
+                }
+            }
+            return pure ? addToClass(node) : IMPURE;
+        case CONDITIONAL_NODE_TYPE:
+            classifyNode(node->data.condition.condition, level);
+            classifyNode(node->data.condition._true, level);
+            classifyNode(node->data.condition._false, level);
+            return IMPURE;
+        default:
+            // nested scopes are regions of their own
+            return IMPURE;
+    }
+}
+
+// Counts the uses of each class in evaluation order. Only the first occurrence of
+// a class keeps its operands, so the occurrences after it are not looked into.
+static void countUses(AST_NODE *node)
+{
+    int class;
+
+    switch (node->type)
+    {
+        case FUNC_NODE_TYPE:
+            class = classOf(node);
+            if (class >= 0 && ++classes[class].uses > 1)
+            {
+                return;
+            }
+            for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+            {
+                countUses(op);
+            }
+            break;
+        case CONDITIONAL_NODE_TYPE:
+            countUses(node->data.condition.condition);
+            countUses(node->data.condition._true);
+            countUses(node->data.condition._false);
+            break;
+        default:
+            break;
+    }
+}
+
+static ATOM *tempName(int slot)
+{
+    char name[16];
+
+    // not a symbol the lexer accepts, so it cannot clash with the program's
+    snprintf(name, sizeof(name), "#%d", slot);
+    return intern(name);
+}
+
+static void shareOperands(AST_NODE *node);
+
+// Replaces the occurrences of classes used more than once by their binding.
+static void shareNode(AST_NODE *node)
+{
+    CSE_CLASS *class;
+    SYMBOL_TABLE_NODE *temp;
+
+    switch (node->type)
+    {
+        case FUNC_NODE_TYPE:
+            if (classOf(node) < 0 || classes[classOf(node)].uses < 2)
+            {
+                shareOperands(node);
+                break;
+            }
+
+            class = &classes[classOf(node)];
+            if (class->temp < 0)
+            {
+                temp = arenaCalloc(&currentContext->astArena, sizeof(SYMBOL_TABLE_NODE));
+                temp->id = tempName(tempLen);
+                temp->type = NO_TYPE;
+                temp->value = arenaAlloc(&currentContext->astArena, sizeof(AST_NODE));
+                *temp->value = *node;
+                temp->value->next = NULL;
+
+                class->temp = tempLen;
+                RESERVE(temps, tempLen, tempCap);
+                temps[tempLen++] = temp;
+
+                shareOperands(temp->value);
+            }
+
+            // the binding is in the scope wrapped right around the region
+            node->type = SYM_NODE_TYPE;
+            node->data.symbol = (AST_SYMBOL) {temps[class->temp]->id, 0, class->temp};
+            break;
+        case CONDITIONAL_NODE_TYPE:
+            shareNode(node->data.condition.condition);
+            shareNode(node->data.condition._true);
+            shareNode(node->data.condition._false);
+            break;
+        default:
+            break;
+    }
+}
+
+static void shareOperands(AST_NODE *node)
+{
+    for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+    {
+        shareNode(op);
+    }
+}
+
+// Adds one to the depth of the symbols and calls under node that refer to a binding
+// outside of the region, whose nodes are depth levels below the region's root.
+static void shiftDepths(AST_NODE *node, int depth)
+{
+    AST_SCOPE *scope;
+
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+        case LAMBDA_NODE_TYPE:
+            break;
+        case SYM_NODE_TYPE:
+            if (node->data.symbol.slot >= 0 && node->data.symbol.id->name[0] != '#'
+                && node->data.symbol.depth >= depth)
+            {
+                node->data.symbol.depth++;
+            }
+            break;
+        case FUNC_NODE_TYPE:
+            for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+            {
+                shiftDepths(op, depth);
+            }
+            if (node->data.function.func == CUSTOM_FUNC && node->data.function.slot >= 0
+                && node->data.function.depth >= depth)
+            {
+                node->data.function.depth++;
+            }
+            break;
+        case SCOPE_NODE_TYPE:
+            scope = &node->data.scope;
+            for (int i = 0; i < scope->nBindings; i++)
+            {
+                AST_NODE *value = scope->bindings[i]->value;
+
+                if (value->type == LAMBDA_NODE_TYPE)
+                {
+                    shiftDepths(value->data.lambda.body, depth + 2);
+                }
+                else
+                {
+                    shiftDepths(value, depth + 1);
+                }
+            }
+            shiftDepths(scope->child, depth + 1);
+            break;
+        case CONDITIONAL_NODE_TYPE:
+            shiftDepths(node->data.condition.condition, depth);
+            shiftDepths(node->data.condition._true, depth);
+            shiftDepths(node->data.condition._false, depth);
+            break;
+    }
+}
+
+// Turns root into a scope binding the shared values, with root's old node as its
+// child, so that everything under it is one level deeper.
+static void wrapRegion(AST_NODE *root)
+{
+    AST_NODE *child = arenaAlloc(&currentContext->astArena, sizeof(AST_NODE));
+    SYMBOL_TABLE_NODE **bindings = arenaAlloc(&currentContext->astArena, tempLen * sizeof(SYMBOL_TABLE_NODE *));
+
+    shiftDepths(root, 0);
+    for (int i = 0; i < tempLen; i++)
+    {
+        shiftDepths(temps[i]->value, 0);
+        temps[i]->value->parent = root;
+        bindings[i] = temps[i];
+    }
+
+    *child = *root;
+    child->parent = root;
+    child->symbolTable = NULL;
+    child->next = NULL;
+
+    root->type = SCOPE_NODE_TYPE;
+    root->data.scope = (AST_SCOPE) {child, bindings, tempLen};
+}
+
+static void cseNested(AST_NODE *node, int level);
+
+// Shares the common subexpressions of the region at root, whose nodes are at the
+// given level, after those of the regions nested in it.
+static void cseRegion(AST_NODE *root, int level)
+{
+    cseNested(root, level);
+
+    generation++;
+    classLen = 0;
+    nodeCount = 0;
+    tempLen = 0;
+
+    classifyNode(root, level);
+    countUses(root);
+    shareNode(root);
+
+    if (tempLen > 0)
+    {
+        wrapRegion(root);
+    }
+}
+
+static void cseScope(AST_NODE *node, int level)
+{
+    AST_SCOPE *scope = &node->data.scope;
+
+    level++;
+    RESERVE(levels, level, levelCap);
+
+    levels[level] = (CSE_LEVEL) {node, false};
+    for (int i = 0; i < scope->nBindings; i++)
+    {
+        AST_NODE *value = scope->bindings[i]->value;
+
+        if (value->type == LAMBDA_NODE_TYPE)
+        {
+            RESERVE(levels, level + 1, levelCap);
+            levels[level + 1] = (CSE_LEVEL) {NULL, true};
+            cseRegion(value->data.lambda.body, level + 1);
+        }
+        else
+        {
+            cseRegion(value, level);
+        }
+    }
+
+    levels[level] = (CSE_LEVEL) {node, true};
+    cseRegion(scope->child, level);
+}
+
+// Finds the regions nested in a region.
+static void cseNested(AST_NODE *node, int level)
+{
+    switch (node->type)
+    {
+        case FUNC_NODE_TYPE:
+            for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+            {
+                cseNested(op, level);
+            }
+            break;
+        case SCOPE_NODE_TYPE:
+            cseScope(node, level);
+            break;
+        case CONDITIONAL_NODE_TYPE:
+            cseNested(node->data.condition.condition, level);
+            cseNested(node->data.condition._true, level);
+            cseNested(node->data.condition._false, level);
+            break;
+        default:
+            break;
+    }
+}
+
+void freeCseScratch(void)
+{
+    free(levels);
+    free(classes);
+    free(classTable);
+    free(nodeTable);
+    free(temps);
+    levels = NULL;
+    classes = NULL;
+    classTable = NULL;
+    nodeTable = NULL;
+    temps = NULL;
+    levelCap = classLen = classCap = classTableSize = nodeTableSize = nodeCount = tempLen = tempCap = 0;
+}
+
+// Shares the pure builtins that are repeated within a region; see the top of the
+// file. Runs after resolveProgram and keeps its depths and slots up to date.
+void cseProgram(AST_NODE *node)
+{
+    RESERVE(levels, 0, levelCap);
+    levels[0] = (CSE_LEVEL) {NULL, true};
+
+    cseRegion(node, 0);
+}
@@ -0,0 +1,780 @@
+#include <ctype.h>
+#include "vm.h"
+#include "reduce.h"
+#include "vector.h"
+
+// --emit-c: each top-level expression, once compiled to bytecode, becomes C doing
+// what vmRun does with its chunk. Every instruction turns into the statements of
+// its handler with its operands, constants and jump targets written in, so that
+// nothing is decoded or dispatched at run time. The main code, each lambda and
+// each thunk are functions of their own, so the calls of the VM and the thunks
+// its loads run are C calls, counted against the same limits. The int and double kernels of add, mult, max and min on fewer
+// than REDUCE_MIN_OPERANDS operands are written out as the folds reduceIntValues
+// and reduceDoubleValues run, the other builtins call what the VM calls.
+//
+// main calls these functions in order and prints their values with aotPrint.
+// Whatever cilisp prints while it reads the input, its prompts, the echo of each
+// line and the warnings of the parser and the passes, is captured in the meantime
+// and written into main as strings printed between the calls, so the program
+// prints exactly what cilisp would print for its input.
+
+static FILE *emitOut;   // the C file
+static FILE *emitMain;  // the statements of main, copied to emitOut at exit
+static FILE *capture;   // stdout while translating
+static long captured;   // how much of capture main prints already
+static DOUBLE_FORMAT doubles; // how the program prints doubles, as cilisp would
+static uint32_t expressions;
+
+// The part of a chunk one C function runs: the main code (function 0), the body
+// of a lambda (function), or a thunk (function UINT32_MAX).
+typedef struct region {
+    CHUNK *chunk;
+    uint32_t expression;
+    uint32_t activationCap;
+    uint32_t function;
+} REGION;
+
+// Writes s as a C string literal, split after each newline.
+static void writeString(FILE *out, const char *s, size_t n, const char *indent)
+{
+    fputc('"', out);
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned char ch = s[i];
+
+        switch (ch)
+        {
+            case '\\':
+                fputs("\\\\", out);
+                break;
+            case '"':
+                fputs("\\\"", out);
+                break;
+            case '?': // no trigraphs
+                fputs("\\?", out);
+                break;
+            case '\t':
+                fputs("\\t", out);
+                break;
+            case '\n':
+                fputs("\\n", out);
+                if (i + 1 < n)
+                {
+                    fprintf(out, "\"\n%s\"", indent);
+                }
+                break;
+            default:
+                if (ch < 0x20 || ch >= 0x7f)
+                {
+                    fprintf(out, "\\%03o", ch);
+                }
+                else
+                {
+                    fputc(ch, out);
+                }
+                break;
+        }
+    }
+    fputc('"', out);
+}
+
+// Adds what has been printed since the last call to main.
+static void replayCapture(void)
+{
+    long end;
+    char *text;
+
+    if (runtime != NULL)
+    {
+        flushRuntime(runtime);
+    }
+    fflush(capture);
+    end = ftell(capture);
+    if (end <= captured)
+    {
+        return;
+    }
+
+    if ((text = malloc(end - captured)) == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+    fseek(capture, captured, SEEK_SET);
+    if (fread(text, 1, end - captured, capture) != (size_t) (end - captured))
+    {
+        yyerror("Cannot read back the output captured for --emit-c!");
+    }
+    fseek(capture, end, SEEK_SET);
+
+    fputs("    aotEcho(", emitMain);
+    writeString(emitMain, text, end - captured, "            ");
+    fputs(");\n", emitMain);
+
+    free(text);
+    captured = end;
+}
+
+static void finishEmit(void)
+{
+    int ch;
+
+    replayCapture();
+
+    fprintf(emitOut, "\nint main(int argc, char **argv)\n{\n    aotStart(argc, argv, %s);\n",
+            doubles == SHORTEST_DOUBLES ? "SHORTEST_DOUBLES" : "FIXED_DOUBLES");
+    rewind(emitMain);
+    while ((ch = getc(emitMain)) != EOF)
+    {
+        putc(ch, emitOut);
+    }
+    fprintf(emitOut, "    return %d;\n}\n", fatalError ? 1 : 0);
+
+    fclose(emitMain);
+    fflush(emitOut);
+}
+
+void startEmit(const char *path, DOUBLE_FORMAT format)
+{
+    doubles = format;
+    emitOut = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (emitOut == NULL)
+    {
+        yyerror("Cannot open \"%s\" for --emit-c!", path);
+    }
+    if ((emitMain = tmpfile()) == NULL || (capture = tmpfile()) == NULL)
+    {
+        yyerror("Cannot create a temporary file for --emit-c!");
+    }
+
+    fputs("// Translated by cilisp --emit-c; link against the cilisp runtime.\n"
+          "#include \"aot.h\"\n", emitOut);
+
+    stdout = capture;
+    atexit(finishEmit);
+}
+
+static const char *typeName(NUM_TYPE type)
+{
+    switch (type)
+    {
+        case INT_TYPE:
+            return "INT_TYPE";
+        case DOUBLE_TYPE:
+            return "DOUBLE_TYPE";
+        case VECTOR_TYPE:
+            return "VECTOR_TYPE";
+        default:
+            return "NO_TYPE";
+    }
+}
+
+static uint64_t bitsOf(double value)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static void writeInt(FILE *out, int64_t ival)
+{
+    if (ival == INT64_MIN)
+    {
+        fputs("INT64_MIN", out);
+    }
+    else
+    {
+        fprintf(out, "INT64_C(%" PRId64 ")", ival);
+    }
+}
+
+// Hexadecimal literals keep every bit; NANs and infinities have none.
+static void writeDouble(FILE *out, double value)
+{
+    if (isfinite(value))
+    {
+        fprintf(out, "%a", value);
+    }
+    else
+    {
+        fprintf(out, "aotDouble(UINT64_C(0x%016" PRIx64 "))", bitsOf(value));
+    }
+}
+
+static void writeValue(FILE *out, RET_VAL val)
+{
+    switch (val.type)
+    {
+        case INT_TYPE:
+            fputs("(RET_VAL) {INT_TYPE, .ival = ", out);
+            writeInt(out, val.ival);
+            fputs("}", out);
+            break;
+        case VECTOR_TYPE:
+            fprintf(out, "aotVector(%s, %zu, ", typeName(val.vector->type), val.vector->length);
+            if (val.vector->length == 0)
+            {
+                fputs("NULL)", out);
+                break;
+            }
+            fputs("(const uint64_t[]) {", out);
+            for (size_t i = 0; i < val.vector->length; i++)
+            {
+                uint64_t bits = val.vector->type == INT_TYPE ? (uint64_t) val.vector->ivals[i] : bitsOf(val.vector->values[i]);
+
+                fprintf(out, i ? ", UINT64_C(0x%" PRIx64 ")" : "UINT64_C(0x%" PRIx64 ")", bits);
+            }
+            fputs("})", out);
+            break;
+        default:
+            fprintf(out, "(RET_VAL) {%s, .value = ", typeName(val.type));
+            writeDouble(out, val.value);
+            fputs("}", out);
+            break;
+    }
+}
+
+// Writes the frame the instruction at pc links out to into frame.
+static void writeFrame(FILE *out, INSTR *pc)
+{
+    fputs("    frame = fp", out);
+    for (uint32_t hops = pc->d; hops > 0; hops--)
+    {
+        fputs("->link", out);
+    }
+    fputs(";\n", out);
+}
+
+// R[a] = step(...step(step(init, R[b]), R[b + 1])..., R[b + n - 1]), or from
+// R[b] without init, on the given field of the registers. An operator as step
+// is written infix: init + R[b] + R[b + 1] ...
+static void writeFold(FILE *out, INSTR *pc, const char *type, const char *field,
+                      const char *step, const char *init)
+{
+    uint32_t first = init == NULL;
+
+    fprintf(out, "    R[%u] = (RET_VAL) {%s, .%s = ", (unsigned) pc->a, type, field);
+    if (!isalpha((unsigned char) step[0]))
+    {
+        fputs(init, out);
+        for (uint32_t i = 0; i < pc->c; i++)
+        {
+            fprintf(out, " %s R[%u].%s", step, pc->b + i, field);
+        }
+        fputs("};\n", out);
+        return;
+    }
+
+    for (uint32_t i = first; i < pc->c; i++)
+    {
+        fprintf(out, "%s(", step);
+    }
+    if (init != NULL)
+    {
+        fputs(init, out);
+    }
+    else
+    {
+        fprintf(out, "R[%u].%s", pc->b, field);
+    }
+    for (uint32_t i = first; i < pc->c; i++)
+    {
+        fprintf(out, ", R[%u].%s)", pc->b + i, field);
+    }
+    fputs("};\n", out);
+}
+
+// R[a] = call, the builtin's operands standing for %1$s (the first one) and
+// %2$s (the second one), or for R + b and c with a list.
+static void writeBuiltin(FILE *out, INSTR *pc, const char *call)
+{
+    char first[32];
+    char second[32];
+
+    snprintf(first, sizeof(first), "R[%u]", pc->b);
+    snprintf(second, sizeof(second), "R[%u]", pc->b + 1);
+
+    fprintf(out, "    R[%u] = ", (unsigned) pc->a);
+    for (const char *s = call; *s != '\0'; s++)
+    {
+        if (s[0] == '$' && (s[1] == '1' || s[1] == '2'))
+        {
+            fputs(*++s == '1' ? first : second, out);
+        }
+        else if (s[0] == '$' && s[1] == 'L')
+        {
+            fprintf(out, "R + %u, %u", pc->b, pc->c);
+            s++;
+        }
+        else
+        {
+            fputc(*s, out);
+        }
+    }
+    fputs(";\n", out);
+}
+
+static void writeReduction(FILE *out, INSTR *pc, const char *type, const char *field,
+                           const char *reduce, const char *op, const char *step, const char *init)
+{
+    if (pc->c > 0 && pc->c < REDUCE_MIN_OPERANDS)
+    {
+        writeFold(out, pc, type, field, step, init);
+        return;
+    }
+
+    fprintf(out, "    R[%u] = (RET_VAL) {%s, .%s = %s(%s, R + %u, %u)};\n",
+            (unsigned) pc->a, type, field, reduce, op, pc->b, pc->c);
+}
+
+// Writes the C of the instruction at pc into the function of region.
+static void writeInstr(FILE *out, REGION *region, INSTR *pc)
+{
+    CHUNK *chunk = region->chunk;
+    FUNCTION *function;
+
+    switch ((OPCODE) pc->op)
+    {
+        case OP_LOADK:
+            fprintf(out, "    R[%u] = ", (unsigned) pc->a);
+            writeValue(out, chunk->constants[pc->b]);
+            fputs(";\n", out);
+            break;
+        case OP_MOVE:
+            fprintf(out, "    R[%u] = R[%u];\n", (unsigned) pc->a, pc->b);
+            break;
+        case OP_UNBIND:
+            if (pc->c > 4)
+            {
+                fprintf(out, "    for (int i = %u; i < %u; i++)\n    {\n        R[i].type = UNBOUND_TYPE;\n    }\n",
+                        (unsigned) pc->a, pc->a + pc->c);
+                break;
+            }
+            for (uint32_t i = 0; i < pc->c; i++)
+            {
+                fprintf(out, "    R[%u].type = UNBOUND_TYPE;\n", pc->a + i);
+            }
+            break;
+        case OP_LOADSYM:
+            writeFrame(out, pc);
+            if (pc->c >= chunk->thunkLen)
+            {
+                fprintf(out, "    R[%u] = frame->R[%u];\n", (unsigned) pc->a, pc->b);
+                break;
+            }
+            fprintf(out, "    R[%u] = frame->R[%u].type < UNBOUND_TYPE ? frame->R[%u]\n"
+                         "            : aotLoad(frame->R + %u, frame, expr%u_t%u, ",
+                    (unsigned) pc->a, pc->b, pc->b, pc->b, region->expression, pc->c);
+            writeString(out, chunk->thunks[pc->c].name, strlen(chunk->thunks[pc->c].name), "");
+            fprintf(out, ", %u);\n", region->activationCap);
+            break;
+        case OP_BIND:
+            if (pc->c == NO_TYPE)
+            {
+                fprintf(out, "    R[%u] = R[%u];\n", (unsigned) pc->a, pc->b);
+            }
+            else
+            {
+                fprintf(out, "    R[%u] = castBindingValue(R[%u], %s);\n", (unsigned) pc->a, pc->b, typeName(pc->c));
+            }
+            fputs("    aotActive--;\n    return;\n", out);
+            break;
+        case OP_UNDEF:
+            fputs("    warning(", out);
+            writeString(out, vmMessages[pc->c], strlen(vmMessages[pc->c]), "");
+            fputs(", ", out);
+            writeString(out, chunk->names[pc->b], strlen(chunk->names[pc->b]), "");
+            fprintf(out, ");\n    R[%u] = NAN_RET_VAL;\n", (unsigned) pc->a);
+            break;
+        case OP_WARN:
+            fputs("    warning(\"%s\", ", out);
+            writeString(out, vmMessages[pc->b], strlen(vmMessages[pc->b]), "");
+            fputs(");\n", out);
+            break;
+        case OP_JUMP:
+            fprintf(out, "    goto L%u;\n", pc->b);
+            break;
+        case OP_JUMPF:
+            fprintf(out, "    if (isZero(R[%u]))\n    {\n        goto L%u;\n    }\n", (unsigned) pc->a, pc->b);
+            break;
+        case OP_CALL:
+            function = &chunk->functions[pc->c];
+            fprintf(out, "    if (aotTop == aotFrames + MAX_CALL_DEPTH + 1 || aotActive == %u || aotSp + %u > AOT_STACK_END)\n"
+                         "    {\n        R[%u] = stackOverflowValue();\n    }\n    else\n    {\n",
+                    region->activationCap, function->nRegs, (unsigned) pc->a);
+            fputs("    ", out);
+            writeFrame(out, pc);
+            for (uint32_t i = 0; i < function->nParams; i++)
+            {
+                fprintf(out, "        aotSp[%u] = R[%u];\n", i, pc->b + i);
+            }
+            fprintf(out, "        *aotTop = (AOT_FRAME) {aotSp, frame};\n"
+                         "        aotActive++;\n        aotSp += %u;\n", function->nRegs);
+            if (function->type == NO_TYPE)
+            {
+                fprintf(out, "        R[%u] = expr%u_f%u(aotTop++);\n    }\n", (unsigned) pc->a, region->expression, pc->c);
+            }
+            else
+            {
+                fprintf(out, "        R[%u] = castReturnValue(expr%u_f%u(aotTop++), %s);\n    }\n",
+                        (unsigned) pc->a, region->expression, pc->c, typeName(function->type));
+            }
+            break;
+        case OP_TAILCALL:
+            // the callee returns to the caller of this function, through the
+            // compiler's sibling call unless it is this function again
+            function = &chunk->functions[pc->c];
+            fprintf(out, "    if (R + %u > AOT_STACK_END)\n    {\n        R[%u] = stackOverflowValue();\n    }\n    else\n    {\n",
+                    function->nRegs, (unsigned) pc->a);
+            fputs("    ", out);
+            writeFrame(out, pc);
+            fprintf(out, "        memmove(R, R + %u, %u * sizeof(RET_VAL));\n        fp->link = frame;\n"
+                         "        aotSp = R + %u;\n", pc->b, function->nParams, function->nRegs);
+            if (pc->c == region->function)
+            {
+                fputs("        goto start;\n    }\n", out);
+            }
+            else
+            {
+                fprintf(out, "        return expr%u_f%u(fp);\n    }\n", region->expression, pc->c);
+            }
+            break;
+        case OP_RET:
+            // the main code returns from the chunk, lambdas to their caller
+            if (region->function != 0)
+            {
+                fputs("    aotSp = R;\n    aotTop = fp;\n    aotActive--;\n", out);
+            }
+            fprintf(out, "    return R[%u];\n", (unsigned) pc->a);
+            break;
+
+        case OP_NEG:
+            writeBuiltin(out, pc, "numberNeg($1)");
+            break;
+        case OP_ABS:
+            writeBuiltin(out, pc, "numberAbs($1)");
+            break;
+        case OP_ADD:
+            writeBuiltin(out, pc, "reduceValues(REDUCE_SUM, $L)");
+            break;
+        case OP_SUB:
+            writeBuiltin(out, pc, "numberSub($1, $2)");
+            break;
+        case OP_MULT:
+            writeBuiltin(out, pc, "reduceValues(REDUCE_PRODUCT, $L)");
+            break;
+        case OP_DIV:
+            writeBuiltin(out, pc, "numberDiv($1, $2)");
+            break;
+        case OP_REM:
+            writeBuiltin(out, pc, "numberRem($1, $2)");
+            break;
+        case OP_EXP:
+            writeBuiltin(out, pc, "numberExp($1)");
+            break;
+        case OP_EXP2:
+            writeBuiltin(out, pc, "numberExp2($1)");
+            break;
+        case OP_POW:
+            writeBuiltin(out, pc, "numberPow($1, $2)");
+            break;
+        case OP_LOG:
+            writeBuiltin(out, pc, "numberLog($1)");
+            break;
+        case OP_SQRT:
+            writeBuiltin(out, pc, "numberSqrt($1)");
+            break;
+        case OP_CBRT:
+            writeBuiltin(out, pc, "numberCbrt($1)");
+            break;
+        case OP_HYPOT:
+            writeBuiltin(out, pc, "numberSqrt(reduceValues(REDUCE_SQUARES, $L))");
+            break;
+        case OP_MAX:
+            writeBuiltin(out, pc, "reduceValues(REDUCE_MAX, $L)");
+            break;
+        case OP_MIN:
+            writeBuiltin(out, pc, "reduceValues(REDUCE_MIN, $L)");
+            break;
+        case OP_EQUAL:
+            writeBuiltin(out, pc, "compareEqual($1, $2)");
+            break;
+        case OP_LESS:
+            writeBuiltin(out, pc, "compareLess($1, $2)");
+            break;
+        case OP_GREATER:
+            writeBuiltin(out, pc, "compareGreater($1, $2)");
+            break;
+        case OP_RAND:
+            writeBuiltin(out, pc, "evalRandFunc()");
+            break;
+        case OP_READ:
+            writeBuiltin(out, pc, "evalReadFunc()");
+            break;
+        case OP_PRINT:
+            fprintf(out, "    printRetVal(R[%u]);\n", pc->b);
+            writeBuiltin(out, pc, "$1");
+            break;
+        case OP_VECTOR:
+            writeBuiltin(out, pc, "vectorMake($L)");
+            break;
+        case OP_SUM:
+            writeBuiltin(out, pc, "vectorSum($1)");
+            break;
+        case OP_DOT:
+            writeBuiltin(out, pc, "vectorDot($1, $2)");
+            break;
+        case OP_MEAN:
+            writeBuiltin(out, pc, "vectorMean($1)");
+            break;
+
+        case OP_ABS_INT:
+            writeBuiltin(out, pc, "(RET_VAL) {INT_TYPE, .ival = intAbs($1.ival)}");
+            break;
+        case OP_ABS_DOUBLE:
+            writeBuiltin(out, pc, "(RET_VAL) {DOUBLE_TYPE, .value = fabs($1.value)}");
+            break;
+        case OP_ADD_INT:
+            writeReduction(out, pc, "INT_TYPE", "ival", "reduceIntValues", "REDUCE_SUM", "intAdd", "INT64_C(0)");
+            break;
+        case OP_ADD_DOUBLE:
+            writeReduction(out, pc, "DOUBLE_TYPE", "value", "reduceDoubleValues", "REDUCE_SUM", "+", "0.0");
+            break;
+        case OP_SUB_INT:
+            writeBuiltin(out, pc, "(RET_VAL) {INT_TYPE, .ival = intSub($1.ival, $2.ival)}");
+            break;
+        case OP_SUB_DOUBLE:
+            writeBuiltin(out, pc, "(RET_VAL) {DOUBLE_TYPE, .value = $1.value - $2.value}");
+            break;
+        case OP_MULT_INT:
+            writeReduction(out, pc, "INT_TYPE", "ival", "reduceIntValues", "REDUCE_PRODUCT", "intMult", "INT64_C(1)");
+            break;
+        case OP_MULT_DOUBLE:
+            writeReduction(out, pc, "DOUBLE_TYPE", "value", "reduceDoubleValues", "REDUCE_PRODUCT", "*", "1.0");
+            break;
+        case OP_DIV_INT:
+            writeBuiltin(out, pc, "(RET_VAL) {INT_TYPE, .ival = intDiv($1.ival, $2.ival)}");
+            break;
+        case OP_DIV_DOUBLE:
+            writeBuiltin(out, pc, "(RET_VAL) {DOUBLE_TYPE, .value = $1.value / $2.value}");
+            break;
+        case OP_REM_INT:
+            writeBuiltin(out, pc, "(RET_VAL) {INT_TYPE, .ival = intRem($1.ival, $2.ival)}");
+            break;
+        case OP_REM_DOUBLE:
+            writeBuiltin(out, pc, "(RET_VAL) {DOUBLE_TYPE, .value = doubleRem($1.value, $2.value)}");
+            break;
+        case OP_POW_INT:
+            writeBuiltin(out, pc, "(RET_VAL) {INT_TYPE, .ival = intPow($1.ival, $2.ival)}");
+            break;
+        case OP_POW_DOUBLE:
+            writeBuiltin(out, pc, "(RET_VAL) {DOUBLE_TYPE, .value = pow($1.value, $2.value)}");
+            break;
+        case OP_MAX_INT:
+            writeBuiltin(out, pc, "(RET_VAL) {INT_TYPE, .ival = reduceIntValues(REDUCE_MAX, $L)}");
+            break;
+        case OP_MAX_DOUBLE:
+            writeReduction(out, pc, "DOUBLE_TYPE", "value", "reduceDoubleValues", "REDUCE_MAX", "doubleMax", NULL);
+            break;
+        case OP_MIN_INT:
+            writeBuiltin(out, pc, "(RET_VAL) {INT_TYPE, .ival = reduceIntValues(REDUCE_MIN, $L)}");
+            break;
+        case OP_MIN_DOUBLE:
+            writeReduction(out, pc, "DOUBLE_TYPE", "value", "reduceDoubleValues", "REDUCE_MIN", "doubleMin", NULL);
+            break;
+
+        default:
+            yyerror("Invalid opcode %d!", pc->op);
+    }
+}
+
+// Writes the function running the instructions of a region, from first to end.
+static void writeRegion(FILE *out, REGION *region, uint32_t first, uint32_t end, bool *targets)
+{
+    CHUNK *chunk = region->chunk;
+    bool link = false;
+    bool selfCall = false;
+
+    // labels go where jumps go
+    for (uint32_t at = first; at < end; at++)
+    {
+        INSTR *pc = &chunk->code[at];
+
+        switch (pc->op)
+        {
+            case OP_JUMP:
+            case OP_JUMPF:
+                targets[pc->b] = true;
+                break;
+            case OP_TAILCALL:
+                selfCall = selfCall || pc->c == region->function;
+                // fall through
+            case OP_LOADSYM:
+            case OP_CALL:
+                link = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    fputs("{\n", out);
+    if (region->function == 0)
+    {
+        fputs("    RET_VAL *R = aotStack;\n    AOT_FRAME *fp = aotFrames;\n", out);
+    }
+    else
+    {
+        fputs("    RET_VAL *R = fp->R;\n", out);
+    }
+    if (link)
+    {
+        fputs("    AOT_FRAME *frame;\n", out);
+    }
+    fputs("\n", out);
+    if (region->function == 0)
+    {
+        fprintf(out, "    runtime->stackOverflow = false;\n"
+                     "    if (R + %u > AOT_STACK_END)\n    {\n        return stackOverflowValue();\n    }\n"
+                     "    *fp = (AOT_FRAME) {R, NULL};\n"
+                     "    aotTop = fp + 1;\n    aotSp = R + %u;\n    aotActive = 0;\n\n",
+                chunk->functions[0].nRegs, chunk->functions[0].nRegs);
+    }
+    if (selfCall)
+    {
+        fputs("start:\n", out);
+    }
+
+    for (uint32_t at = first; at < end; at++)
+    {
+        if (targets[at])
+        {
+            fprintf(out, "L%u:\n", at);
+        }
+        writeInstr(out, region, &chunk->code[at]);
+    }
+    fputs("}\n", out);
+}
+
+void emitChunk(CHUNK *chunk)
+{
+    FILE *out = emitOut;
+    REGION region = {chunk, ++expressions};
+    uint32_t *thunkAt;
+    uint32_t *functionAt;
+    bool *used;
+    bool *targets;
+
+    replayCapture();
+    fprintf(emitMain, "    aotPrint(expr%u());\n", region.expression);
+
+    // the activations the VM allows the chunk, see struct vm_stacks in vm.c
+    region.activationCap = MAX_CALL_DEPTH + chunk->thunkLen;
+
+    // The main code, each lambda and each thunk of a binding that is not a lambda
+    // become a function of their own, unless nothing calls or loads them. Lambda
+    // thunks start where their function does.
+    thunkAt = malloc(chunk->codeLen * sizeof(uint32_t));
+    functionAt = malloc(chunk->codeLen * sizeof(uint32_t));
+    used = calloc(chunk->codeLen, sizeof(bool));
+    targets = calloc(chunk->codeLen, sizeof(bool));
+    if (thunkAt == NULL || functionAt == NULL || used == NULL || targets == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+    memset(thunkAt, 0xff, chunk->codeLen * sizeof(uint32_t));
+    memset(functionAt, 0xff, chunk->codeLen * sizeof(uint32_t));
+    for (uint32_t i = 0; i < chunk->functionLen; i++)
+    {
+        functionAt[chunk->functions[i].pc] = i;
+    }
+    for (uint32_t i = 0; i < chunk->thunkLen; i++)
+    {
+        if (functionAt[chunk->thunks[i].pc] == UINT32_MAX)
+        {
+            thunkAt[chunk->thunks[i].pc] = i;
+        }
+    }
+    // Only the regions reachable from the main code are written, found by
+    // scanning those already reached until no new one turns up.
+    used[0] = true;
+    for (bool changed = true; changed;)
+    {
+        bool live = false;
+
+        changed = false;
+        for (uint32_t at = 0; at < chunk->codeLen; at++)
+        {
+            INSTR *pc = &chunk->code[at];
+            uint32_t callee = UINT32_MAX;
+
+            if (at == 0 || functionAt[at] != UINT32_MAX || thunkAt[at] != UINT32_MAX)
+            {
+                live = used[at];
+            }
+            if (!live)
+            {
+                continue;
+            }
+            if (pc->op == OP_LOADSYM && pc->c < chunk->thunkLen)
+            {
+                callee = chunk->thunks[pc->c].pc;
+            }
+            else if (pc->op == OP_CALL || pc->op == OP_TAILCALL)
+            {
+                callee = chunk->functions[pc->c].pc;
+            }
+            if (callee != UINT32_MAX && !used[callee])
+            {
+                used[callee] = true;
+                changed = true;
+            }
+        }
+    }
+
+    fputc('\n', out);
+    for (uint32_t at = 1; at < chunk->codeLen; at++)
+    {
+        if (used[at] && functionAt[at] != UINT32_MAX)
+        {
+            fprintf(out, "static RET_VAL expr%u_f%u(AOT_FRAME *fp);\n", region.expression, functionAt[at]);
+        }
+        else if (used[at] && thunkAt[at] != UINT32_MAX)
+        {
+            fprintf(out, "static void expr%u_t%u(AOT_FRAME *fp);\n", region.expression, thunkAt[at]);
+        }
+    }
+
+    for (uint32_t first = 0, end; first < chunk->codeLen; first = end)
+    {
+        end = first + 1;
+        while (end < chunk->codeLen && functionAt[end] == UINT32_MAX && thunkAt[end] == UINT32_MAX)
+        {
+            end++;
+        }
+        if (!used[first])
+        {
+            continue;
+        }
+
+        region.function = functionAt[first];
+        if (region.function == 0)
+        {
+            fprintf(out, "\nstatic RET_VAL expr%u(void)\n", region.expression);
+        }
+        else if (region.function != UINT32_MAX)
+        {
+            fprintf(out, "\nstatic RET_VAL expr%u_f%u(AOT_FRAME *fp)\n", region.expression, region.function);
+        }
+        else
+        {
+            fprintf(out, "\nstatic void expr%u_t%u(AOT_FRAME *fp)\n", region.expression, thunkAt[first]);
+        }
+        writeRegion(out, &region, first, end, targets);
+    }
+
+    free(thunkAt);
+    free(functionAt);
+    free(used);
+    free(targets);
+}
@@ -0,0 +1,160 @@
+#include "cilisp.h"
+
+// How many operands a builtin is pure with: exactly as many as its eval helper
+// uses, so evaluating it never warns about missing or extra operands.
+// Must be in sync with FUNC_TYPE; rand, read, print and custom functions have
+// effects or depend on more than their operands, so they are never pure.
+typedef enum pure_arity {
+    NOT_PURE,
+    UNARY_PURE,
+    BINARY_PURE,
+    VARIADIC_PURE,
+    LIST_PURE // any number of operands, none included
+} PURE_ARITY;
+
+static const PURE_ARITY pureArity[] = {
+        [NEG_FUNC]     = UNARY_PURE,
+        [ABS_FUNC]     = UNARY_PURE,
+        [ADD_FUNC]     = VARIADIC_PURE,
+        [SUB_FUNC]     = BINARY_PURE,
+        [MULT_FUNC]    = VARIADIC_PURE,
+        [DIV_FUNC]     = BINARY_PURE,
+        [REM_FUNC]     = BINARY_PURE,
+        [EXP_FUNC]     = UNARY_PURE,
+        [EXP2_FUNC]    = UNARY_PURE,
+        [POW_FUNC]     = BINARY_PURE,
+        [LOG_FUNC]     = UNARY_PURE,
+        [SQRT_FUNC]    = UNARY_PURE,
+        [CBRT_FUNC]    = UNARY_PURE,
+        [HYPOT_FUNC]   = VARIADIC_PURE,
+        [MAX_FUNC]     = VARIADIC_PURE,
+        [MIN_FUNC]     = VARIADIC_PURE,
+        [EQUAL_FUNC]   = BINARY_PURE,
+        [LESS_FUNC]    = BINARY_PURE,
+        [GREATER_FUNC] = BINARY_PURE,
+        [RAND_FUNC]    = NOT_PURE,
+        [READ_FUNC]    = NOT_PURE,
+        [PRINT_FUNC]   = NOT_PURE,
+        [VECTOR_FUNC]  = LIST_PURE,
+        [SUM_FUNC]     = UNARY_PURE,
+        [DOT_FUNC]     = BINARY_PURE,
+        [MEAN_FUNC]    = UNARY_PURE,
+        [CUSTOM_FUNC]  = NOT_PURE
+};
+
+bool isPureBuiltin(AST_NODE *node)
+{
+    int n = 0;
+
+    for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+    {
+        n++;
+    }
+
+    switch (pureArity[node->data.function.func])
+    {
+        case NOT_PURE:
+            return false;
+        case UNARY_PURE:
+            return n == 1;
+        case BINARY_PURE:
+            return n == 2;
+        case VARIADIC_PURE:
+            return n > 0;
+        case LIST_PURE:
+            return true;
+    }
+
+    return false;
+}
+
+static void foldNode(AST_NODE *node);
+
+// Turns node into a copy of with, keeping its place in the tree and in the input.
+static void replaceNode(AST_NODE *node, AST_NODE *with)
+{
+    AST_NODE *parent = node->parent;
+    SYMBOL_TABLE_NODE *symbolTable = node->symbolTable;
+    AST_NODE *next = node->next;
+    SOURCE_LOCATION location = node->location;
+
+    *node = *with;
+    node->parent = parent;
+    node->symbolTable = symbolTable;
+    node->next = next;
+    node->location = location;
+}
+
+static void foldFuncNode(AST_NODE *node)
+{
+    bool constant = true;
+
+    for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+    {
+        foldNode(op);
+        constant = constant && op->type == NUM_NODE_TYPE;
+    }
+
+    if (!constant || !isPureBuiltin(node))
+    {
+        return;
+    }
+
+    // the operands are numbers, so the eval helper needs no environment
+    node->data.number = evalFuncNode(node, NULL);
+    node->type = NUM_NODE_TYPE;
+}
+
+static void foldCondNode(AST_NODE *node)
+{
+    AST_NODE *cond = node->data.condition.condition;
+    AST_NODE *branch;
+
+    foldNode(cond);
+
+    if (cond->type != NUM_NODE_TYPE)
+    {
+        foldNode(node->data.condition._true);
+        foldNode(node->data.condition._false);
+        return;
+    }
+
+    // same test as eval
+    branch = isZero(cond->data.number) ? node->data.condition._false : node->data.condition._true;
+    foldNode(branch);
+    replaceNode(node, branch);
+}
+
+static void foldNode(AST_NODE *node)
+{
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+        case SYM_NODE_TYPE:
+            break;
+        case FUNC_NODE_TYPE:
+            foldFuncNode(node);
+            break;
+        case SCOPE_NODE_TYPE:
+            for (SYMBOL_TABLE_NODE *symbol = node->data.scope.child->symbolTable; symbol != NULL; symbol = symbol->next)
+            {
+                foldNode(symbol->value);
+            }
+            foldNode(node->data.scope.child);
+            break;
+        case CONDITIONAL_NODE_TYPE:
+            foldCondNode(node);
+            break;
+        case LAMBDA_NODE_TYPE:
+            foldNode(node->data.lambda.body);
+            break;
+    }
+}
+
+// Replaces the pure builtins whose operands are all constant by their value, and
+// conds whose condition is constant by the branch they take. Runs before
+// resolveProgram, which sees the pruned tree.
+void foldProgram(AST_NODE *node)
+{
+    foldNode(node);
+}
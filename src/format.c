@@ -0,0 +1,393 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "format.h"
+#include "format_table.h"
+
+static const char digitPairs[200] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+static int digitCount(uint64_t value)
+{
+    int count = 1;
+
+    for (uint64_t power = 10; count < 20 && value >= power; power *= 10)
+    {
+        count++;
+    }
+    return count;
+}
+
+// Writes the digits of value backwards from end, and returns where they start.
+static char *putDigits(char *end, uint64_t value)
+{
+    while (value >= 100)
+    {
+        end -= 2;
+        memcpy(end, digitPairs + value % 100 * 2, 2);
+        value /= 100;
+    }
+    if (value >= 10)
+    {
+        end -= 2;
+        memcpy(end, digitPairs + value * 2, 2);
+    }
+    else
+    {
+        *--end = (char) ('0' + value);
+    }
+    return end;
+}
+
+int formatInt(char *buffer, int64_t value)
+{
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t) value : (uint64_t) value;
+    int len = (value < 0) + digitCount(magnitude);
+
+    buffer[0] = '-';
+    putDigits(buffer + len, magnitude);
+    return len;
+}
+
+// inf, signed as printf signs it, and nan, never signed: the sign of a nan is
+// that of whichever operand the compiler, the JIT or the C compiler of --emit-c
+// happened to put first, so printing it would make the modes differ.
+static int formatSpecial(char *buffer, double value)
+{
+    int len = 0;
+
+    if (signbit(value) && !isnan(value))
+    {
+        buffer[len++] = '-';
+    }
+    memcpy(buffer + len, isnan(value) ? "nan" : "inf", 3);
+    return len + 3;
+}
+
+int formatFixed(char *buffer, double value)
+{
+    double magnitude = fabs(value);
+    uint64_t integer, fraction;
+    int len = 0;
+
+    if (!isfinite(value))
+    {
+        return formatSpecial(buffer, value);
+    }
+
+    if (magnitude < 0x1p52 / 1e6)
+    {
+        // Veltkamp's split of magnitude into two halves of 26 bits, which times
+        // 10^6, of 14 bits, are exact: scaled + error is magnitude * 10^6.
+        double split = 134217729.0 * magnitude;
+        double high = split - (split - magnitude);
+        double scaledHigh = high * 1e6;
+        double scaledLow = (magnitude - high) * 1e6;
+        double scaled = scaledHigh + scaledLow;
+        double error = scaledLow - (scaled - scaledHigh);
+        // rounded to an integer, half to even, by the addition, as scaled < 2^52
+        double rounded = (scaled + 0x1p52) - 0x1p52;
+
+        // scaled is halfway only if rounding made it so
+        if (scaled - rounded == 0.5 && error > 0)
+        {
+            rounded++;
+        }
+        else if (scaled - rounded == -0.5 && error < 0)
+        {
+            rounded--;
+        }
+        integer = (uint64_t) rounded / 1000000;
+        fraction = (uint64_t) rounded % 1000000;
+    }
+    else if (magnitude < 0x1p64 && magnitude == trunc(magnitude))
+    {
+        // as every double from 2^52 on is
+        integer = (uint64_t) magnitude;
+        fraction = 0;
+    }
+    else
+    {
+        return snprintf(buffer, FORMAT_SIZE, "%lf", value);
+    }
+
+    if (signbit(value))
+    {
+        buffer[len++] = '-';
+    }
+    len += digitCount(integer);
+    putDigits(buffer + len, integer);
+    // the fraction, after a 1 that makes it 7 digits, which the point replaces
+    putDigits(buffer + len + 7, fraction + 1000000)[0] = '.';
+    return len + 7;
+}
+
+// Ryu's algorithm, see format_table.h: the shortest decimal in the interval of
+// the reals that round to a double, or the one nearest to it of those as short.
+
+static int pow5Bits(int e)
+{
+    return ((e * 1217359) >> 19) + 1;
+}
+
+static int log10Pow2(int e)
+{
+    return (e * 78913) >> 18;
+}
+
+static int log10Pow5(int e)
+{
+    return (e * 732923) >> 20;
+}
+
+static bool multipleOfPow5(uint64_t value, int p)
+{
+    int count = 0;
+
+    while (value % 5 == 0 && count < p)
+    {
+        value /= 5;
+        count++;
+    }
+    return count >= p;
+}
+
+static bool multipleOfPow2(uint64_t value, int p)
+{
+    return (value & ((UINT64_C(1) << p) - 1)) == 0;
+}
+
+static uint64_t mulShift(uint64_t m, const uint64_t *mul, int shift)
+{
+    unsigned __int128 low = (unsigned __int128) m * mul[0];
+    unsigned __int128 high = (unsigned __int128) m * mul[1];
+
+    return (uint64_t) (((low >> 64) + high) >> (shift - 64));
+}
+
+// The digits of a finite, positive double, times 10^*exponent.
+static uint64_t shortestDigits(uint64_t bits, int *exponent)
+{
+    uint64_t ieeeMantissa = bits & ((UINT64_C(1) << 52) - 1);
+    int ieeeExponent = (int) (bits >> 52 & 0x7ff);
+    // the double is m2 * 2^e2, and its interval, times 4, is (4 * m2 - 1 - mmShift, 4 * m2 + 2)
+    int e2 = (ieeeExponent == 0 ? 1 : ieeeExponent) - 1023 - 52 - 2;
+    uint64_t m2 = ieeeExponent == 0 ? ieeeMantissa : UINT64_C(1) << 52 | ieeeMantissa;
+    bool acceptBounds = (m2 & 1) == 0;
+    uint64_t mv = 4 * m2;
+    int mmShift = ieeeMantissa != 0 || ieeeExponent <= 1;
+    bool vmTrailingZeros = false;
+    bool vrTrailingZeros = false;
+    uint64_t vr, vp, vm, output;
+    int e10, removed = 0, lastRemoved = 0;
+
+    // small integers are their own digits
+    if (e2 + 2 <= 0 && e2 + 2 >= -52 && multipleOfPow2(m2, -(e2 + 2)))
+    {
+        output = m2 >> -(e2 + 2);
+        for (*exponent = 0; output % 10 == 0; (*exponent)++)
+        {
+            output /= 10;
+        }
+        return output;
+    }
+
+    // vr, vp and vm are the double and the ends of its interval, times 10^-e10
+    if (e2 >= 0)
+    {
+        int q = log10Pow2(e2) - (e2 > 3);
+        int shift = -e2 + q + POW5_INV_BITS + pow5Bits(q) - 1;
+
+        e10 = q;
+        vr = mulShift(4 * m2, POW5_INV_SPLIT[q], shift);
+        vp = mulShift(4 * m2 + 2, POW5_INV_SPLIT[q], shift);
+        vm = mulShift(4 * m2 - 1 - mmShift, POW5_INV_SPLIT[q], shift);
+        if (q <= 21)
+        {
+            if (mv % 5 == 0)
+            {
+                vrTrailingZeros = multipleOfPow5(mv, q);
+            }
+            else if (acceptBounds)
+            {
+                vmTrailingZeros = multipleOfPow5(mv - 1 - mmShift, q);
+            }
+            else
+            {
+                vp -= multipleOfPow5(mv + 2, q);
+            }
+        }
+    }
+    else
+    {
+        int q = log10Pow5(-e2) - (-e2 > 1);
+        int i = -e2 - q;
+        int shift = q - (pow5Bits(i) - POW5_BITS);
+
+        e10 = q + e2;
+        vr = mulShift(4 * m2, POW5_SPLIT[i], shift);
+        vp = mulShift(4 * m2 + 2, POW5_SPLIT[i], shift);
+        vm = mulShift(4 * m2 - 1 - mmShift, POW5_SPLIT[i], shift);
+        if (q <= 1)
+        {
+            // mv has at least q trailing zeros, with its factor 4
+            vrTrailingZeros = true;
+            if (acceptBounds)
+            {
+                vmTrailingZeros = mmShift == 1;
+            }
+            else
+            {
+                vp--;
+            }
+        }
+        else if (q < 63)
+        {
+            vrTrailingZeros = multipleOfPow2(mv, q);
+        }
+    }
+
+    // drops the digits that vp and vm do not need, rounding vr
+    if (vmTrailingZeros || vrTrailingZeros)
+    {
+        // rare: an end of the interval, or vr, may be exact
+        while (vp / 10 > vm / 10)
+        {
+            vmTrailingZeros &= vm % 10 == 0;
+            vrTrailingZeros &= lastRemoved == 0;
+            lastRemoved = (int) (vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vmTrailingZeros)
+        {
+            while (vm % 10 == 0)
+            {
+                vrTrailingZeros &= lastRemoved == 0;
+                lastRemoved = (int) (vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        if (vrTrailingZeros && lastRemoved == 5 && vr % 2 == 0)
+        {
+            // exactly halfway: to even
+            lastRemoved = 4;
+        }
+        output = vr + ((vr == vm && (!acceptBounds || !vmTrailingZeros)) || lastRemoved >= 5);
+    }
+    else
+    {
+        bool roundUp = false;
+
+        if (vp / 100 > vm / 100)
+        {
+            roundUp = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        while (vp / 10 > vm / 10)
+        {
+            roundUp = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || roundUp);
+    }
+
+    *exponent = e10 + removed;
+    return output;
+}
+
+int formatShortest(char *buffer, double value)
+{
+    uint64_t bits, digits;
+    int exponent, count, point, len = 0;
+    char text[20];
+
+    if (!isfinite(value))
+    {
+        return formatSpecial(buffer, value);
+    }
+
+    if (signbit(value))
+    {
+        buffer[len++] = '-';
+    }
+    if (value == 0)
+    {
+        memcpy(buffer + len, "0.0", 3);
+        return len + 3;
+    }
+
+    memcpy(&bits, &value, sizeof(bits));
+    digits = shortestDigits(bits & ~(UINT64_C(1) << 63), &exponent);
+    count = digitCount(digits);
+    putDigits(text + count, digits);
+    // value is 0.digits * 10^point
+    point = count + exponent;
+
+    if (point <= -4 || point > 16)
+    {
+        buffer[len++] = text[0];
+        if (count > 1)
+        {
+            buffer[len++] = '.';
+            memcpy(buffer + len, text + 1, count - 1);
+            len += count - 1;
+        }
+        buffer[len++] = 'e';
+        buffer[len++] = point - 1 < 0 ? '-' : '+';
+        point = abs(point - 1);
+        if (point < 10)
+        {
+            // two digits at least
+            buffer[len++] = '0';
+        }
+        len += formatInt(buffer + len, point);
+    }
+    else if (point <= 0)
+    {
+        memcpy(buffer + len, "0.000", 2 - point);
+        len += 2 - point;
+        memcpy(buffer + len, text, count);
+        len += count;
+    }
+    else if (point >= count)
+    {
+        memcpy(buffer + len, text, count);
+        len += count;
+        memset(buffer + len, '0', point - count);
+        len += point - count;
+        memcpy(buffer + len, ".0", 2);
+        len += 2;
+    }
+    else
+    {
+        memcpy(buffer + len, text, point);
+        buffer[len + point] = '.';
+        memcpy(buffer + len + point + 1, text + point, count - point);
+        len += count + 1;
+    }
+
+    return len;
+}
@@ -0,0 +1,21 @@
+#ifndef __format_h_
+#define __format_h_
+
+#include <stdint.h>
+
+// Numbers written as text without printf, for the output of output.c. Each
+// function writes into buffer without a NUL and returns the length.
+
+// Room for any number written here: "%lf" writes all 309 digits of the integer
+// part of DBL_MAX.
+#define FORMAT_SIZE 320
+
+int formatInt(char *buffer, int64_t value);
+// As printf's "%lf" writes value, with six decimals, rounded the same way, but
+// for nan, which is never signed.
+int formatFixed(char *buffer, double value);
+// The fewest digits that read back as value, laid out as Python's repr() does:
+// 3.0, 0.1, 1e-05, 1e+16.
+int formatShortest(char *buffer, double value);
+
+#endif
@@ -0,0 +1,759 @@
+// MAP_ANONYMOUS is not part of plain C11 and POSIX
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+#include "reduce.h"
+
+#if JIT_AVAILABLE
+
+#include <sys/mman.h>
+
+// Executable memory for the lambdas of one expression, reused by the next one.
+#define JIT_REGION_SIZE ((size_t) 1 << 20)
+#define JIT_CODE_ALIGN 16
+#define INITIAL_CODE_SIZE 1024
+
+// Generated functions follow the System V calling convention: args comes in rdi,
+// depth in rsi, and the result goes back in xmm0. Their frame holds the
+// parameters and the remaining depth below rbp, and the temporaries that
+// operands are spilled to above rsp:
+//
+//     [rbp - 8 * (i + 1)]         parameter i
+//     [rbp - 8 * (nParams + 1)]   depth
+//     [rsp + 8 * i]               temporary i
+//
+// Every node leaves its value in xmm0, and may clobber xmm1, rax and the
+// temporaries from the first one it is given.
+
+typedef enum base {
+    BASE_RSP = 4,
+    BASE_RBP = 5,
+    BASE_RDI = 7
+} BASE;
+
+enum {
+    XMM0,
+    XMM1
+};
+
+// SSE2 opcodes, after the 0x0F escape.
+enum {
+    SSE_MOVAPD = 0x28,
+    SSE_UCOMISD = 0x2E,
+    SSE_MOVMSKPD = 0x50,
+    SSE_SQRTSD = 0x51,
+    SSE_ANDPD = 0x54,
+    SSE_XORPD = 0x57,
+    SSE_ADDSD = 0x58,
+    SSE_MULSD = 0x59,
+    SSE_SUBSD = 0x5C,
+    SSE_DIVSD = 0x5E,
+    SSE_CMPSD = 0xC2
+};
+
+// Prefixes selecting the packed double (66) or scalar double (F2) form.
+#define PD 0x66
+#define SD 0xF2
+
+// Condition codes of jcc rel32, after the 0x0F escape; JMP is a plain jmp.
+enum {
+    JMP = 0,
+    JB = 0x82,
+    JE = 0x84,
+    JNE = 0x85,
+    JP = 0x8A
+};
+
+// Predicates of cmpsd.
+enum {
+    CMP_EQ = 0,
+    CMP_LT = 1
+};
+
+typedef struct jit {
+    uint8_t *code;
+    size_t len;
+    size_t cap;
+    SYMBOL_TABLE_NODE *symbol; // the lambda being compiled
+    int nParams;
+    int temps; // temporaries used so far
+    size_t body; // where tail calls jump back to
+} JIT;
+
+// Reused for every lambda compiled on this thread, like the compiler's chunk.
+static _Thread_local JIT jit;
+
+static _Thread_local uint8_t *region;
+static _Thread_local size_t regionUsed;
+
+static bool genNode(JIT *j, AST_NODE *node, int temp);
+
+static void emitBytes(JIT *j, const uint8_t *bytes, size_t n)
+{
+    if (j->len + n > j->cap)
+    {
+        j->cap = j->cap ? 2 * j->cap : INITIAL_CODE_SIZE;
+        if ((j->code = realloc(j->code, j->cap)) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+    }
+    memcpy(j->code + j->len, bytes, n);
+    j->len += n;
+}
+
+#define EMIT(j, ...) emitBytes(j, (const uint8_t[]) {__VA_ARGS__}, sizeof((const uint8_t[]) {__VA_ARGS__}))
+
+static void emit32(JIT *j, int32_t value)
+{
+    emitBytes(j, (const uint8_t *) &value, sizeof(value));
+}
+
+static void emit64(JIT *j, uint64_t value)
+{
+    emitBytes(j, (const uint8_t *) &value, sizeof(value));
+}
+
+// The ModRM byte (and SIB byte for rsp) of [base + disp32] with reg.
+static void emitMem(JIT *j, int reg, BASE base, int32_t disp)
+{
+    EMIT(j, 0x80 | reg << 3 | base);
+    if (base == BASE_RSP)
+    {
+        EMIT(j, 0x24);
+    }
+    emit32(j, disp);
+}
+
+static void emitSse(JIT *j, uint8_t prefix, uint8_t op, int dst, int src)
+{
+    EMIT(j, prefix, 0x0F, op, 0xC0 | dst << 3 | src);
+}
+
+static void loadDouble(JIT *j, int xmm, BASE base, int32_t disp)
+{
+    EMIT(j, SD, 0x0F, 0x10);
+    emitMem(j, xmm, base, disp);
+}
+
+static void storeDouble(JIT *j, BASE base, int32_t disp, int xmm)
+{
+    EMIT(j, SD, 0x0F, 0x11);
+    emitMem(j, xmm, base, disp);
+}
+
+// mov rax, imm64; movq xmm, rax
+static void loadBits(JIT *j, int xmm, uint64_t bits)
+{
+    EMIT(j, 0x48, 0xB8);
+    emit64(j, bits);
+    EMIT(j, PD, 0x48, 0x0F, 0x6E, 0xC0 | xmm << 3);
+}
+
+static void loadConst(JIT *j, int xmm, double value)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    loadBits(j, xmm, bits);
+}
+
+// Emits a jump to be patched, returning where its offset goes.
+static size_t emitJump(JIT *j, uint8_t cc)
+{
+    if (cc == JMP)
+    {
+        EMIT(j, 0xE9);
+    }
+    else
+    {
+        EMIT(j, 0x0F, cc);
+    }
+    emit32(j, 0);
+
+    return j->len - 4;
+}
+
+// Points the jump whose offset is at at to the next instruction.
+static void patchJump(JIT *j, size_t at)
+{
+    int32_t rel = (int32_t) (j->len - (at + 4));
+
+    memcpy(j->code + at, &rel, sizeof(rel));
+}
+
+static int32_t paramDisp(int param)
+{
+    return -8 * (param + 1);
+}
+
+static int32_t tempDisp(JIT *j, int temp)
+{
+    if (temp >= j->temps)
+    {
+        j->temps = temp + 1;
+    }
+
+    return 8 * temp;
+}
+
+static double jitStackOverflow(void)
+{
+    return stackOverflowValue().value;
+}
+
+static bool isInt(AST_NODE *node)
+{
+    return node->type == NUM_NODE_TYPE && node->data.number.type == INT_TYPE;
+}
+
+static bool isParam(JIT *j, AST_NODE *node)
+{
+    return node->type == SYM_NODE_TYPE && node->data.symbol.depth == 0
+           && node->data.symbol.slot >= 0 && node->data.symbol.slot < j->nParams;
+}
+
+// Numbers and parameters load without clobbering anything but rax.
+static bool isLeaf(JIT *j, AST_NODE *node)
+{
+    return (node->type == NUM_NODE_TYPE && node->data.number.type != VECTOR_TYPE) || isParam(j, node);
+}
+
+// Loads a leaf into xmm, converting an int to a double.
+static void loadLeaf(JIT *j, AST_NODE *node, int xmm)
+{
+    if (node->type == SYM_NODE_TYPE)
+    {
+        loadDouble(j, xmm, BASE_RBP, paramDisp(node->data.symbol.slot));
+    }
+    else
+    {
+        loadConst(j, xmm, toDouble(node->data.number));
+    }
+}
+
+static int countOperands(AST_NODE *opList)
+{
+    int n = 0;
+
+    for (AST_NODE *op = opList; op != NULL; op = op->next)
+    {
+        n++;
+    }
+
+    return n;
+}
+
+// Like genNode, but an int literal gives its value as a double.
+static bool genConverted(JIT *j, AST_NODE *node, int temp)
+{
+    if (isInt(node))
+    {
+        loadLeaf(j, node, XMM0);
+        return true;
+    }
+
+    return genNode(j, node, temp);
+}
+
+// Computes the next operand of a builtin into xmm1, keeping xmm0.
+static bool genNextOperand(JIT *j, AST_NODE *node, int temp)
+{
+    if (isLeaf(j, node))
+    {
+        loadLeaf(j, node, XMM1);
+        return true;
+    }
+
+    storeDouble(j, BASE_RSP, tempDisp(j, temp), XMM0);
+    if (!genNode(j, node, temp + 1))
+    {
+        return false;
+    }
+    emitSse(j, PD, SSE_MOVAPD, XMM1, XMM0);
+    loadDouble(j, XMM0, BASE_RSP, tempDisp(j, temp));
+
+    return true;
+}
+
+// Computes a into xmm0 and b into xmm1, converting int literals.
+static bool genPair(JIT *j, AST_NODE *a, AST_NODE *b, int temp)
+{
+    return genConverted(j, a, temp) && genNextOperand(j, b, temp);
+}
+
+// add and mult fold their operands from left to right, starting from 0 or 1,
+// which stays an int up to the first double operand like in foldValues.
+static bool genFold(JIT *j, AST_NODE *node, int temp)
+{
+    bool add = node->data.function.func == ADD_FUNC;
+    uint8_t op = add ? SSE_ADDSD : SSE_MULSD;
+    int64_t acc = add ? 0 : 1;
+    bool running = false;
+    int n = countOperands(node->data.function.opList);
+
+    if (n == 0 || n >= REDUCE_MIN_OPERANDS)
+    {
+        return false;
+    }
+
+    for (AST_NODE *operand = node->data.function.opList; operand != NULL; operand = operand->next)
+    {
+        if (!running && isInt(operand))
+        {
+            acc = add ? intAdd(acc, operand->data.number.ival) : intMult(acc, operand->data.number.ival);
+            continue;
+        }
+
+        if (!running)
+        {
+            if (!genNode(j, operand, temp))
+            {
+                return false;
+            }
+            emitSse(j, PD, SSE_MOVAPD, XMM1, XMM0);
+            loadConst(j, XMM0, (double) acc);
+            running = true;
+        }
+        else if (!genNextOperand(j, operand, temp))
+        {
+            return false;
+        }
+        emitSse(j, SD, op, XMM0, XMM1);
+    }
+
+    // only ints give an int
+    return running;
+}
+
+// doubleMax and doubleMin of xmm0 and xmm1 into xmm0.
+static void genMinMax(JIT *j, bool max)
+{
+    size_t unordered;
+    size_t take;
+    size_t differ;
+    size_t positive;
+
+    // max takes b if a < b, min if b < a; on equal values, the one whose
+    // sign bit is set loses for max and wins for min
+    emitSse(j, PD, SSE_UCOMISD, max ? XMM0 : XMM1, max ? XMM1 : XMM0);
+    unordered = emitJump(j, JP);
+    take = emitJump(j, JB);
+    differ = emitJump(j, JNE);
+    emitSse(j, PD, SSE_MOVMSKPD, 0, max ? XMM0 : XMM1);
+    EMIT(j, 0xA8, 0x01);
+    positive = emitJump(j, JE);
+    patchJump(j, take);
+    emitSse(j, PD, SSE_MOVAPD, XMM0, XMM1);
+    patchJump(j, unordered);
+    patchJump(j, differ);
+    patchJump(j, positive);
+}
+
+// max and min fold from their first operand, so they only take doubles.
+static bool genExtremum(JIT *j, AST_NODE *node, int temp)
+{
+    bool max = node->data.function.func == MAX_FUNC;
+    AST_NODE *first = node->data.function.opList;
+    int n = countOperands(first);
+
+    if (n == 0 || n >= REDUCE_MIN_OPERANDS)
+    {
+        return false;
+    }
+    for (AST_NODE *operand = first; operand != NULL; operand = operand->next)
+    {
+        if (isInt(operand))
+        {
+            return false;
+        }
+    }
+
+    if (!genNode(j, first, temp))
+    {
+        return false;
+    }
+    for (AST_NODE *operand = first->next; operand != NULL; operand = operand->next)
+    {
+        if (!genNextOperand(j, operand, temp))
+        {
+            return false;
+        }
+        genMinMax(j, max);
+    }
+
+    return true;
+}
+
+// A comparison gives 1.0 or 0.0 when its first operand is a double. With an int
+// first, it gives an int that only a cond condition can take, so only genTruth
+// lets it through.
+static bool genCompare(JIT *j, AST_NODE *node, int temp)
+{
+    AST_NODE *a = node->data.function.opList;
+    AST_NODE *b = a->next;
+
+    if (!genPair(j, a, b, temp))
+    {
+        return false;
+    }
+
+    switch (node->data.function.func)
+    {
+        case EQUAL_FUNC:
+            emitSse(j, SD, SSE_CMPSD, XMM0, XMM1);
+            EMIT(j, CMP_EQ);
+            break;
+        case LESS_FUNC:
+            emitSse(j, SD, SSE_CMPSD, XMM0, XMM1);
+            EMIT(j, CMP_LT);
+            break;
+        default:
+            emitSse(j, SD, SSE_CMPSD, XMM1, XMM0);
+            EMIT(j, CMP_LT);
+            emitSse(j, PD, SSE_MOVAPD, XMM0, XMM1);
+            break;
+    }
+    loadConst(j, XMM1, 1.0);
+    emitSse(j, PD, SSE_ANDPD, XMM0, XMM1);
+
+    return true;
+}
+
+static bool isComparison(AST_NODE *node)
+{
+    if (node->type != FUNC_NODE_TYPE || countOperands(node->data.function.opList) != 2)
+    {
+        return false;
+    }
+
+    switch (node->data.function.func)
+    {
+        case EQUAL_FUNC:
+        case LESS_FUNC:
+        case GREATER_FUNC:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Calls of the lambda itself with all of its arguments. A tail call overwrites
+// the parameters and jumps back to the body; the others check the depth left.
+static bool genCall(JIT *j, AST_NODE *node, int temp)
+{
+    AST_FUNCTION *call = &node->data.function;
+    size_t recurse;
+    size_t done;
+    int i = 0;
+
+    if (call->callee != j->symbol || countOperands(call->opList) != j->nParams)
+    {
+        return false;
+    }
+
+    for (AST_NODE *arg = call->opList; arg != NULL; arg = arg->next, i++)
+    {
+        // an int argument would make the parameter an int
+        if (isInt(arg) || !genNode(j, arg, temp + i))
+        {
+            return false;
+        }
+        storeDouble(j, BASE_RSP, tempDisp(j, temp + i), XMM0);
+    }
+
+    if (call->tail)
+    {
+        for (i = 0; i < j->nParams; i++)
+        {
+            loadDouble(j, XMM0, BASE_RSP, tempDisp(j, temp + i));
+            storeDouble(j, BASE_RBP, paramDisp(i), XMM0);
+        }
+        EMIT(j, 0xE9);
+        emit32(j, (int32_t) (j->body - (j->len + 4)));
+        return true;
+    }
+
+    // lea rdi, [rsp + temp]
+    EMIT(j, 0x48, 0x8D);
+    emitMem(j, 7, BASE_RSP, tempDisp(j, temp));
+    // mov rsi, [rbp + depth]; test rsi, rsi
+    EMIT(j, 0x48, 0x8B);
+    emitMem(j, 6, BASE_RBP, paramDisp(j->nParams));
+    EMIT(j, 0x48, 0x85, 0xF6);
+    recurse = emitJump(j, JNE);
+    // mov rax, jitStackOverflow; call rax
+    EMIT(j, 0x48, 0xB8);
+    emit64(j, (uint64_t) (uintptr_t) jitStackOverflow);
+    EMIT(j, 0xFF, 0xD0);
+    done = emitJump(j, JMP);
+    patchJump(j, recurse);
+    // dec rsi; call the start of the function
+    EMIT(j, 0x48, 0xFF, 0xCE, 0xE8);
+    emit32(j, (int32_t) -(j->len + 4));
+    patchJump(j, done);
+
+    return true;
+}
+
+static bool genFuncNode(JIT *j, AST_NODE *node, int temp)
+{
+    AST_NODE *opList = node->data.function.opList;
+    int n = countOperands(opList);
+
+    switch (node->data.function.func)
+    {
+        case ADD_FUNC:
+        case MULT_FUNC:
+            return genFold(j, node, temp);
+        case SUB_FUNC:
+        case DIV_FUNC:
+            if (n != 2 || (isInt(opList) && isInt(opList->next)) || !genPair(j, opList, opList->next, temp))
+            {
+                return false;
+            }
+            emitSse(j, SD, node->data.function.func == SUB_FUNC ? SSE_SUBSD : SSE_DIVSD, XMM0, XMM1);
+            return true;
+        case NEG_FUNC:
+        case ABS_FUNC:
+            if (n != 1 || !genNode(j, opList, temp))
+            {
+                return false;
+            }
+            if (node->data.function.func == NEG_FUNC)
+            {
+                loadBits(j, XMM1, UINT64_C(0x8000000000000000));
+                emitSse(j, PD, SSE_XORPD, XMM0, XMM1);
+            }
+            else
+            {
+                loadBits(j, XMM1, UINT64_C(0x7FFFFFFFFFFFFFFF));
+                emitSse(j, PD, SSE_ANDPD, XMM0, XMM1);
+            }
+            return true;
+        case SQRT_FUNC:
+            if (n != 1 || !genConverted(j, opList, temp))
+            {
+                return false;
+            }
+            emitSse(j, SD, SSE_SQRTSD, XMM0, XMM0);
+            return true;
+        case MAX_FUNC:
+        case MIN_FUNC:
+            return genExtremum(j, node, temp);
+        case EQUAL_FUNC:
+        case LESS_FUNC:
+        case GREATER_FUNC:
+            return isComparison(node) && !isInt(opList) && genCompare(j, node, temp);
+        case CUSTOM_FUNC:
+            return genCall(j, node, temp);
+        default:
+            return false;
+    }
+}
+
+// The condition of a cond, in xmm0; a comparison may have an int first here.
+static bool genTruth(JIT *j, AST_NODE *node, int temp)
+{
+    AST_NODE *opList;
+
+    if (isComparison(node))
+    {
+        opList = node->data.function.opList;
+        return !(isInt(opList) && isInt(opList->next)) && genCompare(j, node, temp);
+    }
+
+    return genNode(j, node, temp);
+}
+
+// cond takes the false branch on zero only, so NAN is true as in isZero.
+static bool genCondNode(JIT *j, AST_NODE *node, int temp)
+{
+    size_t unordered;
+    size_t zero;
+    size_t end;
+
+    if (!genTruth(j, node->data.condition.condition, temp))
+    {
+        return false;
+    }
+    emitSse(j, PD, SSE_XORPD, XMM1, XMM1);
+    emitSse(j, PD, SSE_UCOMISD, XMM0, XMM1);
+    unordered = emitJump(j, JP);
+    zero = emitJump(j, JE);
+    patchJump(j, unordered);
+    if (!genNode(j, node->data.condition._true, temp))
+    {
+        return false;
+    }
+    end = emitJump(j, JMP);
+    patchJump(j, zero);
+    if (!genNode(j, node->data.condition._false, temp))
+    {
+        return false;
+    }
+    patchJump(j, end);
+
+    return true;
+}
+
+// Compiles node into xmm0, or returns false if it may not give a double or uses
+// anything but the parameters and the builtins above.
+static bool genNode(JIT *j, AST_NODE *node, int temp)
+{
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+            if (node->data.number.type != DOUBLE_TYPE)
+            {
+                return false;
+            }
+            loadLeaf(j, node, XMM0);
+            return true;
+        case SYM_NODE_TYPE:
+            if (!isParam(j, node))
+            {
+                return false;
+            }
+            loadLeaf(j, node, XMM0);
+            return true;
+        case FUNC_NODE_TYPE:
+            return genFuncNode(j, node, temp);
+        case CONDITIONAL_NODE_TYPE:
+            return genCondNode(j, node, temp);
+        default:
+            return false;
+    }
+}
+
+// Copies the code into the executable region, which is only writable meanwhile.
+static JIT_CODE install(JIT *j)
+{
+    uint8_t *code;
+
+    if (region == NULL)
+    {
+        region = mmap(NULL, JIT_REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED)
+        {
+            region = NULL;
+            return NULL;
+        }
+    }
+
+    if (regionUsed + j->len > JIT_REGION_SIZE || mprotect(region, JIT_REGION_SIZE, PROT_READ | PROT_WRITE) != 0)
+    {
+        return NULL;
+    }
+    code = region + regionUsed;
+    memcpy(code, j->code, j->len);
+    regionUsed = (regionUsed + j->len + JIT_CODE_ALIGN - 1) & ~(size_t) (JIT_CODE_ALIGN - 1);
+    if (mprotect(region, JIT_REGION_SIZE, PROT_READ | PROT_EXEC) != 0)
+    {
+        return NULL;
+    }
+    __builtin___clear_cache((char *) code, (char *) code + j->len);
+
+    return (JIT_CODE) code;
+}
+
+JIT_CODE jitCompile(SYMBOL_TABLE_NODE *symbol, NUM_TYPE type)
+{
+    JIT *j = &jit;
+    AST_LAMBDA *lambda = &symbol->value->data.lambda;
+    size_t frame;
+    int32_t size;
+
+    if ((type != NO_TYPE && type != DOUBLE_TYPE) || lambda->nParams > JIT_MAX_PARAMS)
+    {
+        return NULL;
+    }
+
+    j->len = 0;
+    j->symbol = symbol;
+    j->nParams = lambda->nParams;
+    j->temps = 0;
+
+    // push rbp; mov rbp, rsp; sub rsp, frame
+    EMIT(j, 0x55, 0x48, 0x89, 0xE5, 0x48, 0x81, 0xEC);
+    frame = j->len;
+    emit32(j, 0);
+    for (int i = 0; i < j->nParams; i++)
+    {
+        loadDouble(j, XMM0, BASE_RDI, 8 * i);
+        storeDouble(j, BASE_RBP, paramDisp(i), XMM0);
+    }
+    // mov [rbp + depth], rsi
+    EMIT(j, 0x48, 0x89);
+    emitMem(j, 6, BASE_RBP, paramDisp(j->nParams));
+
+    j->body = j->len;
+    if (!genNode(j, lambda->body, 0))
+    {
+        return NULL;
+    }
+    // leave; ret
+    EMIT(j, 0xC9, 0xC3);
+
+    // keeps rsp 16-byte aligned at the calls
+    size = (int32_t) ((8 * (j->nParams + 1 + j->temps) + 15) & ~15);
+    memcpy(j->code + frame, &size, sizeof(size));
+
+    return install(j);
+}
+
+bool jitCall(JIT_CODE code, const RET_VAL *args, uint32_t n, int64_t depth, RET_VAL *val)
+{
+    double values[JIT_MAX_PARAMS];
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (args[i].type != DOUBLE_TYPE)
+        {
+            return false;
+        }
+        values[i] = args[i].value;
+    }
+
+    *val = (RET_VAL) {DOUBLE_TYPE, .value = code(values, depth)};
+    return true;
+}
+
+void jitReset(void)
+{
+    regionUsed = 0;
+}
+
+void jitFree(void)
+{
+    if (region != NULL)
+    {
+        munmap(region, JIT_REGION_SIZE);
+    }
+    free(jit.code);
+    region = NULL;
+    regionUsed = 0;
+    jit = (JIT) {0};
+}
+
+#else
+
+JIT_CODE jitCompile(SYMBOL_TABLE_NODE *symbol, NUM_TYPE type)
+{
+    return NULL;
+}
+
+bool jitCall(JIT_CODE code, const RET_VAL *args, uint32_t n, int64_t depth, RET_VAL *val)
+{
+    return false;
+}
+
+void jitReset(void)
+{
+}
+
+void jitFree(void)
+{
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef __jit_h_
+#define __jit_h_
+
+#include <stdint.h>
+#include "cilisp.h"
+
+// Compiles hot lambdas to x86-64 machine code with SSE2 scalar doubles.
+//
+// The VM counts the calls to each lambda; with --jit, the call that reaches the
+// threshold hands it to jitCompile, and the calls from then on whose arguments
+// are all doubles run the machine code instead of the bytecode. Only lambdas
+// that are untyped or typed double and whose body is built from double numbers,
+// parameters, add, sub, mult, div, neg, abs, sqrt, max, min, the comparisons,
+// cond, and calls of the lambda itself, all giving doubles, are compiled. Others
+// keep running on the VM, so anything that reads, prints or draws random numbers
+// does too.
+//
+// The machine code computes exactly what the VM does: operands fold in the same
+// order, ints are converted where the VM would convert them, tail calls jump back
+// to the start, and the other calls stop at the depth the VM would overflow at.
+
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__unix__) && !defined(JIT_DISABLED)
+#define JIT_AVAILABLE 1
+#else
+#define JIT_AVAILABLE 0
+#endif
+
+// Calls to a lambda before --jit compiles it.
+#define JIT_DEFAULT_THRESHOLD 100
+// Lambdas taking more arguments are left to the VM.
+#define JIT_MAX_PARAMS 16
+
+// A compiled lambda: returns its value for the arguments in args, recursing
+// at most depth calls deep before the innermost call overflows the stack.
+typedef double (*JIT_CODE)(const double *args, int64_t depth);
+
+// Compiles the lambda bound to symbol, with return type type, or returns NULL.
+JIT_CODE jitCompile(SYMBOL_TABLE_NODE *symbol, NUM_TYPE type);
+// Runs code on the n arguments in args into *val if they are all doubles.
+bool jitCall(JIT_CODE code, const RET_VAL *args, uint32_t n, int64_t depth, RET_VAL *val);
+// Frees the code of the previous expression for the next one to reuse.
+void jitReset(void);
+// Unmaps the code of the calling thread and frees what its lambdas are compiled
+// into, which the next jitCompile maps and allocates again.
+void jitFree(void);
+
+#endif
@@ -0,0 +1,416 @@
+#if defined(__unix__)
+#define MAP_INPUT_AVAILABLE 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define MAP_INPUT_AVAILABLE 0
+#endif
+#include <limits.h>
+#include <signal.h>
+#include "cilisp.h"
+#include "batch.h"
+#include "profile.h"
+#include "sampler.h"
+#include "timeline.h"
+#include "yyreadprint.c"
+
+#define S_EXPR_POSTFIX_PADDING 2
+#define READ_BUFFER_SIZE 4096
+
+// Exits as main does after an expression that did not return CILISP_OK.
+static void stop(CILISP_STATUS status)
+{
+    if (status == CILISP_QUIT)
+    {
+        exit(EXIT_SUCCESS);
+    }
+    fatalError = true;
+    exit(1);
+}
+
+// Reads the next top-level expression of the input, from a line that is not blank
+// on, over the lines after it until its brackets close or the input ends, as
+// padded lines from yyreadline.
+static char *readExpression(size_t *len)
+{
+    char *text = NULL;
+    int depth;
+
+    do
+    {
+        free(text);
+        text = NULL;
+        *len = 0;
+        if (yyreadline(&text, len, stdin, S_EXPR_POSTFIX_PADDING) == (size_t) -1)
+        {
+            yyerror("Memory allocation failed!");
+        }
+    } while (text[0] == '\n');
+
+    depth = cilispDepth(0, text, *len - S_EXPR_POSTFIX_PADDING);
+    while (depth > 0 && text[*len - 1 - S_EXPR_POSTFIX_PADDING] != (char) EOF)
+    {
+        char *line = NULL;
+        size_t line_len = 0;
+
+        if (yyreadline(&line, &line_len, stdin, S_EXPR_POSTFIX_PADDING) == (size_t) -1 ||
+            (text = realloc(text, *len + line_len - S_EXPR_POSTFIX_PADDING)) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+        // the line goes over the padding of the text, and brings its own
+        memcpy(text + *len - S_EXPR_POSTFIX_PADDING, line, line_len);
+        *len += line_len - S_EXPR_POSTFIX_PADDING;
+        depth = cilispDepth(depth, line, line_len - S_EXPR_POSTFIX_PADDING);
+        free(line);
+    }
+
+    return text;
+}
+
+// --batch: reads every expression of the input file as main would, then prints
+// each one with what it printed, in order, as they are evaluated on
+// options->batch threads.
+static void runBatch(const CILISP_OPTIONS *options, FILE *read_target)
+{
+    char **lines = NULL;
+    size_t *lens = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+    BATCH *batch;
+
+    while (true)
+    {
+        size_t len;
+        char *line = readExpression(&len);
+
+        if (count == cap)
+        {
+            cap = cap ? 2 * cap : 1024;
+            if ((lines = realloc(lines, cap * sizeof(char *))) == NULL ||
+                (lens = realloc(lens, cap * sizeof(size_t))) == NULL)
+            {
+                yyerror("Memory allocation failed!");
+            }
+        }
+        lines[count] = line;
+        lens[count++] = len;
+
+        // the expression with the end of the input quits, so nothing comes after it
+        if (line[len - 1 - S_EXPR_POSTFIX_PADDING] == (char) EOF)
+        {
+            break;
+        }
+    }
+
+    batch = batchStart(options, read_target, lines, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        CILISP_STATUS status;
+        const char *output, *messages;
+        size_t len, messages_len;
+
+        if (!options->script)
+        {
+            printf("\n> ");
+        }
+        status = batchNext(batch, &output, &len, &messages, &messages_len);
+        if (!options->script)
+        {
+            yyprintline(lines[i], lens[i], S_EXPR_POSTFIX_PADDING);
+        }
+        if (output == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+        if (messages != NULL)
+        {
+            fwrite(messages, 1, messages_len, stderr);
+        }
+        fwrite(output, 1, len, stdout);
+        free(lines[i]);
+
+        if (status != CILISP_OK)
+        {
+            stop(status);
+        }
+    }
+    exit(EXIT_SUCCESS);
+}
+
+// --parse-trace: the interpreter whose records are dumped at exit, or when a
+// SIGUSR1 comes, after the expression that runs then or before the next piece
+// of input is read, whichever comes first.
+static CILISP_CTX *traced;
+static volatile sig_atomic_t traceDumpRequested;
+
+static void dumpTrace(void)
+{
+    FILE *out = fopen(traced->options.parseTrace, "wb");
+
+    if (out == NULL || traceDump(traced->trace, out) != 0)
+    {
+        fprintf(stderr, "Could not write the trace to \"%s\"!\n", traced->options.parseTrace);
+    }
+    if (out != NULL)
+    {
+        fclose(out);
+    }
+}
+
+static void requestTraceDump(int signal)
+{
+    traceDumpRequested = 1;
+}
+
+static void checkTraceDump(void)
+{
+    if (traceDumpRequested)
+    {
+        traceDumpRequested = 0;
+        dumpTrace();
+    }
+}
+
+// What the parser does with each expression of a traced interpreter, which may
+// parse a mapped --script in one go without reading any more input.
+static void runTraced(AST_NODE *node)
+{
+    runProgram(node);
+    checkTraceDump();
+}
+
+// --profile: the interpreter whose counters are printed when cilisp exits.
+static CILISP_CTX *profiled;
+
+static void printProfile(void)
+{
+    profileReport(profiled->profile, stderr);
+}
+
+// --trace: the interpreter whose timeline is closed when cilisp exits.
+static CILISP_CTX *timed;
+
+static void closeTimeline(void)
+{
+    if (timelineClose(timed->timeline) != 0)
+    {
+        fprintf(stderr, "Could not write the trace to \"%s\"!\n", timed->options.timeline);
+    }
+    timed->timeline = NULL;
+}
+
+// --sample: the interpreter whose samples are written out when cilisp exits.
+static CILISP_CTX *sampled;
+
+static void writeSamples(void)
+{
+    FILE *out = fopen(sampled->options.sample, "w");
+
+    if (out == NULL || samplerReport(sampled->sampler, out, stderr) != 0)
+    {
+        fprintf(stderr, "Could not write the samples to \"%s\"!\n", sampled->options.sample);
+    }
+    if (out != NULL)
+    {
+        fclose(out);
+    }
+    samplerFree(sampled->sampler);
+    sampled->sampler = NULL;
+}
+
+// The interpreter whose buffered output is written out when cilisp exits, before
+// the reports of the options above.
+static CILISP_CTX *printing;
+
+static void flushOutput(void)
+{
+    cilispFlush(printing);
+}
+
+// --script: maps the whole input, followed by the end of the input and the two
+// NULs flex wants, as cilispEvalBuffer takes it. The file goes over an anonymous
+// mapping long enough for those three bytes, whose zeros follow its last page.
+// Returns NULL if the input is not a regular file, or too long for a flex buffer,
+// and where there is no mmap, which leaves the input to the push parser.
+#if MAP_INPUT_AVAILABLE
+static char *mapInput(FILE *input, size_t *len)
+{
+    struct stat st;
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t size;
+    char *buffer;
+
+    if (fstat(fileno(input), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > INT_MAX - 3)
+    {
+        return NULL;
+    }
+
+    size = ((size_t) st.st_size + 3 + page - 1) / page * page;
+    buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED)
+    {
+        return NULL;
+    }
+    // private, since flex writes into the buffer as it scans
+    if (st.st_size > 0 && mmap(buffer, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                               fileno(input), 0) == MAP_FAILED)
+    {
+        munmap(buffer, size);
+        return NULL;
+    }
+    madvise(buffer, size, MADV_SEQUENTIAL);
+
+    buffer[st.st_size] = (char) EOF;
+    *len = st.st_size + 3;
+    return buffer;
+}
+#else
+static char *mapInput(FILE *input, size_t *len)
+{
+    return NULL;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    CILISP_OPTIONS options = defaultOptions;
+    CILISP_CTX *ctx;
+    FILE *read_target;
+    CILISP_STATUS status;
+
+    argc = parseOptions(argc, argv, &options);
+
+    if (argc > 2) read_target = fopen(argv[2], "r");
+    else read_target = stdin;
+
+    bool input_from_file;
+    if ((input_from_file = argc > 1))
+    {
+        stdin = fopen(argv[1], "r");
+    }
+
+    if (options.batch > 0 && input_from_file && options.emit == NULL)
+    {
+        runBatch(&options, read_target);
+    }
+
+    // after parseOptions, which may have redirected stdout for --emit-c
+    if ((ctx = cilispCreate(&options, stdout, read_target)) == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+
+    if (options.parseTrace != NULL)
+    {
+        if ((ctx->trace = traceCreate()) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+        traced = ctx;
+        ctx->run = runTraced;
+        atexit(dumpTrace);
+#ifdef SIGUSR1
+        signal(SIGUSR1, requestTraceDump);
+#endif
+    }
+
+    if (options.profile)
+    {
+        profiled = ctx;
+        atexit(printProfile);
+    }
+
+    if (options.timeline != NULL)
+    {
+        if ((ctx->timeline = timelineOpen(options.timeline, options.timelineThreshold)) == NULL)
+        {
+            yyerror("Cannot open \"%s\" for --trace!", options.timeline);
+        }
+        timed = ctx;
+        atexit(closeTimeline);
+    }
+
+    if (options.sample != NULL)
+    {
+        if ((ctx->sampler = samplerCreate(options.sampleRate)) == NULL)
+        {
+            yyerror("Cannot start the sampler of --sample!");
+        }
+        sampled = ctx;
+        atexit(writeSamples);
+    }
+
+    printing = ctx;
+    atexit(flushOutput);
+
+    if (options.script)
+    {
+        // one scanner buffer over the whole input
+        char *buffer;
+        size_t len;
+
+        if ((buffer = mapInput(stdin, &len)) != NULL)
+        {
+            stop(cilispEvalBuffer(ctx, buffer, len));
+        }
+    }
+
+    // The input is read into a buffer of a fixed size, a line or a piece of a long
+    // one at a time, and each expression runs as soon as its last line is in.
+    char buffer[READ_BUFFER_SIZE];
+    bool line_start = true;
+    bool prompted = false;
+
+    while (true)
+    {
+        checkTraceDump();
+
+        // a new expression starts on a new line outside any brackets
+        if (line_start && ctx->depth == 0 && !prompted)
+        {
+            if (!options.script)
+            {
+                outputText(&ctx->runtime.output, "\n> ");
+            }
+            if (!input_from_file)
+            {
+                // someone may be typing the input, --script or not
+                cilispFlush(ctx);
+            }
+            prompted = true;
+        }
+
+        if (fgets(buffer, sizeof(buffer), stdin) == NULL)
+        {
+            if (input_from_file && !options.script)
+            {
+                outputText(&ctx->runtime.output, line_start ? "EOF\n" : "\n");
+            }
+            stop(cilispPush(ctx, NULL, 0));
+        }
+        size_t len = strlen(buffer);
+
+        // blank lines between expressions get no prompt of their own, but count
+        // toward the lines of the locations the scanner gives
+        if (line_start && ctx->depth == 0 && buffer[0] == '\n')
+        {
+            ctx->line++;
+            continue;
+        }
+
+        if (input_from_file && !options.script)
+        {
+            outputWrite(&ctx->runtime.output, buffer, len);
+        }
+        line_start = buffer[len - 1] == '\n';
+        prompted = false;
+
+        status = cilispPush(ctx, buffer, len);
+        if (status != CILISP_OK)
+        {
+            stop(status);
+        }
+    }
+}
@@ -0,0 +1,349 @@
+#include "number.h"
+#include "vector.h"
+
+// Exponentiation by squaring, wrapping around like intMult. A negative exponent
+// gives 1 / base^-exponent truncated towards zero, and 0 for a base of 0 like intDiv.
+int64_t intPow(int64_t base, int64_t exponent)
+{
+    uint64_t result = 1;
+    uint64_t square = (uint64_t) base;
+
+    if (exponent < 0)
+    {
+        if (base == 1 || base == -1)
+        {
+            return (exponent & 1) ? base : 1;
+        }
+        return 0;
+    }
+
+    while (exponent > 0)
+    {
+        if (exponent & 1)
+        {
+            result *= square;
+        }
+        square *= square;
+        exponent >>= 1;
+    }
+
+    return (int64_t) result;
+}
+
+int64_t toInt(double value)
+{
+    if (isnan(value))
+    {
+        return 0;
+    }
+
+    // 2^63 is exact as a double, unlike INT64_MAX
+    if (value >= 9223372036854775808.0)
+    {
+        return INT64_MAX;
+    }
+
+    if (value < -9223372036854775808.0)
+    {
+        return INT64_MIN;
+    }
+
+    return (int64_t) value;
+}
+
+AST_NUMBER castNumber(AST_NUMBER number, NUM_TYPE type)
+{
+    if (number.type == VECTOR_TYPE && type != NO_TYPE)
+    {
+        number = (AST_NUMBER) {DOUBLE_TYPE, .value = NAN};
+    }
+
+    if (type == INT_TYPE && number.type != INT_TYPE)
+    {
+        number.ival = toInt(number.value);
+    }
+    else if (type == DOUBLE_TYPE && number.type == INT_TYPE)
+    {
+        number.value = (double) number.ival;
+    }
+
+    if (type != NO_TYPE)
+    {
+        number.type = type;
+    }
+
+    return number;
+}
+
+AST_NUMBER numberFromBool(NUM_TYPE type, bool value)
+{
+    if (type == INT_TYPE)
+    {
+        return (AST_NUMBER) {INT_TYPE, .ival = value};
+    }
+
+    return (AST_NUMBER) {type, .value = value};
+}
+
+static inline bool anyVector(AST_NUMBER a, AST_NUMBER b)
+{
+    return a.type == VECTOR_TYPE || b.type == VECTOR_TYPE;
+}
+
+// The arithmetic builtins on numbers of any type: ints give an int, anything
+// else the double computed from both values.
+
+AST_NUMBER numberNeg(AST_NUMBER a)
+{
+    if (a.type == VECTOR_TYPE)
+    {
+        return vectorMap(MAP_NEG, a, a);
+    }
+
+    if (a.type == INT_TYPE)
+    {
+        a.ival = intNeg(a.ival);
+    }
+    else
+    {
+        a.value = -a.value;
+    }
+
+    return a;
+}
+
+AST_NUMBER numberAbs(AST_NUMBER a)
+{
+    if (a.type == VECTOR_TYPE)
+    {
+        return vectorMap(MAP_ABS, a, a);
+    }
+
+    if (a.type == INT_TYPE)
+    {
+        a.ival = intAbs(a.ival);
+    }
+    else
+    {
+        a.value = fabs(a.value);
+    }
+
+    return a;
+}
+
+AST_NUMBER numberAdd(AST_NUMBER a, AST_NUMBER b)
+{
+    if (anyVector(a, b))
+    {
+        return vectorMap(MAP_ADD, a, b);
+    }
+
+    if (a.type == INT_TYPE && b.type == INT_TYPE)
+    {
+        return (AST_NUMBER) {INT_TYPE, .ival = intAdd(a.ival, b.ival)};
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = toDouble(a) + toDouble(b)};
+}
+
+AST_NUMBER numberSub(AST_NUMBER a, AST_NUMBER b)
+{
+    if (anyVector(a, b))
+    {
+        return vectorMap(MAP_SUB, a, b);
+    }
+
+    if (a.type == INT_TYPE && b.type == INT_TYPE)
+    {
+        return (AST_NUMBER) {INT_TYPE, .ival = intSub(a.ival, b.ival)};
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = toDouble(a) - toDouble(b)};
+}
+
+AST_NUMBER numberMult(AST_NUMBER a, AST_NUMBER b)
+{
+    if (anyVector(a, b))
+    {
+        return vectorMap(MAP_MULT, a, b);
+    }
+
+    if (a.type == INT_TYPE && b.type == INT_TYPE)
+    {
+        return (AST_NUMBER) {INT_TYPE, .ival = intMult(a.ival, b.ival)};
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = toDouble(a) * toDouble(b)};
+}
+
+AST_NUMBER numberDiv(AST_NUMBER a, AST_NUMBER b)
+{
+    if (anyVector(a, b))
+    {
+        return vectorMap(MAP_DIV, a, b);
+    }
+
+    if (a.type == INT_TYPE && b.type == INT_TYPE)
+    {
+        return (AST_NUMBER) {INT_TYPE, .ival = intDiv(a.ival, b.ival)};
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = toDouble(a) / toDouble(b)};
+}
+
+AST_NUMBER numberRem(AST_NUMBER a, AST_NUMBER b)
+{
+    if (anyVector(a, b))
+    {
+        return vectorMap(MAP_REM, a, b);
+    }
+
+    if (a.type == INT_TYPE && b.type == INT_TYPE)
+    {
+        return (AST_NUMBER) {INT_TYPE, .ival = intRem(a.ival, b.ival)};
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = doubleRem(toDouble(a), toDouble(b))};
+}
+
+AST_NUMBER numberPow(AST_NUMBER a, AST_NUMBER b)
+{
+    if (anyVector(a, b))
+    {
+        return vectorMap(MAP_POW, a, b);
+    }
+
+    if (a.type == INT_TYPE && b.type == INT_TYPE)
+    {
+        return (AST_NUMBER) {INT_TYPE, .ival = intPow(a.ival, b.ival)};
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = pow(toDouble(a), toDouble(b))};
+}
+
+// Non-negative int exponents give an int.
+AST_NUMBER numberExp2(AST_NUMBER a)
+{
+    if (a.type == VECTOR_TYPE)
+    {
+        return vectorMap(MAP_EXP2, a, a);
+    }
+
+    if (a.type == INT_TYPE && a.ival >= 0)
+    {
+        return (AST_NUMBER) {INT_TYPE, .ival = intPow(2, a.ival)};
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = pow(2, toDouble(a))};
+}
+
+// Of an int and a double that are equal, the one seen first is kept.
+AST_NUMBER numberMax(AST_NUMBER a, AST_NUMBER b)
+{
+    if (anyVector(a, b))
+    {
+        return vectorMap(MAP_MAX, a, b);
+    }
+
+    if (a.type == DOUBLE_TYPE && b.type == DOUBLE_TYPE)
+    {
+        return (AST_NUMBER) {DOUBLE_TYPE, .value = doubleMax(a.value, b.value)};
+    }
+
+    return numberLess(a, b) ? b : a;
+}
+
+AST_NUMBER numberMin(AST_NUMBER a, AST_NUMBER b)
+{
+    if (anyVector(a, b))
+    {
+        return vectorMap(MAP_MIN, a, b);
+    }
+
+    if (a.type == DOUBLE_TYPE && b.type == DOUBLE_TYPE)
+    {
+        return (AST_NUMBER) {DOUBLE_TYPE, .value = doubleMin(a.value, b.value)};
+    }
+
+    return numberLess(b, a) ? b : a;
+}
+
+AST_NUMBER numberExp(AST_NUMBER a)
+{
+    if (a.type == VECTOR_TYPE)
+    {
+        return vectorMap(MAP_EXP, a, a);
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = exp(toDouble(a))};
+}
+
+AST_NUMBER numberLog(AST_NUMBER a)
+{
+    if (a.type == VECTOR_TYPE)
+    {
+        return vectorMap(MAP_LOG, a, a);
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = log(toDouble(a))};
+}
+
+AST_NUMBER numberSqrt(AST_NUMBER a)
+{
+    if (a.type == VECTOR_TYPE)
+    {
+        return vectorMap(MAP_SQRT, a, a);
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = sqrt(toDouble(a))};
+}
+
+AST_NUMBER numberCbrt(AST_NUMBER a)
+{
+    if (a.type == VECTOR_TYPE)
+    {
+        return vectorMap(MAP_CBRT, a, a);
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = cbrt(toDouble(a))};
+}
+
+AST_NUMBER compareEqual(AST_NUMBER a, AST_NUMBER b)
+{
+    if (anyVector(a, b))
+    {
+        return vectorMap(MAP_EQUAL, a, b);
+    }
+
+    return numberFromBool(a.type, numberEqual(a, b));
+}
+
+AST_NUMBER compareLess(AST_NUMBER a, AST_NUMBER b)
+{
+    if (anyVector(a, b))
+    {
+        return vectorMap(MAP_LESS, a, b);
+    }
+
+    return numberFromBool(a.type, numberLess(a, b));
+}
+
+AST_NUMBER compareGreater(AST_NUMBER a, AST_NUMBER b)
+{
+    if (anyVector(a, b))
+    {
+        return vectorMap(MAP_GREATER, a, b);
+    }
+
+    return numberFromBool(a.type, numberLess(b, a));
+}
+
+AST_NUMBER numberAddSquare(AST_NUMBER a, AST_NUMBER b)
+{
+    if (anyVector(a, b))
+    {
+        return vectorMap(MAP_ADD_SQUARE, a, b);
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = toDouble(a) + toDouble(b) * toDouble(b)};
+}
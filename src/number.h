@@ -0,0 +1,187 @@
+#ifndef __number_h_
+#define __number_h_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+typedef enum num_type {
+    INT_TYPE,
+    DOUBLE_TYPE,
+    VECTOR_TYPE,
+    NO_TYPE
+} NUM_TYPE;
+
+struct vector;
+
+// INT_TYPE numbers are exact 64-bit integers held in ival and VECTOR_TYPE ones
+// point to their elements, see vector.h; every other type holds a double in value.
+typedef struct {
+    NUM_TYPE type;
+    union {
+        double value;
+        int64_t ival;
+        struct vector *vector;
+    };
+} AST_NUMBER;
+
+typedef AST_NUMBER RET_VAL;
+
+// The value of a number for the builtins that compute with doubles.
+static inline double toDouble(AST_NUMBER number)
+{
+    return number.type == INT_TYPE ? (double) number.ival : number.value;
+}
+
+// True when every element of vector is 0.
+bool vectorIsZero(const struct vector *vector);
+
+static inline bool isZero(AST_NUMBER number)
+{
+    switch (number.type)
+    {
+        case INT_TYPE:
+            return number.ival == 0;
+        case VECTOR_TYPE:
+            return vectorIsZero(number.vector);
+        default:
+            return number.value == 0;
+    }
+}
+
+// Ints compare exactly, anything else as doubles; both take scalars only.
+static inline bool numberLess(AST_NUMBER a, AST_NUMBER b)
+{
+    if (a.type == INT_TYPE && b.type == INT_TYPE)
+    {
+        return a.ival < b.ival;
+    }
+
+    return toDouble(a) < toDouble(b);
+}
+
+static inline bool numberEqual(AST_NUMBER a, AST_NUMBER b)
+{
+    if (a.type == INT_TYPE && b.type == INT_TYPE)
+    {
+        return a.ival == b.ival;
+    }
+
+    return toDouble(a) == toDouble(b);
+}
+
+// The greater and the lesser of two doubles, with 0.0 greater than -0.0 so that
+// neither depends on the order of its operands. A NAN in a, the extremum so far,
+// is kept and one in b ignored.
+static inline double doubleMax(double a, double b)
+{
+    return a < b || (a == b && signbit(a)) ? b : a;
+}
+
+static inline double doubleMin(double a, double b)
+{
+    return b < a || (a == b && signbit(b)) ? b : a;
+}
+
+// Integer arithmetic wraps around modulo 2^64, as two's complement hardware does,
+// instead of overflowing into undefined behaviour.
+static inline int64_t intAdd(int64_t a, int64_t b)
+{
+    return (int64_t) ((uint64_t) a + (uint64_t) b);
+}
+
+static inline int64_t intSub(int64_t a, int64_t b)
+{
+    return (int64_t) ((uint64_t) a - (uint64_t) b);
+}
+
+static inline int64_t intMult(int64_t a, int64_t b)
+{
+    return (int64_t) ((uint64_t) a * (uint64_t) b);
+}
+
+static inline int64_t intNeg(int64_t a)
+{
+    return (int64_t) -(uint64_t) a;
+}
+
+static inline int64_t intAbs(int64_t a)
+{
+    return a < 0 ? intNeg(a) : a;
+}
+
+// Dividing by zero gives 0; INT64_MIN / -1 wraps around to INT64_MIN.
+static inline int64_t intDiv(int64_t a, int64_t b)
+{
+    if (b == 0)
+    {
+        return 0;
+    }
+
+    return b == -1 ? intNeg(a) : a / b;
+}
+
+// The remainder of a / b made non-negative by adding |b|, like doubleRem does.
+static inline int64_t intRem(int64_t a, int64_t b)
+{
+    int64_t rem;
+
+    if (b == 0 || b == -1)
+    {
+        return 0;
+    }
+
+    rem = a % b;
+    return rem < 0 ? intAdd(rem, intAbs(b)) : rem;
+}
+
+static inline double doubleRem(double a, double b)
+{
+    a = fmod(a, b);
+
+    if (a < 0)
+    {
+        a += fabs(b);
+    }
+
+    return a;
+}
+
+int64_t intPow(int64_t base, int64_t exponent);
+
+// Truncates towards zero; NAN gives 0 and out of range values saturate.
+int64_t toInt(double value);
+
+// Converts number to the representation of type; NO_TYPE leaves it as it is.
+// A vector has no int or double value and casts like NAN does.
+AST_NUMBER castNumber(AST_NUMBER number, NUM_TYPE type);
+
+// 1 or 0 as a number of the given type, like the comparison builtins return.
+AST_NUMBER numberFromBool(NUM_TYPE type, bool value);
+
+// The builtins on numbers. Each applies element-wise to vector operands, a scalar
+// operand standing for every element and the longer vector being cut to the
+// length of the shorter one.
+AST_NUMBER numberNeg(AST_NUMBER a);
+AST_NUMBER numberAbs(AST_NUMBER a);
+AST_NUMBER numberAdd(AST_NUMBER a, AST_NUMBER b);
+AST_NUMBER numberSub(AST_NUMBER a, AST_NUMBER b);
+AST_NUMBER numberMult(AST_NUMBER a, AST_NUMBER b);
+AST_NUMBER numberDiv(AST_NUMBER a, AST_NUMBER b);
+AST_NUMBER numberRem(AST_NUMBER a, AST_NUMBER b);
+AST_NUMBER numberPow(AST_NUMBER a, AST_NUMBER b);
+AST_NUMBER numberExp2(AST_NUMBER a);
+AST_NUMBER numberMax(AST_NUMBER a, AST_NUMBER b);
+AST_NUMBER numberMin(AST_NUMBER a, AST_NUMBER b);
+AST_NUMBER numberExp(AST_NUMBER a);
+AST_NUMBER numberLog(AST_NUMBER a);
+AST_NUMBER numberSqrt(AST_NUMBER a);
+AST_NUMBER numberCbrt(AST_NUMBER a);
+// 1 or 0 of the type of a, like the comparison builtins return.
+AST_NUMBER compareEqual(AST_NUMBER a, AST_NUMBER b);
+AST_NUMBER compareLess(AST_NUMBER a, AST_NUMBER b);
+AST_NUMBER compareGreater(AST_NUMBER a, AST_NUMBER b);
+// a + b * b as a double, a step of hypot.
+AST_NUMBER numberAddSquare(AST_NUMBER a, AST_NUMBER b);
+
+#endif
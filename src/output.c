@@ -0,0 +1,192 @@
+#include <math.h>
+#include <stdlib.h>
+#include "output.h"
+#include "format.h"
+
+void outputInit(OUTPUT *output, FILE *file)
+{
+    output->file = file;
+    output->mode = TEXT_OUTPUT;
+    output->doubles = FIXED_DOUBLES;
+    output->failed = false;
+    output->capturing = false;
+    output->captured = NULL;
+    output->capturedLen = 0;
+    output->capturedCap = 0;
+    output->len = 0;
+}
+
+// Writes text to the file, or to what is collected.
+static void put(OUTPUT *output, const char *text, size_t len)
+{
+    if (output->failed || len == 0)
+    {
+        return;
+    }
+
+    if (!output->capturing)
+    {
+        if (output->file != NULL && fwrite(text, 1, len, output->file) != len)
+        {
+            output->failed = true;
+        }
+        return;
+    }
+
+    if (output->capturedLen + len > output->capturedCap)
+    {
+        size_t cap = output->capturedCap ? 2 * output->capturedCap : OUTPUT_BUFFER_SIZE;
+        char *captured;
+
+        while (cap < output->capturedLen + len)
+        {
+            cap *= 2;
+        }
+        if ((captured = realloc(output->captured, cap)) == NULL)
+        {
+            output->failed = true;
+            return;
+        }
+        output->captured = captured;
+        output->capturedCap = cap;
+    }
+    memcpy(output->captured + output->capturedLen, text, len);
+    output->capturedLen += len;
+}
+
+static void drain(OUTPUT *output)
+{
+    put(output, output->buffer, output->len);
+    output->len = 0;
+}
+
+int outputFlush(OUTPUT *output)
+{
+    drain(output);
+    if (output->file != NULL && fflush(output->file) != 0)
+    {
+        output->failed = true;
+    }
+
+    return output->failed ? -1 : 0;
+}
+
+void outputCapture(OUTPUT *output)
+{
+    drain(output);
+    output->capturing = true;
+}
+
+// A failure to collect belongs to what was collected, so it does not outlast it.
+char *outputRelease(OUTPUT *output, size_t *len)
+{
+    char *captured;
+
+    drain(output);
+    captured = output->failed ? NULL : output->captured != NULL ? output->captured : malloc(1);
+    if (captured == NULL)
+    {
+        free(output->captured);
+    }
+    *len = captured != NULL ? output->capturedLen : 0;
+    output->failed = false;
+    output->capturing = false;
+    output->captured = NULL;
+    output->capturedLen = 0;
+    output->capturedCap = 0;
+    return captured;
+}
+
+void outputWrite(OUTPUT *output, const char *text, size_t len)
+{
+    if (output->len + len > OUTPUT_BUFFER_SIZE)
+    {
+        drain(output);
+        if (len > OUTPUT_BUFFER_SIZE)
+        {
+            put(output, text, len);
+            return;
+        }
+    }
+
+    memcpy(output->buffer + output->len, text, len);
+    output->len += len;
+}
+
+// Numbers are written straight into the buffer when it has room for any of them.
+void outputInt(OUTPUT *output, int64_t value)
+{
+    if (output->len + FORMAT_SIZE > OUTPUT_BUFFER_SIZE)
+    {
+        drain(output);
+    }
+    output->len += formatInt(output->buffer + output->len, value);
+}
+
+void outputDouble(OUTPUT *output, double value)
+{
+    if (output->len + FORMAT_SIZE > OUTPUT_BUFFER_SIZE)
+    {
+        drain(output);
+    }
+    output->len += output->doubles == SHORTEST_DOUBLES ? formatShortest(output->buffer + output->len, value) :
+                   formatFixed(output->buffer + output->len, value);
+}
+
+void outputJsonString(OUTPUT *output, const char *text)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    outputChar(output, '"');
+    for (const unsigned char *c = (const unsigned char *) text; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            outputChar(output, '\\');
+            outputChar(output, (char) *c);
+        }
+        else if (*c < 0x20)
+        {
+            char escape[6] = {'\\', 'u', '0', '0', hex[*c >> 4], hex[*c & 0xf]};
+
+            outputWrite(output, escape, sizeof(escape));
+        }
+        else
+        {
+            outputChar(output, (char) *c);
+        }
+    }
+    outputChar(output, '"');
+}
+
+void outputJsonDouble(OUTPUT *output, double value)
+{
+    if (!isfinite(value))
+    {
+        outputText(output, isnan(value) ? "\"nan\"" : value < 0 ? "\"-inf\"" : "\"inf\"");
+        return;
+    }
+
+    if (output->len + FORMAT_SIZE > OUTPUT_BUFFER_SIZE)
+    {
+        drain(output);
+    }
+    output->len += formatShortest(output->buffer + output->len, value);
+}
+
+static void putLittleEndian(unsigned char *bytes, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        bytes[i] = (unsigned char) (value >> 8 * i);
+    }
+}
+
+void outputRecord(OUTPUT *output, RECORD_TYPE type, int flags, uint64_t expression, uint64_t value)
+{
+    unsigned char record[OUTPUT_RECORD_SIZE] = {(unsigned char) type, (unsigned char) flags};
+
+    putLittleEndian(record + 8, expression);
+    putLittleEndian(record + 16, value);
+    outputWrite(output, (const char *) record, sizeof(record));
+}
@@ -0,0 +1,99 @@
+#ifndef __output_h_
+#define __output_h_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// What an interpreter prints: values, warnings, prompts and the echo of its
+// input all go through a buffer of its own, written to its file as it fills up
+// and when flushed, which is up to whoever drives the interpreter: cilisp
+// flushes before it waits for input someone may be typing, and at exit.
+
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+// How values print doubles.
+typedef enum double_format {
+    FIXED_DOUBLES,   // six decimals, as "%lf" writes them
+    SHORTEST_DOUBLES // the fewest digits that read back as the same double
+} DOUBLE_FORMAT;
+
+// How values print, and where warnings go: in red among the values as text, or
+// as JSON lines of their own on stderr otherwise.
+typedef enum output_mode {
+    TEXT_OUTPUT,   // Integer : 3
+    JSONL_OUTPUT,  // a JSON object per line, see printJson in runtime.c
+    BINARY_OUTPUT  // a record of OUTPUT_RECORD_SIZE bytes per value, see below
+} OUTPUT_MODE;
+
+// A record of BINARY_OUTPUT: the type of the value, its flags and 6 bytes of
+// zeros, then the index of the top-level expression and the value, as 64-bit
+// little-endian numbers. The value is an int, the bits of a double, or the length
+// of a vector, whose elements follow as records of their own.
+#define OUTPUT_RECORD_SIZE 24
+
+typedef enum record_type {
+    NONE_RECORD,   // a value of no type, given as a double
+    INT_RECORD,
+    DOUBLE_RECORD,
+    VECTOR_RECORD
+} RECORD_TYPE;
+
+#define RECORD_PRINTED 1 // printed by print, rather than the value of the expression
+#define RECORD_ELEMENT 2 // an element of the vector before it
+
+typedef struct output {
+    FILE *file;
+    OUTPUT_MODE mode;
+    DOUBLE_FORMAT doubles;
+    bool failed; // set once writing to file fails
+    // Set by outputCapture: what is written goes on the end of captured rather than
+    // to file, until outputRelease.
+    bool capturing;
+    char *captured;
+    size_t capturedLen;
+    size_t capturedCap;
+    size_t len;
+    char buffer[OUTPUT_BUFFER_SIZE];
+} OUTPUT;
+
+void outputInit(OUTPUT *output, FILE *file);
+// Writes the buffer to the file, which is flushed too. Returns 0, or -1 if
+// anything written since outputInit has failed.
+int outputFlush(OUTPUT *output);
+
+// Has what is written from now on collect in memory, as --batch does for the
+// output of each expression, rather than go to the file.
+void outputCapture(OUTPUT *output);
+// Stops collecting, and returns what was collected, len bytes for the caller to
+// free, or NULL if there was no memory for it.
+char *outputRelease(OUTPUT *output, size_t *len);
+
+void outputWrite(OUTPUT *output, const char *text, size_t len);
+void outputInt(OUTPUT *output, int64_t value);
+void outputDouble(OUTPUT *output, double value);
+
+// text as a JSON string, quoted and escaped
+void outputJsonString(OUTPUT *output, const char *text);
+// value as a JSON number of the fewest digits that read back as it, or as the
+// string "nan", "inf" or "-inf"
+void outputJsonDouble(OUTPUT *output, double value);
+void outputRecord(OUTPUT *output, RECORD_TYPE type, int flags, uint64_t expression, uint64_t value);
+
+static inline void outputText(OUTPUT *output, const char *text)
+{
+    outputWrite(output, text, strlen(text));
+}
+
+static inline void outputChar(OUTPUT *output, char c)
+{
+    if (output->len == OUTPUT_BUFFER_SIZE)
+    {
+        outputWrite(output, &c, 1);
+        return;
+    }
+    output->buffer[output->len++] = c;
+}
+
+#endif
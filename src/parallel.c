@@ -0,0 +1,223 @@
+#include "cilisp.h"
+
+// Fork-join evaluation of the operands of variadic builtins.
+//
+// With more than one thread, the tree walker evaluates some operands of add,
+// mult, max, min and hypot as tasks of the pool (see pool.h and evalOperands):
+// those that can reach neither rand, read nor print, the values of the let
+// bindings they look up aside, and are estimated to cost at
+// least PARALLEL_MIN_COST, when a call has two of them or more. The builtin still
+// reduces its operands in their order, so the result does not depend on which
+// thread evaluated what.
+//
+// A task that would warn, overflow the stack, or evaluate a let binding with
+// effects or that another task is evaluating fails instead, and is evaluated
+// again by the thread that spawned it in its turn. This gives the output of
+// evaluating everything on one thread.
+
+// Roughly the number of nodes worth a task. A call may recurse any number of
+// times, so it is taken to be worth one.
+#define PARALLEL_MIN_COST 1024
+#define CALL_COST PARALLEL_MIN_COST
+
+typedef struct plan {
+    size_t cost;
+    bool effects;
+} PLAN;
+
+static bool isSpawning(FUNC_TYPE func)
+{
+    switch (func)
+    {
+        case ADD_FUNC:
+        case MULT_FUNC:
+        case MAX_FUNC:
+        case MIN_FUNC:
+        case HYPOT_FUNC:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Whether evaluating node may run rand, read or print, given the lambdas
+// already known to.
+static bool hasEffects(AST_NODE *node)
+{
+    SYMBOL_TABLE_NODE *callee;
+
+    switch (node->type)
+    {
+        case FUNC_NODE_TYPE:
+            switch (node->data.function.func)
+            {
+                case RAND_FUNC:
+                case READ_FUNC:
+                case PRINT_FUNC:
+                    return true;
+                case CUSTOM_FUNC:
+                    callee = node->data.function.callee;
+                    if (callee != NULL && callee->effects)
+                    {
+                        return true;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+            {
+                if (hasEffects(op))
+                {
+                    return true;
+                }
+            }
+            return false;
+        case SCOPE_NODE_TYPE:
+            for (int i = 0; i < node->data.scope.nBindings; i++)
+            {
+                AST_NODE *value = node->data.scope.bindings[i]->value;
+
+                // a lambda only runs when called
+                if (value->type != LAMBDA_NODE_TYPE && hasEffects(value))
+                {
+                    return true;
+                }
+            }
+            return hasEffects(node->data.scope.child);
+        case CONDITIONAL_NODE_TYPE:
+            return hasEffects(node->data.condition.condition)
+                   || hasEffects(node->data.condition._true)
+                   || hasEffects(node->data.condition._false);
+        default:
+            return false;
+    }
+}
+
+// Sets effects on the bindings in node whose value, or lambda body, has effects,
+// given the lambdas already known to. Returns whether any was set.
+static bool markEffects(AST_NODE *node)
+{
+    bool changed = false;
+
+    switch (node->type)
+    {
+        case FUNC_NODE_TYPE:
+            for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+            {
+                changed |= markEffects(op);
+            }
+            break;
+        case SCOPE_NODE_TYPE:
+            for (int i = 0; i < node->data.scope.nBindings; i++)
+            {
+                SYMBOL_TABLE_NODE *binding = node->data.scope.bindings[i];
+                AST_NODE *value = binding->value;
+
+                if (value->type == LAMBDA_NODE_TYPE)
+                {
+                    value = value->data.lambda.body;
+                }
+                if (!binding->effects && hasEffects(value))
+                {
+                    binding->effects = true;
+                    changed = true;
+                }
+                changed |= markEffects(value);
+            }
+            changed |= markEffects(node->data.scope.child);
+            break;
+        case CONDITIONAL_NODE_TYPE:
+            changed |= markEffects(node->data.condition.condition);
+            changed |= markEffects(node->data.condition._true);
+            changed |= markEffects(node->data.condition._false);
+            break;
+        default:
+            break;
+    }
+
+    return changed;
+}
+
+static void addPlan(PLAN *plan, PLAN part)
+{
+    plan->cost += part.cost;
+    plan->effects = plan->effects || part.effects;
+}
+
+// The cost and effects of evaluating node, marking the operands in it to spawn.
+static PLAN planNode(AST_NODE *node)
+{
+    SYMBOL_TABLE_NODE *callee = NULL;
+    PLAN plan = {1, false};
+    PLAN part;
+    int spawned = 0;
+
+    switch (node->type)
+    {
+        case FUNC_NODE_TYPE:
+            switch (node->data.function.func)
+            {
+                case RAND_FUNC:
+                case READ_FUNC:
+                case PRINT_FUNC:
+                    plan.effects = true;
+                    break;
+                case CUSTOM_FUNC:
+                    callee = node->data.function.callee;
+                    plan.cost += CALL_COST;
+                    plan.effects = callee != NULL && callee->effects;
+                    break;
+                default:
+                    break;
+            }
+            for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+            {
+                part = planNode(op);
+                addPlan(&plan, part);
+                op->spawn = !part.effects && part.cost >= PARALLEL_MIN_COST;
+                spawned += op->spawn;
+            }
+            if (!isSpawning(node->data.function.func) || spawned < 2)
+            {
+                for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+                {
+                    op->spawn = false;
+                }
+            }
+            break;
+        case SCOPE_NODE_TYPE:
+            for (int i = 0; i < node->data.scope.nBindings; i++)
+            {
+                AST_NODE *value = node->data.scope.bindings[i]->value;
+
+                if (value->type == LAMBDA_NODE_TYPE)
+                {
+                    planNode(value->data.lambda.body);
+                    continue;
+                }
+                addPlan(&plan, planNode(value));
+            }
+            addPlan(&plan, planNode(node->data.scope.child));
+            break;
+        case CONDITIONAL_NODE_TYPE:
+            addPlan(&plan, planNode(node->data.condition.condition));
+            addPlan(&plan, planNode(node->data.condition._true));
+            addPlan(&plan, planNode(node->data.condition._false));
+            break;
+        default:
+            break;
+    }
+
+    return plan;
+}
+
+// Marks the operands to evaluate as tasks in a resolved expression.
+void parallelProgram(AST_NODE *node)
+{
+    while (markEffects(node))
+    {
+    }
+
+    planNode(node);
+}
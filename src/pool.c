@@ -0,0 +1,204 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include "cilisp.h"
+#include "pool.h"
+
+#define INITIAL_DEQUE_SIZE 64
+// Room for workers to recurse as deeply as a main thread with the usual 8 MB
+// stack, and to run more tasks on top of that while joining.
+#define WORKER_STACK_SIZE ((size_t) 32 << 20)
+// Tries to find a task before a worker goes to sleep.
+#define IDLE_SPINS 64
+
+// Tasks from head (oldest, taken by thieves) to tail (newest, taken by the
+// owner), in a ring of size entries.
+typedef struct deque {
+    pthread_mutex_t lock;
+    POOL_TASK **tasks;
+    size_t size;
+    size_t head;
+    size_t tail;
+} DEQUE;
+
+static DEQUE *deques;
+static int threadCount = 1;
+static void (*initWorker)(void);
+
+// The deque of the calling thread; the thread that started the pool has 0.
+static _Thread_local int self;
+
+// Tasks queued on any deque, and the lock and condition idle workers sleep on.
+static atomic_int queued;
+static pthread_mutex_t idleLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idleCond = PTHREAD_COND_INITIALIZER;
+
+static void pushTask(DEQUE *deque, POOL_TASK *task)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail - deque->head == deque->size)
+    {
+        size_t size = deque->size ? 2 * deque->size : INITIAL_DEQUE_SIZE;
+        POOL_TASK **tasks = malloc(size * sizeof(POOL_TASK *));
+
+        if (tasks == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+        for (size_t i = deque->head; i < deque->tail; i++)
+        {
+            tasks[i % size] = deque->tasks[i % deque->size];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->size = size;
+    }
+    deque->tasks[deque->tail++ % deque->size] = task;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// The newest task for the owner, the oldest one for a thief, or NULL.
+static POOL_TASK *takeTask(DEQUE *deque, bool newest)
+{
+    POOL_TASK *task = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head != deque->tail)
+    {
+        task = newest ? deque->tasks[--deque->tail % deque->size] : deque->tasks[deque->head++ % deque->size];
+        atomic_fetch_sub(&queued, 1);
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return task;
+}
+
+// A task of this thread, or else one stolen from the others in turn.
+static POOL_TASK *findTask(void)
+{
+    POOL_TASK *task;
+
+    if ((task = takeTask(&deques[self], true)) != NULL)
+    {
+        return task;
+    }
+
+    for (int i = 1; i < threadCount; i++)
+    {
+        if ((task = takeTask(&deques[(self + i) % threadCount], false)) != NULL)
+        {
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+static void runTask(POOL_TASK *task)
+{
+    task->run(task);
+    atomic_store_explicit(&task->done, true, memory_order_release);
+}
+
+static void *workerMain(void *arg)
+{
+    POOL_TASK *task;
+
+    self = (int) (intptr_t) arg;
+    if (initWorker != NULL)
+    {
+        initWorker();
+    }
+
+    while (true)
+    {
+        for (int spins = 0; spins < IDLE_SPINS; spins++)
+        {
+            if ((task = findTask()) != NULL)
+            {
+                runTask(task);
+                spins = 0;
+            }
+            else
+            {
+                sched_yield();
+            }
+        }
+
+        pthread_mutex_lock(&idleLock);
+        while (atomic_load(&queued) == 0)
+        {
+            pthread_cond_wait(&idleCond, &idleLock);
+        }
+        pthread_mutex_unlock(&idleLock);
+    }
+
+    return NULL;
+}
+
+void poolStart(int threads, void (*init)(void))
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if (threadCount > 1 || threads < 2)
+    {
+        return;
+    }
+
+    if ((deques = calloc(threads, sizeof(DEQUE))) == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_mutex_init(&deques[i].lock, NULL);
+    }
+    threadCount = threads;
+    initWorker = init;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (int i = 1; i < threads; i++)
+    {
+        if (pthread_create(&thread, &attr, workerMain, (void *) (intptr_t) i) != 0)
+        {
+            yyerror("Could not start a worker thread!");
+        }
+    }
+    pthread_attr_destroy(&attr);
+}
+
+int poolThreads(void)
+{
+    return threadCount;
+}
+
+void poolSpawn(POOL_TASK *task)
+{
+    atomic_init(&task->done, false);
+    atomic_fetch_add(&queued, 1);
+    pushTask(&deques[self], task);
+
+    pthread_mutex_lock(&idleLock);
+    pthread_cond_signal(&idleCond);
+    pthread_mutex_unlock(&idleLock);
+}
+
+void poolJoin(POOL_TASK *task)
+{
+    POOL_TASK *other;
+
+    while (!atomic_load_explicit(&task->done, memory_order_acquire))
+    {
+        if ((other = findTask()) != NULL)
+        {
+            runTask(other);
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef __pool_h_
+#define __pool_h_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// Work-stealing thread pool for fork-join parallelism.
+//
+// Each thread of the pool, the one that started it included, has a deque of the
+// tasks it spawned. It runs its own tasks newest first, and takes the oldest task
+// of another thread when it has none left. A thread joining a task runs other
+// tasks until that one is done, so joining never blocks a thread that could work.
+
+typedef struct pool_task {
+    void (*run)(struct pool_task *task);
+    atomic_bool done;
+} POOL_TASK;
+
+// Starts threads - 1 workers next to the calling thread; nothing happens if the
+// pool is already running or threads < 2. init runs first on each worker.
+void poolStart(int threads, void (*init)(void));
+// The number of threads running tasks, 1 before poolStart.
+int poolThreads(void);
+
+// Queues task on the calling thread's deque, for this thread or another one to run.
+void poolSpawn(POOL_TASK *task);
+// Returns once task has run, running queued tasks in the meantime.
+void poolJoin(POOL_TASK *task);
+
+#endif
@@ -0,0 +1,190 @@
+#include <time.h>
+#include "profile.h"
+
+#if PROFILE_TSC
+#include <x86intrin.h>
+#endif
+
+_Thread_local PROFILE *currentProfile;
+
+static const char *stageNames[] = {"parse", "prepare", "compile", "run", "print", "free"};
+
+// by AST_NODE_TYPE
+static const char *nodeNames[] = {"number", "function", "symbol", "let", "cond", "lambda"};
+
+static uint64_t ticks(void)
+{
+#if PROFILE_TSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+PROFILE *profileCreate(void)
+{
+    PROFILE *profile = calloc(1, sizeof(PROFILE));
+
+    if (profile != NULL)
+    {
+        profile->startTicks = ticks();
+        profile->startTime = seconds();
+    }
+
+    return profile;
+}
+
+void profileFree(PROFILE *profile)
+{
+    free(profile);
+}
+
+void profileBegin(PROFILE *profile, PROFILE_SPAN *span, int entry)
+{
+    span->parent = profile->current;
+    span->children = 0;
+    span->entry = entry;
+    profile->current = span;
+    profile->entries[entry].active++;
+    span->start = ticks();
+}
+
+void profileEnd(PROFILE *profile, PROFILE_SPAN *span, int operands)
+{
+    uint64_t elapsed = ticks() - span->start;
+    PROFILE_ENTRY *entry = &profile->entries[span->entry];
+
+    entry->calls++;
+    entry->exclusive += elapsed - span->children;
+    if (--entry->active == 0)
+    {
+        entry->inclusive += elapsed;
+    }
+    if (operands >= 0)
+    {
+        entry->operands[operands < 4 ? operands : operands < 8 ? 4 : operands < 16 ? 5 : operands < 64 ? 6 : 7]++;
+    }
+
+    profile->current = span->parent;
+    if (span->parent != NULL)
+    {
+        span->parent->children += elapsed;
+    }
+}
+
+void profileAbort(PROFILE *profile)
+{
+    profile->current = NULL;
+    for (int i = 0; i < PROFILE_ENTRIES; i++)
+    {
+        profile->entries[i].active = 0;
+    }
+}
+
+typedef struct profile_row {
+    const char *name;
+    const PROFILE_ENTRY *entry;
+} PROFILE_ROW;
+
+static int byExclusive(const void *a, const void *b)
+{
+    uint64_t x = ((const PROFILE_ROW *) a)->entry->exclusive;
+    uint64_t y = ((const PROFILE_ROW *) b)->entry->exclusive;
+
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// Prints the entries from first to last that were called, as a table headed by title.
+static void printRows(const PROFILE *profile, FILE *out, const char *title, int first, int last,
+                      double tickSeconds, uint64_t total)
+{
+    static const char *bucketNames[] = {"0", "1", "2", "3", "4-7", "8-15", "16-63", "64+"};
+    PROFILE_ROW rows[PROFILE_ENTRIES];
+    int count = 0;
+    bool calls = first == PROFILE_FUNC(0);
+
+    for (int i = first; i < last; i++)
+    {
+        if (profile->entries[i].calls == 0)
+        {
+            continue;
+        }
+
+        rows[count].entry = &profile->entries[i];
+        if (i < PROFILE_FUNC(0))
+        {
+            rows[count].name = stageNames[i];
+        }
+        else if (i < PROFILE_FUNC(CUSTOM_FUNC))
+        {
+            rows[count].name = funcName(i - PROFILE_FUNC(0));
+        }
+        else if (i == PROFILE_FUNC(CUSTOM_FUNC))
+        {
+            rows[count].name = "lambda call";
+        }
+        else
+        {
+            rows[count].name = nodeNames[i - PROFILE_NODE(0)];
+        }
+        count++;
+    }
+    if (count == 0)
+    {
+        return;
+    }
+    qsort(rows, count, sizeof(PROFILE_ROW), byExclusive);
+
+    fprintf(out, "\n%-12s %12s %12s %12s %7s%s\n", title, "calls", "incl ms", "excl ms", "excl %",
+            calls ? "   operands" : "");
+    for (int i = 0; i < count; i++)
+    {
+        const PROFILE_ENTRY *entry = rows[i].entry;
+
+        fprintf(out, "%-12s %12llu %12.3f %12.3f %7.2f", rows[i].name, (unsigned long long) entry->calls,
+                entry->inclusive * tickSeconds * 1e3, entry->exclusive * tickSeconds * 1e3,
+                total > 0 ? 100.0 * entry->exclusive / total : 0.0);
+        if (calls)
+        {
+            fprintf(out, "  ");
+            for (int b = 0; b < PROFILE_BUCKETS; b++)
+            {
+                if (entry->operands[b] > 0)
+                {
+                    fprintf(out, " %s:%llu", bucketNames[b], (unsigned long long) entry->operands[b]);
+                }
+            }
+        }
+        fprintf(out, "\n");
+    }
+}
+
+void profileReport(const PROFILE *profile, FILE *out)
+{
+    double wall = seconds() - profile->startTime;
+    uint64_t elapsed = ticks() - profile->startTicks;
+    // the time stamp counter runs at a constant rate, measured against the clock
+    double tickSeconds = elapsed > 0 ? wall / elapsed : 0;
+    uint64_t total = 0;
+
+    for (int i = 0; i < PROFILE_ENTRIES; i++)
+    {
+        total += profile->entries[i].exclusive;
+    }
+
+    fprintf(out, "\nprofile: %llu expressions in %.3f ms, %.3f ms of it profiled\n",
+            (unsigned long long) profile->entries[PROFILE_RUN].calls, wall * 1e3, total * tickSeconds * 1e3);
+    printRows(profile, out, "stage", 0, PROFILE_FUNC(0), tickSeconds, total);
+    printRows(profile, out, "call", PROFILE_FUNC(0), PROFILE_NODE(0), tickSeconds, total);
+    printRows(profile, out, "eval of", PROFILE_NODE(0), PROFILE_ENTRIES, tickSeconds, total);
+    fflush(out);
+}
@@ -0,0 +1,87 @@
+#ifndef __profile_h_
+#define __profile_h_
+
+#include "cilisp.h"
+
+// Counters of --profile and (stats).
+//
+// An interpreter created with the profile option counts the calls, and adds up
+// the inclusive and exclusive time, of the stages each top-level expression goes
+// through, of the builtins and lambda calls the tree walker makes, by FUNC_TYPE,
+// and of eval by the type of the node it is called on, along with how many
+// operands each builtin and lambda was called with. Without it, currentProfile
+// is NULL and each hook costs a load and a branch. Time is read from the time
+// stamp counter where there is one, and turned into seconds in the report.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PROFILE_TSC 1
+#else
+#define PROFILE_TSC 0
+#endif
+
+typedef enum profile_stage {
+    PROFILE_PARSE,   // scanning and parsing, without what the parser runs
+    PROFILE_PREPARE, // the passes over each expression
+    PROFILE_COMPILE, // compiling it to bytecode
+    PROFILE_RUN,     // running it on the VM or the tree walker
+    PROFILE_PRINT,   // printing its value
+    PROFILE_FREE,    // freeing its AST and values, which resets their arenas
+    PROFILE_STAGES
+} PROFILE_STAGE;
+
+// What the profile counts: the stages, then the builtins with the lambda calls
+// at CUSTOM_FUNC, then the node types.
+#define PROFILE_FUNC(func) (PROFILE_STAGES + (func))
+#define PROFILE_NODE(type) (PROFILE_FUNC(CUSTOM_FUNC) + 1 + (type))
+#define PROFILE_ENTRIES PROFILE_NODE(LAMBDA_NODE_TYPE + 1)
+
+// Operand counts 0, 1, 2, 3, 4 to 7, 8 to 15, 16 to 63, and 64 or more.
+#define PROFILE_BUCKETS 8
+
+typedef struct profile_entry {
+    uint64_t calls;
+    uint64_t inclusive;
+    uint64_t exclusive;
+    uint64_t operands[PROFILE_BUCKETS];
+    int active; // its spans open, of which only the outermost adds to inclusive
+} PROFILE_ENTRY;
+
+// What a hook is timing, kept on the stack of the function it times. The time of
+// the spans inside it is taken out of its exclusive time.
+typedef struct profile_span {
+    uint64_t start;
+    uint64_t children;
+    int entry;
+    struct profile_span *parent;
+} PROFILE_SPAN;
+
+typedef struct profile {
+    PROFILE_ENTRY entries[PROFILE_ENTRIES];
+    PROFILE_SPAN *current;
+    uint64_t startTicks;
+    double startTime;
+} PROFILE;
+
+// The profile of the interpreter this thread is running, if it keeps one, set by
+// useContext; the threads of --threads keep none.
+extern _Thread_local PROFILE *currentProfile;
+
+// Returns an empty profile, or NULL if memory runs out.
+PROFILE *profileCreate(void);
+void profileFree(PROFILE *profile);
+
+void profileBegin(PROFILE *profile, PROFILE_SPAN *span, int entry);
+// operands < 0 for a span that is not a call
+void profileEnd(PROFILE *profile, PROFILE_SPAN *span, int operands);
+
+// Forgets the spans an error jumped out of.
+void profileAbort(PROFILE *profile);
+
+// Prints the stages, then the builtins and lambda calls, then the node types,
+// each sorted by exclusive time.
+void profileReport(const PROFILE *profile, FILE *out);
+
+#define PROFILE_BEGIN(span, entry) {if (currentProfile != NULL) {profileBegin(currentProfile, &(span), entry);}}
+#define PROFILE_END(span) {if (currentProfile != NULL) {profileEnd(currentProfile, &(span), -1);}}
+
+#endif
@@ -0,0 +1,1144 @@
+#include "runtime.h"
+#include "reduce.h"
+#include "vector.h"
+
+#if REDUCE_X86
+#include <immintrin.h>
+#endif
+
+#define SCRATCH_ALIGN 32
+
+// The reductions and dot accumulate n values, a multiple of REDUCE_LANES, into
+// lanes; the maps take any n.
+typedef struct reduce_kernels {
+    void (*doubles)(REDUCE_OP op, const double *values, size_t n, double *lanes);
+    void (*ints)(REDUCE_OP op, const int64_t *values, size_t n, int64_t *lanes);
+    void (*dot)(const double *a, const double *b, size_t n, double *lanes);
+    void (*mapDoubles)(MAP_OP op, const double *a, size_t aStep, const double *b, size_t bStep, double *out, size_t n);
+    void (*mapInts)(MAP_OP op, const int64_t *a, size_t aStep, const int64_t *b, size_t bStep, int64_t *out, size_t n);
+} REDUCE_KERNELS;
+
+// Where reduceValues and friends gather operand values, so the kernels read them
+// contiguously rather than from the tagged RET_VALs. Each thread has its own.
+static _Thread_local void *scratch;
+static _Thread_local size_t scratchCap;
+
+static const REDUCE_KERNELS *kernels;
+static REDUCE_ISA kernelsIsa;
+
+static inline double addDouble(double lane, double value)
+{
+    return lane + value;
+}
+
+static inline double multDouble(double lane, double value)
+{
+    return lane * value;
+}
+
+static inline double addSquare(double lane, double value)
+{
+    return lane + value * value;
+}
+
+static inline int64_t intMax(int64_t lane, int64_t value)
+{
+    return value > lane ? value : lane;
+}
+
+static inline int64_t intMin(int64_t lane, int64_t value)
+{
+    return value < lane ? value : lane;
+}
+
+static inline int64_t addIntSquare(int64_t lane, int64_t value)
+{
+    return intAdd(lane, intMult(value, value));
+}
+
+static double stepDouble(REDUCE_OP op, double lane, double value)
+{
+    switch (op)
+    {
+        case REDUCE_SUM:
+            return addDouble(lane, value);
+        case REDUCE_PRODUCT:
+            return multDouble(lane, value);
+        case REDUCE_MAX:
+            return doubleMax(lane, value);
+        case REDUCE_MIN:
+            return doubleMin(lane, value);
+        case REDUCE_SQUARES:
+            return addSquare(lane, value);
+    }
+
+    return lane;
+}
+
+// How two lanes, or two partial results, combine.
+static double combineDouble(REDUCE_OP op, double a, double b)
+{
+    return stepDouble(op == REDUCE_SQUARES ? REDUCE_SUM : op, a, b);
+}
+
+static int64_t stepInt(REDUCE_OP op, int64_t lane, int64_t value)
+{
+    switch (op)
+    {
+        case REDUCE_SUM:
+            return intAdd(lane, value);
+        case REDUCE_PRODUCT:
+            return intMult(lane, value);
+        case REDUCE_MAX:
+            return intMax(lane, value);
+        case REDUCE_MIN:
+            return intMin(lane, value);
+        case REDUCE_SQUARES:
+            return addIntSquare(lane, value);
+    }
+
+    return lane;
+}
+
+static int64_t combineInt(REDUCE_OP op, int64_t a, int64_t b)
+{
+    return stepInt(op == REDUCE_SQUARES ? REDUCE_SUM : op, a, b);
+}
+
+// Applies step to value i and lane i % REDUCE_LANES, with one loop per op so
+// that the switch stays out of it.
+#define SCALAR_LOOP(step) \
+    for (size_t i = 0; i < n; i++) \
+    { \
+        lanes[i % REDUCE_LANES] = step(lanes[i % REDUCE_LANES], values[i]); \
+    }
+
+static void scalarDoubles(REDUCE_OP op, const double *values, size_t n, double *lanes)
+{
+    switch (op)
+    {
+        case REDUCE_SUM:
+            SCALAR_LOOP(addDouble)
+            break;
+        case REDUCE_PRODUCT:
+            SCALAR_LOOP(multDouble)
+            break;
+        case REDUCE_MAX:
+            SCALAR_LOOP(doubleMax)
+            break;
+        case REDUCE_MIN:
+            SCALAR_LOOP(doubleMin)
+            break;
+        case REDUCE_SQUARES:
+            SCALAR_LOOP(addSquare)
+            break;
+    }
+}
+
+static void scalarInts(REDUCE_OP op, const int64_t *values, size_t n, int64_t *lanes)
+{
+    switch (op)
+    {
+        case REDUCE_SUM:
+            SCALAR_LOOP(intAdd)
+            break;
+        case REDUCE_PRODUCT:
+            SCALAR_LOOP(intMult)
+            break;
+        case REDUCE_MAX:
+            SCALAR_LOOP(intMax)
+            break;
+        case REDUCE_MIN:
+            SCALAR_LOOP(intMin)
+            break;
+        case REDUCE_SQUARES:
+            SCALAR_LOOP(addIntSquare)
+            break;
+    }
+}
+
+static void scalarDot(const double *a, const double *b, size_t n, double *lanes)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        lanes[i % REDUCE_LANES] += a[i] * b[i];
+    }
+}
+
+// Applies expr to x = a[i * aStep], and y = b[i * bStep] for the binary ops.
+#define SCALAR_MAP1(type, expr) \
+    for (size_t i = 0; i < n; i++) \
+    { \
+        type x = a[i * aStep]; \
+        out[i] = (expr); \
+    }
+
+#define SCALAR_MAP2(type, expr) \
+    for (size_t i = 0; i < n; i++) \
+    { \
+        type x = a[i * aStep]; \
+        type y = b[i * bStep]; \
+        out[i] = (expr); \
+    }
+
+static void scalarMapDoubles(MAP_OP op, const double *a, size_t aStep, const double *b, size_t bStep, double *out, size_t n)
+{
+    switch (op)
+    {
+        case MAP_NEG:
+            SCALAR_MAP1(double, -x)
+            break;
+        case MAP_ABS:
+            SCALAR_MAP1(double, fabs(x))
+            break;
+        case MAP_EXP:
+            SCALAR_MAP1(double, exp(x))
+            break;
+        case MAP_EXP2:
+            SCALAR_MAP1(double, pow(2, x))
+            break;
+        case MAP_LOG:
+            SCALAR_MAP1(double, log(x))
+            break;
+        case MAP_SQRT:
+            SCALAR_MAP1(double, sqrt(x))
+            break;
+        case MAP_CBRT:
+            SCALAR_MAP1(double, cbrt(x))
+            break;
+        case MAP_ADD:
+            SCALAR_MAP2(double, x + y)
+            break;
+        case MAP_SUB:
+            SCALAR_MAP2(double, x - y)
+            break;
+        case MAP_MULT:
+            SCALAR_MAP2(double, x * y)
+            break;
+        case MAP_DIV:
+            SCALAR_MAP2(double, x / y)
+            break;
+        case MAP_REM:
+            SCALAR_MAP2(double, doubleRem(x, y))
+            break;
+        case MAP_POW:
+            SCALAR_MAP2(double, pow(x, y))
+            break;
+        case MAP_MAX:
+            SCALAR_MAP2(double, doubleMax(x, y))
+            break;
+        case MAP_MIN:
+            SCALAR_MAP2(double, doubleMin(x, y))
+            break;
+        case MAP_EQUAL:
+            SCALAR_MAP2(double, x == y)
+            break;
+        case MAP_LESS:
+            SCALAR_MAP2(double, x < y)
+            break;
+        case MAP_GREATER:
+            SCALAR_MAP2(double, y < x)
+            break;
+        case MAP_ADD_SQUARE:
+            SCALAR_MAP2(double, x + y * y)
+            break;
+    }
+}
+
+static void scalarMapInts(MAP_OP op, const int64_t *a, size_t aStep, const int64_t *b, size_t bStep, int64_t *out, size_t n)
+{
+    switch (op)
+    {
+        case MAP_NEG:
+            SCALAR_MAP1(int64_t, intNeg(x))
+            break;
+        case MAP_ABS:
+            SCALAR_MAP1(int64_t, intAbs(x))
+            break;
+        case MAP_EXP2:
+            SCALAR_MAP1(int64_t, intPow(2, x))
+            break;
+        case MAP_ADD:
+            SCALAR_MAP2(int64_t, intAdd(x, y))
+            break;
+        case MAP_SUB:
+            SCALAR_MAP2(int64_t, intSub(x, y))
+            break;
+        case MAP_MULT:
+            SCALAR_MAP2(int64_t, intMult(x, y))
+            break;
+        case MAP_DIV:
+            SCALAR_MAP2(int64_t, intDiv(x, y))
+            break;
+        case MAP_REM:
+            SCALAR_MAP2(int64_t, intRem(x, y))
+            break;
+        case MAP_POW:
+            SCALAR_MAP2(int64_t, intPow(x, y))
+            break;
+        case MAP_MAX:
+            SCALAR_MAP2(int64_t, intMax(x, y))
+            break;
+        case MAP_MIN:
+            SCALAR_MAP2(int64_t, intMin(x, y))
+            break;
+        case MAP_EQUAL:
+            SCALAR_MAP2(int64_t, x == y)
+            break;
+        case MAP_LESS:
+            SCALAR_MAP2(int64_t, x < y)
+            break;
+        case MAP_GREATER:
+            SCALAR_MAP2(int64_t, y < x)
+            break;
+        default:
+            break;
+    }
+}
+
+static const REDUCE_KERNELS scalarKernels = {scalarDoubles, scalarInts, scalarDot, scalarMapDoubles, scalarMapInts};
+
+#if REDUCE_X86
+
+// Lanes 0-7 are held by four registers of two, in order.
+
+// max_pd(value, lane) keeps lane when value is NAN, like doubleMax; only the
+// choice between 0.0 and -0.0 is left, which the sign bits of both settle.
+__attribute__((target("sse2")))
+static inline __m128d sse2Max(__m128d lane, __m128d value)
+{
+    __m128d equal = _mm_cmpeq_pd(lane, value);
+
+    return _mm_or_pd(_mm_and_pd(equal, _mm_and_pd(lane, value)), _mm_andnot_pd(equal, _mm_max_pd(value, lane)));
+}
+
+__attribute__((target("sse2")))
+static inline __m128d sse2Min(__m128d lane, __m128d value)
+{
+    __m128d equal = _mm_cmpeq_pd(lane, value);
+
+    return _mm_or_pd(_mm_and_pd(equal, _mm_or_pd(lane, value)), _mm_andnot_pd(equal, _mm_min_pd(value, lane)));
+}
+
+// Applies step to the four registers for each group of REDUCE_LANES values.
+#define SSE2_LOOP(step) \
+    for (size_t i = 0; i < n; i += REDUCE_LANES) \
+    { \
+        r0 = step(r0, _mm_loadu_pd(values + i)); \
+        r1 = step(r1, _mm_loadu_pd(values + i + 2)); \
+        r2 = step(r2, _mm_loadu_pd(values + i + 4)); \
+        r3 = step(r3, _mm_loadu_pd(values + i + 6)); \
+    }
+
+__attribute__((target("sse2")))
+static inline __m128d sse2Squares(__m128d lane, __m128d value)
+{
+    return _mm_add_pd(lane, _mm_mul_pd(value, value));
+}
+
+__attribute__((target("sse2")))
+static void sse2Doubles(REDUCE_OP op, const double *values, size_t n, double *lanes)
+{
+    __m128d r0 = _mm_loadu_pd(lanes);
+    __m128d r1 = _mm_loadu_pd(lanes + 2);
+    __m128d r2 = _mm_loadu_pd(lanes + 4);
+    __m128d r3 = _mm_loadu_pd(lanes + 6);
+
+    switch (op)
+    {
+        case REDUCE_SUM:
+            SSE2_LOOP(_mm_add_pd)
+            break;
+        case REDUCE_PRODUCT:
+            SSE2_LOOP(_mm_mul_pd)
+            break;
+        case REDUCE_MAX:
+            SSE2_LOOP(sse2Max)
+            break;
+        case REDUCE_MIN:
+            SSE2_LOOP(sse2Min)
+            break;
+        case REDUCE_SQUARES:
+            SSE2_LOOP(sse2Squares)
+            break;
+    }
+
+    _mm_storeu_pd(lanes, r0);
+    _mm_storeu_pd(lanes + 2, r1);
+    _mm_storeu_pd(lanes + 4, r2);
+    _mm_storeu_pd(lanes + 6, r3);
+}
+
+// SSE2 has no 64-bit compares or multiplies, so only sums are vectorized.
+__attribute__((target("sse2")))
+static void sse2Ints(REDUCE_OP op, const int64_t *values, size_t n, int64_t *lanes)
+{
+    __m128i r0, r1, r2, r3;
+
+    if (op != REDUCE_SUM)
+    {
+        scalarInts(op, values, n, lanes);
+        return;
+    }
+
+    r0 = _mm_loadu_si128((const __m128i *) lanes);
+    r1 = _mm_loadu_si128((const __m128i *) (lanes + 2));
+    r2 = _mm_loadu_si128((const __m128i *) (lanes + 4));
+    r3 = _mm_loadu_si128((const __m128i *) (lanes + 6));
+
+    for (size_t i = 0; i < n; i += REDUCE_LANES)
+    {
+        r0 = _mm_add_epi64(r0, _mm_loadu_si128((const __m128i *) (values + i)));
+        r1 = _mm_add_epi64(r1, _mm_loadu_si128((const __m128i *) (values + i + 2)));
+        r2 = _mm_add_epi64(r2, _mm_loadu_si128((const __m128i *) (values + i + 4)));
+        r3 = _mm_add_epi64(r3, _mm_loadu_si128((const __m128i *) (values + i + 6)));
+    }
+
+    _mm_storeu_si128((__m128i *) lanes, r0);
+    _mm_storeu_si128((__m128i *) (lanes + 2), r1);
+    _mm_storeu_si128((__m128i *) (lanes + 4), r2);
+    _mm_storeu_si128((__m128i *) (lanes + 6), r3);
+}
+
+__attribute__((target("sse2")))
+static void sse2Dot(const double *a, const double *b, size_t n, double *lanes)
+{
+    __m128d r0 = _mm_loadu_pd(lanes);
+    __m128d r1 = _mm_loadu_pd(lanes + 2);
+    __m128d r2 = _mm_loadu_pd(lanes + 4);
+    __m128d r3 = _mm_loadu_pd(lanes + 6);
+
+    for (size_t i = 0; i < n; i += REDUCE_LANES)
+    {
+        r0 = _mm_add_pd(r0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        r1 = _mm_add_pd(r1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+        r2 = _mm_add_pd(r2, _mm_mul_pd(_mm_loadu_pd(a + i + 4), _mm_loadu_pd(b + i + 4)));
+        r3 = _mm_add_pd(r3, _mm_mul_pd(_mm_loadu_pd(a + i + 6), _mm_loadu_pd(b + i + 6)));
+    }
+
+    _mm_storeu_pd(lanes, r0);
+    _mm_storeu_pd(lanes + 2, r1);
+    _mm_storeu_pd(lanes + 4, r2);
+    _mm_storeu_pd(lanes + 6, r3);
+}
+
+// Maps whole registers of elements, loading a scalar operand (a step of 0) once;
+// the scalar kernel does the elements left over.
+#define SIMD_MAP1(vector, width, splat, load, store, expr) \
+    { \
+        vector xs = aStep ? splat(0) : splat(*a); \
+        for (; i + width <= n; i += width) \
+        { \
+            vector x = aStep ? load(a + i) : xs; \
+            store(out + i, expr); \
+        } \
+    }
+
+#define SIMD_MAP2(vector, width, splat, load, store, expr) \
+    { \
+        vector xs = aStep ? splat(0) : splat(*a); \
+        vector ys = bStep ? splat(0) : splat(*b); \
+        for (; i + width <= n; i += width) \
+        { \
+            vector x = aStep ? load(a + i) : xs; \
+            vector y = bStep ? load(b + i) : ys; \
+            store(out + i, expr); \
+        } \
+    }
+
+#define SSE2_MAP1(expr) SIMD_MAP1(__m128d, 2, _mm_set1_pd, _mm_loadu_pd, _mm_storeu_pd, expr)
+#define SSE2_MAP2(expr) SIMD_MAP2(__m128d, 2, _mm_set1_pd, _mm_loadu_pd, _mm_storeu_pd, expr)
+
+// Comparisons give 1.0 or 0.0 by masking 1.0 with the all ones or zeros they set.
+__attribute__((target("sse2")))
+static void sse2MapDoubles(MAP_OP op, const double *a, size_t aStep, const double *b, size_t bStep, double *out, size_t n)
+{
+    __m128d sign = _mm_set1_pd(-0.0);
+    __m128d one = _mm_set1_pd(1);
+    size_t i = 0;
+
+    switch (op)
+    {
+        case MAP_NEG:
+            SSE2_MAP1(_mm_xor_pd(x, sign))
+            break;
+        case MAP_ABS:
+            SSE2_MAP1(_mm_andnot_pd(sign, x))
+            break;
+        case MAP_SQRT:
+            SSE2_MAP1(_mm_sqrt_pd(x))
+            break;
+        case MAP_ADD:
+            SSE2_MAP2(_mm_add_pd(x, y))
+            break;
+        case MAP_SUB:
+            SSE2_MAP2(_mm_sub_pd(x, y))
+            break;
+        case MAP_MULT:
+            SSE2_MAP2(_mm_mul_pd(x, y))
+            break;
+        case MAP_DIV:
+            SSE2_MAP2(_mm_div_pd(x, y))
+            break;
+        case MAP_MAX:
+            SSE2_MAP2(sse2Max(x, y))
+            break;
+        case MAP_MIN:
+            SSE2_MAP2(sse2Min(x, y))
+            break;
+        case MAP_EQUAL:
+            SSE2_MAP2(_mm_and_pd(_mm_cmpeq_pd(x, y), one))
+            break;
+        case MAP_LESS:
+            SSE2_MAP2(_mm_and_pd(_mm_cmplt_pd(x, y), one))
+            break;
+        case MAP_GREATER:
+            SSE2_MAP2(_mm_and_pd(_mm_cmplt_pd(y, x), one))
+            break;
+        case MAP_ADD_SQUARE:
+            SSE2_MAP2(sse2Squares(x, y))
+            break;
+        default:
+            break;
+    }
+
+    scalarMapDoubles(op, a + i * aStep, aStep, b + i * bStep, bStep, out + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sse2LoadInts(const int64_t *values)
+{
+    return _mm_loadu_si128((const __m128i *) values);
+}
+
+__attribute__((target("sse2")))
+static inline void sse2StoreInts(int64_t *values, __m128i ints)
+{
+    _mm_storeu_si128((__m128i *) values, ints);
+}
+
+#define SSE2_INT_MAP1(expr) SIMD_MAP1(__m128i, 2, _mm_set1_epi64x, sse2LoadInts, sse2StoreInts, expr)
+#define SSE2_INT_MAP2(expr) SIMD_MAP2(__m128i, 2, _mm_set1_epi64x, sse2LoadInts, sse2StoreInts, expr)
+
+__attribute__((target("sse2")))
+static void sse2MapInts(MAP_OP op, const int64_t *a, size_t aStep, const int64_t *b, size_t bStep, int64_t *out, size_t n)
+{
+    size_t i = 0;
+
+    switch (op)
+    {
+        case MAP_NEG:
+            SSE2_INT_MAP1(_mm_sub_epi64(_mm_setzero_si128(), x))
+            break;
+        case MAP_ADD:
+            SSE2_INT_MAP2(_mm_add_epi64(x, y))
+            break;
+        case MAP_SUB:
+            SSE2_INT_MAP2(_mm_sub_epi64(x, y))
+            break;
+        default:
+            break;
+    }
+
+    scalarMapInts(op, a + i * aStep, aStep, b + i * bStep, bStep, out + i, n - i);
+}
+
+static const REDUCE_KERNELS sse2Kernels = {sse2Doubles, sse2Ints, sse2Dot, sse2MapDoubles, sse2MapInts};
+
+// Lanes 0-7 are held by two registers of four, in order.
+
+#define AVX2_LOOP(step, load, type) \
+    for (size_t i = 0; i < n; i += REDUCE_LANES) \
+    { \
+        low = step(low, load((const type *) (values + i))); \
+        high = step(high, load((const type *) (values + i + 4))); \
+    }
+
+// The same for max and min, whose result does not depend on the order of their
+// operands: two more registers take every other group, hiding the latency of step.
+#define AVX2_UNORDERED_LOOP(step, load, type, vector) \
+    { \
+        vector low2 = low, high2 = high; \
+        size_t i = 0; \
+        for (; i + 2 * REDUCE_LANES <= n; i += 2 * REDUCE_LANES) \
+        { \
+            low = step(low, load((const type *) (values + i))); \
+            high = step(high, load((const type *) (values + i + 4))); \
+            low2 = step(low2, load((const type *) (values + i + 8))); \
+            high2 = step(high2, load((const type *) (values + i + 12))); \
+        } \
+        if (i < n) \
+        { \
+            low = step(low, load((const type *) (values + i))); \
+            high = step(high, load((const type *) (values + i + 4))); \
+        } \
+        low = step(low, low2); \
+        high = step(high, high2); \
+    }
+
+__attribute__((target("avx2")))
+static inline __m256d avx2Max(__m256d lane, __m256d value)
+{
+    __m256d equal = _mm256_cmp_pd(lane, value, _CMP_EQ_OQ);
+
+    return _mm256_blendv_pd(_mm256_max_pd(value, lane), _mm256_and_pd(lane, value), equal);
+}
+
+__attribute__((target("avx2")))
+static inline __m256d avx2Min(__m256d lane, __m256d value)
+{
+    __m256d equal = _mm256_cmp_pd(lane, value, _CMP_EQ_OQ);
+
+    return _mm256_blendv_pd(_mm256_min_pd(value, lane), _mm256_or_pd(lane, value), equal);
+}
+
+// A separate multiply and add: a fused one would round differently from the others.
+__attribute__((target("avx2")))
+static inline __m256d avx2Squares(__m256d lane, __m256d value)
+{
+    return _mm256_add_pd(lane, _mm256_mul_pd(value, value));
+}
+
+__attribute__((target("avx2")))
+static void avx2Doubles(REDUCE_OP op, const double *values, size_t n, double *lanes)
+{
+    __m256d low = _mm256_loadu_pd(lanes);
+    __m256d high = _mm256_loadu_pd(lanes + 4);
+
+    switch (op)
+    {
+        case REDUCE_SUM:
+            AVX2_LOOP(_mm256_add_pd, _mm256_loadu_pd, double)
+            break;
+        case REDUCE_PRODUCT:
+            AVX2_LOOP(_mm256_mul_pd, _mm256_loadu_pd, double)
+            break;
+        case REDUCE_MAX:
+            AVX2_UNORDERED_LOOP(avx2Max, _mm256_loadu_pd, double, __m256d)
+            break;
+        case REDUCE_MIN:
+            AVX2_UNORDERED_LOOP(avx2Min, _mm256_loadu_pd, double, __m256d)
+            break;
+        case REDUCE_SQUARES:
+            AVX2_LOOP(avx2Squares, _mm256_loadu_pd, double)
+            break;
+    }
+
+    _mm256_storeu_pd(lanes, low);
+    _mm256_storeu_pd(lanes + 4, high);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2IntMax(__m256i lane, __m256i value)
+{
+    return _mm256_blendv_epi8(lane, value, _mm256_cmpgt_epi64(value, lane));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2IntMin(__m256i lane, __m256i value)
+{
+    return _mm256_blendv_epi8(lane, value, _mm256_cmpgt_epi64(lane, value));
+}
+
+// AVX2 has no 64-bit multiply, so products stay scalar.
+__attribute__((target("avx2")))
+static void avx2Ints(REDUCE_OP op, const int64_t *values, size_t n, int64_t *lanes)
+{
+    __m256i low = _mm256_loadu_si256((const __m256i *) lanes);
+    __m256i high = _mm256_loadu_si256((const __m256i *) (lanes + 4));
+
+    switch (op)
+    {
+        case REDUCE_SUM:
+            AVX2_LOOP(_mm256_add_epi64, _mm256_loadu_si256, __m256i)
+            break;
+        case REDUCE_MAX:
+            AVX2_UNORDERED_LOOP(avx2IntMax, _mm256_loadu_si256, __m256i, __m256i)
+            break;
+        case REDUCE_MIN:
+            AVX2_UNORDERED_LOOP(avx2IntMin, _mm256_loadu_si256, __m256i, __m256i)
+            break;
+        default:
+            scalarInts(op, values, n, lanes);
+            return;
+    }
+
+    _mm256_storeu_si256((__m256i *) lanes, low);
+    _mm256_storeu_si256((__m256i *) (lanes + 4), high);
+}
+
+__attribute__((target("avx2")))
+static void avx2Dot(const double *a, const double *b, size_t n, double *lanes)
+{
+    __m256d low = _mm256_loadu_pd(lanes);
+    __m256d high = _mm256_loadu_pd(lanes + 4);
+
+    for (size_t i = 0; i < n; i += REDUCE_LANES)
+    {
+        low = _mm256_add_pd(low, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        high = _mm256_add_pd(high, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+
+    _mm256_storeu_pd(lanes, low);
+    _mm256_storeu_pd(lanes + 4, high);
+}
+
+#define AVX2_MAP1(expr) SIMD_MAP1(__m256d, 4, _mm256_set1_pd, _mm256_loadu_pd, _mm256_storeu_pd, expr)
+#define AVX2_MAP2(expr) SIMD_MAP2(__m256d, 4, _mm256_set1_pd, _mm256_loadu_pd, _mm256_storeu_pd, expr)
+
+__attribute__((target("avx2")))
+static void avx2MapDoubles(MAP_OP op, const double *a, size_t aStep, const double *b, size_t bStep, double *out, size_t n)
+{
+    __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d one = _mm256_set1_pd(1);
+    size_t i = 0;
+
+    switch (op)
+    {
+        case MAP_NEG:
+            AVX2_MAP1(_mm256_xor_pd(x, sign))
+            break;
+        case MAP_ABS:
+            AVX2_MAP1(_mm256_andnot_pd(sign, x))
+            break;
+        case MAP_SQRT:
+            AVX2_MAP1(_mm256_sqrt_pd(x))
+            break;
+        case MAP_ADD:
+            AVX2_MAP2(_mm256_add_pd(x, y))
+            break;
+        case MAP_SUB:
+            AVX2_MAP2(_mm256_sub_pd(x, y))
+            break;
+        case MAP_MULT:
+            AVX2_MAP2(_mm256_mul_pd(x, y))
+            break;
+        case MAP_DIV:
+            AVX2_MAP2(_mm256_div_pd(x, y))
+            break;
+        case MAP_MAX:
+            AVX2_MAP2(avx2Max(x, y))
+            break;
+        case MAP_MIN:
+            AVX2_MAP2(avx2Min(x, y))
+            break;
+        case MAP_EQUAL:
+            AVX2_MAP2(_mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_EQ_OQ), one))
+            break;
+        case MAP_LESS:
+            AVX2_MAP2(_mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_LT_OQ), one))
+            break;
+        case MAP_GREATER:
+            AVX2_MAP2(_mm256_and_pd(_mm256_cmp_pd(y, x, _CMP_LT_OQ), one))
+            break;
+        case MAP_ADD_SQUARE:
+            AVX2_MAP2(avx2Squares(x, y))
+            break;
+        default:
+            break;
+    }
+
+    scalarMapDoubles(op, a + i * aStep, aStep, b + i * bStep, bStep, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2LoadInts(const int64_t *values)
+{
+    return _mm256_loadu_si256((const __m256i *) values);
+}
+
+__attribute__((target("avx2")))
+static inline void avx2StoreInts(int64_t *values, __m256i ints)
+{
+    _mm256_storeu_si256((__m256i *) values, ints);
+}
+
+#define AVX2_INT_MAP1(expr) SIMD_MAP1(__m256i, 4, _mm256_set1_epi64x, avx2LoadInts, avx2StoreInts, expr)
+#define AVX2_INT_MAP2(expr) SIMD_MAP2(__m256i, 4, _mm256_set1_epi64x, avx2LoadInts, avx2StoreInts, expr)
+
+// Comparisons shift the sign bit of their all ones or zeros down to 1 or 0.
+__attribute__((target("avx2")))
+static void avx2MapInts(MAP_OP op, const int64_t *a, size_t aStep, const int64_t *b, size_t bStep, int64_t *out, size_t n)
+{
+    size_t i = 0;
+
+    switch (op)
+    {
+        case MAP_NEG:
+            AVX2_INT_MAP1(_mm256_sub_epi64(_mm256_setzero_si256(), x))
+            break;
+        case MAP_ADD:
+            AVX2_INT_MAP2(_mm256_add_epi64(x, y))
+            break;
+        case MAP_SUB:
+            AVX2_INT_MAP2(_mm256_sub_epi64(x, y))
+            break;
+        case MAP_MAX:
+            AVX2_INT_MAP2(avx2IntMax(x, y))
+            break;
+        case MAP_MIN:
+            AVX2_INT_MAP2(avx2IntMin(x, y))
+            break;
+        case MAP_EQUAL:
+            AVX2_INT_MAP2(_mm256_srli_epi64(_mm256_cmpeq_epi64(x, y), 63))
+            break;
+        case MAP_LESS:
+            AVX2_INT_MAP2(_mm256_srli_epi64(_mm256_cmpgt_epi64(y, x), 63))
+            break;
+        case MAP_GREATER:
+            AVX2_INT_MAP2(_mm256_srli_epi64(_mm256_cmpgt_epi64(x, y), 63))
+            break;
+        default:
+            break;
+    }
+
+    scalarMapInts(op, a + i * aStep, aStep, b + i * bStep, bStep, out + i, n - i);
+}
+
+static const REDUCE_KERNELS avx2Kernels = {avx2Doubles, avx2Ints, avx2Dot, avx2MapDoubles, avx2MapInts};
+
+#endif
+
+static bool isaSupported(REDUCE_ISA isa)
+{
+#if REDUCE_X86
+    __builtin_cpu_init();
+    switch (isa)
+    {
+        case REDUCE_SCALAR:
+            return true;
+        case REDUCE_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case REDUCE_AVX2:
+            return __builtin_cpu_supports("avx2");
+    }
+    return false;
+#else
+    return isa == REDUCE_SCALAR;
+#endif
+}
+
+bool reduceSetIsa(REDUCE_ISA isa)
+{
+    if (!isaSupported(isa))
+    {
+        return false;
+    }
+
+    switch (isa)
+    {
+#if REDUCE_X86
+        case REDUCE_AVX2:
+            kernels = &avx2Kernels;
+            break;
+        case REDUCE_SSE2:
+            kernels = &sse2Kernels;
+            break;
+#endif
+        default:
+            kernels = &scalarKernels;
+            break;
+    }
+    kernelsIsa = isa;
+
+    return true;
+}
+
+static void selectKernels(void)
+{
+    if (!reduceSetIsa(REDUCE_AVX2) && !reduceSetIsa(REDUCE_SSE2))
+    {
+        reduceSetIsa(REDUCE_SCALAR);
+    }
+}
+
+REDUCE_ISA reduceIsa(void)
+{
+    if (kernels == NULL)
+    {
+        selectKernels();
+    }
+
+    return kernelsIsa;
+}
+
+double reduceDoubles(REDUCE_OP op, const double *values, size_t n)
+{
+    double lanes[REDUCE_LANES];
+    size_t vectorized = n - n % REDUCE_LANES;
+    double identity = op == REDUCE_PRODUCT ? 1 : 0;
+
+    if (kernels == NULL)
+    {
+        selectKernels();
+    }
+
+    if (op == REDUCE_MAX || op == REDUCE_MIN)
+    {
+        // every lane starts out with the first value, which a NAN stays
+        if (isnan(values[0]))
+        {
+            return values[0];
+        }
+        identity = values[0];
+    }
+
+    for (int i = 0; i < REDUCE_LANES; i++)
+    {
+        lanes[i] = identity;
+    }
+
+    kernels->doubles(op, values, vectorized, lanes);
+    scalarDoubles(op, values + vectorized, n - vectorized, lanes);
+
+    return combineDouble(op,
+                         combineDouble(op, combineDouble(op, lanes[0], lanes[4]), combineDouble(op, lanes[2], lanes[6])),
+                         combineDouble(op, combineDouble(op, lanes[1], lanes[5]), combineDouble(op, lanes[3], lanes[7])));
+}
+
+int64_t reduceInts(REDUCE_OP op, const int64_t *values, size_t n)
+{
+    int64_t lanes[REDUCE_LANES];
+    size_t vectorized = n - n % REDUCE_LANES;
+    int64_t identity = op == REDUCE_PRODUCT ? 1 : 0;
+
+    if (kernels == NULL)
+    {
+        selectKernels();
+    }
+
+    if (op == REDUCE_MAX || op == REDUCE_MIN)
+    {
+        identity = values[0];
+    }
+
+    for (int i = 0; i < REDUCE_LANES; i++)
+    {
+        lanes[i] = identity;
+    }
+
+    kernels->ints(op, values, vectorized, lanes);
+    scalarInts(op, values + vectorized, n - vectorized, lanes);
+
+    return combineInt(op,
+                      combineInt(op, combineInt(op, lanes[0], lanes[4]), combineInt(op, lanes[2], lanes[6])),
+                      combineInt(op, combineInt(op, lanes[1], lanes[5]), combineInt(op, lanes[3], lanes[7])));
+}
+
+double reduceSum(const double *values, size_t n)
+{
+    double val = 0;
+
+    if (n >= REDUCE_MIN_OPERANDS)
+    {
+        return reduceDoubles(REDUCE_SUM, values, n);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        val += values[i];
+    }
+
+    return val;
+}
+
+// The products are rounded before they are summed, as add would get them from mult.
+double reduceDot(const double *a, const double *b, size_t n)
+{
+    double lanes[REDUCE_LANES] = {0};
+    size_t vectorized = n - n % REDUCE_LANES;
+    double val = 0;
+
+    if (n < REDUCE_MIN_OPERANDS)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            val += a[i] * b[i];
+        }
+        return val;
+    }
+
+    if (kernels == NULL)
+    {
+        selectKernels();
+    }
+
+    kernels->dot(a, b, vectorized, lanes);
+    scalarDot(a + vectorized, b + vectorized, n - vectorized, lanes);
+
+    return ((lanes[0] + lanes[4]) + (lanes[2] + lanes[6])) + ((lanes[1] + lanes[5]) + (lanes[3] + lanes[7]));
+}
+
+void mapDoubles(MAP_OP op, const double *a, size_t aStep, const double *b, size_t bStep, double *out, size_t n)
+{
+    if (kernels == NULL)
+    {
+        selectKernels();
+    }
+
+    kernels->mapDoubles(op, a, aStep, b, bStep, out, n);
+}
+
+void mapInts(MAP_OP op, const int64_t *a, size_t aStep, const int64_t *b, size_t bStep, int64_t *out, size_t n)
+{
+    if (kernels == NULL)
+    {
+        selectKernels();
+    }
+
+    kernels->mapInts(op, a, aStep, b, bStep, out, n);
+}
+
+void freeReduceScratch(void)
+{
+    free(scratch);
+    scratch = NULL;
+    scratchCap = 0;
+}
+
+static void *reserveScratch(size_t n)
+{
+    size_t size = n * sizeof(double);
+
+    if (size > scratchCap)
+    {
+        free(scratch);
+        scratchCap = (size + SCRATCH_ALIGN - 1) & ~(size_t) (SCRATCH_ALIGN - 1);
+        if ((scratch = aligned_alloc(SCRATCH_ALIGN, scratchCap)) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+    }
+
+    return scratch;
+}
+
+double reduceDoubleValues(REDUCE_OP op, const RET_VAL *args, size_t n)
+{
+    double *values;
+    double val;
+
+    if (n < REDUCE_MIN_OPERANDS)
+    {
+        val = op == REDUCE_MAX || op == REDUCE_MIN ? args[0].value : op == REDUCE_PRODUCT ? 1 : 0;
+        for (size_t i = op == REDUCE_MAX || op == REDUCE_MIN; i < n; i++)
+        {
+            val = stepDouble(op, val, args[i].value);
+        }
+        return val;
+    }
+
+    values = reserveScratch(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        values[i] = args[i].value;
+    }
+
+    return reduceDoubles(op, values, n);
+}
+
+// Ints wrap around, so any order gives the same result.
+int64_t reduceIntValues(REDUCE_OP op, const RET_VAL *args, size_t n)
+{
+    int64_t *values;
+    int64_t val;
+
+    if (n < REDUCE_MIN_OPERANDS)
+    {
+        val = op == REDUCE_MAX || op == REDUCE_MIN ? args[0].ival : op == REDUCE_PRODUCT ? 1 : 0;
+        for (size_t i = op == REDUCE_MAX || op == REDUCE_MIN; i < n; i++)
+        {
+            val = stepInt(op, val, args[i].ival);
+        }
+        return val;
+    }
+
+    values = reserveScratch(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        values[i] = args[i].ival;
+    }
+
+    return reduceInts(op, values, n);
+}
+
+// Left to right, as the builtins have always folded their operands.
+static RET_VAL foldValues(REDUCE_OP op, const RET_VAL *args, size_t n)
+{
+    RET_VAL val = {INT_TYPE, .ival = op == REDUCE_PRODUCT};
+    size_t i = 0;
+
+    if (op == REDUCE_MAX || op == REDUCE_MIN)
+    {
+        val = args[i++];
+    }
+    else if (op == REDUCE_SQUARES)
+    {
+        val = (RET_VAL) {DOUBLE_TYPE, .value = 0};
+    }
+
+    for (; i < n; i++)
+    {
+        switch (op)
+        {
+            case REDUCE_SUM:
+                val = numberAdd(val, args[i]);
+                break;
+            case REDUCE_PRODUCT:
+                val = numberMult(val, args[i]);
+                break;
+            case REDUCE_MAX:
+                val = numberMax(val, args[i]);
+                break;
+            case REDUCE_MIN:
+                val = numberMin(val, args[i]);
+                break;
+            case REDUCE_SQUARES:
+                val = numberAddSquare(val, args[i]);
+                break;
+        }
+    }
+
+    return val;
+}
+
+RET_VAL reduceValues(REDUCE_OP op, const RET_VAL *args, size_t n)
+{
+    bool ints = true;
+    bool doubles = true;
+    double *values;
+
+    if (n < REDUCE_MIN_OPERANDS)
+    {
+        return foldValues(op, args, n);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (args[i].type == VECTOR_TYPE)
+        {
+            return vectorReduceValues(op, args, n);
+        }
+        ints = ints && args[i].type == INT_TYPE;
+        doubles = doubles && args[i].type == DOUBLE_TYPE;
+    }
+
+    if (ints && op != REDUCE_SQUARES)
+    {
+        return (RET_VAL) {INT_TYPE, .ival = reduceIntValues(op, args, n)};
+    }
+
+    if (!doubles && (op == REDUCE_MAX || op == REDUCE_MIN))
+    {
+        // the result keeps the type of the operand it is
+        return foldValues(op, args, n);
+    }
+
+    values = reserveScratch(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        values[i] = toDouble(args[i]);
+    }
+
+    return (RET_VAL) {DOUBLE_TYPE, .value = reduceDoubles(op, values, n)};
+}
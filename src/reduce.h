@@ -0,0 +1,94 @@
+#ifndef __reduce_h_
+#define __reduce_h_
+
+#include <stddef.h>
+#include "number.h"
+
+// SSE2 and AVX2 kernels need GCC's target attributes and CPU detection builtins.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(REDUCE_NO_SIMD)
+#define REDUCE_X86 1
+#else
+#define REDUCE_X86 0
+#endif
+
+// Summation order: lists of fewer than REDUCE_MIN_OPERANDS values are folded left
+// to right. Longer ones are accumulated in REDUCE_LANES lanes, value i going to
+// lane i % REDUCE_LANES and each lane folding its values in order, and the lanes
+// are then combined as ((l0 . l4) . (l2 . l6)) . ((l1 . l5) . (l3 . l7)).
+// The scalar, SSE2 and AVX2 kernels all follow this order, so they give the same bits.
+#define REDUCE_LANES 8
+#define REDUCE_MIN_OPERANDS 16
+
+typedef enum reduce_op {
+    REDUCE_SUM,
+    REDUCE_PRODUCT,
+    REDUCE_MAX,
+    REDUCE_MIN,
+    REDUCE_SQUARES  // sum of the squares, for hypot
+} REDUCE_OP;
+
+// Element-wise operations of the vector builtins, see mapDoubles and mapInts.
+typedef enum map_op {
+    MAP_NEG,
+    MAP_ABS,
+    MAP_EXP,
+    MAP_EXP2,
+    MAP_LOG,
+    MAP_SQRT,
+    MAP_CBRT,
+    MAP_ADD,
+    MAP_SUB,
+    MAP_MULT,
+    MAP_DIV,
+    MAP_REM,
+    MAP_POW,
+    MAP_MAX,
+    MAP_MIN,
+    MAP_EQUAL,
+    MAP_LESS,
+    MAP_GREATER,
+    MAP_ADD_SQUARE  // a + b * b, a step of hypot
+} MAP_OP;
+
+typedef enum reduce_isa {
+    REDUCE_SCALAR,
+    REDUCE_SSE2,
+    REDUCE_AVX2
+} REDUCE_ISA;
+
+// The kernels in use, for reductions and maps alike: the widest the CPU supports,
+// unless set otherwise.
+REDUCE_ISA reduceIsa(void);
+// Returns false, keeping the current kernels, if the CPU does not support isa.
+bool reduceSetIsa(REDUCE_ISA isa);
+
+// Lane-ordered reductions of n > 0 values, whatever n is.
+double reduceDoubles(REDUCE_OP op, const double *values, size_t n);
+int64_t reduceInts(REDUCE_OP op, const int64_t *values, size_t n);
+
+// Sum of n >= 0 values, and of the products a[i] * b[i], in the order add sums
+// that many operands.
+double reduceSum(const double *values, size_t n);
+double reduceDot(const double *a, const double *b, size_t n);
+
+// out[i] = op(a[i * aStep], b[i * bStep]) for i < n, where a step of 0 repeats
+// a scalar; unary ops ignore b. Each element gets exactly what the scalar builtin
+// computes for doubles, comparisons giving 1.0 or 0.0. mapInts only takes the ops
+// whose result is an int: neg, abs, exp2 of non-negative ints, the arithmetic
+// ones, max, min and the comparisons.
+void mapDoubles(MAP_OP op, const double *a, size_t aStep, const double *b, size_t bStep, double *out, size_t n);
+void mapInts(MAP_OP op, const int64_t *a, size_t aStep, const int64_t *b, size_t bStep, int64_t *out, size_t n);
+
+// Reductions of the n > 0 operands of a builtin, in the order above.
+// reduceValues takes operands of any type, like the generic builtins: ints give an
+// int; for max and min, lists mixing ints and doubles are folded left to right;
+// otherwise any double makes every operand count as a double. Vector operands
+// are reduced element by element, see vector.h.
+// The others take operands known to be all doubles or all ints.
+RET_VAL reduceValues(REDUCE_OP op, const RET_VAL *args, size_t n);
+double reduceDoubleValues(REDUCE_OP op, const RET_VAL *args, size_t n);
+int64_t reduceIntValues(REDUCE_OP op, const RET_VAL *args, size_t n);
+// Frees where the calling thread gathers operand values, allocated again as needed.
+void freeReduceScratch(void);
+
+#endif
@@ -0,0 +1,215 @@
+#include "cilisp.h"
+
+// While resolving, each atom points at its innermost visible let binding or
+// lambda parameter. Entering a scope pushes one record per binding and leaving
+// it pops them, so looking a symbol up is a single pointer load.
+typedef struct scope_binding {
+    int level;
+    int slot;
+    SYMBOL_TABLE_NODE *symbol;
+    struct scope_binding *prev;
+} SCOPE_BINDING;
+
+// The lambda whose body is being resolved: the level of its parameters (0 outside
+// of any lambda) and its declared type.
+static _Thread_local int lambdaLevel;
+static _Thread_local NUM_TYPE lambdaType;
+
+static void resolveNode(AST_NODE *node, int level, bool tail);
+static void resolveLambdaNode(AST_NODE *node, int level, NUM_TYPE type);
+
+static void resolveScopeNode(AST_NODE *node, int level, bool tail)
+{
+    AST_NODE *child = node->data.scope.child;
+    SYMBOL_TABLE_NODE **bindings;
+    SCOPE_BINDING *records;
+    int n = 0;
+
+    for (SYMBOL_TABLE_NODE *symbol = child->symbolTable; symbol != NULL; symbol = symbol->next)
+    {
+        n++;
+    }
+
+    bindings = arenaAlloc(&currentContext->astArena, n * sizeof(SYMBOL_TABLE_NODE *));
+    records = arenaAlloc(&currentContext->astArena, n * sizeof(SCOPE_BINDING));
+    level++;
+
+    n = 0;
+    for (SYMBOL_TABLE_NODE *symbol = child->symbolTable; symbol != NULL; symbol = symbol->next)
+    {
+        ATOM *id = symbol->id;
+
+        if (id->binding != NULL && id->binding->level == level)
+        {
+            warning("The symbol \"%s\" already exists within the scope. Value remains unchanged.", id->name);
+            continue;
+        }
+
+        records[n] = (SCOPE_BINDING) {level, n, symbol, id->binding};
+        id->binding = &records[n];
+        bindings[n++] = symbol;
+    }
+
+    node->data.scope.bindings = bindings;
+    node->data.scope.nBindings = n;
+
+    // values see the scope they are bound in, like the body does
+    for (int i = 0; i < n; i++)
+    {
+        if (bindings[i]->value->type == LAMBDA_NODE_TYPE)
+        {
+            resolveLambdaNode(bindings[i]->value, level, bindings[i]->type);
+        }
+        else
+        {
+            resolveNode(bindings[i]->value, level, false);
+        }
+    }
+    resolveNode(child, level, tail);
+
+    for (int i = n; i-- > 0;)
+    {
+        bindings[i]->id->binding = records[i].prev;
+    }
+}
+
+// Parameters take the slots of their argument positions. A repeated name keeps
+// its slot, so arguments still line up, but cannot be referred to.
+static void resolveLambdaNode(AST_NODE *node, int level, NUM_TYPE type)
+{
+    int n = node->data.lambda.nParams;
+    SCOPE_BINDING *records = arenaAlloc(&currentContext->astArena, n * sizeof(SCOPE_BINDING));
+    int slot = 0;
+    int outerLevel = lambdaLevel;
+    NUM_TYPE outerType = lambdaType;
+
+    level++;
+    lambdaLevel = level;
+    lambdaType = type;
+
+    for (SYMBOL_TABLE_NODE *param = node->data.lambda.params; param != NULL; param = param->next, slot++)
+    {
+        ATOM *id = param->id;
+
+        if (id->binding != NULL && id->binding->level == level)
+        {
+            warning("The symbol \"%s\" already exists within the scope. Value remains unchanged.", id->name);
+            records[slot].symbol = NULL;
+            continue;
+        }
+
+        records[slot] = (SCOPE_BINDING) {level, slot, param, id->binding};
+        id->binding = &records[slot];
+    }
+
+    resolveNode(node->data.lambda.body, level, true);
+
+    for (int i = n; i-- > 0;)
+    {
+        if (records[i].symbol != NULL)
+        {
+            records[i].symbol->id->binding = records[i].prev;
+        }
+    }
+
+    lambdaLevel = outerLevel;
+    lambdaType = outerType;
+}
+
+// Lambdas are not values, so a call can only target a binding defined with
+// lambda; anything else leaves callee NULL.
+//
+// A call that is the result of a lambda body is a tail call, reusing the frame
+// of that lambda, if
+//  - the callee is defined outside of that frame, so the frame is dead,
+//  - it passes exactly the arguments the callee takes, so no warning is pending,
+//  - the callee is untyped or has the same type, so casting the result once for
+//    the call that created the frame gives the same value.
+static void resolveCallNode(AST_NODE *node, int level, bool tail)
+{
+    SCOPE_BINDING *binding = node->data.function.name->binding;
+    SYMBOL_TABLE_NODE *callee;
+    AST_NODE *value;
+    int n = 0;
+
+    if (binding == NULL)
+    {
+        node->data.function.slot = -1;
+        return;
+    }
+
+    node->data.function.depth = level - binding->level;
+    node->data.function.slot = binding->slot;
+
+    value = binding->symbol->value;
+    if (value == NULL || value->type != LAMBDA_NODE_TYPE)
+    {
+        node->data.function.callee = NULL;
+        return;
+    }
+    callee = node->data.function.callee = binding->symbol;
+
+    for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+    {
+        n++;
+    }
+
+    node->data.function.tail = tail && binding->level < lambdaLevel
+                               && n == value->data.lambda.nParams
+                               && (callee->type == NO_TYPE || callee->type == lambdaType);
+}
+
+static void resolveSymbolNode(AST_NODE *node, int level)
+{
+    SCOPE_BINDING *binding = node->data.symbol.id->binding;
+
+    if (binding == NULL)
+    {
+        node->data.symbol.slot = -1;
+        return;
+    }
+
+    node->data.symbol.depth = level - binding->level;
+    node->data.symbol.slot = binding->slot;
+}
+
+// tail is set for the nodes whose value is the result of the innermost lambda.
+static void resolveNode(AST_NODE *node, int level, bool tail)
+{
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+            break;
+        case FUNC_NODE_TYPE:
+            for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+            {
+                resolveNode(op, level, false);
+            }
+            if (node->data.function.func == CUSTOM_FUNC)
+            {
+                resolveCallNode(node, level, tail);
+            }
+            break;
+        case SYM_NODE_TYPE:
+            resolveSymbolNode(node, level);
+            break;
+        case SCOPE_NODE_TYPE:
+            resolveScopeNode(node, level, tail);
+            break;
+        case CONDITIONAL_NODE_TYPE:
+            resolveNode(node->data.condition.condition, level, false);
+            resolveNode(node->data.condition._true, level, tail);
+            resolveNode(node->data.condition._false, level, tail);
+            break;
+        case LAMBDA_NODE_TYPE:
+            // resolved along with its binding, which holds its type
+            break;
+    }
+}
+
+// Turns every symbol of a parsed expression into a (scope depth, slot index) pair,
+// so that neither eval nor the compiler has to compare names.
+void resolveProgram(AST_NODE *node)
+{
+    resolveNode(node, 0, false);
+}
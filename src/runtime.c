@@ -0,0 +1,465 @@
+#define _POSIX_C_SOURCE 200809L // fileno
+#include <unistd.h>
+#include "runtime.h"
+#include "vector.h"
+
+#define RED             "\033[31m"
+#define RESET_COLOR     "\033[0m"
+
+_Thread_local RUNTIME *runtime;
+
+_Thread_local ARENA value_arena;
+_Thread_local bool *taskFailed;
+
+bool fatalError;
+
+// where the messages printed without an interpreter go, once sendMessagesApart
+// has been called
+static OUTPUT apartMessages;
+static OUTPUT *plainMessages;
+
+// Seeds the generator like srandom(1), which rand() starts from: an LCG fills
+// the first 31 words, and the first 310 numbers of the feedback are dropped.
+static void seedRand(RAND_STATE *state, uint32_t seed)
+{
+    int32_t *r = (int32_t *) state->r;
+
+    r[0] = (int32_t) seed;
+    for (int i = 1; i < 31; i++)
+    {
+        int64_t next = (16807 * (int64_t) r[i - 1]) % 2147483647;
+        r[i] = (int32_t) (next < 0 ? next + 2147483647 : next);
+    }
+    for (int i = 31; i < 34; i++)
+    {
+        r[i] = r[i - 31];
+    }
+
+    state->i = 0;
+    for (int i = 0; i < 310; i++)
+    {
+        state->r[state->i] = state->r[(state->i + 3) % 34] + state->r[(state->i + 31) % 34];
+        state->i = (state->i + 1) % 34;
+    }
+}
+
+// Element n of the sequence is element n - 31 plus element n - 3; the ring holds the last 34.
+static int nextRand(RAND_STATE *state)
+{
+    uint32_t value = state->r[(state->i + 3) % 34] + state->r[(state->i + 31) % 34];
+
+    state->r[state->i] = value;
+    state->i = (state->i + 1) % 34;
+
+    return (int) (value >> 1);
+}
+
+void initRuntime(RUNTIME *rt, FILE *out, FILE *readTarget)
+{
+    // field by field, as the buffer of the output needs no clearing
+    rt->readTarget = readTarget;
+    rt->messages = NULL;
+    rt->expression = 0;
+    rt->stackOverflow = false;
+    rt->status = CILISP_OK;
+    rt->onError = NULL;
+    outputInit(&rt->output, out);
+    seedRand(&rt->rand, 1);
+}
+
+int flushRuntime(RUNTIME *rt)
+{
+    int status = outputFlush(&rt->output);
+
+    if (rt->messages != NULL && outputFlush(rt->messages) != 0)
+    {
+        status = -1;
+    }
+    return status;
+}
+
+void sendMessagesApart(void)
+{
+    outputInit(&apartMessages, stderr);
+    plainMessages = &apartMessages;
+}
+
+// Prints a message in red on the interpreter this thread is running, or on stdout
+// before there is one, or as a JSON line of the given kind on the messages of
+// the interpreter, or on stderr, if they go apart.
+static void printMessage(const char *kind, const char *prefix, const char *message, const char *suffix)
+{
+    OUTPUT *messages = runtime != NULL ? runtime->messages : plainMessages;
+
+    if (messages != NULL)
+    {
+        outputChar(messages, '{');
+        if (runtime != NULL)
+        {
+            outputText(messages, "\"expression\":");
+            outputInt(messages, (int64_t) runtime->expression);
+            outputChar(messages, ',');
+        }
+        outputChar(messages, '"');
+        outputText(messages, kind);
+        outputText(messages, "\":");
+        outputJsonString(messages, message);
+        outputText(messages, "}\n");
+        if (runtime == NULL)
+        {
+            outputFlush(messages);
+        }
+        return;
+    }
+    if (runtime == NULL)
+    {
+        printf(RED "%s%s%s" RESET_COLOR, prefix, message, suffix);
+        return;
+    }
+
+    outputText(&runtime->output, RED);
+    outputText(&runtime->output, prefix);
+    outputText(&runtime->output, message);
+    outputText(&runtime->output, suffix);
+    outputText(&runtime->output, RESET_COLOR);
+}
+
+// Prints an error and returns to the interpreter running, or exits if there is none.
+static void fail(CILISP_STATUS status, const char *message)
+{
+    printMessage("error", "\nERROR: ", message, "\nExiting...\n");
+    if (runtime != NULL)
+    {
+        flushRuntime(runtime);
+    }
+    else
+    {
+        fflush(stdout);
+    }
+
+    if (runtime != NULL && runtime->onError != NULL)
+    {
+        runtime->status = status;
+        longjmp(*runtime->onError, 1);
+    }
+    fatalError = true;
+    exit(1);
+}
+
+// yyerror:
+// Something went so wrong that the interpreter cannot go on with the line.
+// You should basically never call this unless an allocation fails.
+// (see the "yyerror("Memory allocation failed!")" calls and do the same.
+// This is basically printf, but red, with "\nERROR: " prepended, "\n" appended,
+// and the evaluation of the line given to cilispEval stops there, which returns
+// CILISP_ERROR. Without an interpreter running, as in programs translated to C,
+// the program exits with status 1 instead.
+void yyerror(char *format, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start (args, format);
+    vsnprintf (buffer, 255, format, args);
+    va_end (args);
+
+    fail(CILISP_ERROR, buffer);
+}
+
+void syntaxError(const char *message)
+{
+    fail(CILISP_SYNTAX_ERROR, message);
+}
+
+// warning:
+// Something went mildly wrong (on the user-input level, probably)
+// Let the user know what happened and what you're doing about it.
+// Then, move on. No big deal, they can enter more inputs. ¯\_(ツ)_/¯
+// You should use this pretty often:
+//      too many arguments, let them know and ignore the extra
+//      too few arguments, let them know and return NAN
+//      invalid arguments, let them know and return NAN
+//      many more uses to be added as we progress...
+// This is basically printf, but red, and with "\nWARNING: " prepended and "\n" appended.
+void warning(char *format, ...)
+{
+    char buffer[256];
+    va_list args;
+
+    if (taskFailed != NULL)
+    {
+        *taskFailed = true;
+        return;
+    }
+
+    va_start (args, format);
+    vsnprintf (buffer, 255, format, args);
+
+    printMessage("warning", "WARNING: ", buffer, "\n");
+
+    va_end (args);
+}
+
+RET_VAL evalRandFunc(void)
+{
+    return (RET_VAL){DOUBLE_TYPE, .value = (((double) nextRand(&runtime->rand) / 0x7fffffff))};
+}
+
+RET_VAL evalReadFunc(void)
+{
+    int offset = 0; // Number of characters read by sscanf
+    int kept = 0, len = 0; // characters of the line kept in buffer, and in all
+    double value;
+    int64_t integer;
+    char *end;
+    char buffer[64] = ""; // left empty by fscanf at the end of the file
+    // the prompt and the echo are text, which the other modes leave out
+    bool echo = runtime->output.mode == TEXT_OUTPUT;
+
+    if (echo)
+    {
+        outputText(&runtime->output, "read :: ");
+    }
+    if (fileno(runtime->readTarget) == STDIN_FILENO)
+    {
+        // someone may be typing the value
+        outputFlush(&runtime->output);
+    }
+    // an entry is a line: what does not fit in buffer is dropped with it, rather
+    // than left for the next read
+    if (fscanf(runtime->readTarget, "%63[^\n]%n%*[^\n]%n", buffer, &kept, &len) == 1)
+    {
+        fscanf(runtime->readTarget, "\n");
+    }
+
+    if (strcmp(buffer, "0") == 0) { return ZERO_RET_VAL; }
+    if (echo)
+    {
+        outputText(&runtime->output, buffer);
+        outputChar(&runtime->output, '\n');
+    }
+    if (len > kept)
+    {
+        warning("Read entry longer than 63 characters! Rest of the line ignored!");
+    }
+
+    if (sscanf(buffer, "%lf%n", &value, &offset) != 1) {
+        if (offset != strlen(buffer))
+        {
+            warning("Invalid read entry! NAN returned!");
+            return NAN_RET_VAL;
+        }
+        warning("Invalid read entry! NAN returned!");
+        return NAN_RET_VAL;
+    }
+
+    if (value != trunc(value) || fabs(value) >= 0x1p63)
+    {
+        return (RET_VAL) {DOUBLE_TYPE, .value = value};
+    }
+
+    // entries written as integers are read exactly rather than through the double
+    integer = strtoll(buffer, &end, 10);
+    return (RET_VAL) {INT_TYPE, .ival = end - buffer == offset ? integer : toInt(value)};
+}
+
+RET_VAL stackOverflowValue(void)
+{
+    if (taskFailed != NULL)
+    {
+        *taskFailed = true;
+    }
+    else if (!runtime->stackOverflow)
+    {
+        warning("Stack overflow. Returning NAN");
+        runtime->stackOverflow = true;
+    }
+
+    return NAN_RET_VAL;
+}
+
+static void warnVectorCast(RET_VAL val, NUM_TYPE type)
+{
+    if (val.type == VECTOR_TYPE && (type == INT_TYPE || type == DOUBLE_TYPE))
+    {
+        warning("Cannot cast a vector to %s. Returning NAN", type == INT_TYPE ? "int" : "double");
+    }
+}
+
+RET_VAL castReturnValue(RET_VAL val, NUM_TYPE type)
+{
+    if (type == INT_TYPE && val.type == DOUBLE_TYPE)
+    {
+        warning("Precision loss on int cast from %.3lf to %" PRId64, val.value, toInt(val.value));
+    }
+    warnVectorCast(val, type);
+
+    return castNumber(val, type);
+}
+
+RET_VAL castBindingValue(RET_VAL val, NUM_TYPE type)
+{
+    warnVectorCast(val, type);
+
+    return castNumber(val, type);
+}
+
+// prints the type and value of a RET_VAL as text
+static void printText(OUTPUT *out, RET_VAL val)
+{
+    switch (val.type)
+    {
+        case INT_TYPE:
+            outputText(out, "Integer : ");
+            outputInt(out, val.ival);
+            break;
+        case DOUBLE_TYPE:
+            outputText(out, "Double : ");
+            outputDouble(out, val.value);
+            break;
+        case VECTOR_TYPE:
+            outputText(out, "Vector : [");
+            for (size_t i = 0; i < val.vector->length; i++)
+            {
+                if (i > 0)
+                {
+                    outputChar(out, ' ');
+                }
+                if (val.vector->type == INT_TYPE)
+                {
+                    outputInt(out, val.vector->ivals[i]);
+                }
+                else
+                {
+                    outputDouble(out, val.vector->values[i]);
+                }
+            }
+            outputChar(out, ']');
+            break;
+        default:
+            outputText(out, "No Type : ");
+            outputDouble(out, val.value);
+            break;
+    }
+    outputChar(out, '\n');
+}
+
+// {"expression":0,"printed":false,"type":"vector","elements":"int","value":[1,2]}
+static void printJson(OUTPUT *out, RET_VAL val, int flags)
+{
+    outputText(out, "{\"expression\":");
+    outputInt(out, (int64_t) runtime->expression);
+    outputText(out, flags & RECORD_PRINTED ? ",\"printed\":true,\"type\":" : ",\"printed\":false,\"type\":");
+    switch (val.type)
+    {
+        case INT_TYPE:
+            outputText(out, "\"int\",\"value\":");
+            outputInt(out, val.ival);
+            break;
+        case DOUBLE_TYPE:
+            outputText(out, "\"double\",\"value\":");
+            outputJsonDouble(out, val.value);
+            break;
+        case VECTOR_TYPE:
+            outputText(out, val.vector->type == INT_TYPE ? "\"vector\",\"elements\":\"int\",\"value\":[" :
+                            "\"vector\",\"elements\":\"double\",\"value\":[");
+            for (size_t i = 0; i < val.vector->length; i++)
+            {
+                if (i > 0)
+                {
+                    outputChar(out, ',');
+                }
+                if (val.vector->type == INT_TYPE)
+                {
+                    outputInt(out, val.vector->ivals[i]);
+                }
+                else
+                {
+                    outputJsonDouble(out, val.vector->values[i]);
+                }
+            }
+            outputChar(out, ']');
+            break;
+        default:
+            outputText(out, "\"none\",\"value\":");
+            outputJsonDouble(out, val.value);
+            break;
+    }
+    outputText(out, "}\n");
+}
+
+// the bits of value, with every nan the same quiet one, as text prints them alike
+static uint64_t doubleBits(double value)
+{
+    uint64_t bits;
+
+    if (isnan(value))
+    {
+        return UINT64_C(0x7ff8000000000000);
+    }
+
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// a record of OUTPUT_RECORD_SIZE bytes, and one per element of a vector
+static void printRecords(OUTPUT *out, RET_VAL val, int flags)
+{
+    uint64_t expression = runtime->expression;
+
+    switch (val.type)
+    {
+        case INT_TYPE:
+            outputRecord(out, INT_RECORD, flags, expression, (uint64_t) val.ival);
+            break;
+        case DOUBLE_TYPE:
+            outputRecord(out, DOUBLE_RECORD, flags, expression, doubleBits(val.value));
+            break;
+        case VECTOR_TYPE:
+            outputRecord(out, VECTOR_RECORD, flags, expression, val.vector->length);
+            for (size_t i = 0; i < val.vector->length; i++)
+            {
+                if (val.vector->type == INT_TYPE)
+                {
+                    outputRecord(out, INT_RECORD, flags | RECORD_ELEMENT, expression, (uint64_t) val.vector->ivals[i]);
+                }
+                else
+                {
+                    outputRecord(out, DOUBLE_RECORD, flags | RECORD_ELEMENT, expression,
+                                 doubleBits(val.vector->values[i]));
+                }
+            }
+            break;
+        default:
+            outputRecord(out, NONE_RECORD, flags, expression, doubleBits(val.value));
+            break;
+    }
+}
+
+static void printValue(RET_VAL val, int flags)
+{
+    OUTPUT *out = &runtime->output;
+
+    switch (out->mode)
+    {
+        case JSONL_OUTPUT:
+            printJson(out, val, flags);
+            break;
+        case BINARY_OUTPUT:
+            printRecords(out, val, flags);
+            break;
+        default:
+            printText(out, val);
+            break;
+    }
+}
+
+void printRetVal(RET_VAL val)
+{
+    printValue(val, RECORD_PRINTED);
+}
+
+void printResult(RET_VAL val)
+{
+    printValue(val, 0);
+    runtime->expression++;
+}
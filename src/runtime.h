@@ -0,0 +1,110 @@
+#ifndef __runtime_h_
+#define __runtime_h_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <setjmp.h>
+#include "number.h"
+#include "arena.h"
+#include "output.h"
+
+// What running a program needs besides the builtins of number.c, reduce.c and
+// vector.c: messages, read, rand, print and the casts of typed values. Shared by
+// the interpreter and the programs translated to C by --emit-c (see aot.h),
+// which link against it without the parser or the evaluators.
+
+#define NAN_RET_VAL (RET_VAL){DOUBLE_TYPE, .value = NAN}
+#define ZERO_RET_VAL (RET_VAL){INT_TYPE, .ival = 0}
+
+// Markers kept in the type of a let slot that has not been evaluated yet,
+// or whose value is being evaluated right now (a self-referencing binding).
+#define UNBOUND_TYPE ((NUM_TYPE) (NO_TYPE + 1))
+#define PENDING_TYPE ((NUM_TYPE) (NO_TYPE + 2))
+
+// Both evaluation modes keep let slots and call frames on a preallocated stack
+// of VALUE_STACK_SIZE values. Calls nested deeper than MAX_CALL_DEPTH warn and
+// return NAN.
+#define VALUE_STACK_SIZE (1 << 20)
+#define MAX_CALL_DEPTH 4096
+
+// What evaluating one line of input came to; see cilispEval in cilisp.h.
+typedef enum cilisp_status {
+    CILISP_OK,
+    CILISP_QUIT,         // quit, or the end of the input
+    CILISP_SYNTAX_ERROR, // the line does not parse
+    CILISP_ERROR         // yyerror was called, for instance as memory ran out
+} CILISP_STATUS;
+
+// The state of glibc's random(), whose sequence rand() gives unless seeded,
+// kept per interpreter so that each one gives the same numbers in any thread.
+typedef struct rand_state {
+    uint32_t r[34];
+    int i;
+} RAND_STATE;
+
+// The part of an interpreter (see CILISP_CTX) the builtins and the messages use.
+typedef struct runtime {
+    OUTPUT output;     // where print, read and the messages write
+    // Where the messages go as JSON lines instead, with --output=jsonl or binary,
+    // or NULL to print them in red among the values.
+    OUTPUT *messages;
+    uint64_t expression; // the index of the top-level expression running, from 0
+    FILE *readTarget;  // where read reads
+    RAND_STATE rand;
+    // Set once a call has been refused for lack of stack, so that the expression
+    // unwinding from it warns only once. Cleared before each expression runs.
+    bool stackOverflow;
+    CILISP_STATUS status;
+    jmp_buf *onError;  // where yyerror returns to with status set, or NULL to exit
+} RUNTIME;
+
+// The runtime of the interpreter this thread is running, if any.
+extern _Thread_local RUNTIME *runtime;
+
+void initRuntime(RUNTIME *rt, FILE *out, FILE *readTarget);
+// Writes what the runtime has printed so far, values and messages, to their files;
+// see output.h.
+int flushRuntime(RUNTIME *rt);
+
+// Owns the vectors computed while evaluating an expression, reset once its
+// result has been printed. Each thread of the pool has its own, see initEvalThread.
+extern _Thread_local ARENA value_arena;
+
+// Points to the failed flag of the task of the pool this thread is running, if
+// any: a task fails rather than warn or overflow the stack, so that it has no effect.
+extern _Thread_local bool *taskFailed;
+
+// Set before the process exits on an error, for the atexit handlers.
+extern bool fatalError;
+
+// Has the messages printed without an interpreter, as before one is created, go
+// to stderr as JSON lines, as the interpreters of --output=jsonl and binary do.
+void sendMessagesApart(void);
+
+void yyerror(char *, ...);
+// what the parser calls yyerror for, see cilisp.y
+void syntaxError(const char *message);
+void warning(char*, ...);
+
+// builtins with side effects, shared with the bytecode VM
+RET_VAL evalRandFunc(void);
+RET_VAL evalReadFunc(void);
+
+// applies the declared type of a lambda to the value its body returned
+RET_VAL castReturnValue(RET_VAL val, NUM_TYPE type);
+// applies the declared type of a let binding to its value
+RET_VAL castBindingValue(RET_VAL val, NUM_TYPE type);
+// what a call that does not fit on the stack returns; warns once per expression
+RET_VAL stackOverflowValue(void);
+
+// prints a value as print does, and as the result of an expression, which then
+// counts as done; both lay it out as the output mode says
+void printRetVal(RET_VAL val);
+void printResult(RET_VAL val);
+
+#endif
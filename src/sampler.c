@@ -0,0 +1,431 @@
+#include "sampler.h"
+#if SAMPLER_AVAILABLE
+#include <sys/time.h>
+#endif
+
+_Thread_local SAMPLER *currentSampler;
+
+#if SAMPLER_AVAILABLE
+
+
+// SIGPROF: copies the frames of the expression the interpreter this thread runs
+// is in, from the shadow stack and the frames of the tree walker, and the current
+// node of the innermost one as one more.
+static void takeSample(int signal)
+{
+    SAMPLER *sampler = currentSampler;
+    SAMPLER_FRAME *frames;
+    const AST_NODE *current;
+    ENV *env;
+    ENV *top;
+    int depth;
+    int n;
+    bool complete;
+
+    if (sampler == NULL || sampler->paused)
+    {
+        return;
+    }
+    if (sampler->pendingLen == SAMPLER_SAMPLES || sampler->frameLen + SAMPLER_STACK_SIZE + 1 > SAMPLER_FRAMES)
+    {
+        sampler->dropped++;
+        return;
+    }
+
+    depth = sampler->depth;
+    atomic_signal_fence(memory_order_seq_cst);
+    frames = sampler->frames + sampler->frameLen;
+    n = depth < SAMPLER_STACK_SIZE ? depth : SAMPLER_STACK_SIZE;
+    for (int i = 0; i < n; i++)
+    {
+        frames[i] = (SAMPLER_FRAME) {sampler->stack[i], i == 0 ? "expression" : NULL};
+    }
+    complete = n == depth;
+    current = sampler->current;
+
+    // only an expression has frames of the tree walker, which an error may leave
+    for (env = evalFrames(&top); depth > 0 && env < top; env++)
+    {
+        if (env->scope->type == LAMBDA_NODE_TYPE)
+        {
+            if (n == SAMPLER_STACK_SIZE)
+            {
+                complete = false;
+                break;
+            }
+            frames[n++] = (SAMPLER_FRAME) {env->scope, NULL};
+        }
+        current = env->current;
+    }
+    if (complete && depth > 0 && current != NULL)
+    {
+        frames[n++] = (SAMPLER_FRAME) {current, NULL};
+    }
+
+    sampler->frameLen += n;
+    sampler->pending[sampler->pendingLen++] = (SAMPLER_SAMPLE) {n, !complete};
+    if (sampler->pendingLen >= SAMPLER_SAMPLES / 2 || sampler->frameLen >= SAMPLER_FRAMES / 2)
+    {
+        sampler->full = 1;
+    }
+}
+
+SAMPLER *samplerCreate(int rate)
+{
+    SAMPLER *sampler = calloc(1, sizeof(SAMPLER));
+    struct sigaction action = {.sa_handler = takeSample, .sa_flags = SA_RESTART};
+    long interval = 1000000 / rate;
+    struct itimerval timer = {{interval / 1000000, interval % 1000000}, {interval / 1000000, interval % 1000000}};
+
+    if (sampler == NULL)
+    {
+        return NULL;
+    }
+
+    sampler->rate = rate;
+    sampler->pending = malloc(SAMPLER_SAMPLES * sizeof(SAMPLER_SAMPLE));
+    sampler->frames = malloc(SAMPLER_FRAMES * sizeof(SAMPLER_FRAME));
+    sigemptyset(&action.sa_mask);
+    if (sampler->pending == NULL || sampler->frames == NULL ||
+        sigaction(SIGPROF, &action, NULL) != 0 || setitimer(ITIMER_PROF, &timer, NULL) != 0)
+    {
+        free(sampler->pending);
+        free(sampler->frames);
+        free(sampler);
+        return NULL;
+    }
+
+    return sampler;
+}
+
+#else
+
+SAMPLER *samplerCreate(int rate)
+{
+    return NULL;
+}
+
+#endif
+
+void samplerFree(SAMPLER *sampler)
+{
+    if (sampler == NULL)
+    {
+        return;
+    }
+
+#if SAMPLER_AVAILABLE
+    struct itimerval stop = {{0, 0}, {0, 0}};
+
+    setitimer(ITIMER_PROF, &stop, NULL);
+    signal(SIGPROF, SIG_IGN);
+#endif
+    for (size_t i = 0; i < sampler->stackCap; i++)
+    {
+        free(sampler->stacks[i].frames);
+    }
+    free(sampler->stacks);
+    free(sampler->lines);
+    free(sampler->folded);
+    free(sampler->pending);
+    free(sampler->frames);
+    free(sampler);
+}
+
+// Appends text to the folded stack being made, of *len bytes. Returns false if
+// memory runs out.
+static bool append(SAMPLER *sampler, size_t *len, const char *text)
+{
+    size_t textLen = strlen(text);
+
+    if (*len + textLen + 1 > sampler->foldedCap)
+    {
+        size_t cap = sampler->foldedCap ? sampler->foldedCap : 256;
+        char *folded;
+
+        while (*len + textLen + 1 > cap)
+        {
+            cap *= 2;
+        }
+        if ((folded = realloc(sampler->folded, cap)) == NULL)
+        {
+            return false;
+        }
+        sampler->folded = folded;
+        sampler->foldedCap = cap;
+    }
+
+    memcpy(sampler->folded + *len, text, textLen + 1);
+    *len += textLen;
+    return true;
+}
+
+static int kindOf(const SAMPLER_FRAME *frame)
+{
+    if (frame->name != NULL)
+    {
+        return SAMPLER_EXPRESSION;
+    }
+
+    return frame->node->type == LAMBDA_NODE_TYPE ? SAMPLER_LAMBDA : frame->node->data.function.func;
+}
+
+// A lambda is named after the symbol of the let it is bound in.
+static const char *nameOf(const SAMPLER_FRAME *frame)
+{
+    if (frame->name != NULL)
+    {
+        return frame->name;
+    }
+    if (frame->node->type == FUNC_NODE_TYPE)
+    {
+        return funcName(frame->node->data.function.func);
+    }
+
+    for (const SYMBOL_TABLE_NODE *symbol = frame->node->parent != NULL ? frame->node->parent->symbolTable : NULL;
+         symbol != NULL; symbol = symbol->next)
+    {
+        if (symbol->value == frame->node)
+        {
+            return symbol->id->name;
+        }
+    }
+    return "lambda";
+}
+
+static uint64_t hash(const char *text)
+{
+    uint64_t hash = 14695981039346656037u;
+
+    for (; *text != '\0'; text++)
+    {
+        hash = (hash ^ (unsigned char) *text) * 1099511628211u;
+    }
+
+    return hash;
+}
+
+// The entry of the table for stack, or the empty one where it goes.
+static SAMPLER_STACK *findStack(SAMPLER_STACK *stacks, size_t cap, const char *frames)
+{
+    size_t i = hash(frames) & (cap - 1);
+
+    while (stacks[i].frames != NULL && strcmp(stacks[i].frames, frames) != 0)
+    {
+        i = (i + 1) & (cap - 1);
+    }
+
+    return &stacks[i];
+}
+
+static bool countStack(SAMPLER *sampler, const char *frames)
+{
+    SAMPLER_STACK *stack;
+
+    if (2 * (sampler->stackCount + 1) > sampler->stackCap)
+    {
+        size_t cap = sampler->stackCap ? 2 * sampler->stackCap : 256;
+        SAMPLER_STACK *stacks = calloc(cap, sizeof(SAMPLER_STACK));
+
+        if (stacks == NULL)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < sampler->stackCap; i++)
+        {
+            if (sampler->stacks[i].frames != NULL)
+            {
+                *findStack(stacks, cap, sampler->stacks[i].frames) = sampler->stacks[i];
+            }
+        }
+        free(sampler->stacks);
+        sampler->stacks = stacks;
+        sampler->stackCap = cap;
+    }
+
+    stack = findStack(sampler->stacks, sampler->stackCap, frames);
+    if (stack->frames == NULL)
+    {
+        if ((stack->frames = strdup(frames)) == NULL)
+        {
+            return false;
+        }
+        sampler->stackCount++;
+    }
+    stack->count++;
+
+    return true;
+}
+
+static SAMPLER_LINE *lineOf(SAMPLER *sampler, int line)
+{
+    if (line >= sampler->lineCap)
+    {
+        int cap = sampler->lineCap ? sampler->lineCap : 64;
+        SAMPLER_LINE *lines;
+
+        while (line >= cap)
+        {
+            cap *= 2;
+        }
+        if ((lines = realloc(sampler->lines, cap * sizeof(SAMPLER_LINE))) == NULL)
+        {
+            return NULL;
+        }
+        memset(lines + sampler->lineCap, 0, (cap - sampler->lineCap) * sizeof(SAMPLER_LINE));
+        sampler->lines = lines;
+        sampler->lineCap = cap;
+    }
+
+    return &sampler->lines[line];
+}
+
+// Counts a sample of n frames, above which there were more if truncated.
+static void countSample(SAMPLER *sampler, const SAMPLER_FRAME *frames, int n, bool truncated)
+{
+    size_t len = 0;
+    bool made = append(sampler, &len, n == 0 ? "(between expressions)" : "");
+
+    sampler->samples++;
+    for (int i = 0; i < n; i++)
+    {
+        const SOURCE_LOCATION *location = &frames[i].node->location;
+        SAMPLER_LINE *line;
+        char at[32] = "";
+
+        if (location->firstLine > 0)
+        {
+            snprintf(at, sizeof(at), "@%d:%d", location->firstLine, location->firstColumn);
+            if ((line = lineOf(sampler, location->firstLine)) != NULL)
+            {
+                if (line->lastSample != sampler->samples)
+                {
+                    line->total++;
+                    line->lastSample = sampler->samples;
+                }
+                if (i == n - 1 && !truncated)
+                {
+                    line->self++;
+                    line->leaves[kindOf(&frames[i])]++;
+                }
+            }
+        }
+        made = made && (i == 0 || append(sampler, &len, ";")) &&
+               append(sampler, &len, nameOf(&frames[i])) && append(sampler, &len, at);
+    }
+    made = made && (!truncated || append(sampler, &len, ";..."));
+
+    if (!made || !countStack(sampler, sampler->folded))
+    {
+        sampler->dropped++;
+    }
+}
+
+void samplerCollect(SAMPLER *sampler)
+{
+    const SAMPLER_FRAME *frames;
+
+    sampler->paused = 1;
+    atomic_signal_fence(memory_order_seq_cst);
+
+    frames = sampler->frames;
+    for (size_t i = 0; i < sampler->pendingLen; i++)
+    {
+        countSample(sampler, frames, sampler->pending[i].frames, sampler->pending[i].truncated);
+        frames += sampler->pending[i].frames;
+    }
+    sampler->pendingLen = 0;
+    sampler->frameLen = 0;
+    sampler->full = 0;
+
+    atomic_signal_fence(memory_order_seq_cst);
+    sampler->paused = 0;
+}
+
+void samplerAbort(SAMPLER *sampler)
+{
+    // first, so that no sample is taken of what is gone
+    sampler->depth = 0;
+    atomic_signal_fence(memory_order_seq_cst);
+    samplerCollect(sampler);
+}
+
+static const SAMPLER_LINE *sortedLines;
+
+static int bySelf(const void *a, const void *b)
+{
+    const SAMPLER_LINE *x = &sortedLines[*(const int *) a];
+    const SAMPLER_LINE *y = &sortedLines[*(const int *) b];
+
+    if (x->self != y->self)
+    {
+        return x->self < y->self ? 1 : -1;
+    }
+    return x->total < y->total ? 1 : x->total > y->total ? -1 : 0;
+}
+
+static const char *kindName(int kind)
+{
+    return kind == SAMPLER_LAMBDA ? "lambda" : kind == SAMPLER_EXPRESSION ? "expression" : funcName(kind);
+}
+
+// Prints the lines with the most samples whose innermost frame is on them.
+static void printLines(SAMPLER *sampler, FILE *out)
+{
+    int *order = malloc(sampler->lineCap * sizeof(int));
+    int count = 0;
+    double samples = sampler->samples > 0 ? sampler->samples : 1;
+
+    if (order == NULL)
+    {
+        return;
+    }
+    for (int i = 1; i < sampler->lineCap; i++)
+    {
+        if (sampler->lines[i].total > 0)
+        {
+            order[count++] = i;
+        }
+    }
+    sortedLines = sampler->lines;
+    qsort(order, count, sizeof(int), bySelf);
+
+    fprintf(out, "\n%6s %10s %7s %10s %7s   %s\n", "line", "self", "self %", "total", "total %", "mostly in");
+    for (int i = 0; i < count && i < SAMPLER_TOP_LINES; i++)
+    {
+        const SAMPLER_LINE *line = &sampler->lines[order[i]];
+        int kind = 0;
+
+        for (int k = 1; k < SAMPLER_KINDS; k++)
+        {
+            kind = line->leaves[k] > line->leaves[kind] ? k : kind;
+        }
+        fprintf(out, "%6d %10llu %7.2f %10llu %7.2f   %s\n", order[i], (unsigned long long) line->self,
+                100.0 * line->self / samples, (unsigned long long) line->total, 100.0 * line->total / samples,
+                line->self > 0 ? kindName(kind) : "");
+    }
+    free(order);
+}
+
+int samplerReport(SAMPLER *sampler, FILE *folded, FILE *table)
+{
+    int result = 0;
+
+    samplerCollect(sampler);
+
+    for (size_t i = 0; i < sampler->stackCap; i++)
+    {
+        if (sampler->stacks[i].frames != NULL &&
+            fprintf(folded, "%s %llu\n", sampler->stacks[i].frames, (unsigned long long) sampler->stacks[i].count) < 0)
+        {
+            result = -1;
+        }
+    }
+
+    fprintf(table, "\nsampler: %llu samples at %d Hz, %llu dropped\n", (unsigned long long) sampler->samples,
+            sampler->rate, (unsigned long long) sampler->dropped);
+    printLines(sampler, table);
+    fflush(table);
+
+    return result;
+}
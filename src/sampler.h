@@ -0,0 +1,156 @@
+#ifndef __sampler_h_
+#define __sampler_h_
+
+#include <signal.h>
+#include <stdatomic.h>
+#include "cilisp.h"
+
+// Sampling profiler of --sample.
+//
+// SIGPROF, which setitimer sends at a rate of CPU time, copies what the
+// interpreter with the sampler is in into the samples of the sampler, and
+// nothing else. That is the expression it runs, then the frames of the lambdas
+// it is in: the VM pushes those it calls onto the shadow stack of the sampler,
+// and the tree walker has its own frames of calls and lets for the handler to
+// read, each with its current node, the builtin last started in it, which is
+// all it stores for the sampler. Once the expression has been printed, while its
+// nodes are still there, the samples are turned into the folded stacks of
+// flamegraph.pl, whose frames are the names of the lambdas and builtins with the
+// line and column of their node, and counted by source line. The VM has no
+// current node. The timer is the process's, so one interpreter samples at a time.
+
+// The timer and its signal are POSIX; elsewhere samplerCreate gives no sampler.
+#if defined(__unix__)
+#define SAMPLER_AVAILABLE 1
+#else
+#define SAMPLER_AVAILABLE 0
+#endif
+
+#define SAMPLER_DEFAULT_RATE 1000 // samples per second of CPU time
+#define SAMPLER_STACK_SIZE 1024  // outermost frames a sample keeps
+// Room for the samples not collected yet, see samplerCheck.
+#define SAMPLER_SAMPLES ((size_t) 1 << 12)
+#define SAMPLER_FRAMES ((size_t) 1 << 18)
+#define SAMPLER_TOP_LINES 20
+
+// A frame of a sample: the expression at the bottom, then the lambdas, then the
+// builtin the innermost one runs, if any is known.
+typedef struct sampler_frame {
+    const AST_NODE *node;
+    const char *name; // NULL to name it after its node
+} SAMPLER_FRAME;
+
+// A sample not collected yet.
+typedef struct sampler_sample {
+    int frames; // it has in the frames of the sampler, outermost first
+    bool truncated; // set if the stack went on above them
+} SAMPLER_SAMPLE;
+
+// What the innermost frame of a sample is: a builtin, by FUNC_TYPE, a lambda or
+// an expression.
+#define SAMPLER_LAMBDA CUSTOM_FUNC
+#define SAMPLER_EXPRESSION (CUSTOM_FUNC + 1)
+#define SAMPLER_KINDS (CUSTOM_FUNC + 2)
+
+// Per source line: samples whose innermost frame is on it, by what that is, and
+// samples with any frame on it.
+typedef struct sampler_line {
+    uint64_t self;
+    uint64_t total;
+    uint64_t leaves[SAMPLER_KINDS];
+    uint64_t lastSample; // the last sample counted in total
+} SAMPLER_LINE;
+
+typedef struct sampler_stack {
+    char *frames; // NULL for an empty entry of the table
+    uint64_t count;
+} SAMPLER_STACK;
+
+typedef struct sampler {
+    // The shadow stack: the expression, then the lambdas the VM calls. The frames
+    // from SAMPLER_STACK_SIZE on all go to the last one, which samples leave out.
+    const AST_NODE *stack[SAMPLER_STACK_SIZE + 1];
+    volatile sig_atomic_t depth;
+    volatile sig_atomic_t paused; // set while the samples are collected
+    volatile sig_atomic_t full;   // set once they take half their room
+    const AST_NODE *current; // of the expression, for the builtins outside of any frame
+
+    SAMPLER_SAMPLE *pending;
+    size_t pendingLen;
+    SAMPLER_FRAME *frames;
+    size_t frameLen;
+    uint64_t dropped; // samples that found no room
+
+    // What the samples have come to.
+    uint64_t samples;
+    SAMPLER_STACK *stacks; // a hash table of the folded stacks
+    size_t stackCount;
+    size_t stackCap;
+    SAMPLER_LINE *lines; // by line number
+    int lineCap;
+    char *folded; // scratch space for a folded stack
+    size_t foldedCap;
+    int rate;
+} SAMPLER;
+
+// The sampler of the interpreter this thread is running, if it has one, set by
+// useContext; the threads of --threads keep none, and their samples are lost.
+extern _Thread_local SAMPLER *currentSampler;
+
+// Returns a sampler that takes rate samples per second of CPU time from now on,
+// or NULL if memory runs out, the timer cannot be set or there is none.
+SAMPLER *samplerCreate(int rate);
+// Stops the timer and frees the sampler.
+void samplerFree(SAMPLER *sampler);
+
+// Turns the samples taken so far into stacks, while the nodes they point to are there.
+void samplerCollect(SAMPLER *sampler);
+// Collects the samples an error jumped out of, and empties the shadow stack.
+void samplerAbort(SAMPLER *sampler);
+
+// Writes the folded stacks to folded, for flamegraph.pl, and the lines with the
+// most samples to table. Returns 0, or -1 if writing the stacks fails.
+int samplerReport(SAMPLER *sampler, FILE *folded, FILE *table);
+
+// Collects the samples once they take half their room; the tree walker checks at
+// each builtin and the VM at each call, and the samples that come before that
+// are dropped.
+static inline void samplerCheck(SAMPLER *sampler)
+{
+    if (sampler->full)
+    {
+        samplerCollect(sampler);
+    }
+}
+
+// Pushes the expression at node, or the lambda it calls.
+static inline void samplerPush(SAMPLER *sampler, const AST_NODE *node)
+{
+    int depth = sampler->depth;
+
+    sampler->stack[depth < SAMPLER_STACK_SIZE ? depth : SAMPLER_STACK_SIZE] = node;
+    // the handler must not see the frame before it is there
+    atomic_signal_fence(memory_order_seq_cst);
+    sampler->depth = depth + 1;
+}
+
+static inline void samplerPop(SAMPLER *sampler)
+{
+    sampler->depth--;
+}
+
+// The builtin at node, or nothing if NULL, is what the frame env of the tree
+// walker, or the expression if NULL, runs now.
+static inline void samplerBuiltin(SAMPLER *sampler, AST_NODE *node, ENV *env)
+{
+    if (env != NULL)
+    {
+        env->current = node;
+    }
+    else
+    {
+        sampler->current = node;
+    }
+}
+
+#endif
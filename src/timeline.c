@@ -0,0 +1,221 @@
+#include <time.h>
+#include "timeline.h"
+
+_Thread_local TIMELINE *currentTimeline;
+
+uint64_t timelineNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void flush(TIMELINE *timeline)
+{
+    if (timeline->len > 0 && !timeline->failed &&
+        fwrite(timeline->buffer, 1, timeline->len, timeline->out) != timeline->len)
+    {
+        timeline->failed = true;
+    }
+    timeline->len = 0;
+}
+
+static void put(TIMELINE *timeline, const char *text, size_t len)
+{
+    if (timeline->len + len > TIMELINE_BUFFER_SIZE)
+    {
+        flush(timeline);
+        if (len > TIMELINE_BUFFER_SIZE)
+        {
+            // only a name could be that long
+            if (!timeline->failed && fwrite(text, 1, len, timeline->out) != len)
+            {
+                timeline->failed = true;
+            }
+            return;
+        }
+    }
+
+    memcpy(timeline->buffer + timeline->len, text, len);
+    timeline->len += len;
+}
+
+#define PUT(timeline, literal) put(timeline, literal, sizeof(literal) - 1)
+
+static void putNumber(TIMELINE *timeline, uint64_t number)
+{
+    char digits[20];
+    int i = sizeof(digits);
+
+    do
+    {
+        digits[--i] = (char) ('0' + number % 10);
+        number /= 10;
+    }
+    while (number > 0);
+
+    put(timeline, digits + i, sizeof(digits) - i);
+}
+
+// Trace events count microseconds; ns is written as that with three decimals.
+static void putTime(TIMELINE *timeline, uint64_t ns)
+{
+    char decimals[4] = {'.', (char) ('0' + ns / 100 % 10), (char) ('0' + ns / 10 % 10), (char) ('0' + ns % 10)};
+
+    putNumber(timeline, ns / 1000);
+    put(timeline, decimals, sizeof(decimals));
+}
+
+// Names are those of builtins and symbols, which need no escaping in JSON.
+static void putString(TIMELINE *timeline, const char *text)
+{
+    PUT(timeline, "\"");
+    put(timeline, text, strlen(text));
+    PUT(timeline, "\"");
+}
+
+// Starts an event after the one before it, up to its time stamp.
+static void putEvent(TIMELINE *timeline, const char *name, const char *category, const char *phase, uint64_t now)
+{
+    PUT(timeline, ",\n{");
+    if (name != NULL)
+    {
+        PUT(timeline, "\"name\":");
+        putString(timeline, name);
+        PUT(timeline, ",\"cat\":");
+        putString(timeline, category);
+        PUT(timeline, ",");
+    }
+    PUT(timeline, "\"ph\":");
+    putString(timeline, phase);
+    PUT(timeline, ",\"pid\":1,\"tid\":1,\"ts\":");
+    putTime(timeline, now - timeline->start);
+}
+
+static bool located(const AST_NODE *node)
+{
+    return node != NULL && node->location.firstLine > 0;
+}
+
+static void putLocation(TIMELINE *timeline, const char *key, const AST_NODE *node, bool first)
+{
+    const SOURCE_LOCATION *location = &node->location;
+
+    if (!first)
+    {
+        PUT(timeline, ",");
+    }
+    putString(timeline, key);
+    PUT(timeline, ":\"");
+    putNumber(timeline, location->firstLine);
+    PUT(timeline, ":");
+    putNumber(timeline, location->firstColumn);
+    PUT(timeline, "-");
+    putNumber(timeline, location->lastLine);
+    PUT(timeline, ":");
+    putNumber(timeline, location->lastColumn);
+    PUT(timeline, "\"");
+}
+
+// Ends an event with the locations of node and lambda, where there are any.
+static void putArgs(TIMELINE *timeline, const AST_NODE *node, const AST_NODE *lambda)
+{
+    if (located(node) || located(lambda))
+    {
+        PUT(timeline, ",\"args\":{");
+        if (located(node))
+        {
+            putLocation(timeline, "at", node, true);
+        }
+        if (located(lambda))
+        {
+            putLocation(timeline, "lambda", lambda, !located(node));
+        }
+        PUT(timeline, "}");
+    }
+    PUT(timeline, "}");
+}
+
+TIMELINE *timelineOpen(const char *path, int threshold)
+{
+    TIMELINE *timeline = calloc(1, sizeof(TIMELINE));
+
+    if (timeline == NULL)
+    {
+        return NULL;
+    }
+    if ((timeline->out = fopen(path, "w")) == NULL)
+    {
+        free(timeline);
+        return NULL;
+    }
+
+    timeline->start = timelineNow();
+    timeline->threshold = (uint64_t) threshold * 1000;
+    PUT(timeline, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"cilisp\"}}");
+
+    return timeline;
+}
+
+int timelineClose(TIMELINE *timeline)
+{
+    int result;
+
+    if (timeline == NULL)
+    {
+        return 0;
+    }
+
+    timelineAbort(timeline);
+    PUT(timeline, "\n]\n");
+    flush(timeline);
+    result = fclose(timeline->out) != 0 || timeline->failed ? -1 : 0;
+    free(timeline);
+
+    return result;
+}
+
+void timelineExpression(TIMELINE *timeline, const AST_NODE *node)
+{
+    putEvent(timeline, "expression", "expression", "B", timelineNow());
+    putArgs(timeline, node, NULL);
+    timeline->open++;
+}
+
+void timelineCall(TIMELINE *timeline, const char *name, const AST_NODE *node, const AST_NODE *lambda)
+{
+    putEvent(timeline, name, "call", "B", timelineNow());
+    putArgs(timeline, node, lambda);
+    timeline->open++;
+}
+
+void timelineEnd(TIMELINE *timeline)
+{
+    putEvent(timeline, NULL, NULL, "E", timelineNow());
+    PUT(timeline, "}");
+    timeline->open--;
+}
+
+void timelineBuiltin(TIMELINE *timeline, const AST_NODE *node, uint64_t start)
+{
+    uint64_t now = timelineNow();
+
+    if (now - start < timeline->threshold)
+    {
+        return;
+    }
+
+    putEvent(timeline, funcName(node->data.function.func), "builtin", "X", start);
+    PUT(timeline, ",\"dur\":");
+    putTime(timeline, now - start);
+    putArgs(timeline, node, NULL);
+}
+
+void timelineAbort(TIMELINE *timeline)
+{
+    while (timeline->open > 0)
+    {
+        timelineEnd(timeline);
+    }
+}
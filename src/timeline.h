@@ -0,0 +1,58 @@
+#ifndef __timeline_h_
+#define __timeline_h_
+
+#include "cilisp.h"
+
+// Spans of --trace, written as Chrome trace events.
+//
+// An interpreter given a timeline writes a span for each top-level expression,
+// from the start of its passes to the end of printing it, one for each call of a
+// lambda, and one for each builtin the tree walker runs that takes at least the
+// threshold of the timeline. Expressions and calls are written as begin and end
+// events as they start and end, builtins as complete events once they have taken
+// long enough. Each event carries the location of its node in the input, as
+// "line:column-line:column", and a call the location of the lambda it runs. The
+// file, a JSON array of events, opens in Perfetto or chrome://tracing. Events go
+// through a buffer of the timeline, written out as it fills up and when the
+// timeline is closed.
+
+#define TIMELINE_BUFFER_SIZE ((size_t) 1 << 16)
+#define TIMELINE_DEFAULT_THRESHOLD 100 // microseconds
+
+typedef struct timeline {
+    FILE *out;
+    size_t len; // of what the buffer holds
+    uint64_t start; // the time events are timed from, in nanoseconds
+    uint64_t threshold; // in nanoseconds
+    int open; // begin events without an end event yet
+    bool failed; // set once writing fails, after which events are dropped
+    char buffer[TIMELINE_BUFFER_SIZE];
+} TIMELINE;
+
+// The timeline of the interpreter this thread is running, if it has one, set by
+// useContext; the threads of --threads write none.
+extern _Thread_local TIMELINE *currentTimeline;
+
+// Opens path for a timeline whose builtins are written from threshold
+// microseconds, and returns it, or NULL if it cannot be opened.
+TIMELINE *timelineOpen(const char *path, int threshold);
+// Ends the spans still open, writes out what is left and closes the file.
+// Returns 0, or -1 if writing failed.
+int timelineClose(TIMELINE *timeline);
+
+// The time, in nanoseconds, to pass to timelineBuiltin.
+uint64_t timelineNow(void);
+
+// Begin the span of a top-level expression, or of a call of the lambda bound to
+// name, from the call at node, or NULL if it is not known, to lambda, or NULL if
+// there is none; timelineEnd ends the one begun last.
+void timelineExpression(TIMELINE *timeline, const AST_NODE *node);
+void timelineCall(TIMELINE *timeline, const char *name, const AST_NODE *node, const AST_NODE *lambda);
+void timelineEnd(TIMELINE *timeline);
+// Writes the span of the builtin at node, started at start, if it took long enough.
+void timelineBuiltin(TIMELINE *timeline, const AST_NODE *node, uint64_t start);
+
+// Ends the spans an error jumped out of.
+void timelineAbort(TIMELINE *timeline);
+
+#endif
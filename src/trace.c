@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+TRACE_RING *traceCreate(void)
+{
+    TRACE_RING *ring = calloc(1, sizeof(TRACE_RING));
+
+    if (ring == NULL || (ring->records = malloc(TRACE_CAPACITY * sizeof(TRACE_RECORD))) == NULL)
+    {
+        free(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+void traceFree(TRACE_RING *ring)
+{
+    if (ring != NULL)
+    {
+        free(ring->records);
+        free(ring);
+    }
+}
+
+void traceToken(TRACE_RING *ring, const char *name, const char *text, size_t len)
+{
+    TRACE_RECORD *record = &ring->records[ring->next++ % TRACE_CAPACITY];
+
+    record->name = name;
+    record->production = NULL;
+    record->len = len > UINT16_MAX ? UINT16_MAX : (uint16_t) len;
+    memcpy(record->text, text, len < TRACE_TEXT_SIZE ? len : TRACE_TEXT_SIZE);
+}
+
+void traceRule(TRACE_RING *ring, const char *name, const char *production)
+{
+    TRACE_RECORD *record = &ring->records[ring->next++ % TRACE_CAPACITY];
+
+    record->name = name;
+    record->production = production;
+    record->len = 0;
+}
+
+// The strings of a dump: each string literal the records point to, once.
+typedef struct trace_strings {
+    const char **strings;
+    uint32_t *offsets;
+    size_t count;
+    size_t cap;
+    uint32_t len;
+} TRACE_STRINGS;
+
+// The offset of s in the strings, added if it is not there yet; the scanner and
+// the parser have a few hundred of them at most.
+static uint32_t stringOffset(TRACE_STRINGS *strings, const char *s)
+{
+    for (size_t i = strings->count; i > 0; i--)
+    {
+        if (strings->strings[i - 1] == s)
+        {
+            return strings->offsets[i - 1];
+        }
+    }
+
+    if (strings->count == strings->cap)
+    {
+        size_t cap = strings->cap ? 2 * strings->cap : 64;
+        const char **grown = realloc(strings->strings, cap * sizeof(char *));
+        uint32_t *offsets;
+
+        if (grown == NULL)
+        {
+            return TRACE_NO_STRING;
+        }
+        strings->strings = grown;
+        if ((offsets = realloc(strings->offsets, cap * sizeof(uint32_t))) == NULL)
+        {
+            return TRACE_NO_STRING;
+        }
+        strings->offsets = offsets;
+        strings->cap = cap;
+    }
+
+    strings->strings[strings->count] = s;
+    strings->offsets[strings->count++] = strings->len;
+    strings->len += strlen(s) + 1;
+    return strings->offsets[strings->count - 1];
+}
+
+int traceDump(const TRACE_RING *ring, FILE *out)
+{
+    uint64_t first = ring->next > TRACE_CAPACITY ? ring->next - TRACE_CAPACITY : 0;
+    TRACE_FILE_HEADER header = {TRACE_MAGIC, TRACE_VERSION, first, (uint32_t) (ring->next - first), 0};
+    TRACE_STRINGS strings = {0};
+    int status = 0;
+
+    // the strings first, for the header to hold their length
+    for (uint64_t i = first; i < ring->next && status == 0; i++)
+    {
+        const TRACE_RECORD *record = &ring->records[i % TRACE_CAPACITY];
+
+        if (stringOffset(&strings, record->name) == TRACE_NO_STRING ||
+            (record->production != NULL && stringOffset(&strings, record->production) == TRACE_NO_STRING))
+        {
+            status = -1;
+        }
+    }
+    header.stringsLen = strings.len;
+
+    if (status == 0 && fwrite(&header, sizeof(header), 1, out) != 1)
+    {
+        status = -1;
+    }
+    for (uint64_t i = first; i < ring->next && status == 0; i++)
+    {
+        const TRACE_RECORD *record = &ring->records[i % TRACE_CAPACITY];
+        TRACE_FILE_RECORD fileRecord = {
+                stringOffset(&strings, record->name),
+                record->production != NULL ? stringOffset(&strings, record->production) : TRACE_NO_STRING,
+                record->len
+        };
+
+        // the rest of the text, which the record never held, stays zero
+        memcpy(fileRecord.text, record->text, record->len < TRACE_TEXT_SIZE ? record->len : TRACE_TEXT_SIZE);
+        if (fwrite(&fileRecord, sizeof(fileRecord), 1, out) != 1)
+        {
+            status = -1;
+        }
+    }
+    for (size_t i = 0; i < strings.count && status == 0; i++)
+    {
+        if (fwrite(strings.strings[i], strlen(strings.strings[i]) + 1, 1, out) != 1)
+        {
+            status = -1;
+        }
+    }
+
+    free(strings.strings);
+    free(strings.offsets);
+    if (fflush(out) != 0)
+    {
+        status = -1;
+    }
+    return status;
+}
@@ -0,0 +1,74 @@
+#ifndef __trace_h_
+#define __trace_h_
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Tracing of the tokens the scanner returns and the rules the parser reduces.
+//
+// Built with CILISP_TRACE defined (the CILISP_TRACE option in CMake), the scanner
+// and the parser call TRACE_TOKEN and TRACE_RULE, which record a fixed-size
+// record into the ring of the interpreter when --parse-trace gave it one. Without
+// it, they compile to nothing. A dump holds the last TRACE_CAPACITY records;
+// tools/trace_decode.c prints it as lines of the form
+//     LEX: INT "42"
+//     BISON: s_expr ::= number
+// A dump is read on a machine with the byte order of the one that wrote it.
+
+#define TRACE_CAPACITY ((size_t) 1 << 16)
+#define TRACE_TEXT_SIZE 46
+#define TRACE_MAGIC "CLTR"
+#define TRACE_VERSION 1
+
+// A token, its name and the start of its text, or a rule, its name and its
+// production, which are string literals.
+typedef struct trace_record {
+    const char *name;
+    const char *production; // NULL for a token
+    uint16_t len;           // of the whole token text, which may be cut off
+    char text[TRACE_TEXT_SIZE];
+} TRACE_RECORD;
+
+typedef struct trace_ring {
+    TRACE_RECORD *records;
+    uint64_t next; // records written so far; the oldest are overwritten
+} TRACE_RING;
+
+// A dump: the header, count records, then the strings they point to, each
+// ending with a NUL, at offsets from the start of the strings.
+typedef struct trace_file_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t dropped; // records overwritten before the dump
+    uint32_t count;
+    uint32_t stringsLen;
+} TRACE_FILE_HEADER;
+
+#define TRACE_NO_STRING UINT32_MAX
+
+typedef struct trace_file_record {
+    uint32_t name;
+    uint32_t production; // TRACE_NO_STRING for a token
+    uint16_t len;
+    char text[TRACE_TEXT_SIZE];
+} TRACE_FILE_RECORD;
+
+// Returns a ring of TRACE_CAPACITY records, or NULL if memory runs out.
+TRACE_RING *traceCreate(void);
+void traceFree(TRACE_RING *ring);
+
+void traceToken(TRACE_RING *ring, const char *name, const char *text, size_t len);
+void traceRule(TRACE_RING *ring, const char *name, const char *production);
+
+// Writes the records in the ring, oldest first, and returns 0, or -1 if writing fails.
+int traceDump(const TRACE_RING *ring, FILE *out);
+
+#ifdef CILISP_TRACE
+#define TRACE_TOKEN(ring, name, text, len) {if ((ring) != NULL) {traceToken(ring, name, text, len);}}
+#define TRACE_RULE(ring, name, production) {if ((ring) != NULL) {traceRule(ring, name, production);}}
+#else
+#define TRACE_TOKEN(ring, name, text, len) {}
+#define TRACE_RULE(ring, name, production) {}
+#endif
+
+#endif
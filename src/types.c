@@ -0,0 +1,596 @@
+#include <string.h>
+#include "cilisp.h"
+
+// Type inference.
+//
+// The type of a node is the tag every value it evaluates to is guaranteed to have:
+// INT_TYPE, DOUBLE_TYPE, VECTOR_TYPE, SCALAR_TYPE when it can be an int or a
+// double, NO_TYPE when it can be anything, or UNBOUND_TYPE when no value reaches
+// it, as for the parameters of a lambda no call has been seen for.
+// Builtins whose operands all have the same known type are given an INT_KERNEL or
+// DOUBLE_KERNEL evaluator.
+//
+// The warnings that return NAN give a double wherever they happen, so they are
+// part of the types: undefined symbols and functions, functions used as values,
+// missing arguments, stack overflows (so a call is only known to give a double,
+// when its lambda is typed double) and lookups of let bindings that are being
+// evaluated. Such a lookup can only come from the value of a binding of the same
+// scope, or from a lambda defined there, that the binding looked up depends on.
+//
+// Parameter types join the argument types of every call, which may depend on
+// other parameters, so the tree is walked until none of them changes.
+
+// What a pass knows about a let scope being walked.
+typedef struct type_scope {
+    int *component;    // strongly connected component of each binding's dependencies
+    NUM_TYPE *types;   // type of each binding's value, once typed
+    char *state;
+} TYPE_SCOPE;
+
+enum binding_state {
+    UNTYPED,
+    TYPING,
+    TYPED
+};
+
+// A level of the environment, as seen from the node being typed.
+typedef struct type_frame {
+    struct type_frame *parent;
+    AST_NODE *node;     // let scope or lambda, NULL at the top level
+    TYPE_SCOPE *scope;  // NULL for lambda frames
+    int binding;        // binding whose value is being typed, -1 in the scope's body
+} TYPE_FRAME;
+
+// A dependency of a binding's value on another binding of the same scope.
+typedef struct edge {
+    int from;
+    int to;
+} EDGE;
+
+#define INITIAL_EDGES 64
+
+static _Thread_local EDGE *edges;
+static _Thread_local int edgeLen;
+static _Thread_local int edgeCap;
+
+// Tarjan's algorithm state, per scope
+static _Thread_local int *first;
+static _Thread_local int *targets;
+static _Thread_local int *indices;
+static _Thread_local int *lowLinks;
+static _Thread_local int *stack;
+static _Thread_local bool *onStack;
+static _Thread_local int stackLen;
+static _Thread_local int nextIndex;
+static _Thread_local int nextComponent;
+
+static _Thread_local bool changed;
+
+#define SCALAR_TYPE ((NUM_TYPE) (NO_TYPE + 3))
+
+static NUM_TYPE inferNode(AST_NODE *node, TYPE_FRAME *frame);
+
+// The type of a node that has the value of one of a or b.
+static inline bool isScalarType(NUM_TYPE type)
+{
+    return type == INT_TYPE || type == DOUBLE_TYPE || type == SCALAR_TYPE;
+}
+
+static NUM_TYPE joinTypes(NUM_TYPE a, NUM_TYPE b)
+{
+    if (a == UNBOUND_TYPE || a == b)
+    {
+        return b;
+    }
+
+    if (b == UNBOUND_TYPE)
+    {
+        return a;
+    }
+
+    return isScalarType(a) && isScalarType(b) ? SCALAR_TYPE : NO_TYPE;
+}
+
+// The result type of the arithmetic builtins on scalars: an int if both operands
+// are ints.
+static NUM_TYPE promoteTypes(NUM_TYPE a, NUM_TYPE b)
+{
+    if (a == DOUBLE_TYPE || b == DOUBLE_TYPE)
+    {
+        return DOUBLE_TYPE;
+    }
+
+    if (a == UNBOUND_TYPE || b == UNBOUND_TYPE)
+    {
+        return UNBOUND_TYPE;
+    }
+
+    return a == INT_TYPE && b == INT_TYPE ? INT_TYPE : SCALAR_TYPE;
+}
+
+// What the value of a binding or lambda of a declared type can be: the NAN
+// warnings give doubles whatever the type.
+static NUM_TYPE declaredType(NUM_TYPE type)
+{
+    return type == INT_TYPE ? SCALAR_TYPE : type;
+}
+
+static void addEdge(int from, int to)
+{
+    if (edgeLen == edgeCap)
+    {
+        edgeCap = edgeCap ? 2 * edgeCap : INITIAL_EDGES;
+        if ((edges = realloc(edges, edgeCap * sizeof(EDGE))) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+    }
+
+    edges[edgeLen++] = (EDGE) {from, to};
+}
+
+// Records the bindings of a scope that the value of binding from refers to;
+// node is depth levels below the scope's bindings.
+static void collectEdges(AST_NODE *node, int depth, int from)
+{
+    AST_SCOPE *scope;
+
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+        case LAMBDA_NODE_TYPE:
+            break;
+        case SYM_NODE_TYPE:
+            if (node->data.symbol.slot >= 0 && node->data.symbol.depth == depth)
+            {
+                addEdge(from, node->data.symbol.slot);
+            }
+            break;
+        case FUNC_NODE_TYPE:
+            for (AST_NODE *op = node->data.function.opList; op != NULL; op = op->next)
+            {
+                collectEdges(op, depth, from);
+            }
+            if (node->data.function.func == CUSTOM_FUNC && node->data.function.slot >= 0
+                && node->data.function.depth == depth)
+            {
+                addEdge(from, node->data.function.slot);
+            }
+            break;
+        case SCOPE_NODE_TYPE:
+            scope = &node->data.scope;
+            for (int i = 0; i < scope->nBindings; i++)
+            {
+                AST_NODE *value = scope->bindings[i]->value;
+
+                if (value->type == LAMBDA_NODE_TYPE)
+                {
+                    collectEdges(value->data.lambda.body, depth + 2, from);
+                }
+                else
+                {
+                    collectEdges(value, depth + 1, from);
+                }
+            }
+            collectEdges(scope->child, depth + 1, from);
+            break;
+        case CONDITIONAL_NODE_TYPE:
+            collectEdges(node->data.condition.condition, depth, from);
+            collectEdges(node->data.condition._true, depth, from);
+            collectEdges(node->data.condition._false, depth, from);
+            break;
+    }
+}
+
+static void visitBinding(int v, int *component)
+{
+    indices[v] = lowLinks[v] = nextIndex++;
+    stack[stackLen++] = v;
+    onStack[v] = true;
+
+    for (int e = first[v]; e < first[v + 1]; e++)
+    {
+        int w = targets[e];
+
+        if (indices[w] < 0)
+        {
+            visitBinding(w, component);
+            if (lowLinks[w] < lowLinks[v])
+            {
+                lowLinks[v] = lowLinks[w];
+            }
+        }
+        else if (onStack[w] && indices[w] < lowLinks[v])
+        {
+            lowLinks[v] = indices[w];
+        }
+    }
+
+    if (lowLinks[v] == indices[v])
+    {
+        int w;
+
+        do
+        {
+            w = stack[--stackLen];
+            onStack[w] = false;
+            component[w] = nextComponent;
+        } while (w != v);
+        nextComponent++;
+    }
+}
+
+// Splits the bindings of a scope into strongly connected components of the
+// relation "the value of a refers to b".
+static int *findComponents(AST_SCOPE *scope)
+{
+    int n = scope->nBindings;
+    int *component = arenaAlloc(&currentContext->astArena, n * sizeof(int));
+
+    edgeLen = 0;
+    for (int i = 0; i < n; i++)
+    {
+        AST_NODE *value = scope->bindings[i]->value;
+
+        if (value->type == LAMBDA_NODE_TYPE)
+        {
+            collectEdges(value->data.lambda.body, 1, i);
+        }
+        else
+        {
+            collectEdges(value, 0, i);
+        }
+    }
+
+    // adjacency lists, by counting sort on the source binding
+    first = arenaCalloc(&currentContext->astArena, (n + 1) * sizeof(int));
+    targets = arenaAlloc(&currentContext->astArena, edgeLen * sizeof(int));
+    for (int e = 0; e < edgeLen; e++)
+    {
+        first[edges[e].from + 1]++;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        first[i + 1] += first[i];
+    }
+
+    // indices doubles as the fill position of each list
+    indices = arenaAlloc(&currentContext->astArena, n * sizeof(int));
+    memcpy(indices, first, n * sizeof(int));
+    for (int e = 0; e < edgeLen; e++)
+    {
+        targets[indices[edges[e].from]++] = edges[e].to;
+    }
+
+    lowLinks = arenaAlloc(&currentContext->astArena, n * sizeof(int));
+    stack = arenaAlloc(&currentContext->astArena, n * sizeof(int));
+    onStack = arenaCalloc(&currentContext->astArena, n * sizeof(bool));
+    stackLen = 0;
+    nextIndex = 0;
+    nextComponent = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        indices[i] = -1;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (indices[i] < 0)
+        {
+            visitBinding(i, component);
+        }
+    }
+
+    return component;
+}
+
+static NUM_TYPE typeBinding(TYPE_FRAME *scopeFrame, int slot)
+{
+    TYPE_SCOPE *scope = scopeFrame->scope;
+    TYPE_FRAME valueFrame = {scopeFrame->parent, scopeFrame->node, scope, slot};
+
+    if (scope->state[slot] == TYPED)
+    {
+        return scope->types[slot];
+    }
+
+    if (scope->state[slot] == TYPING)
+    {
+        // only lookups that may be pending get here, and are typed without it
+        return NO_TYPE;
+    }
+
+    scope->state[slot] = TYPING;
+    scope->types[slot] = inferNode(scopeFrame->node->data.scope.bindings[slot]->value, &valueFrame);
+    scope->state[slot] = TYPED;
+
+    return scope->types[slot];
+}
+
+static NUM_TYPE inferSymbolNode(AST_NODE *node, TYPE_FRAME *frame)
+{
+    AST_SYMBOL *symbol = &node->data.symbol;
+    SYMBOL_TABLE_NODE *binding;
+    TYPE_SCOPE *scope;
+    bool pending;
+
+    if (symbol->slot < 0)
+    {
+        return DOUBLE_TYPE;
+    }
+
+    for (int depth = symbol->depth; depth > 0; depth--)
+    {
+        frame = frame->parent;
+    }
+
+    if (frame->scope == NULL)
+    {
+        return frame->node->data.lambda.paramTypes[symbol->slot];
+    }
+
+    scope = frame->scope;
+    binding = frame->node->data.scope.bindings[symbol->slot];
+    if (binding->value->type == LAMBDA_NODE_TYPE)
+    {
+        // used as a value
+        return DOUBLE_TYPE;
+    }
+
+    pending = frame->binding >= 0 && scope->component[symbol->slot] == scope->component[frame->binding];
+    if (pending)
+    {
+        return declaredType(binding->type);
+    }
+
+    // typed bindings are cast, untyped ones keep their value's type
+    return binding->type != NO_TYPE ? binding->type : typeBinding(frame, symbol->slot);
+}
+
+static NUM_TYPE inferCallNode(AST_NODE *node, TYPE_FRAME *frame)
+{
+    AST_FUNCTION *call = &node->data.function;
+    AST_LAMBDA *lambda;
+    AST_NODE *arg = call->opList;
+    NUM_TYPE type;
+    int n = 0;
+
+    for (AST_NODE *op = call->opList; op != NULL; op = op->next)
+    {
+        n++;
+    }
+
+    if (call->slot < 0 || call->callee == NULL || n < call->callee->value->data.lambda.nParams)
+    {
+        for (; arg != NULL; arg = arg->next)
+        {
+            inferNode(arg, frame);
+        }
+        return DOUBLE_TYPE;
+    }
+
+    lambda = &call->callee->value->data.lambda;
+    for (int i = 0; arg != NULL; i++, arg = arg->next)
+    {
+        type = inferNode(arg, frame);
+        if (i < lambda->nParams && joinTypes(lambda->paramTypes[i], type) != lambda->paramTypes[i])
+        {
+            lambda->paramTypes[i] = joinTypes(lambda->paramTypes[i], type);
+            changed = true;
+        }
+    }
+
+    return declaredType(call->callee->type);
+}
+
+static NUM_TYPE inferBuiltinNode(AST_NODE *node, TYPE_FRAME *frame)
+{
+    AST_FUNCTION *function = &node->data.function;
+    NUM_TYPE firstType = UNBOUND_TYPE;
+    NUM_TYPE promoted = INT_TYPE;
+    NUM_TYPE joined = UNBOUND_TYPE;
+    bool vector = false;
+    bool unknown = false;
+    int n = 0;
+
+    for (AST_NODE *op = function->opList; op != NULL; op = op->next, n++)
+    {
+        NUM_TYPE type = inferNode(op, frame);
+
+        firstType = n == 0 ? type : firstType;
+        promoted = promoteTypes(promoted, type);
+        joined = joinTypes(joined, type);
+        vector = vector || type == VECTOR_TYPE;
+        unknown = unknown || type == NO_TYPE;
+    }
+
+    function->kernel = GENERIC_KERNEL;
+
+    switch (function->func)
+    {
+        case RAND_FUNC:
+            return DOUBLE_TYPE;
+        case READ_FUNC:
+            return SCALAR_TYPE;
+        case PRINT_FUNC:
+            return n == 1 ? firstType : NO_TYPE;
+        default:
+            break;
+    }
+
+    // the operand count warnings return either type
+    if (!isPureBuiltin(node))
+    {
+        return NO_TYPE;
+    }
+
+    switch (function->func)
+    {
+        case ABS_FUNC:
+        case ADD_FUNC:
+        case SUB_FUNC:
+        case MULT_FUNC:
+        case DIV_FUNC:
+        case REM_FUNC:
+        case POW_FUNC:
+        case MAX_FUNC:
+        case MIN_FUNC:
+            if (joined == INT_TYPE)
+            {
+                function->kernel = INT_KERNEL;
+            }
+            else if (joined == DOUBLE_TYPE)
+            {
+                function->kernel = DOUBLE_KERNEL;
+            }
+            break;
+        default:
+            break;
+    }
+
+    switch (function->func)
+    {
+        case VECTOR_FUNC:
+            return VECTOR_TYPE;
+        case SUM_FUNC:
+            return firstType == INT_TYPE || firstType == DOUBLE_TYPE || firstType == UNBOUND_TYPE ? firstType : SCALAR_TYPE;
+        case DOT_FUNC:
+            return vector || unknown ? SCALAR_TYPE : promoted;
+        case MEAN_FUNC:
+            return DOUBLE_TYPE;
+        default:
+            break;
+    }
+
+    // the others apply to each element of vector operands
+    if (unknown)
+    {
+        return NO_TYPE;
+    }
+
+    if (vector)
+    {
+        return VECTOR_TYPE;
+    }
+
+    switch (function->func)
+    {
+        case NEG_FUNC:
+        case ABS_FUNC:
+        case EQUAL_FUNC:
+        case LESS_FUNC:
+        case GREATER_FUNC:
+            return firstType;
+        case ADD_FUNC:
+        case SUB_FUNC:
+        case MULT_FUNC:
+        case DIV_FUNC:
+        case REM_FUNC:
+        case POW_FUNC:
+            return promoted;
+        case MAX_FUNC:
+        case MIN_FUNC:
+            return joined;
+        case EXP2_FUNC:
+            // negative exponents give doubles
+            return firstType == INT_TYPE ? SCALAR_TYPE : firstType;
+        default:
+            return DOUBLE_TYPE;
+    }
+}
+
+static void inferLambdaNode(AST_NODE *node, TYPE_FRAME *scopeFrame, int slot)
+{
+    TYPE_FRAME bindingFrame = {scopeFrame->parent, scopeFrame->node, scopeFrame->scope, slot};
+    TYPE_FRAME paramFrame = {&bindingFrame, node, NULL, -1};
+
+    inferNode(node->data.lambda.body, &paramFrame);
+}
+
+static NUM_TYPE inferScopeNode(AST_NODE *node, TYPE_FRAME *frame)
+{
+    AST_SCOPE *scope = &node->data.scope;
+    int n = scope->nBindings;
+    TYPE_SCOPE types = {
+            findComponents(scope),
+            arenaAlloc(&currentContext->astArena, n * sizeof(NUM_TYPE)),
+            arenaCalloc(&currentContext->astArena, n * sizeof(char))
+    };
+    TYPE_FRAME scopeFrame = {frame, node, &types, -1};
+
+    // calls can be typed before the lambda they call
+    for (int i = 0; i < n; i++)
+    {
+        AST_LAMBDA *lambda = &scope->bindings[i]->value->data.lambda;
+
+        if (scope->bindings[i]->value->type == LAMBDA_NODE_TYPE && lambda->paramTypes == NULL)
+        {
+            lambda->paramTypes = arenaAlloc(&currentContext->astArena, lambda->nParams * sizeof(NUM_TYPE));
+            for (int j = 0; j < lambda->nParams; j++)
+            {
+                lambda->paramTypes[j] = UNBOUND_TYPE;
+            }
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        if (scope->bindings[i]->value->type == LAMBDA_NODE_TYPE)
+        {
+            inferLambdaNode(scope->bindings[i]->value, &scopeFrame, i);
+        }
+        else
+        {
+            typeBinding(&scopeFrame, i);
+        }
+    }
+
+    return inferNode(scope->child, &scopeFrame);
+}
+
+static NUM_TYPE inferNode(AST_NODE *node, TYPE_FRAME *frame)
+{
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+            return node->data.number.type;
+        case SYM_NODE_TYPE:
+            return inferSymbolNode(node, frame);
+        case FUNC_NODE_TYPE:
+            if (node->data.function.func == CUSTOM_FUNC)
+            {
+                return inferCallNode(node, frame);
+            }
+            return inferBuiltinNode(node, frame);
+        case SCOPE_NODE_TYPE:
+            return inferScopeNode(node, frame);
+        case CONDITIONAL_NODE_TYPE:
+            inferNode(node->data.condition.condition, frame);
+            return joinTypes(inferNode(node->data.condition._true, frame),
+                             inferNode(node->data.condition._false, frame));
+        case LAMBDA_NODE_TYPE:
+            break;
+    }
+
+    return NO_TYPE;
+}
+
+void freeInferScratch(void)
+{
+    free(edges);
+    edges = NULL;
+    edgeLen = edgeCap = 0;
+}
+
+// Picks the kernel of every builtin; see the top of the file. Runs after
+// resolveProgram and cseProgram.
+void inferProgram(AST_NODE *node)
+{
+    TYPE_FRAME top = {NULL, NULL, NULL, -1};
+
+    do
+    {
+        changed = false;
+        inferNode(node, &top);
+    } while (changed);
+}
@@ -0,0 +1,353 @@
+#include "runtime.h"
+#include "vector.h"
+
+VECTOR *newVector(ARENA *arena, NUM_TYPE type, size_t length)
+{
+    VECTOR *vector = arenaAlloc(arena, sizeof(VECTOR) + VECTOR_ALIGN + length * sizeof(double));
+    uintptr_t data = (uintptr_t) (vector + 1);
+
+    vector->type = type;
+    vector->length = length;
+    vector->values = (double *) ((data + VECTOR_ALIGN - 1) & ~(uintptr_t) (VECTOR_ALIGN - 1));
+
+    return vector;
+}
+
+static inline AST_NUMBER vectorValue(VECTOR *vector)
+{
+    return (AST_NUMBER) {VECTOR_TYPE, .vector = vector};
+}
+
+// The type of the elements of a, a scalar being its only element.
+static inline NUM_TYPE elementType(AST_NUMBER a)
+{
+    return a.type == VECTOR_TYPE ? a.vector->type : a.type;
+}
+
+static AST_NUMBER element(AST_NUMBER a, size_t i)
+{
+    if (a.type != VECTOR_TYPE)
+    {
+        return a;
+    }
+
+    if (a.vector->type == INT_TYPE)
+    {
+        return (AST_NUMBER) {INT_TYPE, .ival = a.vector->ivals[i]};
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = a.vector->values[i]};
+}
+
+// The length of the shorter vector of the two.
+static size_t mapLength(AST_NUMBER a, AST_NUMBER b)
+{
+    if (a.type != VECTOR_TYPE)
+    {
+        return b.vector->length;
+    }
+
+    if (b.type != VECTOR_TYPE || a.vector->length < b.vector->length)
+    {
+        return a.vector->length;
+    }
+
+    return b.vector->length;
+}
+
+// The first n elements of a as doubles with a step of 1, or a scalar a as one
+// double in *scalar with a step of 0.
+static const double *doublesOf(AST_NUMBER a, size_t n, double *scalar, size_t *step)
+{
+    VECTOR *converted;
+
+    if (a.type != VECTOR_TYPE)
+    {
+        *scalar = toDouble(a);
+        *step = 0;
+        return scalar;
+    }
+
+    *step = 1;
+    if (a.vector->type == DOUBLE_TYPE)
+    {
+        return a.vector->values;
+    }
+
+    converted = newVector(&value_arena, DOUBLE_TYPE, n);
+    for (size_t i = 0; i < n; i++)
+    {
+        converted->values[i] = (double) a.vector->ivals[i];
+    }
+
+    return converted->values;
+}
+
+static const int64_t *intsOf(AST_NUMBER a, int64_t *scalar, size_t *step)
+{
+    if (a.type != VECTOR_TYPE)
+    {
+        *scalar = a.ival;
+        *step = 0;
+        return scalar;
+    }
+
+    *step = 1;
+    return a.vector->ivals;
+}
+
+static bool allNonNegative(AST_NUMBER a, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (element(a, i).ival < 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// exp2, max and min of elements that give ints for some and doubles for others,
+// through the scalar builtin and then to doubles.
+static AST_NUMBER mapMixed(MAP_OP op, AST_NUMBER a, AST_NUMBER b, size_t n)
+{
+    VECTOR *result = newVector(&value_arena, DOUBLE_TYPE, n);
+    AST_NUMBER val;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        switch (op)
+        {
+            case MAP_EXP2:
+                val = numberExp2(element(a, i));
+                break;
+            case MAP_MAX:
+                val = numberMax(element(a, i), element(b, i));
+                break;
+            default:
+                val = numberMin(element(a, i), element(b, i));
+                break;
+        }
+        result->values[i] = toDouble(val);
+    }
+
+    return vectorValue(result);
+}
+
+AST_NUMBER vectorMap(MAP_OP op, AST_NUMBER a, AST_NUMBER b)
+{
+    size_t n = mapLength(a, b);
+    NUM_TYPE aType = elementType(a);
+    bool ints = aType == INT_TYPE && elementType(b) == INT_TYPE;
+    bool unary = op <= MAP_CBRT;
+    VECTOR *result;
+
+    switch (op)
+    {
+        case MAP_EXP:
+        case MAP_LOG:
+        case MAP_SQRT:
+        case MAP_CBRT:
+        case MAP_ADD_SQUARE:
+            ints = false;
+            break;
+        case MAP_EXP2:
+            if (ints && !allNonNegative(a, n))
+            {
+                return mapMixed(op, a, b, n);
+            }
+            break;
+        case MAP_MAX:
+        case MAP_MIN:
+            if (!ints && (aType == INT_TYPE || elementType(b) == INT_TYPE))
+            {
+                return mapMixed(op, a, b, n);
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (ints)
+    {
+        int64_t aScalar, bScalar;
+        size_t aStep, bStep;
+        const int64_t *x = intsOf(a, &aScalar, &aStep);
+        const int64_t *y = unary ? x : intsOf(b, &bScalar, &bStep);
+
+        result = newVector(&value_arena, INT_TYPE, n);
+        mapInts(op, x, aStep, y, unary ? aStep : bStep, result->ivals, n);
+        return vectorValue(result);
+    }
+
+    double aScalar, bScalar;
+    size_t aStep, bStep;
+    const double *x = doublesOf(a, n, &aScalar, &aStep);
+    const double *y = unary ? x : doublesOf(b, n, &bScalar, &bStep);
+
+    result = newVector(&value_arena, DOUBLE_TYPE, n);
+    mapDoubles(op, x, aStep, y, unary ? aStep : bStep, result->values, n);
+
+    if ((op == MAP_EQUAL || op == MAP_LESS || op == MAP_GREATER) && aType == INT_TYPE)
+    {
+        // compared as doubles, answered in the type of a
+        VECTOR *truth = newVector(&value_arena, INT_TYPE, n);
+        for (size_t i = 0; i < n; i++)
+        {
+            truth->ivals[i] = result->values[i] != 0;
+        }
+        result = truth;
+    }
+
+    return vectorValue(result);
+}
+
+AST_NUMBER vectorReduceValues(REDUCE_OP op, const AST_NUMBER *args, size_t n)
+{
+    size_t length = SIZE_MAX;
+    AST_NUMBER *row = arenaAlloc(&value_arena, n * sizeof(AST_NUMBER));
+    AST_NUMBER *results;
+    bool ints = true;
+    VECTOR *result;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (args[i].type == VECTOR_TYPE && args[i].vector->length < length)
+        {
+            length = args[i].vector->length;
+        }
+    }
+
+    results = arenaAlloc(&value_arena, length * sizeof(AST_NUMBER));
+    for (size_t j = 0; j < length; j++)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            row[i] = element(args[i], j);
+        }
+        results[j] = reduceValues(op, row, n);
+        ints = ints && results[j].type == INT_TYPE;
+    }
+
+    result = newVector(&value_arena, ints ? INT_TYPE : DOUBLE_TYPE, length);
+    for (size_t j = 0; j < length; j++)
+    {
+        if (ints)
+        {
+            result->ivals[j] = results[j].ival;
+        }
+        else
+        {
+            result->values[j] = toDouble(results[j]);
+        }
+    }
+
+    return vectorValue(result);
+}
+
+AST_NUMBER vectorMake(const AST_NUMBER *args, size_t n)
+{
+    size_t length = 0;
+    size_t k = 0;
+    bool ints = true;
+    VECTOR *result;
+    AST_NUMBER val;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        length += args[i].type == VECTOR_TYPE ? args[i].vector->length : 1;
+        ints = ints && elementType(args[i]) == INT_TYPE;
+    }
+
+    result = newVector(&value_arena, ints ? INT_TYPE : DOUBLE_TYPE, length);
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t count = args[i].type == VECTOR_TYPE ? args[i].vector->length : 1;
+
+        for (size_t j = 0; j < count; j++, k++)
+        {
+            val = element(args[i], j);
+            if (ints)
+            {
+                result->ivals[k] = val.ival;
+            }
+            else
+            {
+                result->values[k] = toDouble(val);
+            }
+        }
+    }
+
+    return vectorValue(result);
+}
+
+// The same as add of the elements as operands.
+AST_NUMBER vectorSum(AST_NUMBER a)
+{
+    VECTOR *vector = a.vector;
+
+    if (a.type != VECTOR_TYPE)
+    {
+        return reduceValues(REDUCE_SUM, &a, 1);
+    }
+
+    if (vector->type == INT_TYPE)
+    {
+        return (AST_NUMBER) {INT_TYPE, .ival = vector->length ? reduceInts(REDUCE_SUM, vector->ivals, vector->length) : 0};
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = reduceSum(vector->values, vector->length)};
+}
+
+// The same as the sum of mult of a and b, without storing the products.
+AST_NUMBER vectorDot(AST_NUMBER a, AST_NUMBER b)
+{
+    int64_t val = 0;
+    size_t n;
+
+    if (a.type != VECTOR_TYPE || b.type != VECTOR_TYPE || a.vector->type != b.vector->type)
+    {
+        return vectorSum(numberMult(a, b));
+    }
+
+    n = mapLength(a, b);
+    if (a.vector->type == DOUBLE_TYPE)
+    {
+        return (AST_NUMBER) {DOUBLE_TYPE, .value = reduceDot(a.vector->values, b.vector->values, n)};
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        val = intAdd(val, intMult(a.vector->ivals[i], b.vector->ivals[i]));
+    }
+
+    return (AST_NUMBER) {INT_TYPE, .ival = val};
+}
+
+// The sum divided by the length, as a double; NAN for an empty vector.
+AST_NUMBER vectorMean(AST_NUMBER a)
+{
+    size_t n = a.type == VECTOR_TYPE ? a.vector->length : 1;
+
+    if (n == 0)
+    {
+        return (AST_NUMBER) {DOUBLE_TYPE, .value = NAN};
+    }
+
+    return (AST_NUMBER) {DOUBLE_TYPE, .value = toDouble(vectorSum(a)) / (double) n};
+}
+
+bool vectorIsZero(const VECTOR *vector)
+{
+    for (size_t i = 0; i < vector->length; i++)
+    {
+        if (vector->type == INT_TYPE ? vector->ivals[i] != 0 : vector->values[i] != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef __vector_h_
+#define __vector_h_
+
+#include <stddef.h>
+#include "arena.h"
+#include "number.h"
+#include "reduce.h"
+
+// Elements are aligned for the widest SIMD loads.
+#define VECTOR_ALIGN 32
+
+// length elements of one type, INT_TYPE or DOUBLE_TYPE, stored contiguously.
+// A vector is never changed once built, so any number of values can share it.
+typedef struct vector {
+    NUM_TYPE type;
+    size_t length;
+    union {
+        double *values;
+        int64_t *ivals;
+    };
+} VECTOR;
+
+// An uninitialized vector in arena. Vectors computed while evaluating an
+// expression go in value_arena, which is reset once the expression is printed.
+VECTOR *newVector(ARENA *arena, NUM_TYPE type, size_t length);
+
+// op applied to each element of a and b, at least one of which is a vector; a
+// unary op takes b == a. Elements are ints when the scalar builtin would give an
+// int for every one of them, and doubles otherwise.
+AST_NUMBER vectorMap(MAP_OP op, AST_NUMBER a, AST_NUMBER b);
+
+// reduceValues of n operands, some of them vectors, element by element.
+AST_NUMBER vectorReduceValues(REDUCE_OP op, const AST_NUMBER *args, size_t n);
+
+// The builtins on whole vectors. vector concatenates the elements of vector
+// operands and scalar ones, giving ints if they all are. sum, dot and mean take
+// a scalar as a vector of one element, or as every element when dotted with a vector.
+AST_NUMBER vectorMake(const AST_NUMBER *args, size_t n);
+AST_NUMBER vectorSum(AST_NUMBER a);
+AST_NUMBER vectorDot(AST_NUMBER a, AST_NUMBER b);
+AST_NUMBER vectorMean(AST_NUMBER a);
+
+#endif
@@ -0,0 +1,648 @@
+#include "vm.h"
+#include "reduce.h"
+#include "vector.h"
+#include "sampler.h"
+#include "timeline.h"
+
+// Must be in sync with VM_MESSAGE.
+const char *vmMessages[] = {
+        "Not enough parameters. Returning NAN",
+        "Not enough parameters. Returning 0",
+        "Not enough parameters. Returning 1",
+        "Extra parameters ignored.",
+        ">>> Symbol \"%s\" not found. Returning NAN.",
+        ">>> Function \"%s\" not found. Returning NAN.",
+        ">>> Symbol \"%s\" is not a function. Returning NAN.",
+        ">>> Function \"%s\" used as a value. Returning NAN."
+};
+
+// The registers of a running function, on the value stack.
+// link is the frame of the scope the function was defined in.
+typedef struct frame {
+    RET_VAL *R;
+    struct frame *link;
+} FRAME;
+
+// Where to go back to when a call or a thunk returns.
+typedef struct activation {
+    INSTR *ret;
+    FRAME *frame;
+} ACTIVATION;
+
+struct vm_stacks {
+    // Frame 0 belongs to the top-level expression.
+    FRAME frames[MAX_CALL_DEPTH + 1];
+    // Every call and every running thunk has an activation; a chunk may use
+    // MAX_CALL_DEPTH plus one per thunk, since a thunk can only be active once per
+    // frame. Grown to fit the largest chunk run so far, but the limit is the
+    // chunk's own so that what overflows does not depend on earlier expressions.
+    ACTIVATION *activations;
+    uint32_t activationCap;
+};
+
+VM_STACKS *newVmStacks(void)
+{
+    return calloc(1, sizeof(VM_STACKS));
+}
+
+void freeVmStacks(VM_STACKS *vm)
+{
+    if (vm != NULL)
+    {
+        free(vm->activations);
+        free(vm);
+    }
+}
+
+static void reserve(VM_STACKS *vm, CHUNK *chunk)
+{
+    if (MAX_CALL_DEPTH + chunk->thunkLen > vm->activationCap)
+    {
+        vm->activationCap = MAX_CALL_DEPTH + chunk->thunkLen;
+        if ((vm->activations = realloc(vm->activations, vm->activationCap * sizeof(ACTIVATION))) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+    }
+}
+
+// How many calls deep native code called with the frame at ftop may go: as
+// deep as the frames, activations and registers left would let the bytecode.
+static int64_t nativeDepth(FRAME *frames, FRAME *ftop, ACTIVATION *asp, ACTIVATION *activationEnd,
+                           RET_VAL *sp, RET_VAL *stackEnd, uint32_t nRegs)
+{
+    int64_t depth = frames + MAX_CALL_DEPTH - ftop;
+
+    if (activationEnd - asp - 1 < depth)
+    {
+        depth = activationEnd - asp - 1;
+    }
+    if ((stackEnd - sp) / nRegs < depth)
+    {
+        depth = (stackEnd - sp) / nRegs;
+    }
+
+    return depth;
+}
+
+// Ends the span and pops the frame of a call that --trace or --sample saw start.
+static void endObservedCall(TIMELINE *timeline, SAMPLER *sampler)
+{
+    if (timeline != NULL)
+    {
+        timelineEnd(timeline);
+    }
+    if (sampler != NULL)
+    {
+        samplerPop(sampler);
+    }
+}
+
+// Executes a compiled chunk.
+// With VM_THREADED every instruction jumps straight to the next one's handler;
+// otherwise the same handlers are reached through a switch.
+RET_VAL vmRun(CHUNK *chunk)
+{
+#if VM_THREADED
+    static const void *labels[OP_COUNT] = {
+            [OP_LOADK]        = &&L_OP_LOADK,
+            [OP_MOVE]         = &&L_OP_MOVE,
+            [OP_UNBIND]       = &&L_OP_UNBIND,
+            [OP_LOADSYM]      = &&L_OP_LOADSYM,
+            [OP_BIND]         = &&L_OP_BIND,
+            [OP_UNDEF]        = &&L_OP_UNDEF,
+            [OP_WARN]         = &&L_OP_WARN,
+            [OP_JUMP]         = &&L_OP_JUMP,
+            [OP_JUMPF]        = &&L_OP_JUMPF,
+            [OP_CALL]         = &&L_OP_CALL,
+            [OP_TAILCALL]     = &&L_OP_TAILCALL,
+            [OP_RET]          = &&L_OP_RET,
+            [OP_NEG]          = &&L_OP_NEG,
+            [OP_ABS]          = &&L_OP_ABS,
+            [OP_ADD]          = &&L_OP_ADD,
+            [OP_SUB]          = &&L_OP_SUB,
+            [OP_MULT]         = &&L_OP_MULT,
+            [OP_DIV]          = &&L_OP_DIV,
+            [OP_REM]          = &&L_OP_REM,
+            [OP_EXP]          = &&L_OP_EXP,
+            [OP_EXP2]         = &&L_OP_EXP2,
+            [OP_POW]          = &&L_OP_POW,
+            [OP_LOG]          = &&L_OP_LOG,
+            [OP_SQRT]         = &&L_OP_SQRT,
+            [OP_CBRT]         = &&L_OP_CBRT,
+            [OP_HYPOT]        = &&L_OP_HYPOT,
+            [OP_MAX]          = &&L_OP_MAX,
+            [OP_MIN]          = &&L_OP_MIN,
+            [OP_EQUAL]        = &&L_OP_EQUAL,
+            [OP_LESS]         = &&L_OP_LESS,
+            [OP_GREATER]      = &&L_OP_GREATER,
+            [OP_RAND]         = &&L_OP_RAND,
+            [OP_READ]         = &&L_OP_READ,
+            [OP_PRINT]        = &&L_OP_PRINT,
+            [OP_VECTOR]       = &&L_OP_VECTOR,
+            [OP_SUM]          = &&L_OP_SUM,
+            [OP_DOT]          = &&L_OP_DOT,
+            [OP_MEAN]         = &&L_OP_MEAN,
+            [OP_ABS_INT]      = &&L_OP_ABS_INT,
+            [OP_ABS_DOUBLE]   = &&L_OP_ABS_DOUBLE,
+            [OP_ADD_INT]      = &&L_OP_ADD_INT,
+            [OP_ADD_DOUBLE]   = &&L_OP_ADD_DOUBLE,
+            [OP_SUB_INT]      = &&L_OP_SUB_INT,
+            [OP_SUB_DOUBLE]   = &&L_OP_SUB_DOUBLE,
+            [OP_MULT_INT]     = &&L_OP_MULT_INT,
+            [OP_MULT_DOUBLE]  = &&L_OP_MULT_DOUBLE,
+            [OP_DIV_INT]      = &&L_OP_DIV_INT,
+            [OP_DIV_DOUBLE]   = &&L_OP_DIV_DOUBLE,
+            [OP_REM_INT]      = &&L_OP_REM_INT,
+            [OP_REM_DOUBLE]   = &&L_OP_REM_DOUBLE,
+            [OP_POW_INT]      = &&L_OP_POW_INT,
+            [OP_POW_DOUBLE]   = &&L_OP_POW_DOUBLE,
+            [OP_MAX_INT]      = &&L_OP_MAX_INT,
+            [OP_MAX_DOUBLE]   = &&L_OP_MAX_DOUBLE,
+            [OP_MIN_INT]      = &&L_OP_MIN_INT,
+            [OP_MIN_DOUBLE]   = &&L_OP_MIN_DOUBLE
+    };
+#define DISPATCH() goto *pc->handler
+#else
+#define DISPATCH() goto dispatch
+#endif
+#define NEXT() { pc++; DISPATCH(); }
+
+    RET_VAL *R;
+    RET_VAL *sp;
+    RET_VAL *slot;
+    INSTR *code;
+    INSTR *pc;
+    FRAME *fp;
+    FRAME *ftop;
+    FRAME *frame;
+    ACTIVATION *asp;
+    ACTIVATION *activationEnd;
+    FUNCTION *function;
+    RET_VAL *stackEnd = value_stack + VALUE_STACK_SIZE;
+    RET_VAL val;
+    VM_STACKS *vm = currentContext->vm;
+    TIMELINE *timeline = currentTimeline;
+    SAMPLER *sampler = currentSampler;
+    bool observed = timeline != NULL || sampler != NULL;
+    FRAME *frames = vm->frames;
+    ACTIVATION *activations;
+
+    reserve(vm, chunk);
+    activations = vm->activations;
+
+    R = value_stack_top;
+    sp = R + chunk->functions[0].nRegs;
+    if (sp > stackEnd)
+    {
+        return stackOverflowValue();
+    }
+    fp = frames;
+    *fp = (FRAME) {R, NULL};
+    ftop = fp + 1;
+    asp = activations;
+    activationEnd = activations + MAX_CALL_DEPTH + chunk->thunkLen;
+    code = chunk->code;
+    pc = code;
+
+#if VM_THREADED
+    if (!chunk->linked || chunk->observed != observed)
+    {
+        for (uint32_t i = 0; i < chunk->codeLen; i++)
+        {
+            code[i].handler = labels[code[i].op];
+            if (observed && code[i].op == OP_CALL)
+            {
+                code[i].handler = &&L_OBSERVED_CALL;
+            }
+            else if (observed && code[i].op == OP_RET)
+            {
+                code[i].handler = &&L_OBSERVED_RET;
+            }
+        }
+        chunk->linked = true;
+        chunk->observed = observed;
+    }
+#else
+dispatch:
+    switch (pc->op)
+    {
+        case OP_LOADK: goto L_OP_LOADK;
+        case OP_MOVE: goto L_OP_MOVE;
+        case OP_UNBIND: goto L_OP_UNBIND;
+        case OP_LOADSYM: goto L_OP_LOADSYM;
+        case OP_BIND: goto L_OP_BIND;
+        case OP_UNDEF: goto L_OP_UNDEF;
+        case OP_WARN: goto L_OP_WARN;
+        case OP_JUMP: goto L_OP_JUMP;
+        case OP_JUMPF: goto L_OP_JUMPF;
+        case OP_CALL: if (observed) goto L_OBSERVED_CALL; goto L_OP_CALL;
+        case OP_TAILCALL: goto L_OP_TAILCALL;
+        case OP_RET: if (observed) goto L_OBSERVED_RET; goto L_OP_RET;
+        case OP_NEG: goto L_OP_NEG;
+        case OP_ABS: goto L_OP_ABS;
+        case OP_ADD: goto L_OP_ADD;
+        case OP_SUB: goto L_OP_SUB;
+        case OP_MULT: goto L_OP_MULT;
+        case OP_DIV: goto L_OP_DIV;
+        case OP_REM: goto L_OP_REM;
+        case OP_EXP: goto L_OP_EXP;
+        case OP_EXP2: goto L_OP_EXP2;
+        case OP_POW: goto L_OP_POW;
+        case OP_LOG: goto L_OP_LOG;
+        case OP_SQRT: goto L_OP_SQRT;
+        case OP_CBRT: goto L_OP_CBRT;
+        case OP_HYPOT: goto L_OP_HYPOT;
+        case OP_MAX: goto L_OP_MAX;
+        case OP_MIN: goto L_OP_MIN;
+        case OP_EQUAL: goto L_OP_EQUAL;
+        case OP_LESS: goto L_OP_LESS;
+        case OP_GREATER: goto L_OP_GREATER;
+        case OP_RAND: goto L_OP_RAND;
+        case OP_READ: goto L_OP_READ;
+        case OP_PRINT: goto L_OP_PRINT;
+        case OP_VECTOR: goto L_OP_VECTOR;
+        case OP_SUM: goto L_OP_SUM;
+        case OP_DOT: goto L_OP_DOT;
+        case OP_MEAN: goto L_OP_MEAN;
+        case OP_ABS_INT: goto L_OP_ABS_INT;
+        case OP_ABS_DOUBLE: goto L_OP_ABS_DOUBLE;
+        case OP_ADD_INT: goto L_OP_ADD_INT;
+        case OP_ADD_DOUBLE: goto L_OP_ADD_DOUBLE;
+        case OP_SUB_INT: goto L_OP_SUB_INT;
+        case OP_SUB_DOUBLE: goto L_OP_SUB_DOUBLE;
+        case OP_MULT_INT: goto L_OP_MULT_INT;
+        case OP_MULT_DOUBLE: goto L_OP_MULT_DOUBLE;
+        case OP_DIV_INT: goto L_OP_DIV_INT;
+        case OP_DIV_DOUBLE: goto L_OP_DIV_DOUBLE;
+        case OP_REM_INT: goto L_OP_REM_INT;
+        case OP_REM_DOUBLE: goto L_OP_REM_DOUBLE;
+        case OP_POW_INT: goto L_OP_POW_INT;
+        case OP_POW_DOUBLE: goto L_OP_POW_DOUBLE;
+        case OP_MAX_INT: goto L_OP_MAX_INT;
+        case OP_MAX_DOUBLE: goto L_OP_MAX_DOUBLE;
+        case OP_MIN_INT: goto L_OP_MIN_INT;
+        case OP_MIN_DOUBLE: goto L_OP_MIN_DOUBLE;
+        default:
+            yyerror("Invalid opcode %d!", pc->op);
+    }
+#endif
+
+    DISPATCH();
+
+L_OP_LOADK:
+    R[pc->a] = chunk->constants[pc->b];
+    NEXT();
+
+L_OP_MOVE:
+    R[pc->a] = R[pc->b];
+    NEXT();
+
+L_OP_UNBIND:
+    for (uint32_t i = 0; i < pc->c; i++)
+    {
+        R[pc->a + i].type = UNBOUND_TYPE;
+    }
+    NEXT();
+
+L_OP_LOADSYM:
+    frame = fp;
+    for (uint32_t hops = pc->d; hops > 0; hops--)
+    {
+        frame = frame->link;
+    }
+    slot = frame->R + pc->b;
+    if (slot->type == UNBOUND_TYPE)
+    {
+        if (asp == activationEnd)
+        {
+            R[pc->a] = stackOverflowValue();
+            NEXT();
+        }
+        // run the thunk in the frame of its scope; it returns to this instruction
+        // once the slot is bound
+        slot->type = PENDING_TYPE;
+        *asp++ = (ACTIVATION) {pc, fp};
+        fp = frame;
+        R = fp->R;
+        pc = code + chunk->thunks[pc->c].pc;
+        DISPATCH();
+    }
+    if (slot->type == PENDING_TYPE)
+    {
+        warning(">>> Symbol \"%s\" is defined in terms of itself. Returning NAN.", chunk->thunks[pc->c].name);
+        R[pc->a] = NAN_RET_VAL;
+        NEXT();
+    }
+    R[pc->a] = *slot;
+    NEXT();
+
+L_OP_BIND:
+    R[pc->a] = castBindingValue(R[pc->b], pc->c);
+    fp = (--asp)->frame;
+    R = fp->R;
+    pc = asp->ret;
+    DISPATCH();
+
+L_OP_UNDEF:
+    warning((char *) vmMessages[pc->c], chunk->names[pc->b]);
+    R[pc->a] = NAN_RET_VAL;
+    NEXT();
+
+L_OP_WARN:
+    warning("%s", vmMessages[pc->b]);
+    NEXT();
+
+L_OP_JUMP:
+    pc = code + pc->b;
+    DISPATCH();
+
+L_OP_JUMPF:
+    if (isZero(R[pc->a]))
+    {
+        pc = code + pc->b;
+        DISPATCH();
+    }
+    NEXT();
+
+L_OP_CALL:
+    function = &chunk->functions[pc->c];
+    if (ftop == frames + MAX_CALL_DEPTH + 1 || asp == activationEnd || sp + function->nRegs > stackEnd)
+    {
+        if (observed)
+        {
+            endObservedCall(timeline, sampler);
+        }
+        R[pc->a] = stackOverflowValue();
+        NEXT();
+    }
+    if (function->countdown > 0 && --function->countdown == 0)
+    {
+        function->native = jitCompile(function->symbol, function->type);
+    }
+    if (function->native != NULL
+        && jitCall(function->native, R + pc->b, function->nParams,
+                   nativeDepth(frames, ftop, asp, activationEnd, sp + function->nRegs, stackEnd, function->nRegs), &val))
+    {
+        if (observed)
+        {
+            endObservedCall(timeline, sampler);
+        }
+        R[pc->a] = castReturnValue(val, function->type);
+        NEXT();
+    }
+    frame = fp;
+    for (uint32_t hops = pc->d; hops > 0; hops--)
+    {
+        frame = frame->link;
+    }
+    memcpy(sp, R + pc->b, function->nParams * sizeof(RET_VAL));
+    *asp++ = (ACTIVATION) {pc, fp};
+    *ftop = (FRAME) {sp, frame};
+    fp = ftop++;
+    R = sp;
+    sp += function->nRegs;
+    pc = code + function->pc;
+    DISPATCH();
+
+L_OP_TAILCALL:
+    // only emitted in a lambda body, whose frame is the topmost one, for callees
+    // defined outside of it; the return goes to the call that created the frame
+    function = &chunk->functions[pc->c];
+    if (R + function->nRegs > stackEnd)
+    {
+        R[pc->a] = stackOverflowValue();
+        NEXT();
+    }
+    frame = fp;
+    for (uint32_t hops = pc->d; hops > 0; hops--)
+    {
+        frame = frame->link;
+    }
+    memmove(R, R + pc->b, function->nParams * sizeof(RET_VAL));
+    fp->link = frame;
+    sp = R + function->nRegs;
+    pc = code + function->pc;
+    DISPATCH();
+
+L_OP_RET:
+    if (asp == activations)
+    {
+        return R[pc->a];
+    }
+    // the returning frame is always the topmost one
+    val = R[pc->a];
+    sp = fp->R;
+    ftop = fp;
+    fp = (--asp)->frame;
+    R = fp->R;
+    pc = asp->ret;
+    R[pc->a] = castReturnValue(val, chunk->functions[pc->c].type);
+    NEXT();
+
+    // With --trace or --sample, OP_CALL and OP_RET go through these first, so that
+    // without them calls cost no more. The call site is not kept; the lambda tells
+    // which it is. A tail call counts toward the call that made its frame.
+L_OBSERVED_CALL:
+    function = &chunk->functions[pc->c];
+    if (timeline != NULL)
+    {
+        timelineCall(timeline, function->symbol->id->name, NULL, function->symbol->value);
+    }
+    if (sampler != NULL)
+    {
+        samplerCheck(sampler);
+        samplerPush(sampler, function->symbol->value);
+    }
+    goto L_OP_CALL;
+
+L_OBSERVED_RET:
+    if (asp != activations)
+    {
+        endObservedCall(timeline, sampler);
+    }
+    goto L_OP_RET;
+
+    // The builtins below compute exactly what the matching evalXxxFunc helpers in
+    // cilisp.c do, so the two evaluation modes can be diffed against each other.
+
+L_OP_NEG:
+    R[pc->a] = numberNeg(R[pc->b]);
+    NEXT();
+
+L_OP_ABS:
+    R[pc->a] = numberAbs(R[pc->b]);
+    NEXT();
+
+L_OP_ADD:
+    R[pc->a] = reduceValues(REDUCE_SUM, R + pc->b, pc->c);
+    NEXT();
+
+L_OP_SUB:
+    R[pc->a] = numberSub(R[pc->b], R[pc->b + 1]);
+    NEXT();
+
+L_OP_MULT:
+    R[pc->a] = reduceValues(REDUCE_PRODUCT, R + pc->b, pc->c);
+    NEXT();
+
+L_OP_DIV:
+    R[pc->a] = numberDiv(R[pc->b], R[pc->b + 1]);
+    NEXT();
+
+L_OP_REM:
+    R[pc->a] = numberRem(R[pc->b], R[pc->b + 1]);
+    NEXT();
+
+L_OP_EXP:
+    R[pc->a] = numberExp(R[pc->b]);
+    NEXT();
+
+L_OP_EXP2:
+    R[pc->a] = numberExp2(R[pc->b]);
+    NEXT();
+
+L_OP_POW:
+    R[pc->a] = numberPow(R[pc->b], R[pc->b + 1]);
+    NEXT();
+
+L_OP_LOG:
+    R[pc->a] = numberLog(R[pc->b]);
+    NEXT();
+
+L_OP_SQRT:
+    R[pc->a] = numberSqrt(R[pc->b]);
+    NEXT();
+
+L_OP_CBRT:
+    R[pc->a] = numberCbrt(R[pc->b]);
+    NEXT();
+
+L_OP_HYPOT:
+    R[pc->a] = numberSqrt(reduceValues(REDUCE_SQUARES, R + pc->b, pc->c));
+    NEXT();
+
+L_OP_MAX:
+    R[pc->a] = reduceValues(REDUCE_MAX, R + pc->b, pc->c);
+    NEXT();
+
+L_OP_MIN:
+    R[pc->a] = reduceValues(REDUCE_MIN, R + pc->b, pc->c);
+    NEXT();
+
+L_OP_EQUAL:
+    R[pc->a] = compareEqual(R[pc->b], R[pc->b + 1]);
+    NEXT();
+
+L_OP_LESS:
+    R[pc->a] = compareLess(R[pc->b], R[pc->b + 1]);
+    NEXT();
+
+L_OP_GREATER:
+    R[pc->a] = compareGreater(R[pc->b], R[pc->b + 1]);
+    NEXT();
+
+L_OP_RAND:
+    R[pc->a] = evalRandFunc();
+    NEXT();
+
+L_OP_READ:
+    R[pc->a] = evalReadFunc();
+    NEXT();
+
+L_OP_PRINT:
+    printRetVal(R[pc->b]);
+    R[pc->a] = R[pc->b];
+    NEXT();
+
+L_OP_VECTOR:
+    R[pc->a] = vectorMake(R + pc->b, pc->c);
+    NEXT();
+
+L_OP_SUM:
+    R[pc->a] = vectorSum(R[pc->b]);
+    NEXT();
+
+L_OP_DOT:
+    R[pc->a] = vectorDot(R[pc->b], R[pc->b + 1]);
+    NEXT();
+
+L_OP_MEAN:
+    R[pc->a] = vectorMean(R[pc->b]);
+    NEXT();
+
+L_OP_ABS_INT:
+    R[pc->a] = (RET_VAL) {INT_TYPE, .ival = intAbs(R[pc->b].ival)};
+    NEXT();
+
+L_OP_ABS_DOUBLE:
+    R[pc->a] = (RET_VAL) {DOUBLE_TYPE, .value = fabs(R[pc->b].value)};
+    NEXT();
+
+L_OP_ADD_INT:
+    R[pc->a] = (RET_VAL) {INT_TYPE, .ival = reduceIntValues(REDUCE_SUM, R + pc->b, pc->c)};
+    NEXT();
+
+L_OP_ADD_DOUBLE:
+    R[pc->a] = (RET_VAL) {DOUBLE_TYPE, .value = reduceDoubleValues(REDUCE_SUM, R + pc->b, pc->c)};
+    NEXT();
+
+L_OP_SUB_INT:
+    R[pc->a] = (RET_VAL) {INT_TYPE, .ival = intSub(R[pc->b].ival, R[pc->b + 1].ival)};
+    NEXT();
+
+L_OP_SUB_DOUBLE:
+    R[pc->a] = (RET_VAL) {DOUBLE_TYPE, .value = R[pc->b].value - R[pc->b + 1].value};
+    NEXT();
+
+L_OP_MULT_INT:
+    R[pc->a] = (RET_VAL) {INT_TYPE, .ival = reduceIntValues(REDUCE_PRODUCT, R + pc->b, pc->c)};
+    NEXT();
+
+L_OP_MULT_DOUBLE:
+    R[pc->a] = (RET_VAL) {DOUBLE_TYPE, .value = reduceDoubleValues(REDUCE_PRODUCT, R + pc->b, pc->c)};
+    NEXT();
+
+L_OP_DIV_INT:
+    R[pc->a] = (RET_VAL) {INT_TYPE, .ival = intDiv(R[pc->b].ival, R[pc->b + 1].ival)};
+    NEXT();
+
+L_OP_DIV_DOUBLE:
+    R[pc->a] = (RET_VAL) {DOUBLE_TYPE, .value = R[pc->b].value / R[pc->b + 1].value};
+    NEXT();
+
+L_OP_REM_INT:
+    R[pc->a] = (RET_VAL) {INT_TYPE, .ival = intRem(R[pc->b].ival, R[pc->b + 1].ival)};
+    NEXT();
+
+L_OP_REM_DOUBLE:
+    R[pc->a] = (RET_VAL) {DOUBLE_TYPE, .value = doubleRem(R[pc->b].value, R[pc->b + 1].value)};
+    NEXT();
+
+L_OP_POW_INT:
+    R[pc->a] = (RET_VAL) {INT_TYPE, .ival = intPow(R[pc->b].ival, R[pc->b + 1].ival)};
+    NEXT();
+
+L_OP_POW_DOUBLE:
+    R[pc->a] = (RET_VAL) {DOUBLE_TYPE, .value = pow(R[pc->b].value, R[pc->b + 1].value)};
+    NEXT();
+
+L_OP_MAX_INT:
+    R[pc->a] = (RET_VAL) {INT_TYPE, .ival = reduceIntValues(REDUCE_MAX, R + pc->b, pc->c)};
+    NEXT();
+
+L_OP_MAX_DOUBLE:
+    R[pc->a] = (RET_VAL) {DOUBLE_TYPE, .value = reduceDoubleValues(REDUCE_MAX, R + pc->b, pc->c)};
+    NEXT();
+
+L_OP_MIN_INT:
+    R[pc->a] = (RET_VAL) {INT_TYPE, .ival = reduceIntValues(REDUCE_MIN, R + pc->b, pc->c)};
+    NEXT();
+
+L_OP_MIN_DOUBLE:
+    R[pc->a] = (RET_VAL) {DOUBLE_TYPE, .value = reduceDoubleValues(REDUCE_MIN, R + pc->b, pc->c)};
+    NEXT();
+
+#undef NEXT
+#undef DISPATCH
+}
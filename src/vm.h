@@ -0,0 +1,170 @@
+#ifndef __vm_h_
+#define __vm_h_
+
+#include <stdint.h>
+#include "cilisp.h"
+#include "jit.h"
+
+// Direct-threaded dispatch needs GCC's labels-as-values extension.
+#if defined(__GNUC__) && !defined(VM_NO_THREADING)
+#define VM_THREADED 1
+#else
+#define VM_THREADED 0
+#endif
+
+typedef enum opcode {
+    OP_LOADK,       // R[a] = K[b]
+    OP_MOVE,        // R[a] = R[b]
+    OP_UNBIND,      // R[a] .. R[a + c - 1] = unbound let slots
+    OP_LOADSYM,     // R[a] = slot R[b] of the frame d links out, running thunk c first if it is unbound
+    OP_BIND,        // slot R[a] = R[b] cast to type c, return from thunk
+    OP_UNDEF,       // warning(vmMessages[c], NAMES[b]), R[a] = NAN
+    OP_WARN,        // warning(vmMessages[b])
+    OP_JUMP,        // pc = b
+    OP_JUMPF,       // if R[a] == 0 then pc = b
+    OP_CALL,        // R[a] = FUNCTIONS[c](R[b] ..), defined in the frame d links out
+    OP_TAILCALL,    // like OP_CALL, but the callee's frame replaces the current one
+    OP_RET,         // return R[a] from a call, or from the chunk
+
+    // builtins: R[a] = f(R[b] .. R[b + c - 1])
+    OP_NEG,
+    OP_ABS,
+    OP_ADD,
+    OP_SUB,
+    OP_MULT,
+    OP_DIV,
+    OP_REM,
+    OP_EXP,
+    OP_EXP2,
+    OP_POW,
+    OP_LOG,
+    OP_SQRT,
+    OP_CBRT,
+    OP_HYPOT,
+    OP_MAX,
+    OP_MIN,
+    OP_EQUAL,
+    OP_LESS,
+    OP_GREATER,
+    OP_RAND,
+    OP_READ,
+    OP_PRINT,
+    OP_VECTOR,
+    OP_SUM,
+    OP_DOT,
+    OP_MEAN,
+
+    // builtins whose operands are known to be all ints or all doubles (see KERNEL):
+    // same as above, with the result type fixed
+    OP_ABS_INT,
+    OP_ABS_DOUBLE,
+    OP_ADD_INT,
+    OP_ADD_DOUBLE,
+    OP_SUB_INT,
+    OP_SUB_DOUBLE,
+    OP_MULT_INT,
+    OP_MULT_DOUBLE,
+    OP_DIV_INT,
+    OP_DIV_DOUBLE,
+    OP_REM_INT,
+    OP_REM_DOUBLE,
+    OP_POW_INT,
+    OP_POW_DOUBLE,
+    OP_MAX_INT,
+    OP_MAX_DOUBLE,
+    OP_MIN_INT,
+    OP_MIN_DOUBLE,
+
+    OP_COUNT
+} OPCODE;
+
+typedef enum vm_message {
+    MSG_NOT_ENOUGH_NAN,
+    MSG_NOT_ENOUGH_ZERO,
+    MSG_NOT_ENOUGH_ONE,
+    MSG_EXTRA_PARAMS,
+    MSG_SYMBOL_NOT_FOUND,
+    MSG_FUNCTION_NOT_FOUND,
+    MSG_NOT_A_FUNCTION,
+    MSG_FUNCTION_AS_VALUE
+} VM_MESSAGE;
+
+// The format of the warning of each VM_MESSAGE.
+extern const char *vmMessages[];
+
+typedef struct instr {
+    const void *handler;    // label of the op's implementation, filled in on first run
+    uint32_t op : 8;
+    uint32_t a : 24;
+    uint32_t b;
+    uint32_t c;
+    uint32_t d;
+} INSTR;
+
+typedef struct thunk {
+    uint32_t pc;
+    char *name;
+} THUNK;
+
+// A lambda, or the top-level expression as FUNCTIONS[0].
+// Each call gets a frame of nRegs registers on the value stack, the first
+// nParams of which hold its arguments.
+// countdown is the number of calls left before the JIT tries to compile the
+// lambda bound to symbol into native, 0 once it has tried or without --jit.
+typedef struct function {
+    uint32_t pc;
+    uint32_t nRegs;
+    uint32_t nParams;
+    NUM_TYPE type;
+    SYMBOL_TABLE_NODE *symbol;
+    uint32_t countdown;
+    JIT_CODE native;
+} FUNCTION;
+
+// A compiled top-level expression.
+// Let-binding values are compiled into thunks placed after the main code;
+// they run the first time their slot is loaded, like evalSymbolNode does.
+// Lambda bodies are compiled there too, one function per lambda binding.
+typedef struct chunk {
+    INSTR *code;
+    uint32_t codeLen;
+    uint32_t codeCap;
+
+    RET_VAL *constants;
+    uint32_t constLen;
+    uint32_t constCap;
+
+    char **names;
+    uint32_t nameLen;
+    uint32_t nameCap;
+
+    THUNK *thunks;
+    uint32_t thunkLen;
+    uint32_t thunkCap;
+
+    FUNCTION *functions;
+    uint32_t functionLen;
+    uint32_t functionCap;
+
+    bool linked;
+    bool observed; // linked for --trace or --sample, see vmRun
+} CHUNK;
+
+CHUNK *compileProgram(AST_NODE *node);
+// Frees the chunk compileProgram reuses on the calling thread, which the next
+// call allocates again.
+void freeCompilerScratch(void);
+RET_VAL vmRun(CHUNK *chunk);
+
+// The call frames and activations vmRun runs a chunk on, one set per interpreter.
+typedef struct vm_stacks VM_STACKS;
+VM_STACKS *newVmStacks(void);
+void freeVmStacks(VM_STACKS *vm);
+
+// --emit-c: translates each compiled chunk into a C function that runs it like
+// vmRun, and the whole input into a program printing what cilisp prints for it,
+// written to path ("-" for stdout) at exit, printing doubles as doubles says. See emit.c.
+void startEmit(const char *path, DOUBLE_FORMAT doubles);
+void emitChunk(CHUNK *chunk);
+
+#endif
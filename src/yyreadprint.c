@@ -81,7 +81,8 @@ void yyprintline(char *line, size_t len, size_t n_extra_terminates)
     if (lastChar == EOF)
     {
         line[lastIndex] = '\0';
-        if (lastIndex == 0) printf("%sEOF\n", line);
+        // as main echoes the end of the input at the start of a line
+        if (lastIndex == 0 || line[lastIndex - 1] == '\n') printf("%sEOF\n", line);
         else printf("%s\n", line);
         line[lastIndex] = EOF;
     }
@@ -0,0 +1,260 @@
+// Runs the same lines on N interpreters at once, one per thread, with different
+// evaluation options, and checks that each one prints exactly what a single
+// interpreter printed for them beforehand, and returns the same statuses. Some
+// of them get the lines through cilispPush, spread over several lines and cut
+// into pieces of a few bytes, and some print JSON lines, which are checked
+// against those of another interpreter.
+// usage: cilisp_context_test [threads [rounds]]
+
+#include <pthread.h>
+#include "cilisp.h"
+#include "sampler.h"
+#include "timeline.h"
+
+// Every line is evaluated in turn, ROUNDS times over, so that rand and read
+// carry on from one round to the next.
+static const char *lines[] = {
+        "(add 1 2.5)",
+        "(rand)",
+        "((let (x (rand)) (y (mult x 2))) (sub y x))",
+        "((let (int gcd lambda (x y) (cond (equal y 0) x (gcd y (remainder x y))))) (gcd 1071 462))",
+        "((let (fib lambda (n) (cond (less n 2) n (add (fib (sub n 1)) (fib (sub n 2)))))) (fib 15))",
+        "((let (f lambda (x) (add x (print (mult x 3))))) (f (read)))",
+        "((let (v [1 2 3]) (w (vector 4 5 6))) (dot v (add v (read))))",
+        "((let (deep lambda (n) (cond (less n 1) 0.0 (add 1 (deep (sub n 1)))))) (deep 5000))",
+        "(add 1 (sub) undefined)",
+        "((let (int x 2.5)) (hypot x 4))",
+        "(add 1 2",
+        "((let (roots lambda (i acc) (cond (less i 0.5) acc (roots (sub i 1) (add acc (sqrt i)))))) (roots 300.0 0.0))",
+        "(max (rand) (rand) (rand))",
+        "quit"
+};
+
+#define LINE_COUNT (sizeof(lines) / sizeof(lines[0]))
+#define SYNTAX_ERROR_LINE 10
+#define READ_VALUES "7\n2.5\n-3\n"
+// what the first line prints with --output=jsonl
+#define FIRST_JSON_LINE "{\"expression\":0,\"printed\":false,\"type\":\"double\",\"value\":3.5}\n"
+
+typedef struct run {
+    pthread_t thread;
+    CILISP_OPTIONS options;
+    int rounds;
+    FILE *out;
+    CILISP_STATUS *statuses;
+    bool created;
+    bool push;
+    bool traced; // writes every span, every builtin included, to /dev/null
+    bool sampled; // samples at the highest rate, and writes nothing
+} RUN;
+
+#define PIECE_SIZE 3
+
+// Pushes line with a newline between its tokens and after it, PIECE_SIZE bytes
+// at a time, and returns the first status other than CILISP_OK.
+static CILISP_STATUS pushLine(CILISP_CTX *ctx, const char *line)
+{
+    size_t len = strlen(line);
+    char text[256];
+    CILISP_STATUS status = CILISP_OK;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        text[i] = line[i] == ' ' ? '\n' : line[i];
+    }
+    text[len++] = '\n';
+
+    for (size_t i = 0; i < len && status == CILISP_OK; i += PIECE_SIZE)
+    {
+        status = cilispPush(ctx, text + i, len - i < PIECE_SIZE ? len - i : PIECE_SIZE);
+    }
+
+    return status;
+}
+
+// Evaluates the lines, reading from a file of READ_VALUES repeated rounds times.
+static void *runLines(void *arg)
+{
+    RUN *run = arg;
+    FILE *readTarget = tmpfile();
+    CILISP_CTX *ctx;
+
+    if (readTarget == NULL)
+    {
+        return NULL;
+    }
+    for (int i = 0; i < run->rounds; i++)
+    {
+        fputs(READ_VALUES, readTarget);
+    }
+    rewind(readTarget);
+
+    if ((ctx = cilispCreate(&run->options, run->out, readTarget)) != NULL)
+    {
+        run->created = true;
+        if (ctx->runtime.messages != NULL)
+        {
+            // the messages go apart, and are not compared
+            ctx->runtime.messages->file = NULL;
+        }
+        if (run->traced)
+        {
+            ctx->timeline = timelineOpen("/dev/null", 0);
+        }
+        if (run->sampled)
+        {
+            ctx->sampler = samplerCreate(10000);
+        }
+        for (int i = 0; i < run->rounds; i++)
+        {
+            for (size_t j = 0; j < LINE_COUNT; j++)
+            {
+                // the line with the syntax error would go on to the next one
+                run->statuses[i * LINE_COUNT + j] = run->push && j != SYNTAX_ERROR_LINE ?
+                                                    pushLine(ctx, lines[j]) : cilispEval(ctx, lines[j]);
+            }
+        }
+        cilispDestroy(ctx);
+    }
+
+    fclose(readTarget);
+    fflush(run->out);
+    return NULL;
+}
+
+static bool startRun(RUN *run, const CILISP_OPTIONS *options, int rounds)
+{
+    *run = (RUN) {.options = *options, .rounds = rounds};
+    run->out = tmpfile();
+    run->statuses = calloc(rounds * LINE_COUNT, sizeof(CILISP_STATUS));
+
+    return run->out != NULL && run->statuses != NULL;
+}
+
+static void endRun(RUN *run)
+{
+    fclose(run->out);
+    free(run->statuses);
+}
+
+static char *readOutput(FILE *out, long *len)
+{
+    char *text;
+
+    fseek(out, 0, SEEK_END);
+    *len = ftell(out);
+    rewind(out);
+    if ((text = malloc(*len + 1)) == NULL || fread(text, 1, *len, out) != (size_t) *len)
+    {
+        free(text);
+        return NULL;
+    }
+
+    return text;
+}
+
+int main(int argc, char **argv)
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 8;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+    RUN reference, jsonReference;
+    CILISP_OPTIONS jsonOptions = defaultOptions;
+    RUN *runs;
+    char *expected, *expectedJson;
+    long expectedLen, expectedJsonLen;
+    int failures = 0;
+
+    if (threads < 1 || rounds < 1 || (runs = calloc(threads, sizeof(RUN))) == NULL)
+    {
+        fprintf(stderr, "usage: %s [threads [rounds]]\n", argv[0]);
+        return 1;
+    }
+
+    jsonOptions.output = JSONL_OUTPUT;
+    if (!startRun(&reference, &defaultOptions, rounds) || !startRun(&jsonReference, &jsonOptions, rounds))
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        return 1;
+    }
+    runLines(&reference);
+    runLines(&jsonReference);
+    if (!reference.created || (expected = readOutput(reference.out, &expectedLen)) == NULL ||
+        !jsonReference.created || (expectedJson = readOutput(jsonReference.out, &expectedJsonLen)) == NULL)
+    {
+        fprintf(stderr, "Could not run the reference interpreter!\n");
+        return 1;
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        CILISP_OPTIONS options = defaultOptions;
+
+        // the evaluation modes print the same, so each thread may pick its own
+        options.evalMode = i % 2 ? TREE_EVAL_MODE : VM_EVAL_MODE;
+        options.jit = i % 4 == 2 ? 0 : -1;
+        options.cse = i % 3 != 1;
+        options.threads = i % 4 == 1 ? 2 : 1;
+        options.profile = i % 3 == 2; // which counts, but prints nothing until asked
+        options.output = i % 5 == 4 ? JSONL_OUTPUT : TEXT_OUTPUT;
+        if (!startRun(&runs[i], &options, rounds))
+        {
+            fprintf(stderr, "Could not start thread %d!\n", i);
+            return 1;
+        }
+        runs[i].push = i % 4 == 3;
+        runs[i].traced = i % 3 == 0;
+        runs[i].sampled = i == 1; // the timer is the process's
+        if (pthread_create(&runs[i].thread, NULL, runLines, &runs[i]) != 0)
+        {
+            fprintf(stderr, "Could not start thread %d!\n", i);
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        bool json = runs[i].options.output == JSONL_OUTPUT;
+        char *output;
+        long len;
+
+        pthread_join(runs[i].thread, NULL);
+        output = readOutput(runs[i].out, &len);
+        if (!runs[i].created || output == NULL || len != (json ? expectedJsonLen : expectedLen) ||
+            memcmp(output, json ? expectedJson : expected, len) != 0)
+        {
+            fprintf(stderr, "thread %d: the output differs from the reference\n", i);
+            failures++;
+        }
+        else if (memcmp(runs[i].statuses, reference.statuses, rounds * LINE_COUNT * sizeof(CILISP_STATUS)) != 0)
+        {
+            fprintf(stderr, "thread %d: cilispEval returned different statuses\n", i);
+            failures++;
+        }
+        free(output);
+    }
+
+    if (reference.statuses[LINE_COUNT - 1] != CILISP_QUIT || reference.statuses[SYNTAX_ERROR_LINE] != CILISP_SYNTAX_ERROR)
+    {
+        fprintf(stderr, "the reference returned unexpected statuses\n");
+        failures++;
+    }
+    if (memcmp(jsonReference.statuses, reference.statuses, rounds * LINE_COUNT * sizeof(CILISP_STATUS)) != 0 ||
+        strncmp(expectedJson, FIRST_JSON_LINE, strlen(FIRST_JSON_LINE)) != 0)
+    {
+        fprintf(stderr, "the JSON reference printed unexpected lines\n");
+        failures++;
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        endRun(&runs[i]);
+    }
+    endRun(&reference);
+    endRun(&jsonReference);
+    free(runs);
+    free(expected);
+    free(expectedJson);
+    printf("%d interpreters on %d threads, %d rounds of %zu lines: %s\n",
+           threads, threads, rounds, LINE_COUNT, failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
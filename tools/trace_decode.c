@@ -0,0 +1,78 @@
+// Prints a dump written by cilisp --parse-trace as the lines the scanner and the
+// parser logged before tracing went into a ring buffer, see src/trace.h.
+// usage: cilisp_trace_decode [cilisp.trace]
+
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "cilisp.trace";
+    FILE *in = fopen(path, "rb");
+    TRACE_FILE_HEADER header;
+    TRACE_FILE_RECORD *records;
+    char *strings;
+
+    if (in == NULL)
+    {
+        fprintf(stderr, "Could not open \"%s\"!\n", path);
+        return 1;
+    }
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, TRACE_MAGIC, 4) != 0 ||
+        header.version != TRACE_VERSION)
+    {
+        fprintf(stderr, "\"%s\" is not a trace of this version.\n", path);
+        return 1;
+    }
+
+    records = malloc(header.count * sizeof(TRACE_FILE_RECORD) + 1);
+    strings = malloc(header.stringsLen + 1);
+    if (records == NULL || strings == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed!\n");
+        return 1;
+    }
+    if (fread(records, sizeof(TRACE_FILE_RECORD), header.count, in) != header.count ||
+        fread(strings, 1, header.stringsLen, in) != header.stringsLen)
+    {
+        fprintf(stderr, "\"%s\" is cut short.\n", path);
+        return 1;
+    }
+    strings[header.stringsLen] = '\0';
+
+    if (header.dropped > 0)
+    {
+        fprintf(stderr, "%llu earlier records were overwritten.\n", (unsigned long long) header.dropped);
+    }
+
+    for (uint32_t i = 0; i < header.count; i++)
+    {
+        TRACE_FILE_RECORD *record = &records[i];
+
+        if (record->name >= header.stringsLen ||
+            (record->production != TRACE_NO_STRING && record->production >= header.stringsLen))
+        {
+            fprintf(stderr, "Record %u is damaged.\n", i);
+            return 1;
+        }
+
+        if (record->production == TRACE_NO_STRING)
+        {
+            // the text of a token longer than a record holds ends with "..."
+            int kept = record->len < TRACE_TEXT_SIZE ? record->len : TRACE_TEXT_SIZE;
+
+            printf("LEX: %s \"%.*s%s\"\n", strings + record->name, kept, record->text,
+                   record->len > TRACE_TEXT_SIZE ? "..." : "");
+        }
+        else
+        {
+            printf("BISON: %s ::= %s \n", strings + record->name, strings + record->production);
+        }
+    }
+
+    free(records);
+    free(strings);
+    fclose(in);
+    return 0;
+}